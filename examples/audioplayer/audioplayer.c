@@ -169,7 +169,7 @@ enum Page page_menu(void) {
 
 enum Page page_song(void) {
 	char sbuf[1024];
-	int64_t tot_time = 0, tot_cpu = 0, tot_rsp = 0, tot_dma = 0;
+	int64_t tot_time = 0, tot_cpu = 0, tot_rsp = 0, tot_dma = 0, tot_tick = 0;
 	int screen_first_inst = 0;
 	enum SONG_TYPE { SONG_XM, SONG_YM };
 
@@ -255,13 +255,14 @@ enum Page page_song(void) {
 			float pcpu = (float)tot_cpu * 100.f / (float)tot_time;
 			float prsp = (float)tot_rsp * 100.f / (float)tot_time;
 			float pdma = (float)tot_dma * 100.f / (float)tot_time;
+			float ptick = (float)tot_tick * 100.f / (float)tot_time;
 
 			sprintf(sbuf, "CPU: %.2f%%  RSP: %.2f%%\n", pcpu, prsp);
 			graphics_draw_text(disp, 280, 60, sbuf);
-			sprintf(sbuf, "DMA: %.2f%%", pdma);
+			sprintf(sbuf, "DMA: %.2f%%  Tick: %.2f%%", pdma, ptick);
 			graphics_draw_text(disp, 280, 70, sbuf);
 
-			debugf("CPU: %.2f%%  RSP: %.2f%%  DMA: %.2f%%\n", pcpu, prsp, pdma);
+			debugf("CPU: %.2f%%  RSP: %.2f%%  DMA: %.2f%%  Tick: %.2f%%\n", pcpu, prsp, pdma, ptick);
 		}
 
 		for (int i=0; i<32; i++) {
@@ -303,15 +304,15 @@ enum Page page_song(void) {
 
 		display_show(disp);
 
-		tot_time = 0, tot_cpu = 0, tot_rsp = 0, tot_dma = 0;
+		tot_time = 0, tot_cpu = 0, tot_rsp = 0, tot_dma = 0, tot_tick = 0;
 
 		uint32_t start_play_loop = TICKS_READ();
 		bool first_loop = true;
 		int audiosz = audio_get_buffer_length();
 		while (TICKS_DISTANCE(start_play_loop, TICKS_READ()) < TICKS_PER_SECOND)
 		{
-			extern int64_t __mixer_profile_rsp, __wav64_profile_dma;
-			__mixer_profile_rsp = __wav64_profile_dma = 0;
+			extern int64_t __mixer_profile_rsp, __wav64_profile_dma, __xm64_profile_tick;
+			__mixer_profile_rsp = __wav64_profile_dma = __xm64_profile_tick = 0;
 
 			uint32_t t0 = TICKS_READ();
 
@@ -328,6 +329,7 @@ enum Page page_song(void) {
 			if (!first_loop) {
 				tot_dma += __wav64_profile_dma;	
 				tot_rsp += __mixer_profile_rsp;
+				tot_tick += __xm64_profile_tick;
 				tot_cpu += (t2-t1) - __mixer_profile_rsp - __wav64_profile_dma;
 				tot_time += t2-t0;
 			}
@@ -57,6 +57,7 @@ int main(void)
                         case ACCESSORY_MEMPAK:
                         {
                             int err;
+                            uint32_t start = TICKS_READ();
                             if( (err = validate_mempak( i )) )
                             {
                                 if( err == -3 )
@@ -86,7 +87,8 @@ int main(void)
                                     }
                                 }
 
-                                printf( "\nFree space: %d blocks", get_mempak_free_space( i ) );
+                                printf( "\nFree space: %d blocks\n", get_mempak_free_space( i ) );
+                                printf( "Read in %d ms", (int)TICKS_TO_MS( TICKS_SINCE( start ) ) );
                             }
 
                             break;
@@ -180,6 +182,7 @@ int main(void)
                         case ACCESSORY_MEMPAK:
                         {
                             int err = 0;
+                            uint32_t start = TICKS_READ();
 
                             for( int j = 0; j < 128; j++ )
                             {
@@ -192,7 +195,7 @@ int main(void)
                             }
                             else
                             {
-                                printf( "Data loaded into RAM!" );
+                                printf( "Data loaded into RAM in %d ms!", (int)TICKS_TO_MS( TICKS_SINCE( start ) ) );
                             }
 
                             break;
@@ -217,6 +220,7 @@ int main(void)
                         case ACCESSORY_MEMPAK:
                         {
                             int err = 0;
+                            uint32_t start = TICKS_READ();
 
                             for( int j = 0; j < 128; j++ )
                             {
@@ -229,7 +233,7 @@ int main(void)
                             }
                             else
                             {
-                                printf( "Data saved into mempak!" );
+                                printf( "Data saved into mempak in %d ms!", (int)TICKS_TO_MS( TICKS_SINCE( start ) ) );
                             }
 
                             break;
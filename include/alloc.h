@@ -0,0 +1,268 @@
+/**
+ * @file alloc.h
+ * @brief Arena, pool and slab allocators
+ * @ingroup alloc
+ */
+
+/**
+ * @defgroup alloc Arena, pool and slab allocators
+ * @ingroup lowlevel
+ * @brief Specialized allocators on top of the heap, and heap statistics.
+ *
+ * All dynamic memory is normally allocated with malloc, which is a general
+ * purpose allocator: it is relatively slow, and allocating and freeing many
+ * objects of different lifetime fragments the heap over time. This module
+ * provides two allocators for the common patterns of a game loop:
+ *
+ *  * Arenas (#arena_t) are linear allocators over a fixed buffer: allocating
+ *    just moves a pointer forward, and all the allocations are freed at once
+ *    with #arena_reset. The frame arena (#frame_alloc) is a pair of arenas
+ *    used in turn for the data that is only needed for one frame: switching
+ *    frame with #frame_arena_next resets the arena used two frames before, so
+ *    that the data of the previous frame can still be read by RSP and RDP.
+ *
+ *  * Pools (#pool_t) are allocators of fixed-size objects: allocating and
+ *    releasing an object takes constant time and never fragments the heap.
+ *
+ * The uncached slab allocator (#slab_alloc_uncached) serves the memory of
+ * RSP and RDP blocks, which are allocated and freed constantly by games that
+ * rebuild their display lists. Allocations are rounded up to a size class,
+ * and carved from large pages of uncached memory. Freed chunks are kept in a
+ * free list per class and reused as-is: unlike #malloc_uncached, no cache
+ * maintenance is needed, and the chunks never go back to the heap where they
+ * would fragment it.
+ *
+ * Both allocators can manage uncached memory (#ALLOC_UNCACHED), which is
+ * useful for buffers shared with the RSP. All the allocations are aligned to
+ * 16 bytes and rounded to 16 bytes, so that they can be used with DMA, and
+ * never share a data cache line with other allocations.
+ *
+ * Each arena and pool has a tag (a name), used to report per-tag memory
+ * usage (#alloc_get_tag_stats). Statistics on the whole heap are returned by
+ * #heap_get_stats.
+ *
+ * Some libdragon functions need temporary buffers, that are freed before the
+ * function returns (eg: the input buffer of the Shrinkler decompressor, or the
+ * buffers used to serialize data to USB). By default they are allocated with
+ * malloc; #alloc_set_scratch configures an arena to serve them instead,
+ * avoiding heap fragmentation around long-lived allocations.
+ *
+ * @note Arenas and slabs are not safe to use from interrupt handlers. Pools are.
+ *
+ * @{
+ */
+
+#ifndef __LIBDRAGON_ALLOC_H
+#define __LIBDRAGON_ALLOC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Flag for #arena_new and #pool_new: allocate uncached memory */
+#define ALLOC_UNCACHED      (1<<0)
+
+/** @brief A linear allocator (opaque structure) */
+typedef struct arena_s arena_t;
+
+/** @brief A fixed-size object allocator (opaque structure) */
+typedef struct pool_s pool_t;
+
+/** @brief Memory usage of all the allocators with the same tag */
+typedef struct {
+    const char *tag;        ///< Tag of the allocators
+    int size;               ///< Memory reserved by the allocators (bytes)
+    int used;               ///< Memory currently allocated (bytes)
+    int peak;               ///< Peak of allocated memory (bytes)
+} alloc_tag_stats_t;
+
+/** @brief Statistics of the heap */
+typedef struct {
+    int total;              ///< Memory obtained from the system for the heap (bytes)
+    int peak;               ///< Peak of memory obtained from the system (bytes)
+    int used;               ///< Memory currently allocated, including arenas and pools (bytes)
+    int free;               ///< Free memory within the heap (bytes)
+    int free_chunks;        ///< Number of free chunks within the heap
+    int fragmented;         ///< Free memory in holes between allocations (bytes)
+} heap_stats_t;
+
+/** @brief Statistics of the uncached slab allocator */
+typedef struct {
+    int allocs;             ///< Number of allocations
+    int frees;              ///< Number of frees
+    int recycled;           ///< Allocations served by reusing a freed chunk
+    int large;              ///< Allocations too large for the slabs (served by malloc_uncached)
+    int pages;              ///< Number of slab pages obtained from the heap
+    int reserved;           ///< Memory reserved by the slab pages (bytes)
+    int used;               ///< Memory currently allocated from the slab pages (bytes)
+    int peak;               ///< Peak of memory allocated from the slab pages (bytes)
+} slab_stats_t;
+
+/**
+ * @brief Create an arena
+ *
+ * @param tag       Tag used to report memory usage (the string is not copied)
+ * @param size      Size of the arena in bytes
+ * @param flags     Flags (#ALLOC_UNCACHED)
+ * @return          The new arena, or NULL if out of memory
+ */
+arena_t *arena_new(const char *tag, int size, int flags);
+
+/**
+ * @brief Allocate memory from an arena
+ *
+ * @param arena     Arena
+ * @param size      Size of the allocation in bytes
+ * @return          The allocated memory (16-byte aligned), or NULL if the arena is full
+ */
+void *arena_alloc(arena_t *arena, int size);
+
+/**
+ * @brief Allocate memory from an arena, with a specified alignment
+ *
+ * @param arena     Arena
+ * @param align     Alignment in bytes (power of two; at least 16 is used)
+ * @param size      Size of the allocation in bytes
+ * @return          The allocated memory, or NULL if the arena is full
+ */
+void *arena_alloc_aligned(arena_t *arena, int align, int size);
+
+/** @brief Free all the allocations made from an arena */
+void arena_reset(arena_t *arena);
+
+/** @brief Return the number of bytes currently allocated from an arena */
+int arena_get_used(arena_t *arena);
+
+/** @brief Destroy an arena, and free its memory */
+void arena_free(arena_t *arena);
+
+/**
+ * @brief Create a pool of fixed-size objects
+ *
+ * @param tag       Tag used to report memory usage (the string is not copied)
+ * @param obj_size  Size of each object in bytes (rounded up to 16 bytes)
+ * @param num_objs  Number of objects in the pool
+ * @param flags     Flags (#ALLOC_UNCACHED)
+ * @return          The new pool, or NULL if out of memory
+ */
+pool_t *pool_new(const char *tag, int obj_size, int num_objs, int flags);
+
+/**
+ * @brief Allocate an object from a pool
+ *
+ * @param pool      Pool
+ * @return          The allocated object (16-byte aligned), or NULL if the pool is exhausted
+ */
+void *pool_alloc(pool_t *pool);
+
+/** @brief Return an object to the pool it was allocated from */
+void pool_release(pool_t *pool, void *obj);
+
+/** @brief Return the number of objects currently allocated from a pool */
+int pool_get_used(pool_t *pool);
+
+/** @brief Destroy a pool, and free its memory */
+void pool_free(pool_t *pool);
+
+/**
+ * @brief Initialize the frame arena
+ *
+ * The frame arena is made by two arenas of @p size bytes each, which are
+ * used in turn by #frame_alloc, switching at each #frame_arena_next.
+ *
+ * @param size      Size of each of the two arenas in bytes
+ * @param flags     Flags (#ALLOC_UNCACHED)
+ */
+void frame_arena_init(int size, int flags);
+
+/**
+ * @brief Start a new frame
+ *
+ * Switch to the other arena of the frame arena, freeing all the allocations
+ * made from it two frames before. Allocations of the previous frame are still
+ * valid until the next call.
+ */
+void frame_arena_next(void);
+
+/**
+ * @brief Allocate memory from the frame arena
+ *
+ * The memory is valid until the second call to #frame_arena_next. Running
+ * out of space in the frame arena is a fatal error.
+ *
+ * @param size      Size of the allocation in bytes
+ * @return          The allocated memory (16-byte aligned)
+ */
+void *frame_alloc(int size);
+
+/** @brief Free the frame arena */
+void frame_arena_close(void);
+
+/**
+ * @brief Allocate uncached memory from the slab allocator
+ *
+ * The memory is rounded up to the size class of @p size (at most 20% larger).
+ * Allocations larger than 32 KiB (plus 16 bytes, to fit the largest chunks
+ * of blocks with their header) are served by #malloc_uncached.
+ *
+ * @param size      Size of the allocation in bytes
+ * @return          The allocated memory (uncached address, 16-byte aligned),
+ *                  or NULL if out of memory
+ */
+void *slab_alloc_uncached(int size);
+
+/**
+ * @brief Free memory allocated with #slab_alloc_uncached
+ *
+ * @param ptr       Memory to free (can be NULL)
+ * @param size      Size passed to #slab_alloc_uncached
+ */
+void slab_free_uncached(void *ptr, int size);
+
+/**
+ * @brief Get the statistics of the uncached slab allocator
+ *
+ * The slab pages are also reported by #alloc_get_tag_stats, with the
+ * tag "uncached_slab".
+ *
+ * @param stats     Structure that receives the statistics
+ */
+void slab_get_stats(slab_stats_t *stats);
+
+/**
+ * @brief Configure an arena for the temporary allocations of libdragon
+ *
+ * Temporary buffers allocated internally by libdragon are taken from this
+ * arena (in LIFO order, so that the arena never needs to be reset). If a
+ * buffer does not fit, it is allocated with malloc as usual.
+ *
+ * @param arena     Arena to use (must be cached), or NULL to use malloc
+ */
+void alloc_set_scratch(arena_t *arena);
+
+/**
+ * @brief Get the memory usage of arenas and pools, grouped by tag
+ *
+ * @param stats     Array that receives the statistics
+ * @param max_tags  Number of entries in the array
+ * @return          Number of tags (can be larger than @p max_tags)
+ */
+int alloc_get_tag_stats(alloc_tag_stats_t *stats, int max_tags);
+
+/**
+ * @brief Get the statistics of the heap
+ *
+ * @param stats     Structure that receives the statistics
+ */
+void heap_get_stats(heap_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */
+
+#endif
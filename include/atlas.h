@@ -0,0 +1,111 @@
+/**
+ * @file atlas.h
+ * @brief Texture atlases
+ * @ingroup graphics
+ *
+ * A texture atlas is a set of images packed together into one or more pages.
+ * Atlases are created by mksprite in atlas mode (mksprite --atlas), which
+ * packs the images so that each page fits TMEM in the requested format.
+ * Each page is a standard sprite, while the position of each image within
+ * the pages is stored in a separate index file (`.atlas`).
+ *
+ * Images in the atlas can be looked up by name with #atlas_find, and then
+ * drawn with #rdpq_atlas_blit, which uploads a page to TMEM only when it
+ * changes. Drawing many images belonging to the same page thus requires a
+ * single TMEM load.
+ *
+ * @code{.c}
+ *      // Created with: mksprite -f RGBA16 --atlas ui -o filesystem heart.png coin.png
+ *      atlas_t *ui = atlas_load("rom:/ui.atlas");
+ *      int heart = atlas_find(ui, "heart");
+ *      int coin = atlas_find(ui, "coin");
+ *
+ *      rdpq_set_mode_copy(true);
+ *      rdpq_atlas_blit(ui, heart, 10, 10, NULL);
+ *      rdpq_atlas_blit(ui, coin, 30, 10, NULL);
+ * @endcode
+ */
+#ifndef __LIBDRAGON_ATLAS_H
+#define __LIBDRAGON_ATLAS_H
+
+#include <stdint.h>
+#include <surface.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+///@cond
+typedef struct sprite_s sprite_t;
+///@endcond
+
+/** @brief A texture atlas (opaque structure) */
+typedef struct atlas_s atlas_t;
+
+/** @brief An image stored in a texture atlas */
+typedef struct {
+    const char *name;       ///< Name of the image (filename of the source image without extension)
+    uint16_t page;          ///< Page containing the image
+    uint16_t x;             ///< X coordinate of the image within the page
+    uint16_t y;             ///< Y coordinate of the image within the page
+    uint16_t width;         ///< Width of the image
+    uint16_t height;        ///< Height of the image
+    uint16_t __padding;     ///< Reserved
+} atlas_image_t;
+
+/**
+ * @brief Load a texture atlas from the filesystem
+ *
+ * Loads the index file and all the pages of the atlas. Pages are searched
+ * in the same directory of the index file.
+ *
+ * @param fn        Filename of the index file (eg: "rom:/ui.atlas")
+ * @return          The loaded atlas
+ */
+atlas_t *atlas_load(const char *fn);
+
+/** @brief Free a texture atlas and all its pages */
+void atlas_free(atlas_t *atlas);
+
+/**
+ * @brief Find an image in the atlas by name
+ *
+ * The lookup is a binary search, but it still requires some string
+ * comparisons, so it is better to resolve the names once and then
+ * keep the returned indices.
+ *
+ * @param atlas     Texture atlas
+ * @param name      Name of the image
+ * @return          Index of the image, or -1 if not found
+ */
+int atlas_find(atlas_t *atlas, const char *name);
+
+/** @brief Return the number of images in the atlas */
+int atlas_get_num_images(atlas_t *atlas);
+
+/** @brief Return the information on the image at the specified index */
+const atlas_image_t *atlas_get_image(atlas_t *atlas, int idx);
+
+/** @brief Return the number of pages in the atlas */
+int atlas_get_num_pages(atlas_t *atlas);
+
+/** @brief Return the sprite of the specified page */
+sprite_t *atlas_get_page(atlas_t *atlas, int page);
+
+/**
+ * @brief Create a surface_t pointing to the pixels of an image in the atlas
+ *
+ * The returned surface references the page memory, so it must not be
+ * freed, and it is only valid until the atlas is freed.
+ *
+ * @param atlas     Texture atlas
+ * @param idx       Index of the image
+ * @return          Surface referencing the image pixels
+ */
+surface_t atlas_get_pixels(atlas_t *atlas, int idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -32,7 +32,8 @@ extern "C" {
 /** @brief Define the global attenuation applied to volumes (range 0.0 - 1.0). 
  * 
  * The AY8910 often clips so it's important to lower a bit the volume to avoid
- * sound artifacts.
+ * sound artifacts. The volume tables in ay8910.c and rsp_ay8910.S are
+ * precomputed with this value.
  */
 #define AY8910_VOLUME_ATTENUATE   0.8
 
@@ -128,7 +129,8 @@ bool ay8910_is_mute(AY8910 *ay);
 /** @brief Generate audio for the specified number of samples.
  * 
  * "nsamples" is the number of samples after decimation (so the exact number of
- * samples written in the output buffer).
+ * samples written in the output buffer). The output is bit-exact with the
+ * RSP synthesizer used by #ym64player_t.
  */
 int ay8910_gen(AY8910 *ay, int16_t *out, int nsamples);
 
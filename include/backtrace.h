@@ -186,6 +186,34 @@ char** backtrace_symbols(void **buffer, int size);
 bool backtrace_symbols_cb(void **buffer, int size, uint32_t flags,
     void (*cb)(void *, backtrace_frame_t*), void *cb_arg);
 
+/**
+ * @brief Cache the symbol table in RDRAM to speed up symbolization
+ * 
+ * By default, the symbol table is accessed directly from ROM, so that
+ * symbolization works even when the heap is not available (eg: during a
+ * crash). Each lookup requires many ROM accesses though, which is too slow
+ * for code that needs to symbolize many addresses (eg: profilers or allocation
+ * trackers).
+ * 
+ * This function loads the address table into RDRAM, so that lookups are
+ * performed in memory. Optionally, the symbol and string tables can be loaded
+ * too, so that symbolization does not access the ROM at all. This uses
+ * more memory: see the size of the .sym file generated by n64sym.
+ * 
+ * @param strings   If true, also cache the symbol and string tables
+ * @return True if the cache was loaded, false if no symbol table was found
+ * 
+ * @see #backtrace_symbols_cache_close
+ */
+bool backtrace_symbols_cache_init(bool strings);
+
+/**
+ * @brief Free the symbol table cache created by #backtrace_symbols_cache_init
+ * 
+ * Symbolization goes back to accessing the symbol table from ROM.
+ */
+void backtrace_symbols_cache_close(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,138 @@
+/**
+ * @file binlog.h
+ * @brief Binary deferred-format logging
+ * @ingroup binlog
+ */
+
+/**
+ * @defgroup binlog Binary deferred-format logging
+ * @ingroup lowlevel
+ * @brief Compact logging that defers formatting to the PC.
+ *
+ * Formatting a message with #debugf runs the full printf machinery on the
+ * VR4300, which is too expensive for high-frequency tracing (eg: one message
+ * per draw call or per DMA). This module implements a logging API where
+ * the format string is never processed on the N64: each call to #binlogf
+ * just stores the address of its (static) format string, a timestamp and
+ * the raw arguments into a preallocated buffer.
+ *
+ * The address of the format string is its identifier: the n64binlog tool
+ * reads the format strings from the ELF file of the ROM, and reconstructs
+ * the text of each message. This is similar to what n64sym does to build
+ * the symbol table, but no table is embedded in the ROM.
+ *
+ * @code{.c}
+ *      binlog_init(64*1024);
+ *      ...
+ *      binlogf("dma: %08lx -> %p (%d bytes)\n", pi_addr, ram_addr, len);
+ *      ...
+ *      binlog_dump_usb();      // then on PC: n64binlog log.bin program.elf
+ * @endcode
+ *
+ * Supported arguments are integers (up to 64 bits), pointers, floating point
+ * values and strings. Strings are copied into the log (up to 255 bytes).
+ * The type of each argument is recorded along with its value, so a mismatch
+ * with the format string does not corrupt the rest of the log.
+ *
+ * The buffer is linear, not a ring buffer: when it is full, the oldest
+ * messages are kept and new ones are dropped (and counted), until
+ * #binlog_reset is called. Messages can be logged from interrupt handlers
+ * too. Unlike #debugf, binary logging is not disabled by NDEBUG, so that it
+ * can be used in production builds.
+ *
+ * @{
+ */
+
+#ifndef __LIBDRAGON_BINLOG_H
+#define __LIBDRAGON_BINLOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "pputils.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Magic identifier of the dump file ("BLOG") */
+#define BINLOG_MAGIC        0x424C4F47
+/** @brief Version of the dump file format */
+#define BINLOG_VERSION      1
+
+/**
+ * @name Argument types recorded in the log
+ * @{
+ */
+#define BINLOG_ARG_I32      0   ///< 32-bit integer or pointer
+#define BINLOG_ARG_I64      1   ///< 64-bit integer
+#define BINLOG_ARG_DOUBLE   2   ///< Floating point value (stored as double)
+#define BINLOG_ARG_STR      3   ///< String (stored as length + characters)
+/** @} */
+
+/**
+ * @brief Initialize binary logging
+ *
+ * Allocates the buffer that will contain the messages. Until this
+ * is called, #binlogf does nothing. Once @p size bytes have been logged,
+ * further messages are dropped until #binlog_reset is called.
+ *
+ * @param size      Size of the buffer in bytes
+ */
+void binlog_init(int size);
+
+/** @brief Discard all logged messages */
+void binlog_reset(void);
+
+/** @brief Return the number of bytes of messages currently stored in the buffer */
+int binlog_size(void);
+
+/**
+ * @brief Write the logged messages to a file
+ *
+ * The dump can be decoded on the PC with the n64binlog tool.
+ *
+ * @param out       File to write to
+ */
+void binlog_dump(FILE *out);
+
+/**
+ * @brief Send the logged messages to the PC via USB
+ *
+ * This is the same as #binlog_dump, but the dump is sent as a single
+ * binary packet through the USB debug channel.
+ */
+void binlog_dump_usb(void);
+
+/** @brief Free the buffer. #binlogf does nothing after this call. */
+void binlog_close(void);
+
+/// @cond
+#define __BINLOG_TAG(x)  _Generic((x), \
+    float: BINLOG_ARG_DOUBLE, double: BINLOG_ARG_DOUBLE, \
+    char*: BINLOG_ARG_STR, const char*: BINLOG_ARG_STR, \
+    default: sizeof(x) > 4 ? BINLOG_ARG_I64 : BINLOG_ARG_I32),
+
+void __binlog_write(const char *fmt, int nargs, const uint8_t *tags, ...);
+/// @endcond
+
+/**
+ * @brief Log a message in binary format
+ *
+ * The format string must be a string literal, and follows the usual printf
+ * syntax. It is stored into the ROM, and only its address is logged.
+ *
+ * @note This macro is only available in C (not C++).
+ */
+#define binlogf(fmt, ...) ({ \
+    static const char __binlog_fmt[] __attribute__((section(".rodata.binlog"))) = fmt; \
+    static const uint8_t __binlog_tags[] = { __CALL_FOREACH(__BINLOG_TAG, ##__VA_ARGS__) 0 }; \
+    __binlog_write(__binlog_fmt, __COUNT_VARARGS(__VA_ARGS__), __binlog_tags, ##__VA_ARGS__); \
+})
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */
+
+#endif
@@ -193,17 +193,50 @@ typedef struct controller_origin_data
     struct SI_origdat_gc gc[4];
 } SI_controllers_origin_t;
 
+/**
+ * @brief Latency statistics of the background controller scan
+ *
+ * @see #controller_get_latency_stats
+ */
+typedef struct controller_latency_stats
+{
+    /** @brief Number of background scans started */
+    uint32_t polls;
+    /** @brief Number of background scans skipped because the previous one was still running */
+    uint32_t missed;
+    /** @brief Number of calls to #controller_scan that returned a sample */
+    uint32_t scans;
+    /** @brief Number of calls to #controller_scan that returned a sample older than the last vertical blank */
+    uint32_t late;
+    /** @brief Duration of the last background scan (PIF roundtrip), in microseconds */
+    uint32_t poll_us;
+    /** @brief Age of the sample returned by the last #controller_scan, in microseconds */
+    uint32_t sample_age_us;
+    /** @brief Number of displayed frames whose latency was measured */
+    uint32_t frames;
+    /** @brief Input-to-display latency of the last displayed frame, in microseconds */
+    uint32_t latency_us;
+    /** @brief Average input-to-display latency, in microseconds */
+    uint32_t latency_avg_us;
+    /** @brief Maximum input-to-display latency, in microseconds */
+    uint32_t latency_max_us;
+} controller_latency_stats_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 void controller_init( void );
+void controller_close( void );
 void controller_read( struct controller_data * data );
 void controller_read_gc( struct controller_data * data, const uint8_t rumble[4] );
 void controller_read_gc_origin( struct controller_origin_data * data);
 int get_controllers_present( void );
 int get_accessories_present( struct controller_data * data );
 void controller_scan( void );
+void controller_poll_schedule( int offset_us );
+void controller_get_latency_stats( controller_latency_stats_t *out );
+void controller_reset_latency_stats( void );
 struct controller_data get_keys_down( void );
 struct controller_data get_keys_up( void );
 struct controller_data get_keys_held( void );
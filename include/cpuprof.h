@@ -0,0 +1,119 @@
+/**
+ * @file cpuprof.h
+ * @brief Statistical CPU profiler
+ * @ingroup cpuprof
+ */
+
+/**
+ * @defgroup cpuprof Statistical CPU profiler
+ * @ingroup lowlevel
+ * @brief Sampling profiler based on the timer interrupt.
+ *
+ * This module implements a statistical profiler for the CPU. Once started
+ * with #cpuprof_start, a timer interrupt periodically samples the PC of the
+ * interrupted code, together with a short call stack obtained by walking
+ * the stack like #backtrace does. Samples are stored into a ring buffer
+ * that is preallocated by #cpuprof_init, so that no allocation is ever
+ * performed while profiling. When the buffer is full, the oldest samples
+ * are overwritten.
+ *
+ * The collected samples can be inspected in two ways:
+ *
+ *  * #cpuprof_report prints a flat profile directly on the N64, using the
+ *    symbol table created by n64sym to resolve function names.
+ *  * #cpuprof_dump and #cpuprof_dump_usb write the raw samples to a file
+ *    (eg: on the SD card via #debug_init_sdfs) or to the USB channel. The
+ *    n64prof tool can then produce flat and call-graph reports, or folded
+ *    stacks for flamegraphs.
+ *
+ * Notice that the profiler is driven by an interrupt, so code that runs with
+ * interrupts disabled is never sampled: its time is attributed to the point
+ * where interrupts are enabled again.
+ *
+ * @{
+ */
+
+#ifndef __LIBDRAGON_CPUPROF_H
+#define __LIBDRAGON_CPUPROF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Magic identifier of the dump file ("PROF") */
+#define CPUPROF_MAGIC       0x50524F46
+/** @brief Version of the dump file format */
+#define CPUPROF_VERSION     1
+
+/**
+ * @brief Initialize the profiler
+ *
+ * Allocates the ring buffer that will contain the samples. The timer
+ * subsystem must have been initialized with #timer_init.
+ *
+ * @param max_samples   Maximum number of samples kept in the ring buffer
+ * @param max_depth     Maximum number of call frames recorded for each sample
+ *                      (including the sampled PC). Use 1 to only sample the PC.
+ */
+void cpuprof_init(int max_samples, int max_depth);
+
+/**
+ * @brief Start sampling
+ *
+ * @param hz            Sampling frequency (samples per second)
+ */
+void cpuprof_start(int hz);
+
+/** @brief Stop sampling. Samples collected so far are kept. */
+void cpuprof_stop(void);
+
+/** @brief Discard all collected samples */
+void cpuprof_reset(void);
+
+/** @brief Return the number of samples currently stored in the ring buffer */
+int cpuprof_num_samples(void);
+
+/**
+ * @brief Write the collected samples to a file
+ *
+ * The dump can be analyzed on the PC with the n64prof tool. The profiler
+ * must be stopped.
+ *
+ * @param out           File to write to
+ */
+void cpuprof_dump(FILE *out);
+
+/**
+ * @brief Send the collected samples to the PC via USB
+ *
+ * This is the same as #cpuprof_dump, but the dump is sent as a single
+ * binary packet through the USB debug channel.
+ */
+void cpuprof_dump_usb(void);
+
+/**
+ * @brief Print a flat profile of the collected samples
+ *
+ * For each function, prints the number of samples in which it was running
+ * (self) and the number of samples in which it was anywhere in the recorded
+ * call stack (total). Functions are sorted by self samples. Function names
+ * are resolved via the symbol table, so the ROM must have been built with it.
+ *
+ * @param out           File to print to (eg: stderr)
+ * @param max_funcs     Maximum number of functions to print
+ */
+void cpuprof_report(FILE *out, int max_funcs);
+
+/** @brief Stop the profiler and free all its memory */
+void cpuprof_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */
+
+#endif
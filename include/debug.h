@@ -142,6 +142,61 @@ extern "C" {
 	/** @brief Shutdown SD filesystem. */
 	void debug_close_sdfs(void);
 
+	/**
+	 * @brief Configure the sector cache of the SD filesystem.
+	 *
+	 * Small accesses to the SD filesystem (FAT, directories, partial sectors
+	 * of files) go through a LRU cache of @p num_sectors sectors. Sequential
+	 * reads also fetch the next @p readahead sectors with the same command,
+	 * and modified sectors are written back when the file is flushed or
+	 * closed, merging consecutive sectors into a single write command.
+	 *
+	 * The default is a 16-sector (8 KiB) cache with a read-ahead of 8
+	 * sectors. The configuration is applied at the next #debug_init_sdfs.
+	 *
+	 * @param num_sectors   Number of sectors in the cache (0 disables the cache)
+	 * @param readahead     Number of sectors read ahead on sequential reads
+	 */
+	void debug_set_sdfs_cache(int num_sectors, int readahead);
+
+	/**
+	 * @brief Make logging asynchronous.
+	 *
+	 * After this call, messages written to stderr are appended to a ring
+	 * buffer, which is drained at each vblank (VI interrupt), writing at
+	 * most @p budget bytes each time. This avoids stalling the application
+	 * while the logging channels (USB, ISViewer) are written. Messages that
+	 * do not fit in the buffer are dropped (see #debug_get_dropped).
+	 *
+	 * The SD log (#DEBUG_FEATURE_LOG_SD) is still written synchronously,
+	 * as the SD filesystem cannot be accessed under interrupt. Messages
+	 * written with interrupts disabled (eg: assertions and crashes) are
+	 * also written synchronously, after flushing the buffer.
+	 *
+	 * On some flashcarts USB shares the command interface with the SD card,
+	 * so the buffer is not drained while the SD filesystem is being
+	 * accessed. If the USB host is not reading, writes from the interrupt
+	 * give up after a couple of milliseconds and the data is lost. Code
+	 * that talks to the cart directly (eg: #usb_write) while asynchronous
+	 * logging is enabled should do so with interrupts disabled.
+	 *
+	 * @note The VI interrupt is only generated when the display is active
+	 *       (see #display_init). Otherwise, call #debug_flush to write
+	 *       the pending messages.
+	 *
+	 * @param size      Size of the ring buffer in bytes (rounded up to a power of two)
+	 * @param budget    Maximum number of bytes written at each vblank
+	 *
+	 * @return true if the ring buffer was allocated, false otherwise
+	 */
+	bool debug_init_async(int size, int budget);
+
+	/** @brief Write all the pending asynchronous log messages, waiting for completion. */
+	void debug_flush(void);
+
+	/** @brief Return the number of bytes dropped because the asynchronous log buffer was full. */
+	uint32_t debug_get_dropped(void);
+
 	/**
 	 * @brief Initialize debugging features of libdragon.
 	 *
@@ -202,6 +257,10 @@ extern "C" {
 	#define debug_init_isviewer()      ({ false; })
 	#define debug_init_sdlog(fn,fmt)   ({ false; })
 	#define debug_init_sdfs(prefix,np) ({ false; })
+	#define debug_set_sdfs_cache(n,ra) ({ })
+	#define debug_init_async(sz,b)     ({ false; })
+	#define debug_flush()              ({ })
+	#define debug_get_dropped()        ({ 0; })
 	#define debugf(msg, ...)           ({ })
 	#define assertf(expr, msg, ...)    ({ })
 #endif
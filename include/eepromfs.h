@@ -78,8 +78,12 @@ int eepfs_close(void);
 
 int eepfs_read(const char * path, void * dest, size_t size);
 int eepfs_write(const char * path, const void * src, size_t size);
+int eepfs_write_async(const char * path, const void * src, size_t size);
 int eepfs_erase(const char * path);
 
+bool eepfs_busy(void);
+void eepfs_flush(void);
+
 bool eepfs_verify_signature(void);
 void eepfs_wipe(void);
 
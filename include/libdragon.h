@@ -46,6 +46,10 @@
 #include "interrupt.h"
 #include "n64sys.h"
 #include "backtrace.h"
+#include "cpuprof.h"
+#include "binlog.h"
+#include "alloc.h"
+#include "memprof.h"
 #include "rdp.h"
 #include "rsp.h"
 #include "timer.h"
@@ -68,6 +72,7 @@
 #include "rdpq_macros.h"
 #include "surface.h"
 #include "sprite.h"
+#include "atlas.h"
 #include "debugcpp.h"
 
 #endif
@@ -0,0 +1,144 @@
+/**
+ * @file memprof.h
+ * @brief Heap allocation profiler
+ * @ingroup memprof
+ */
+
+/**
+ * @defgroup memprof Heap allocation profiler
+ * @ingroup lowlevel
+ * @brief Tracking of live heap allocations, grouped by call site.
+ *
+ * This module records every heap allocation together with its size and a
+ * short backtrace (see #backtrace), so that the memory currently allocated
+ * can be attributed to the code that allocated it. Allocations with the same
+ * backtrace are grouped into a call site, which keeps the number of live
+ * allocations, the bytes they occupy, and the peak of bytes ever allocated
+ * at the same time from there. This helps finding leaks (sites whose live
+ * memory keeps growing) and the owners of memory at the peak.
+ *
+ * The profiler hooks malloc, calloc, realloc, memalign and free through the
+ * linker (--wrap), so the ROM must be linked with the hooks: when building
+ * with n64.mk, set `N64_MEMPROF=1` in the Makefile. The hooks cost almost
+ * nothing until #memprof_init is called. Allocations made by newlib
+ * internally (eg: the buffers of FILE streams) call the allocator directly,
+ * and are not tracked.
+ *
+ * All the memory used by the profiler is preallocated by #memprof_init.
+ * When its tables are full, further allocations are counted but not
+ * tracked. The same happens to allocations made by interrupt handlers
+ * while another allocation is being tracked.
+ *
+ * The collected data can be inspected in two ways:
+ *
+ *  * #memprof_report prints the call sites with the most live memory directly
+ *    on the N64, using the symbol table created by n64sym.
+ *  * #memprof_dump and #memprof_dump_usb write the call sites to a file or to
+ *    the USB channel. The n64memprof tool then symbolizes them using the
+ *    symbol table of the ROM.
+ *
+ * @note Backtraces are slow to compute, so allocations are noticeably slower
+ *       while the profiler is running.
+ *
+ * @{
+ */
+
+#ifndef __LIBDRAGON_MEMPROF_H
+#define __LIBDRAGON_MEMPROF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Magic identifier of the dump file ("MEMP") */
+#define MEMPROF_MAGIC       0x4D454D50
+/** @brief Version of the dump file format */
+#define MEMPROF_VERSION     1
+
+/** @brief Global statistics of the profiler */
+typedef struct {
+    int live_bytes;         ///< Bytes currently allocated (tracked allocations only)
+    int peak_bytes;         ///< Peak of bytes allocated at the same time
+    int live_allocs;        ///< Number of live tracked allocations
+    int num_allocs;         ///< Number of allocations since #memprof_init
+    int num_frees;          ///< Number of frees since #memprof_init
+    int untracked;          ///< Allocations not tracked (tables full, or made under interrupt while tracking another one)
+    int num_sites;          ///< Number of call sites
+} memprof_stats_t;
+
+/** @brief A call site (allocations with the same backtrace) */
+typedef struct {
+    int live_allocs;        ///< Number of live allocations
+    int live_bytes;         ///< Bytes currently allocated
+    int peak_bytes;         ///< Peak of bytes allocated at the same time
+    int num_allocs;         ///< Number of allocations since #memprof_init
+    int depth;              ///< Number of frames in the backtrace
+    void **frames;          ///< Backtrace (the caller of the allocation function first)
+} memprof_site_t;
+
+/**
+ * @brief Start tracking heap allocations
+ *
+ * @param max_allocs    Maximum number of live allocations that can be tracked
+ * @param max_sites     Maximum number of call sites
+ * @param depth         Number of frames recorded for each call site
+ */
+void memprof_init(int max_allocs, int max_sites, int depth);
+
+/** @brief Get the global statistics of the profiler */
+void memprof_get_stats(memprof_stats_t *stats);
+
+/**
+ * @brief Get the call sites, sorted by live bytes (and then by peak bytes)
+ *
+ * The returned frames point into the profiler tables: they are valid until
+ * #memprof_close.
+ *
+ * @param sites         Array that receives the sites
+ * @param max_sites     Number of entries in the array
+ * @return              Number of entries written in the array
+ */
+int memprof_get_sites(memprof_site_t *sites, int max_sites);
+
+/**
+ * @brief Write the call sites to a file
+ *
+ * The dump can be analyzed on the PC with the n64memprof tool.
+ *
+ * @param out           File to write to
+ */
+void memprof_dump(FILE *out);
+
+/**
+ * @brief Send the call sites to the PC via USB
+ *
+ * This is the same as #memprof_dump, but the dump is sent as a single
+ * binary packet through the USB debug channel.
+ */
+void memprof_dump_usb(void);
+
+/**
+ * @brief Print the call sites with the most live memory
+ *
+ * Function names are resolved via the symbol table, so the ROM must have
+ * been built with it. Consider enabling #backtrace_symbols_cache_init
+ * beforehand, as the report symbolizes many addresses.
+ *
+ * @param out           File to print to (eg: stderr)
+ * @param max_sites     Maximum number of call sites to print
+ */
+void memprof_report(FILE *out, int max_sites);
+
+/** @brief Stop tracking allocations and free the profiler tables */
+void memprof_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */
+
+#endif
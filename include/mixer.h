@@ -238,6 +238,46 @@ void mixer_ch_stop(int ch);
 /** @brief  Return true if the channel is currently playing samples. */
 bool mixer_ch_playing(int ch);
 
+/** @brief #mixer_ch_update_t flag: play #mixer_ch_update_t::wave (as #mixer_ch_play) */
+#define MIXER_UPDATE_WAVE       (1<<0)
+/** @brief #mixer_ch_update_t flag: set #mixer_ch_update_t::pos (as #mixer_ch_set_pos) */
+#define MIXER_UPDATE_POS        (1<<1)
+/** @brief #mixer_ch_update_t flag: set #mixer_ch_update_t::freq (as #mixer_ch_set_freq) */
+#define MIXER_UPDATE_FREQ       (1<<2)
+/** @brief #mixer_ch_update_t flag: set #mixer_ch_update_t::lvol and rvol (as #mixer_ch_set_vol) */
+#define MIXER_UPDATE_VOL        (1<<3)
+/** @brief #mixer_ch_update_t flag: stop the channel (as #mixer_ch_stop) */
+#define MIXER_UPDATE_STOP       (1<<4)
+
+/**
+ * @brief Update of the state of a channel, used by #mixer_ch_update_batch.
+ * 
+ * Only the fields selected by #mask are applied; the others are ignored.
+ */
+typedef struct {
+	uint32_t mask;          ///< Fields to update (bitmask of MIXER_UPDATE_* flags), 0 to skip the channel
+	waveform_t *wave;       ///< Waveform to play (#MIXER_UPDATE_WAVE)
+	float pos;              ///< Playback position in samples (#MIXER_UPDATE_POS)
+	float freq;             ///< Playback frequency in Hz (#MIXER_UPDATE_FREQ)
+	float lvol;             ///< Left volume (#MIXER_UPDATE_VOL)
+	float rvol;             ///< Right volume (#MIXER_UPDATE_VOL)
+} mixer_ch_update_t;
+
+/**
+ * @brief Update the state of multiple consecutive channels with a single call.
+ * 
+ * This is equivalent to calling #mixer_ch_play, #mixer_ch_set_pos,
+ * #mixer_ch_set_freq, #mixer_ch_set_vol and #mixer_ch_stop on each channel,
+ * in this order, but only for the fields selected by the mask of each update.
+ * It is meant for players that drive many channels at every tick (like
+ * XM64), which can track what changed and skip all the other updates.
+ * 
+ * @param[in]   first_ch        Index of the first channel to update
+ * @param[in]   num_channels    Number of channels to update
+ * @param[in]   updates         Array of num_channels updates
+ */
+void mixer_ch_update_batch(int first_ch, int num_channels, const mixer_ch_update_t *updates);
+
 /**
  * @brief Configure the limits of a channel with respect to sample bit size, and
  *        frequency.
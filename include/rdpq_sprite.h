@@ -13,6 +13,7 @@
 #define LIBDRAGON_RDPQ_SPRITE_H
 
 #include <stdint.h>
+#include "surface.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -20,6 +21,7 @@ extern "C" {
 
 ///@cond
 typedef struct sprite_s sprite_t;
+typedef struct atlas_s atlas_t;
 typedef struct rdpq_texparms_s rdpq_texparms_t;
 typedef struct rdpq_blitparms_s rdpq_blitparms_t;
 ///@endcond
@@ -36,8 +38,20 @@ typedef struct rdpq_blitparms_s rdpq_blitparms_t;
  *    (via #rdpq_mode_mipmap).
  *  * If the sprite contains a palette, it is uploaded to TMEM as well, and the
  *    palette is also activated in the render mode (via #rdpq_mode_tlut).
+ *    The palette upload is skipped if the same palette is already in TMEM,
+ *    which is common for sprites converted with a shared palette
+ *    (mksprite --shared-palette). If the sprite uses a bank of a shared
+ *    CI4 palette, the whole palette is loaded starting at @p parms->palette,
+ *    and the tile descriptor is configured to use the bank of the sprite.
  *  * If the sprite is optimized (via mksprite --optimize), the upload function
  *    will be faster.
+ *  * If the sprite is VQ-compressed (via mksprite --vq), it is first expanded
+ *    by the RSP (see #rdpq_sprite_vq_expand).
+ * 
+ * Palettes in TMEM are tracked across calls to #rdpq_tex_upload_tlut and the
+ * texture upload functions. If you overwrite the palette area of TMEM with
+ * raw RDP commands (eg: #rdpq_load_tlut_raw), the tracking is not aware of
+ * it: in that case, load the sprite palette manually with #rdpq_tex_upload_tlut.
  * 
  * After calling this function, the specified tile descriptor will be ready
  * to be used in drawing primitives like #rdpq_triangle or #rdpq_texture_rectangle.
@@ -106,6 +120,8 @@ int rdpq_sprite_upload(rdpq_tile_t tile, sprite_t *sprite, const rdpq_texparms_t
  *    palette is also activated in the render mode (via #rdpq_mode_tlut).
  *  * If the sprite is optimized (via mksprite --optimize), the upload function
  *    will be faster.
+ *  * If the sprite is VQ-compressed (via mksprite --vq), it is first expanded
+ *    by the RSP (see #rdpq_sprite_vq_expand).
  * 
  * Just like #rdpq_tex_blit, this function is designed to work with sprites of
  * arbitrary sizes; those that won't fit in TMEM will be automatically split
@@ -120,6 +136,75 @@ int rdpq_sprite_upload(rdpq_tile_t tile, sprite_t *sprite, const rdpq_texparms_t
  */
 void rdpq_sprite_blit(sprite_t *sprite, float x0, float y0, const rdpq_blitparms_t *parms);
 
+/**
+ * @brief Expand a VQ-compressed sprite using the RSP
+ * 
+ * VQ-compressed sprites (created with mksprite --vq) store each block of 2x2
+ * texels as an index into a codebook of 256 blocks. In RDRAM, they take about
+ * 2 bits per texel plus the codebook (2 KiB for RGBA16, 1 KiB for CI8), so
+ * they are much smaller than the same textures in any format natively
+ * supported by RDP, at the cost of some quality.
+ * 
+ * Since RDP cannot sample them directly, this function schedules a RSP
+ * command that expands the sprite into an internal scratch buffer, and
+ * returns a surface pointing to it. The surface is in TMEM layout
+ * (see #SURFACE_FLAGS_TMEMLAYOUT), so it is uploaded with a single
+ * LOAD_BLOCK. #rdpq_sprite_upload and #rdpq_sprite_blit call this function
+ * automatically, so there is normally no need to call it directly.
+ * 
+ * The scratch buffer is shared by all VQ-compressed sprites, and it is
+ * overwritten by the next call. Before each expansion, the RSP waits for
+ * RDP to finish the previous commands (see #rdpq_fence), so that the
+ * previous contents have been loaded into TMEM.
+ * 
+ * The expansion cannot be recorded in a rspq block, and the CPU should not
+ * access the returned surface without waiting for RSP first (eg: #rspq_wait).
+ * 
+ * @param sprite    VQ-compressed sprite
+ * @return          Surface pointing to the expanded texels (in the scratch buffer)
+ */
+surface_t rdpq_sprite_vq_expand(sprite_t *sprite);
+
+/**
+ * @brief Blit an image of a texture atlas to the active framebuffer
+ * 
+ * This function draws an image of a texture atlas (see #atlas_load), with
+ * the same features of #rdpq_tex_blit. The source sub-rect specified in
+ * @p parms (if any) is relative to the image.
+ * 
+ * Each page of the atlas fits TMEM, so it is uploaded in full (via
+ * #rdpq_sprite_upload) to the tile descriptor specified in @p parms.
+ * The atlas remembers which page is currently loaded, and the upload is
+ * skipped when the image belongs to the same page of the previous blit.
+ * Drawing images sorted by page thus requires one TMEM load per page.
+ * 
+ * The page is uploaded again if anything was loaded into TMEM via the
+ * rdpq_tex and rdpq_sprite APIs, or a rspq block was run, since the previous
+ * call. While recording a block, the page is always uploaded. Textures loaded
+ * with the raw commands (eg: #rdpq_load_tile) are not tracked: call
+ * #rdpq_atlas_invalidate after using them. The render mode (eg: TLUT) must
+ * not be changed between calls either, as it is configured by the upload.
+ * 
+ * Texture repetition (@p parms->nx and @p parms->ny) is not supported,
+ * as it relies on the texture wrapping of the whole page.
+ * 
+ * @param atlas     Texture atlas
+ * @param idx       Index of the image to draw (see #atlas_find)
+ * @param x0        X coordinate on the framebuffer where to draw the image
+ * @param y0        Y coordinate on the framebuffer where to draw the image
+ * @param parms     Parameters for the blit operation (or NULL for default)
+ */
+void rdpq_atlas_blit(atlas_t *atlas, int idx, float x0, float y0, const rdpq_blitparms_t *parms);
+
+/**
+ * @brief Forget which page of the atlas is loaded in TMEM
+ * 
+ * The next call to #rdpq_atlas_blit will upload its page again.
+ * 
+ * @param atlas     Texture atlas
+ */
+void rdpq_atlas_invalidate(atlas_t *atlas);
+
 #ifdef __cplusplus
 }
 #endif
@@ -85,6 +85,7 @@ typedef struct sprite_detail_s
 
 #define SPRITE_FLAGS_TEXFORMAT      0x1F    ///< Pixel format of the sprite
 #define SPRITE_FLAGS_OWNEDBUFFER    0x20    ///< Flag specifying that the sprite buffer must be freed by sprite_free
+#define SPRITE_FLAGS_TMEMLAYOUT     0x40    ///< Pixels are stored pre-swizzled in TMEM layout (mksprite --tmem-layout)
 #define SPRITE_FLAGS_EXT            0x80    ///< Sprite contains extended information (new format)
 
 
@@ -144,6 +145,13 @@ inline tex_format_t sprite_get_format(sprite_t *sprite) {
  * Notice that no memory allocations or copies are performed:
  * the returned surface will point to the sprite contents.
  * 
+ * If the sprite was created with mksprite --tmem-layout (see #SPRITE_FLAGS_TMEMLAYOUT),
+ * the pixels are stored in the same layout used by TMEM: each line is padded
+ * to 8 bytes, and on odd lines the two 32-bit words of each 64-bit word are
+ * swapped. The returned surface has #SURFACE_FLAGS_TMEMLAYOUT set; it can be
+ * uploaded with the rdpq texture API (which uses a single LOAD_BLOCK for it),
+ * but CPU code accessing the pixels must take the swizzling into account.
+ * 
  * @param  sprite      The sprite
  * @return             The surface pointing to the sprite
  */
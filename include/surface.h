@@ -120,6 +120,7 @@ const char* tex_format_name(tex_format_t fmt);
 
 #define SURFACE_FLAGS_TEXFORMAT    0x001F   ///< Pixel format of the surface
 #define SURFACE_FLAGS_OWNEDBUFFER  0x0020   ///< Set if the buffer must be freed
+#define SURFACE_FLAGS_TMEMLAYOUT   0x0040   ///< Pixels are stored pre-swizzled in TMEM layout (see #SPRITE_FLAGS_TMEMLAYOUT)
 #define SURFACE_FLAGS_TEXINDEX     0x0F00   ///< Placeholder for rdpq lookup table
 
 /**
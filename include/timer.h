@@ -39,8 +39,12 @@ typedef struct timer_link
     };
     /** @brief Callback context parameter */
     void *ctx;
-    /** @brief Link to next timer */
+    /** @brief Next sibling in the timer queue */
     struct timer_link *next;
+    /** @brief First child in the timer queue */
+    struct timer_link *child;
+    /** @brief Previous sibling in the timer queue (or parent, for the first child) */
+    struct timer_link *prev;
 } timer_link_t;
 
 /** @brief Timer should fire only once */
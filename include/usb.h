@@ -126,6 +126,17 @@
     extern char usb_timedout(void);
 
 
+    /*==============================
+        usb_set_timeout_limit
+        Limits how long any USB operation waits for the flashcart
+        (eg: when writing from an interrupt handler)
+        @param The limit in milliseconds, or 0 to restore the default timeouts
+        @return The previous limit
+    ==============================*/
+
+    extern int usb_set_timeout_limit(int ms);
+
+
     /*==============================
         usb_sendheartbeat
         Sends a heartbeat packet to the PC
@@ -24,6 +24,11 @@ extern "C" {
  * 
  * Use #wav64_play to playback. For more advanced usage, call directly the
  * mixer functions, accessing the #wave structure field.
+ * 
+ * WAV64 files can be stored uncompressed, or compressed by audioconv64 with
+ * either VADPCM (about 3.5:1) or MDCT (about 10:1, see `--wav-compress`).
+ * Both compressed formats are decoded on the RSP. MDCT files can only be
+ * looped at multiples of 128 samples, which audioconv64 takes care of.
  */
 typedef struct {
 	/** @brief #waveform_t for this WAV64. 
@@ -40,9 +40,13 @@
 extern "C" {
 #endif
 
+/** @brief Maximum number of channels in a XM64 module (as in Fast Tracker II) */
+#define XM64_MAX_CHANNELS    32
+
 /// @cond
 typedef struct xm_context_s xm_context_t;
 typedef struct waveform_s waveform_t;
+typedef struct xm64_source_s xm64_source_t;
 /// @endcond
 
 /**
@@ -58,12 +62,17 @@ typedef struct xm64player_s {
 	waveform_t *waves;        ///< array of all waveforms (one per XM "sample")
 	int nwaves;               ///< number of wavers (XM "samples")
 	FILE *fh;                 ///< open handle of XM64 file
+	xm64_source_t *src;       ///< source of waveform data (internal use)
 	int first_ch;             ///< first channel used in the mixer
 	bool playing;             ///< playing flag
 	bool looping;             ///< true if the XM is configured to loop
 	struct {
 		int patidx, row, tick;
 	} seek;                   ///< seeking to be performed
+	struct {
+		waveform_t *wave;
+		float freq, lvol, rvol;
+	} chstate[XM64_MAX_CHANNELS]; ///< last state applied to each mixer channel (internal use)
 } xm64player_t;
 
 /**
@@ -72,12 +81,32 @@ typedef struct xm64player_s {
  * This function requires the mixer to have been already initialized
  * (via mixer_init).
  * 
+ * Waveforms are streamed during playback. Files on DFS ("rom:/") are
+ * streamed via DMA; files on other filesystems (eg: "sd:/" via
+ * #debug_init_sdfs) are streamed with standard buffered reads, which is
+ * useful to hot-load music during development.
+ * 
  * @param player Pointer to the xm64player_t player structure to use
- * @param fn     Filename of the XM64 (with filesystem prefix). Currently,
- *               only files on DFS ("rom:/") are supported.
+ * @param fn     Filename of the XM64 (with filesystem prefix).
  */
 void xm64player_open(xm64player_t *player, const char *fn);
 
+/**
+ * @brief Open a XM64 module already loaded in RAM and prepare for playback.
+ * 
+ * This is useful for short modules (eg: jingles) that can be kept resident
+ * in memory, so that playback does not generate any PI traffic. The buffer
+ * is not copied, so it must stay valid until #xm64player_close is called.
+ * 
+ * This function requires the mixer to have been already initialized
+ * (via mixer_init).
+ * 
+ * @param player Pointer to the xm64player_t player structure to use
+ * @param buf    Buffer containing the whole XM64 file
+ * @param sz     Size of the buffer in bytes
+ */
+void xm64player_open_buf(xm64player_t *player, const void *buf, int sz);
+
 /**
  * @brief Get the number of channels in the XM64 file
  * 
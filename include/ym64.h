@@ -27,10 +27,12 @@ extern "C" {
  * 
  * The YM format is a simple dump of the state of all registers of the AY
  * chip at a fixed time step. To playback, it is necessary to emulate the
- * AY PSG. The implementation has been carefully optimized for the N64 MIPS
- * CPU for high-performance, so that playback typically takes less than 5%
- * of CPU time, plus a few percents of RSP time for resampling and mixing
- * (done by the mixer).
+ * AY PSG. The emulation of the chip runs on the RSP (one command per audio
+ * frame, batched together), so the CPU only has to parse the register
+ * dumps. The RSP also takes a few percents of time for resampling and
+ * mixing (done by the mixer). The CPU emulator (#ay8910_gen) is still
+ * available: its output is bit-exact with the RSP synthesizer, and it is
+ * used as reference for testing.
  * 
  * The YM64 is actually a valid YM file that has been simply normalized against
  * the different existing revisions, in a way to be efficient for reproduction
@@ -39,7 +41,10 @@ extern "C" {
  * 
  * The main conversion option to pay attention too is whether the output file
  * must be compressed or not. Compressed files are smaller but takes 18 KiB
- * more of RDRAM to be played back and cannot be seeked.
+ * more of RDRAM to be played back. Compressed files are normally a single
+ * LHA stream that cannot be seeked; audioconv64 can instead split the stream
+ * into independently compressed chunks (`--ym-seekable`), with an index
+ * that allows seeking (and looping) by decompressing at most one chunk.
  * 
  * This player is dedicated to the late Sir Clive Sinclair whose computer,
  * powered by the AY-3-8910, helped popularize what we now call
@@ -61,8 +66,13 @@ typedef struct {
 	FILE *f;                  ///< Open file handle
 	void *decoder;            ///< Optional LHA decoder (compressed YM files)
 	int start_off;            ///< Starting offset of the first audio frame
+	uint32_t *chunks;         ///< Offsets of the compressed chunks (seekable compressed files)
+	int nchunks;              ///< Number of compressed chunks (seekable compressed files)
+	int chunk_frames;         ///< Number of audio frames per chunk (seekable compressed files)
+	int chunk_left;           ///< Number of audio frames left in the current chunk
 
 	AY8910 ay;                ///< AY8910 emulator
+	void *rsp_state;          ///< State of the RSP AY8910 synthesizer (uncached)
 	uint8_t regs[16];         ///< Current cached value of the AY registers
 	uint32_t nframes;         ///< Number of YM audio frames
 	uint32_t chipfreq;        ///< Operating frequency of the AY chip
@@ -141,12 +151,13 @@ void ym64player_tell(ym64player_t *player, int *pos, float *secs);
  * 
  * The function seeks to a new absolute position expressed in ticks (internal
  * YM position). Notice that it's not possible to seek in a YM64 file that has
- * been compressed. audioconv64 compresses YM files by default.
+ * been compressed as a single LHA stream. Files compressed by audioconv64
+ * with `--ym-seekable` can instead be seeked.
  * 
  * @param[in]	player 		YM64 player
  * @param[out] 	pos 		Absolute position in ticks
  * @return                  True if it was possible to seek, false if 
- *                          the file is compressed.
+ *                          the file is compressed and not seekable.
  */
 bool ym64player_seek(ym64player_t *player, int pos);
 
@@ -0,0 +1,469 @@
+/**
+ * @file alloc.c
+ * @brief Arena, pool and slab allocators
+ * @ingroup alloc
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include "alloc.h"
+#include "alloc_internal.h"
+#include "n64sys.h"
+#include "interrupt.h"
+#include "debug.h"
+#include "utils.h"
+
+/** @brief Common header of arenas and pools, used for statistics */
+typedef struct alloc_link_s {
+    const char *tag;                ///< Tag of the allocator
+    int size;                       ///< Size of the memory managed by the allocator
+    int used;                       ///< Memory currently allocated
+    int peak;                       ///< Peak of allocated memory
+    struct alloc_link_s *next;      ///< Next allocator in the list
+} alloc_link_t;
+
+/** @brief An arena */
+struct arena_s {
+    alloc_link_t link;              ///< Statistics (link.used is the current offset)
+    uint8_t *buf;                   ///< Buffer (uncached address if #ALLOC_UNCACHED)
+    int flags;                      ///< Flags
+};
+
+/** @brief A pool */
+struct pool_s {
+    alloc_link_t link;              ///< Statistics
+    uint8_t *buf;                   ///< Buffer (uncached address if #ALLOC_UNCACHED)
+    int obj_size;                   ///< Size of each object (multiple of 16)
+    void *free_list;                ///< List of free objects (linked through their first word)
+    int flags;                      ///< Flags
+};
+
+/** @brief Headroom added to every slab size class, for the header of block chunks */
+#define SLAB_HEADROOM       16
+/** @brief Size of the smallest slab size class */
+#define SLAB_MIN_SIZE       (256 + SLAB_HEADROOM)
+/** @brief Size of the largest slab size class (larger allocations use #malloc_uncached) */
+#define SLAB_MAX_SIZE       (32768 + SLAB_HEADROOM)
+/** @brief Number of slab size classes */
+#define SLAB_NUM_CLASSES    29
+/** @brief Minimum size of a slab page (pages of large classes hold a single chunk) */
+#define SLAB_PAGE_SIZE      32768
+
+/** @brief The uncached slab allocator */
+static struct {
+    alloc_link_t link;                      ///< Statistics (size: reserved memory)
+    void *free_list[SLAB_NUM_CLASSES];      ///< Free chunks of each class (linked through their first word)
+    int allocs;                             ///< Number of allocations
+    int frees;                              ///< Number of frees
+    int recycled;                           ///< Allocations served by a free chunk
+    int large;                              ///< Allocations larger than #SLAB_MAX_SIZE
+    int pages;                              ///< Number of slab pages
+} slab;
+
+/** @brief List of all the arenas and pools */
+static alloc_link_t *alloc_list = NULL;
+/** @brief The two arenas of the frame arena */
+static arena_t *frame_arenas[2] = { NULL, NULL };
+/** @brief Index of the current frame arena */
+static int frame_cur = 0;
+/** @brief Arena used for the temporary allocations of libdragon */
+static arena_t *scratch_arena = NULL;
+
+static void alloc_link_add(alloc_link_t *link, const char *tag, int size)
+{
+    link->tag = tag ? tag : "untagged";
+    link->size = size;
+    link->used = link->peak = 0;
+
+    disable_interrupts();
+    link->next = alloc_list;
+    alloc_list = link;
+    enable_interrupts();
+}
+
+static void alloc_link_remove(alloc_link_t *link)
+{
+    disable_interrupts();
+    alloc_link_t **prev = &alloc_list;
+    while (*prev != link)
+        prev = &(*prev)->next;
+    *prev = link->next;
+    enable_interrupts();
+}
+
+/** @brief Allocate the buffer of an allocator, cached or uncached */
+static void *alloc_buffer(int size, int flags)
+{
+    if (flags & ALLOC_UNCACHED)
+        return malloc_uncached(size);
+    return memalign(16, size);
+}
+
+/** @brief Free the buffer of an allocator */
+static void free_buffer(void *buf, int flags)
+{
+    if (flags & ALLOC_UNCACHED)
+        free_uncached(buf);
+    else
+        free(buf);
+}
+
+arena_t *arena_new(const char *tag, int size, int flags)
+{
+    size = ROUND_UP(size, 16);
+    arena_t *arena = malloc(sizeof(arena_t));
+    if (!arena)
+        return NULL;
+    arena->buf = alloc_buffer(size, flags);
+    if (!arena->buf) {
+        free(arena);
+        return NULL;
+    }
+    arena->flags = flags;
+    alloc_link_add(&arena->link, tag, size);
+    return arena;
+}
+
+void *arena_alloc_aligned(arena_t *arena, int align, int size)
+{
+    assertf(align > 0 && (align & (align-1)) == 0, "invalid alignment: %d", align);
+    if (align < 16)
+        align = 16;
+
+    // Align the address rather than the offset, to support alignments
+    // larger than the alignment of the buffer.
+    uint32_t start = (uint32_t)arena->buf;
+    uint32_t addr = ROUND_UP(start + arena->link.used, align);
+    uint32_t end = addr + ROUND_UP(size, 16);
+    if (end > start + arena->link.size)
+        return NULL;
+
+    arena->link.used = end - start;
+    if (arena->link.used > arena->link.peak)
+        arena->link.peak = arena->link.used;
+    return (void*)addr;
+}
+
+void *arena_alloc(arena_t *arena, int size)
+{
+    return arena_alloc_aligned(arena, 16, size);
+}
+
+void arena_reset(arena_t *arena)
+{
+    arena->link.used = 0;
+}
+
+int arena_get_used(arena_t *arena)
+{
+    return arena->link.used;
+}
+
+void arena_free(arena_t *arena)
+{
+    if (!arena)
+        return;
+    if (arena == scratch_arena)
+        scratch_arena = NULL;
+    alloc_link_remove(&arena->link);
+    free_buffer(arena->buf, arena->flags);
+    free(arena);
+}
+
+pool_t *pool_new(const char *tag, int obj_size, int num_objs, int flags)
+{
+    assertf(obj_size > 0 && num_objs > 0, "invalid pool size: %d objects of %d bytes", num_objs, obj_size);
+    obj_size = ROUND_UP(obj_size, 16);
+
+    pool_t *pool = malloc(sizeof(pool_t));
+    if (!pool)
+        return NULL;
+    pool->buf = alloc_buffer(obj_size * num_objs, flags);
+    if (!pool->buf) {
+        free(pool);
+        return NULL;
+    }
+    pool->obj_size = obj_size;
+    pool->flags = flags;
+
+    // Link all the objects in the free list, in address order
+    pool->free_list = NULL;
+    for (int i=num_objs-1; i>=0; i--) {
+        void **obj = (void**)(pool->buf + i * obj_size);
+        *obj = pool->free_list;
+        pool->free_list = obj;
+    }
+
+    alloc_link_add(&pool->link, tag, obj_size * num_objs);
+    return pool;
+}
+
+void *pool_alloc(pool_t *pool)
+{
+    disable_interrupts();
+    void **obj = pool->free_list;
+    if (obj) {
+        pool->free_list = *obj;
+        pool->link.used += pool->obj_size;
+        if (pool->link.used > pool->link.peak)
+            pool->link.peak = pool->link.used;
+    }
+    enable_interrupts();
+    return obj;
+}
+
+void pool_release(pool_t *pool, void *obj)
+{
+    if (!obj)
+        return;
+    int off = (uint8_t*)obj - pool->buf;
+    assertf(off >= 0 && off < pool->link.size && off % pool->obj_size == 0,
+        "object %p does not belong to pool %s", obj, pool->link.tag);
+
+    disable_interrupts();
+    *(void**)obj = pool->free_list;
+    pool->free_list = obj;
+    pool->link.used -= pool->obj_size;
+    enable_interrupts();
+}
+
+int pool_get_used(pool_t *pool)
+{
+    return pool->link.used / pool->obj_size;
+}
+
+void pool_free(pool_t *pool)
+{
+    if (!pool)
+        return;
+    alloc_link_remove(&pool->link);
+    free_buffer(pool->buf, pool->flags);
+    free(pool);
+}
+
+void frame_arena_init(int size, int flags)
+{
+    assertf(!frame_arenas[0], "frame arena already initialized");
+    frame_arenas[0] = arena_new("frame", size, flags);
+    frame_arenas[1] = arena_new("frame", size, flags);
+    assertf(frame_arenas[0] && frame_arenas[1], "not enough memory for the frame arena (2 x %d bytes)", size);
+    frame_cur = 0;
+}
+
+void frame_arena_next(void)
+{
+    assertf(frame_arenas[0], "frame arena not initialized");
+    frame_cur ^= 1;
+    arena_reset(frame_arenas[frame_cur]);
+}
+
+void *frame_alloc(int size)
+{
+    assertf(frame_arenas[0], "frame arena not initialized");
+    void *ptr = arena_alloc(frame_arenas[frame_cur], size);
+    assertf(ptr, "frame arena is full (%d bytes allocated, %d requested)\n"
+        "Increase the size passed to frame_arena_init",
+        frame_arenas[frame_cur]->link.used, size);
+    return ptr;
+}
+
+void frame_arena_close(void)
+{
+    arena_free(frame_arenas[0]);
+    arena_free(frame_arenas[1]);
+    frame_arenas[0] = frame_arenas[1] = NULL;
+}
+
+void alloc_set_scratch(arena_t *arena)
+{
+    assertf(!arena || !(arena->flags & ALLOC_UNCACHED), "the scratch arena must be cached");
+    scratch_arena = arena;
+}
+
+void *__alloc_scratch(int size)
+{
+    if (scratch_arena) {
+        void *ptr = arena_alloc(scratch_arena, size);
+        if (ptr)
+            return ptr;
+    }
+    return malloc(size);
+}
+
+void __free_scratch(void *ptr)
+{
+    if (scratch_arena) {
+        int off = (uint8_t*)ptr - scratch_arena->buf;
+        if (off >= 0 && off < scratch_arena->link.size) {
+            // Temporary buffers are freed in LIFO order: just rewind the arena
+            assertf(off <= scratch_arena->link.used, "scratch buffers freed out of order");
+            scratch_arena->link.used = off;
+            return;
+        }
+    }
+    free(ptr);
+}
+
+int alloc_get_tag_stats(alloc_tag_stats_t *stats, int max_tags)
+{
+    int num_tags = 0;
+
+    disable_interrupts();
+    for (alloc_link_t *link = alloc_list; link; link = link->next) {
+        // Find the entry of the tag, or create a new one
+        int i = 0;
+        while (i < num_tags && i < max_tags && strcmp(stats[i].tag, link->tag))
+            i++;
+        if (i == num_tags || i == max_tags) {
+            // Count tags that do not fit in the array only once
+            bool seen = false;
+            for (alloc_link_t *prev = alloc_list; prev != link && !seen; prev = prev->next)
+                seen = !strcmp(prev->tag, link->tag);
+            if (seen)
+                continue;
+            if (num_tags++ >= max_tags)
+                continue;
+            stats[i] = (alloc_tag_stats_t){ .tag = link->tag };
+        }
+        stats[i].size += link->size;
+        stats[i].used += link->used;
+        stats[i].peak += link->peak;
+    }
+    enable_interrupts();
+    return num_tags;
+}
+
+/**
+ * @brief Find the size class of an allocation
+ *
+ * Classes are spaced by a quarter of a power of two, plus #SLAB_HEADROOM
+ * (272, 336, 400, 464, 528, 656, ...), so that at most 20% of a chunk is
+ * wasted. The chunks of RSP and RDP blocks are a power of two, plus a header
+ * of 8 bytes for the first chunk of a rspq block and all chunks of a rdpq
+ * block: thanks to the headroom, all of them waste at most 16 bytes.
+ *
+ * @param size          Size of the allocation (at most #SLAB_MAX_SIZE)
+ * @param class_size    Receives the size of the chunks of the class
+ * @return              Index of the class
+ */
+static int slab_class(int size, int *class_size)
+{
+    if (size <= SLAB_MIN_SIZE) {
+        *class_size = SLAB_MIN_SIZE;
+        return 0;
+    }
+    size -= SLAB_HEADROOM;
+    int k = 31 - __builtin_clz(size - 1);   // 2^k < size <= 2^(k+1)
+    int step = 1 << (k - 2);
+    int m = (size + step - 1) >> (k - 2);   // 5..8
+    *class_size = m * step + SLAB_HEADROOM;
+    return 1 + (k - 8) * 4 + (m - 5);
+}
+
+/** @brief Carve a new slab page into chunks of a class, and add them to its free list */
+static bool slab_grow(int cls, int class_size)
+{
+    int num = SLAB_PAGE_SIZE / class_size;
+    if (num < 1) num = 1;
+    uint8_t *page = malloc_uncached(num * class_size);
+    if (!page)
+        return false;
+
+    disable_interrupts();
+    if (!slab.pages++)
+        alloc_link_add(&slab.link, "uncached_slab", 0);
+    slab.link.size += num * class_size;
+    for (int i=num-1; i>=0; i--) {
+        void **chunk = (void**)(page + i * class_size);
+        *chunk = slab.free_list[cls];
+        slab.free_list[cls] = chunk;
+    }
+    enable_interrupts();
+    return true;
+}
+
+void *slab_alloc_uncached(int size)
+{
+    assertf(size > 0, "invalid allocation size: %d", size);
+    if (size > SLAB_MAX_SIZE) {
+        disable_interrupts();
+        slab.allocs++;
+        slab.large++;
+        enable_interrupts();
+        return malloc_uncached(size);
+    }
+
+    int class_size;
+    int cls = slab_class(size, &class_size);
+    bool fresh = false;
+    if (!slab.free_list[cls]) {
+        if (!slab_grow(cls, class_size))
+            return NULL;
+        fresh = true;
+    }
+
+    disable_interrupts();
+    void **chunk = slab.free_list[cls];
+    slab.free_list[cls] = *chunk;
+    slab.allocs++;
+    if (!fresh)
+        slab.recycled++;
+    slab.link.used += class_size;
+    if (slab.link.used > slab.link.peak)
+        slab.link.peak = slab.link.used;
+    enable_interrupts();
+    return chunk;
+}
+
+void slab_free_uncached(void *ptr, int size)
+{
+    if (!ptr)
+        return;
+    assertf(ptr == UncachedAddr(ptr), "pointer %p is not uncached", ptr);
+    if (size > SLAB_MAX_SIZE) {
+        disable_interrupts();
+        slab.frees++;
+        enable_interrupts();
+        free_uncached(ptr);
+        return;
+    }
+
+    // The chunk goes back to its free list, and never to the heap: being
+    // only ever accessed through uncached addresses, it can be reused
+    // without any cache maintenance.
+    int class_size;
+    int cls = slab_class(size, &class_size);
+    disable_interrupts();
+    *(void**)ptr = slab.free_list[cls];
+    slab.free_list[cls] = ptr;
+    slab.frees++;
+    slab.link.used -= class_size;
+    enable_interrupts();
+}
+
+void slab_get_stats(slab_stats_t *stats)
+{
+    disable_interrupts();
+    stats->allocs = slab.allocs;
+    stats->frees = slab.frees;
+    stats->recycled = slab.recycled;
+    stats->large = slab.large;
+    stats->pages = slab.pages;
+    stats->reserved = slab.link.size;
+    stats->used = slab.link.used;
+    stats->peak = slab.link.peak;
+    enable_interrupts();
+}
+
+void heap_get_stats(heap_stats_t *stats)
+{
+    struct mallinfo mi = mallinfo();
+    stats->total = mi.arena;
+    stats->peak = mi.usmblks;
+    stats->used = mi.uordblks;
+    stats->free = mi.fordblks;
+    stats->free_chunks = mi.ordblks;
+    // The free space at the top of the heap (keepcost) can be used by any
+    // allocation, while the rest is in holes between allocated chunks.
+    stats->fragmented = mi.fordblks - mi.keepcost;
+}
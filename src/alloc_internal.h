@@ -0,0 +1,23 @@
+/**
+ * @file alloc_internal.h
+ * @brief Arena and pool allocators (internal API)
+ * @ingroup alloc
+ */
+
+#ifndef __LIBDRAGON_ALLOC_INTERNAL_H
+#define __LIBDRAGON_ALLOC_INTERNAL_H
+
+/**
+ * @brief Allocate a temporary buffer
+ *
+ * The buffer is taken from the scratch arena (see #alloc_set_scratch) if
+ * configured and large enough, otherwise from the heap. It must be freed
+ * with #__free_scratch before the calling function returns, in reverse
+ * order of allocation.
+ */
+void *__alloc_scratch(int size);
+
+/** @brief Free a temporary buffer allocated with #__alloc_scratch */
+void __free_scratch(void *ptr);
+
+#endif
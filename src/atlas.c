@@ -0,0 +1,107 @@
+/**
+ * @file atlas.c
+ * @brief Texture atlases
+ * @ingroup graphics
+ */
+
+#include "atlas.h"
+#include "atlas_internal.h"
+#include "sprite.h"
+#include "asset.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert(sizeof(atlas_image_t) == 16, "invalid atlas_image_t size");
+
+atlas_t *atlas_load(const char *fn)
+{
+    int sz;
+    atlas_header_t *header = asset_load(fn, &sz);
+    assertf(sz >= sizeof(atlas_header_t) && header->magic == ATLAS_MAGIC,
+        "invalid atlas file: %s", fn);
+    assertf(header->version == ATLAS_VERSION,
+        "unsupported atlas version (%ld): please regenerate your asset files", header->version);
+
+    atlas_t *atlas = malloc(sizeof(atlas_t));
+    atlas->header = header;
+    atlas->images = (atlas_image_t*)((uint8_t*)header + header->images_off);
+    atlas->pages = malloc(header->num_pages * sizeof(sprite_t*));
+    atlas->loaded_page = -1;
+    atlas->loaded_tile = -1;
+    atlas->loaded_gen = 0;
+
+    // Relocate the image names, that are stored as offsets in the string table
+    const char *strings = (const char*)header + header->strings_off;
+    for (int i=0; i<header->num_images; i++)
+        atlas->images[i].name = strings + (uint32_t)atlas->images[i].name;
+
+    // Load the pages, that are stored in the same directory of the index
+    const char *slash = strrchr(fn, '/');
+    if (!slash) slash = strchr(fn, ':');
+    int dirlen = slash ? slash - fn + 1 : 0;
+    uint32_t *page_names = (uint32_t*)((uint8_t*)header + header->pages_off);
+    for (int i=0; i<header->num_pages; i++) {
+        const char *name = strings + page_names[i];
+        char path[dirlen + strlen(name) + 1];
+        memcpy(path, fn, dirlen);
+        strcpy(path + dirlen, name);
+        atlas->pages[i] = sprite_load(path);
+    }
+
+    return atlas;
+}
+
+void atlas_free(atlas_t *atlas)
+{
+    for (int i=0; i<atlas->header->num_pages; i++)
+        sprite_free(atlas->pages[i]);
+    free(atlas->pages);
+    free(atlas->header);
+    free(atlas);
+}
+
+int atlas_find(atlas_t *atlas, const char *name)
+{
+    int min = 0, max = atlas->header->num_images;
+    while (min < max) {
+        int mid = (min + max) / 2;
+        int cmp = strcmp(atlas->images[mid].name, name);
+        if (cmp == 0)
+            return mid;
+        if (cmp < 0)
+            min = mid + 1;
+        else
+            max = mid;
+    }
+    return -1;
+}
+
+int atlas_get_num_images(atlas_t *atlas)
+{
+    return atlas->header->num_images;
+}
+
+const atlas_image_t *atlas_get_image(atlas_t *atlas, int idx)
+{
+    assertf(idx >= 0 && idx < atlas->header->num_images, "invalid atlas image index: %d", idx);
+    return &atlas->images[idx];
+}
+
+int atlas_get_num_pages(atlas_t *atlas)
+{
+    return atlas->header->num_pages;
+}
+
+sprite_t *atlas_get_page(atlas_t *atlas, int page)
+{
+    assertf(page >= 0 && page < atlas->header->num_pages, "invalid atlas page: %d", page);
+    return atlas->pages[page];
+}
+
+surface_t atlas_get_pixels(atlas_t *atlas, int idx)
+{
+    const atlas_image_t *img = atlas_get_image(atlas, idx);
+    surface_t page = sprite_get_pixels(atlas->pages[img->page]);
+    return surface_make_sub(&page, img->x, img->y, img->width, img->height);
+}
@@ -0,0 +1,40 @@
+#ifndef __LIBDRAGON_ATLAS_INTERNAL_H
+#define __LIBDRAGON_ATLAS_INTERNAL_H
+
+#include <stdint.h>
+#include "atlas.h"
+
+/** @brief Magic identifier of the atlas index file ("ATLS") */
+#define ATLAS_MAGIC         0x41544C53
+/** @brief Version of the atlas index file format */
+#define ATLAS_VERSION       1
+
+/**
+ * @brief Header of the atlas index file, as written by mksprite --atlas
+ *
+ * The header is followed by an array of page filename offsets (one 32-bit
+ * word per page), an array of #atlas_image_t sorted by name (where the name
+ * is stored as an offset), and the string table. All offsets of strings are
+ * relative to the string table.
+ */
+typedef struct {
+    uint32_t magic;         ///< Magic identifier (#ATLAS_MAGIC)
+    uint32_t version;       ///< Version of the format (#ATLAS_VERSION)
+    uint32_t num_pages;     ///< Number of pages
+    uint32_t num_images;    ///< Number of images
+    uint32_t pages_off;     ///< Offset of the page filename offsets
+    uint32_t images_off;    ///< Offset of the image array
+    uint32_t strings_off;   ///< Offset of the string table
+} atlas_header_t;
+
+/** @brief A texture atlas */
+typedef struct atlas_s {
+    atlas_header_t *header;     ///< Index file loaded in memory
+    atlas_image_t *images;      ///< Images (pointing into the index file)
+    sprite_t **pages;           ///< Sprites of the pages
+    int loaded_page;            ///< Page currently uploaded to TMEM by #rdpq_atlas_blit (or -1)
+    int loaded_tile;            ///< Tile descriptor configured for the loaded page
+    uint32_t loaded_gen;        ///< TMEM generation right after the page was uploaded
+} atlas_t;
+
+#endif
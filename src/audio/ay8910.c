@@ -1,7 +1,14 @@
 #include "ay8910.h"
+#include "ay8910_internal.h"
 #include <assert.h>
 #include <memory.h>
 
+#ifdef N64
+#include "rspq.h"
+#include "n64sys.h"
+#include "debug.h"
+#endif
+
 #define AY8910_TRACE   0
 
 #if AY8910_TRACE
@@ -10,29 +17,24 @@
 #define tracef(fmt, ...)  ({ })
 #endif
 
-#if AY8910_CENTER_SILENCE
-#define V(f)  ((f) * 0.5f * AY8910_VOLUME_ATTENUATE + 0.5f)
-#else
-#define V(f)  ((f) * AY8910_VOLUME_ATTENUATE)
-#endif
-
-static const float VOL_TABLE[16] = { V(0.0), V(0.002300939285824675), V(0.005554958830034992), V(0.010156837401684337), V(0.01666487649010497), V(0.02586863363340366), V(0.03888471181024493), V(0.05729222609684229), V(0.08332438245052481), V(0.12013941102371954), V(0.17220372373108456), V(0.24583378087747398), V(0.3499624062922039), V(0.4972225205849827), V(0.7054797714144425), V(1.0) };
+// The generator only implements the default configuration of the emulator,
+// which is the only one supported by the RSP synthesizer too.
+_Static_assert(AY8910_OUTPUT_STEREO && AY8910_DECIMATE == 3 && AY8910_CENTER_SILENCE,
+	"AY8910 emulator only supports stereo output with decimation by 3 and centered silence");
 
-#undef V
+// Output amplitude of each volume level. The table is scaled so that the
+// maximum output of three ticks of all channels (with stereo weights 2/1/2)
+// is AY8910_VOLUME_ATTENUATE, so that the accumulation never overflows.
+// This table is duplicated in rsp_ay8910.S.
+static const int16_t VOL_TABLE[16] = {
+	0, 7, 16, 30, 49, 75, 113, 167, 243, 350, 502, 716, 1019, 1448, 2055, 2913
+};
 
-#define SAMPLE_CONV(f)   ((f) * 65535.0f - 32768.0f)
-
-#define OUTS(s) ({ \
-	*out++ = (int16_t)SAMPLE_CONV(s); \
-	if (AY8910_OUTPUT_STEREO) *out++ = (int16_t)SAMPLE_CONV(s); \
-})
-
-#if AY8910_OUTPUT_STEREO
 #ifdef N64
 	// Store 32-bits at once. This is twice as faster when accessing uncached
 	// addresses like the audio buffers.
 	#define OUT(sl_, sr_) ({ \
-		*(uint32_t*)out = ((uint32_t)(int16_t)(sl_) << 16) | (uint32_t)(int16_t)(sr_); \
+		*(uint32_t*)out = ((uint32_t)(int16_t)(sl_) << 16) | (uint32_t)(uint16_t)(sr_); \
 		out += 2; \
 	})
 #else
@@ -41,425 +43,170 @@ static const float VOL_TABLE[16] = { V(0.0), V(0.002300939285824675), V(0.005554
 		*out++ = (int16_t)(sr_); \
 	})
 #endif
-#else
-	#define OUT(s_) ({ \
-		int16_t s = (int16_t)(s_); \
-		*out++ = (int16_t)(s); \
-	})
-#endif
 
-#if 0
-// Reference implementation.
-// This implementation processes the whole AY8910 state every sample, so it's
-// easy to follow but it's not optimized because it doesn't account for the
-// fact that the internal state doesn't change every tick.
-int ay8910_gen(AY8910 *ay, int16_t *out, int nsamples) {
-	if (ay->ch[0].tone_en && ay->ch[1].tone_en && ay->ch[2].tone_en)
-	{
-		for (int i=0;i<nsamples;i++)
-			OUTS(VOL_TABLE[0]);
-		return nsamples;
+/** @brief Accumulator of the ticks of the current output sample */
+typedef struct {
+	int16_t *out;           ///< Output buffer
+	int l, r;               ///< Accumulated value of the left and right channels
+	int n;                  ///< Number of ticks accumulated
+} ay_mix_t;
+
+/** @brief Emit @p n ticks with the specified stereo value */
+static void ay_mix(ay_mix_t *mix, int n, int l, int r) {
+	int16_t *out = mix->out;
+	if (mix->n) {
+		int k = AY8910_DECIMATE - mix->n;
+		if (k > n) k = n;
+		mix->l += l*k; mix->r += r*k; mix->n += k; n -= k;
+		if (mix->n < AY8910_DECIMATE) return;
+		OUT(mix->l, mix->r);
+		mix->n = 0;
 	}
-
-	#if 0
-	{	
-		AYChannel *ch0 = &ay->ch[0];
-		AYChannel *ch1 = &ay->ch[1];
-		AYChannel *ch2 = &ay->ch[2];
-		AYNoise *ns = &ay->ns;
-		AYEnvelope *env = &ay->env;
-		printf("en: %d %d %d\n", !ch0->tone_en, !ch1->tone_en, !ch2->tone_en);
-		printf("noise: %d %d %d\n", !ch0->noise_en, !ch1->noise_en, !ch2->noise_en);
-		printf("vol: %d %d %d %d\n", ch0->tone_vol, ch1->tone_vol, ch2->tone_vol, env->vol);
-		printf("chout: %d %d %d\n", ch0->out, ch1->out, ch2->out);
-		printf("period: %d %d %d %d %d\n", ch0->tone_period, ch1->tone_period, ch2->tone_period, ns->period, env->period);
-	}
-	#endif
-
-	float sample = 0;
-	int sample_n = 0;
-	for (int i=0; i<nsamples*AY8910_DECIMATE; i++) {
-		AYNoise *ns = &ay->ns;
-		++ns->count;
-		if (ns->count >= ns->period) {
-			ns->out ^= ((ns->out ^ (ns->out>>3)) & 1) << 17;
-			ns->out >>= 1;
-			ns->count -= ns->period;
-		}
-		AYEnvelope *env = &ay->env;
-		if (!env->holding) {
-			++env->count;
-			if (env->count >= env->period) {
-				env->count = 0;
-
-				env->step--;
-				if (env->step < 0) {
-					if (env->hold) {
-						if (env->alternate)
-							env->attack ^= 0xF;
-						env->holding = 1;
-						env->step = 0;
-					} else {
-						if (env->alternate && env->step&0x10)
-							env->attack ^= 0xF;
-						env->step &= 0xF;
-					}
-				}
-				env->vol = env->step ^ env->attack;
-			}
-		}
-
-		for (int c=0; c<3; c++) {
-			AYChannel *ch = &ay->ch[c];
-			++ch->count;
-			if (ch->count >= ch->tone_period) {
-				ch->out ^= 1;
-				ch->count -= ch->tone_period;
-			}
-
-			uint8_t gate = (ch->out | ch->tone_en) & (ns->out | ch->noise_en) & 1;
-			uint8_t vol = (ch->tone_vol == 0x10) ? env->vol : ch->tone_vol;
-			sample += VOL_TABLE[gate ? vol : 0];
-		}
-		if (++sample_n == AY8910_DECIMATE) {
-			OUTS(sample/(3*AY8910_DECIMATE));
-			sample_n = 0;
-			sample = 0;
-		}
-	}
-	return nsamples;
+	for (; n >= AY8910_DECIMATE; n -= AY8910_DECIMATE)
+		OUT(l*AY8910_DECIMATE, r*AY8910_DECIMATE);
+	mix->l = l*n; mix->r = r*n; mix->n = n;
+	mix->out = out;
 }
 
-#else
-
-static uint32_t fastrand() {
-	/* Algorithm "xor" from p. 4 of Marsaglia, "Xorshift RNGs" */
-	static int state = 1;
-	uint32_t x = state;
-	x ^= x << 13;
-	x ^= x >> 17;
-	x ^= x << 5;
-	return state = x;
+/** @brief Output level of a channel in the current state (0 if gated) */
+static int ay_level(AY8910 *ay, AYChannel *ch) {
+	uint8_t gate = (ch->out | ch->tone_en) & (ay->ns.out | ch->noise_en) & 1;
+	if (gate) return 0;
+	return VOL_TABLE[(ch->tone_vol & 0x10) ? ay->env.vol : (ch->tone_vol & 0xF)];
 }
 
-static float fastrandf() {
-	return fastrand() * 2.3283064365386963e-10f;
-}
-
-// Optimized implementation, much faster.
-// This implementation is more complex compared to the reference once. It
-// inspects the internal state of the AY8910 and decides when the next state
-// change is going to happen. Then, it emits a fixed output for all the cycles
-// until next state change.
+// The emulator runs like the hardware: at every tick, each counter is
+// incremented and, when it reaches its period, the corresponding component
+// changes state, which is immediately reflected in the output of that tick.
+// Every AY8910_DECIMATE ticks are summed into an output sample.
+//
+// To be fast, instead of processing every tick, it computes which component
+// is going to change state first, and emits a fixed output for all the ticks
+// until then. Components that cannot affect the output (disabled tones,
+// noise not routed to any channel, unused envelope) do not generate events.
+//
+// The output is computed in integer arithmetic, and it is bit-exact with the
+// RSP synthesizer (rsp_ay8910.S), which is tested against this function.
 int ay8910_gen(AY8910 *ay, int16_t *out, int nsamples) {
-	nsamples *= AY8910_DECIMATE;
-
-	int16_t *iout = out;
-	#if AY8910_OUTPUT_STEREO
-	float sample_accum_l = 0;
-	float sample_accum_r = 0;
-	#else
-	float sample_accum = 0;
-	#endif
-	int sample_accum_n = 0;
-	AYChannel *ch0 = &ay->ch[0];
-	AYChannel *ch1 = &ay->ch[1];
-	AYChannel *ch2 = &ay->ch[2];
+	AYChannel *ch = ay->ch;
 	AYNoise *ns = &ay->ns;
 	AYEnvelope *env = &ay->env;
-	int noise = ((!ch0->noise_en)<<0) | ((!ch1->noise_en)<<1) | ((!ch2->noise_en)<<2);
-	int envelope = ((ch0->tone_vol == 0x10) || (ch1->tone_vol == 0x10) || (ch2->tone_vol == 0x10));
-	if (env->holding) envelope = 0;
-
-	float vol0 = VOL_TABLE[(ch0->tone_vol == 0x10) ? env->vol : ch0->tone_vol];
-	float vol1 = VOL_TABLE[(ch1->tone_vol == 0x10) ? env->vol : ch1->tone_vol];
-	float vol2 = VOL_TABLE[(ch2->tone_vol == 0x10) ? env->vol : ch2->tone_vol];
-
-	// If the period just changed, the counter might have overflown. Just cap next
-	// event to the period.
-	if (ch0->count > ch0->tone_period) { ch0->count = 0; ch0->out ^= 1; }
-	if (ch1->count > ch1->tone_period) { ch1->count = 0; ch1->out ^= 1; }
-	if (ch2->count > ch2->tone_period) { ch2->count = 0; ch2->out ^= 1; }
-	if (ns->count > ns->period) ns->count = 0;
-	if (env->count > env->period) env->count = 0;
-
-	// Calculate when the state will change for the different components of the PSG.
-	// Use a very big number for disabled components, so that it will never become 0
-	// before nsamples.
-	uint32_t n0 = !ch0->tone_en ? (ch0->tone_period - ch0->count) : 0xFFFFFFFF;
-	uint32_t n1 = !ch1->tone_en ? (ch1->tone_period - ch1->count) : 0xFFFFFFFF;
-	uint32_t n2 = !ch2->tone_en ? (ch2->tone_period - ch2->count) : 0xFFFFFFFF;
-	uint32_t nn = noise ?         (ns->period - ns->count)        : 0xFFFFFFFF;
-	uint32_t ne = envelope ?      (env->period - env->count)      : 0xFFFFFFFF;
-	// Period == 1 is probably just a mistake, the frequency is too high anyway, ignore them
-	if (ch0->tone_period == 1) n0 = 0xFFFFFFFF;
-	if (ch1->tone_period == 1) n1 = 0xFFFFFFFF;
-	if (ch2->tone_period == 1) n2 = 0xFFFFFFFF;
-	if (env->period == 1     ) ne = 0xFFFFFFFF;
-
-	// Very low noise periods are instead very common, and it's just high-frequency
-	// noise. To avoid being affected too much by performance, when the noise is
-	// lower than the decimation factor we switch to random amplitude modulation
-	// to emulate the noise. We call this technique "fastnoise".
-	int fastnoise = 0;
-	if (AY8910_DECIMATE > 1 && ns->period <= AY8910_DECIMATE) {
-		ns->period = AY8910_DECIMATE;
-		fastnoise = noise;
-	}
-
-	// Periods should never be 0 (they're capped to 1 when they're written)
-	assert(ch0->tone_period);
-	assert(ch1->tone_period);
-	assert(ch2->tone_period);
-	assert(ns->period);
-	assert(env->period);
-
-	// Now that we have setup the next events in the n* variables, we don't need
-	// the current value of the counters anymore. Update them to the final value
-	// they will have after processing nsamples, ready for next frame.
-	// Handle period==1 (silent) specially, so that we save a division in that case.
-	ch0->count += nsamples;
-	ch1->count += nsamples;
-	ch2->count += nsamples;
-	ns->count += nsamples;
-	env->count += nsamples;
-	if (ch0->tone_period == 1) ch0->count = 0; else ch0->count %= ch0->tone_period;
-	if (ch1->tone_period == 1) ch1->count = 0; else ch1->count %= ch1->tone_period;
-	if (ch2->tone_period == 1) ch2->count = 0; else ch2->count %= ch2->tone_period;
-	if (ns->period == 1) ns->count = 0; else ns->count %= ns->period;
-	if (env->period == 1) env->count = 0; else env->count %= env->period;
-
-	// If the chip is completely silent, just early exit
-	if (!noise && ch0->tone_en && ch1->tone_en && ch2->tone_en) {
-		for (int i=0; i<nsamples/AY8910_DECIMATE; i++)
-			OUTS(VOL_TABLE[0]);
-		return nsamples/AY8910_DECIMATE;
+	int nticks = nsamples * AY8910_DECIMATE;
+
+	// Check which counters are running. A tone period of 1 is ultrasonic, so
+	// it is ignored. The noise counter only runs if the noise is routed to a
+	// channel, and the envelope one only if the envelope is used and not holding.
+	bool count_tone[3], count_noise = false, count_env = false;
+	for (int c=0; c<3; c++) {
+		count_tone[c] = ch[c].tone_period != 1;
+		if (!ch[c].noise_en) count_noise = true;
+		if (ch[c].tone_vol & 0x10) count_env = true;
 	}
+	if (env->period == 1 || env->holding) count_env = false;
 
-	#if 0
-	printf("en: %d %d %d %d\n", !ch0->tone_en, !ch1->tone_en, !ch2->tone_en, envelope);
-	printf("noise: %d %d %d\n", !ch0->noise_en, !ch1->noise_en, !ch2->noise_en);
-	printf("vol: %d %d %d %d\n", ch0->tone_vol, ch1->tone_vol, ch2->tone_vol, env->vol);
-	printf("chout: %d %d %d\n", ch0->out, ch1->out, ch2->out);
-	printf("period: %d %d %d %d %d\n", ch0->tone_period, ch1->tone_period, ch2->tone_period, ns->period, env->period);
-	printf("envelope: step:%d att:%d hld:%d holding:%d\n", env->step, env->attack, env->hold, env->holding);
-	printf("next: %d %d %d %d %d\n", n0, n1, n2, nn, ne);
-	#endif
-
-	int changech = 0x7; // recalc the output of all channels once
-	float s0=0, s1=0, s2=0;
-	float fn0=0, fn1=0, fn2=0;
-
-	while (nsamples > 0) {
-		if (changech & (1<<0)) {
-			if (fastnoise & (1<<0)) {
-				uint8_t gate = (ch0->out | ch0->tone_en) & 1;
-				s0 = !gate ? vol0 : VOL_TABLE[0];
-				fn0 = !gate ? (vol0-VOL_TABLE[0]) : 0;
-			} else {
-				uint8_t gate = (ch0->out | ch0->tone_en) & (ns->out | ch0->noise_en) & 1;
-				s0 = !gate ? vol0 : VOL_TABLE[0];
-				fn0 = 0;
-			}
-		}
-		if (changech & (1<<1)) {
-			if (fastnoise & (1<<1)) {
-				uint8_t gate = (ch1->out | ch1->tone_en) & 1;
-				s1 = !gate ? vol1 : VOL_TABLE[0];
-				fn1 = !gate ? (vol1-VOL_TABLE[0]) : 0;
-			} else {
-				uint8_t gate = (ch1->out | ch1->tone_en) & (ns->out | ch1->noise_en) & 1;
-				s1 = !gate ? vol1 : VOL_TABLE[0];
-				fn1 = 0;
-			}
-		}
-		if (changech & (1<<2)) {
-			if (fastnoise & (1<<2)) {
-				uint8_t gate = (ch2->out | ch2->tone_en) & 1;
-				s2 = !gate ? vol2 : VOL_TABLE[0];
-				fn2 = !gate ? (vol2-VOL_TABLE[0]) : 0;
-			} else {
-				uint8_t gate = (ch2->out | ch2->tone_en) & (ns->out | ch2->noise_en) & 1;
-				s2 = !gate ? vol2 : VOL_TABLE[0];
-				fn2 = 0;
-			}
+	// If the period just changed, the counter might have overflown.
+	for (int c=0; c<3; c++) {
+		if (count_tone[c] && ch[c].count > ch[c].tone_period) {
+			ch[c].count = 0;
+			ch[c].out ^= 1;
 		}
-		changech = 0;
-
-		void *update_func = 0;
-
-		// Check which internal component is going to change state first in the future.
-		uint32_t next = 0xFFFFFFFF;
-		if (n0 < next) { next = n0; update_func = &&update_ch0; }
-		if (n1 < next) { next = n1; update_func = &&update_ch1; }
-		if (n2 < next) { next = n2; update_func = &&update_ch2; }
-		if (nn < next) { next = nn; update_func = &&update_noise; }
-		if (ne < next) { next = ne; update_func = &&update_envelope; }
-		if (nsamples < next) {
-			next = nsamples;
-			update_func = 0;
+	}
+	if (count_noise && ns->count > ns->period) ns->count = 0;
+	if (count_env && env->count > env->period) env->count = 0;
+
+	// Tones that are disabled do not affect the output: their counters
+	// are updated at the end.
+	bool event_tone[3];
+	for (int c=0; c<3; c++)
+		event_tone[c] = count_tone[c] && !ch[c].tone_en;
+
+	ay_mix_t mix = { .out = out };
+	int v0 = ay_level(ay, &ch[0]);
+	int v1 = ay_level(ay, &ch[1]);
+	int v2 = ay_level(ay, &ch[2]);
+
+	int left = nticks;
+	while (left > 0) {
+		// Calculate the number of ticks until the next state change
+		// (the change happens during the last of them).
+		int next = left+1;
+		#define NEXT(cnt, period)  ({ int n = (period) - (cnt); if (n < 1) n = 1; if (n < next) next = n; })
+		for (int c=0; c<3; c++)
+			if (event_tone[c]) NEXT(ch[c].count, ch[c].tone_period);
+		if (count_noise) NEXT(ns->count, ns->period);
+		if (count_env)   NEXT(env->count, env->period);
+		#undef NEXT
+
+		// No state change until the end: just emit the current output
+		if (next > left) {
+			ay_mix(&mix, left, 2*v0 + v1, 2*v2 + v1);
+			for (int c=0; c<3; c++)
+				if (event_tone[c]) ch[c].count += left;
+			if (count_noise) ns->count += left;
+			if (count_env)   env->count += left;
+			break;
 		}
 
-		// Next==0 happens only when two components change state at the same tick.
-		// In the case, we run the whole loop twice, and the second time one
-		// next will be zero. We don't need to generate samples in this case.
-		if (next) {
-			// Update 
-			nsamples -= next;
-			n0 -= next;
-			n1 -= next;
-			n2 -= next;
-			nn -= next;
-			ne -= next;
-
-			// Output the current sample value until the next state change.
-			#if AY8910_OUTPUT_STEREO
-			float samplel = SAMPLE_CONV((s0+s1*0.5f) * (2.f / 3.f));
-			float sampler = SAMPLE_CONV((s2+s1*0.5f) * (2.f / 3.f));
-			#else
-			float sample = SAMPLE_CONV((s0+s1+s2) * (1.f / 3.f));
-			#endif
-
-			#if 0
-			printf("out %04x %d [%d,%d,%d,%d,%d] (%d)\n", (int)(sample*65535), next, n0,n1,n2,nn,ne, nsamples);
-			#endif
-
-			if (AY8910_DECIMATE > 1) {
-				// Calculate the fast-noise amplitude (if any). A random amplitude
-				// in the range [0..fn] must be subtracted from sample to apply the noise.
-				#if AY8910_OUTPUT_STEREO
-				float fnl = (fn0+fn1*0.5f) * (2.f / 3.f) * 65535.f;
-				float fnr = (fn2+fn1*0.5f) * (2.f / 3.f) * 65535.f;
-				#else
-				float fn = (fn0+fn1+fn2) * (1.f / 3.f) * 65535.f;
-				#endif
-
-				if (sample_accum_n) {
-					float fr = fastrandf();
-					int sa = AY8910_DECIMATE-sample_accum_n;
-					if (sa > next) {
-						#if AY8910_OUTPUT_STEREO
-						sample_accum_l += (samplel - fnl*fr) * next;
-						sample_accum_r += (sampler - fnr*fr) * next;
-						#else
-						sample_accum += (sample - fn*fr) * next;
-						#endif
-						sample_accum_n += next;
-						goto end_decim;
-					} else {					
-						#if AY8910_OUTPUT_STEREO
-						sample_accum_l += (samplel - fnl*fr) * sa;
-						sample_accum_r += (sampler - fnr*fr) * sa;
-						OUT(sample_accum_l * (1.f / AY8910_DECIMATE), sample_accum_r * (1.f / AY8910_DECIMATE));
-						#else
-						sample_accum += (sample - fn*fr) * sa;
-						OUT(sample_accum * (1.f / AY8910_DECIMATE));
-						#endif
-						next -= sa;
-						sample_accum_n = 0;
-					}
-				}
+		// Emit the ticks that precede the state change
+		ay_mix(&mix, next-1, 2*v0 + v1, 2*v2 + v1);
+		left -= next;
 
-				int nn = next / AY8910_DECIMATE;
-				if (fastnoise) {
-					for (int i=0; i<nn; i++) {
-						float fr = fastrandf();
-						#if AY8910_OUTPUT_STEREO
-						OUT(samplel - fnl*fr, sampler - fnr*fr);
-						#else
-						OUT(sample - fn*fr);
-						#endif
-					}
-				} else {
-					for (int i=0; i<nn; i++) {
-						#if AY8910_OUTPUT_STEREO
-						OUT(samplel, sampler);
-						#else
-						OUT(sample);
-						#endif
-					}
-				}
-
-				next -= nn*AY8910_DECIMATE;
-				sample_accum_n = next;
-				float fr = fastrandf();
-				#if AY8910_OUTPUT_STEREO
-				sample_accum_l = (samplel - fnl*fr) * next;
-				sample_accum_r = (sampler - fnr*fr) * next;
-				#else
-				sample_accum = (sample - fn*fr) * next;
-				#endif
-				end_decim: (void)0;
-
-			} else {
-				for (int i=0; i<next; i++) {
-					#if AY8910_OUTPUT_STEREO
-					OUT(samplel, sampler);
-					#else
-					OUT(sample);
-					#endif
+		for (int c=0; c<3; c++) {
+			if (event_tone[c]) {
+				ch[c].count += next;
+				if (ch[c].count >= ch[c].tone_period) {
+					ch[c].count -= ch[c].tone_period;
+					ch[c].out ^= 1;
 				}
 			}
 		}
-
-		if (!update_func)
-			continue;
-		goto *update_func;
-
-		update_ch0: {
-			ch0->out ^= 1; changech |= (1<<0); n0 = ch0->tone_period;
-			continue;
-		}
-		update_ch1: {
-			ch1->out ^= 1; changech |= (1<<1); n1 = ch1->tone_period;
-			continue;
-		}
-		update_ch2: {
-			ch2->out ^= 1; changech |= (1<<2); n2 = ch2->tone_period;
-			continue;
-		}
-		update_noise: {
-			ns->out ^= ((ns->out ^ (ns->out>>3)) & 1) << 17;
-			ns->out >>= 1;
-			changech |= noise;
-			nn = ns->period;
-			continue;
+		if (count_noise) {
+			ns->count += next;
+			if (ns->count >= ns->period) {
+				ns->count -= ns->period;
+				ns->out ^= ((ns->out ^ (ns->out>>3)) & 1) << 17;
+				ns->out >>= 1;
+			}
 		}
-		update_envelope: {
-			if (!env->holding) {			
+		if (count_env) {
+			env->count += next;
+			if (env->count >= env->period) {
+				env->count -= env->period;
 				env->step--;
 				if (env->step < 0) {
+					if (env->alternate)
+						env->attack ^= 0xF;
 					if (env->hold) {
-						if (env->alternate)
-							env->attack ^= 0xF;
 						env->holding = 1;
 						env->step = 0;
+						count_env = false;
 					} else {
-						if (env->alternate && env->step&0x10)
-							env->attack ^= 0xF;
 						env->step &= 0xF;
 					}
 				}
 				env->vol = env->step ^ env->attack;
-				ne = env->period;
-			} else {
-				// No need to process envelope anymore, as it reached the holding state
-				ne = 0xFFFFFFFF;
 			}
+		}
 
-			float v = VOL_TABLE[env->vol];
-			if (ch0->tone_vol == 0x10) { vol0 = v; changech |= (1<<0); }
-			if (ch1->tone_vol == 0x10) { vol1 = v; changech |= (1<<1); }
-			if (ch2->tone_vol == 0x10) { vol2 = v; changech |= (1<<2); }
-			ne = env->period;
-			continue;
+		// Emit the tick of the state change with the new output
+		v0 = ay_level(ay, &ch[0]);
+		v1 = ay_level(ay, &ch[1]);
+		v2 = ay_level(ay, &ch[2]);
+		ay_mix(&mix, 1, 2*v0 + v1, 2*v2 + v1);
+	}
+
+	// Update the counters of the disabled tones
+	for (int c=0; c<3; c++) {
+		if (count_tone[c] && !event_tone[c]) {
+			uint32_t cnt = ch[c].count + nticks;
+			ch[c].out ^= (cnt / ch[c].tone_period) & 1;
+			ch[c].count = cnt % ch[c].tone_period;
 		}
 	}
 
-	assert(nsamples == 0);
-	return (out-iout) / (AY8910_OUTPUT_STEREO ? 2 : 1);
+	assert(mix.n == 0);
+	return nsamples;
 }
-#endif
 
 void ay8910_reset(AY8910 *ay) {
 	memset(ay, 0, sizeof(*ay));
@@ -586,3 +333,85 @@ void ay8910_write_data(AY8910 *ay, uint8_t val) {
 		tracef("ay8910: unimplemented register write: 0x%x <- %02x\n", ay->addr, val);
 	}
 }
+
+/*********************************************************************
+ * RSP synthesizer
+ *
+ * The ucode (rsp_ay8910.S) runs every tick of the chip, processing the
+ * three tone channels, the noise and the envelope counters in parallel,
+ * one per vector lane. The noise LFSR and the envelope steps are handled
+ * by scalar code, only when their counter expires. Its output is bit-exact
+ * with #ay8910_gen.
+ *********************************************************************/
+
+void ay8910_rsp_state_reset(ay8910_rsp_state_t *state) {
+	memset(state, 0, sizeof(*state));
+	state->noise = 1;
+}
+
+void ay8910_rsp_frame(AY8910 *ay, ay8910_rsp_frame_t *frame, int nsamples, bool env_restart) {
+	memset(frame, 0, sizeof(*frame));
+	frame->nsamples = nsamples;
+
+	for (int c=0; c<3; c++) {
+		AYChannel *ch = &ay->ch[c];
+		frame->period[c] = ch->tone_period;
+		// Period == 1 is ultrasonic, ignore it (see ay8910_gen)
+		if (ch->tone_period != 1) frame->count_mask |= 1 << c;
+		if (ch->tone_en)  frame->tone_dis |= 1 << c;
+		if (ch->noise_en) frame->noise_dis |= 1 << c;
+		if (ch->tone_vol & 0x10) frame->env_mask |= 1 << c;
+		frame->vol[c] = ch->tone_vol & 0xF;
+	}
+
+	frame->period[3] = ay->ns.period;
+	frame->period[4] = ay->env.period;
+	if (frame->noise_dis != 0x7)
+		frame->count_mask |= 1 << 3;
+	if (frame->env_mask && ay->env.period != 1)
+		frame->count_mask |= 1 << 4;
+
+	if (env_restart) {
+		frame->env_restart = AY8910_RSP_ENV_RESTART;
+		if (ay->env.attack)    frame->env_restart |= AY8910_RSP_ENV_ATTACK;
+		if (ay->env.alternate) frame->env_restart |= AY8910_RSP_ENV_ALTERNATE;
+		if (ay->env.hold)      frame->env_restart |= AY8910_RSP_ENV_HOLD;
+	}
+}
+
+#ifdef N64
+
+DEFINE_RSP_UCODE(rsp_ay8910);
+
+/** @brief Overlay ID of the AY8910 ucode (0 if not registered yet) */
+static uint32_t ay8910_overlay_id;
+
+void rsp_ay8910_init(void) {
+	if (!ay8910_overlay_id)
+		ay8910_overlay_id = rspq_overlay_register(&rsp_ay8910);
+}
+
+void rsp_ay8910_close(void) {
+	if (ay8910_overlay_id) {
+		rspq_overlay_unregister(ay8910_overlay_id);
+		ay8910_overlay_id = 0;
+	}
+}
+
+void rsp_ay8910_synth(const ay8910_rsp_frame_t *frame, ay8910_rsp_state_t *state, int16_t *out) {
+	assertf(ay8910_overlay_id, "rsp_ay8910_init() not called");
+	assertf(frame->nsamples > 0, "invalid number of samples: %d", frame->nsamples);
+	assertf(((uint32_t)out & 3) == 0, "output buffer must be 4-byte aligned: %p", out);
+	assertf(((uint32_t)state & 15) == 0, "state must be 16-byte aligned: %p", state);
+
+	rspq_write(ay8910_overlay_id, 0x0,
+		frame->nsamples | frame->env_restart << 16,
+		PhysicalAddr(state),
+		PhysicalAddr(out),
+		frame->period[0] << 16 | frame->period[1],
+		frame->period[2] << 16 | frame->period[3],
+		frame->period[4] << 16 | frame->noise_dis << 12 | frame->tone_dis << 8 | frame->count_mask,
+		frame->env_mask << 12 | frame->vol[2] << 8 | frame->vol[1] << 4 | frame->vol[0]);
+}
+
+#endif /* N64 */
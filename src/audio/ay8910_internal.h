@@ -0,0 +1,99 @@
+#ifndef LIBDRAGON_AUDIO_AY8910_INTERNAL_H
+#define LIBDRAGON_AUDIO_AY8910_INTERNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ay8910.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Envelope flag: hold at the end of the first cycle */
+#define AY8910_RSP_ENV_HOLD         0x01
+/** @brief Envelope flag: alternate attack and release */
+#define AY8910_RSP_ENV_ALTERNATE    0x02
+/** @brief Envelope flag: the envelope is currently holding */
+#define AY8910_RSP_ENV_HOLDING      0x04
+/** @brief Envelope flag: the envelope starts with an attack (only in #ay8910_rsp_frame_t::env_restart) */
+#define AY8910_RSP_ENV_ATTACK       0x04
+/** @brief Restart the envelope (only in #ay8910_rsp_frame_t::env_restart) */
+#define AY8910_RSP_ENV_RESTART      0x80
+
+/**
+ * @brief Internal state of the RSP synthesizer.
+ *
+ * The state uses the same lane layout of the ucode: lanes 0-2 are the
+ * three tone channels, lane 3 is the noise generator and lane 4 is the
+ * envelope. It must live in RDRAM (uncached), as it is read and written
+ * back by the RSP for each frame.
+ */
+typedef struct __attribute__((aligned(16))) {
+	int16_t count[8];           ///< Tick counters of each lane
+	int16_t out[8];             ///< Output of the tone channels (0 or -1)
+	uint32_t noise;             ///< Noise generator (17-bit LFSR)
+	int16_t env_step;           ///< Current step of the envelope
+	uint8_t env_attack;         ///< 0x0 if in attack, 0xF if in the release
+	uint8_t env_flags;          ///< Envelope flags (AY8910_RSP_ENV_HOLD, etc.)
+} ay8910_rsp_state_t;
+
+_Static_assert(sizeof(ay8910_rsp_state_t) == 48, "invalid ay8910_rsp_state_t size");
+
+/**
+ * @brief Configuration of the AY8910 for a register frame.
+ *
+ * This is a snapshot of the registers of the chip, preprocessed in the
+ * format expected by the ucode. See #ay8910_rsp_frame.
+ */
+typedef struct {
+	uint16_t period[5];         ///< Periods (in ticks) of tones, noise and envelope
+	uint16_t nsamples;          ///< Number of output samples to generate
+	uint8_t count_mask;         ///< Lanes whose counters are running
+	uint8_t tone_dis;           ///< Channels whose tone is disabled (bitmask)
+	uint8_t noise_dis;          ///< Channels whose noise is disabled (bitmask)
+	uint8_t env_mask;           ///< Channels whose volume follows the envelope (bitmask)
+	uint8_t vol[3];             ///< Fixed volume of each channel (0-15)
+	uint8_t env_restart;        ///< If not 0, restart the envelope with these flags (AY8910_RSP_ENV_RESTART, etc.)
+} ay8910_rsp_frame_t;
+
+/** @brief Reset the state of the RSP synthesizer */
+void ay8910_rsp_state_reset(ay8910_rsp_state_t *state);
+
+/**
+ * @brief Prepare a register frame for the RSP synthesizer.
+ *
+ * @param ay            AY8910 emulator, with the registers of the frame already written
+ * @param frame         Output frame
+ * @param nsamples      Number of (decimated) samples to generate
+ * @param env_restart   True if the envelope shape register was written in this frame
+ */
+void ay8910_rsp_frame(AY8910 *ay, ay8910_rsp_frame_t *frame, int nsamples, bool env_restart);
+
+#ifdef N64
+
+/** @brief Register the RSP ucode for AY8910 synthesis (if not done yet) */
+void rsp_ay8910_init(void);
+
+/** @brief Unregister the RSP ucode for AY8910 synthesis */
+void rsp_ay8910_close(void);
+
+/**
+ * @brief Synthesize a register frame using the RSP.
+ *
+ * The command is enqueued in the current RSP queue. The frame is copied
+ * into the command itself, so the caller can immediately reuse it; many
+ * frames can thus be enqueued back-to-back in a single batch.
+ *
+ * @param frame     Register frame
+ * @param state     Synthesizer state (uncached, see #ay8910_rsp_state_t)
+ * @param out       Output buffer (frame->nsamples stereo samples, 4-byte aligned)
+ */
+void rsp_ay8910_synth(const ay8910_rsp_frame_t *frame, ay8910_rsp_state_t *state, int16_t *out);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
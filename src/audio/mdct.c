@@ -0,0 +1,376 @@
+/**
+ * @file mdct.c
+ * @brief MDCT audio codec (used by WAV64)
+ * @ingroup mixer
+ *
+ * This file contains the portable part of the MDCT codec used by WAV64
+ * (#WAV64_FORMAT_MDCT): the bitstream parsing and dequantization, which
+ * runs on the CPU, and a bit-exact reference implementation of the IMDCT
+ * that is normally run by the RSP (rsp_mdct.S).
+ *
+ * The same code is also compiled into audioconv64, which uses it to
+ * keep the encoder in sync with the decoder.
+ *
+ * Each frame is made by MDCT_FRAME_SIZE coefficients per channel, which
+ * are split into #MDCT_NUM_BANDS bands. The bitstream of a frame is:
+ *
+ *  * Global allocation level (#MDCT_ALLOC_BITS bits).
+ *  * Scalefactor of the first band (#MDCT_SF_BITS bits), then the delta of
+ *    each following band scalefactor, using a small prefix code:
+ *    "0" = same, "10s" = +/-1, "110sm" = +/-2 or +/-3, "111" followed by
+ *    the absolute value (#MDCT_SF_BITS bits).
+ *  * The quantized coefficients of each band, using the number of bits
+ *    calculated by #mdct_band_bits.
+ *
+ * Each scalefactor step is 3 dB (the amplitude of the band is 2^(sf/2)).
+ * Bands that get no bits but are not silent are filled with noise at
+ * the band level.
+ */
+
+#include "mdct_internal.h"
+#include <string.h>
+
+#ifdef N64
+#include "rspq.h"
+#include "n64sys.h"
+#include "debug.h"
+#endif
+
+/** @brief Maximum L2 norm of a record, to avoid overflows in the fixed point FFT */
+#define MDCT_RECORD_MAX_NORM     31000
+
+/** @brief Quantization level used for noise filling (4.12) */
+#define MDCT_NOISE_STEP          2458
+
+/** @brief Clamp a value to the 16-bit signed range */
+static inline int16_t clamp16(int64_t x) {
+	if (x > 32767) return 32767;
+	if (x < -32768) return -32768;
+	return x;
+}
+
+const mdct_tables_t mdct_tables = {
+	.dft8_cos = {
+		{  11585, 11585, 11585, 11585, 11585, 11585, 11585, 11585 },
+		{  11585,  8192,     0, -8192,-11585, -8192,     0,  8192 },
+		{  11585,     0,-11585,     0, 11585,     0,-11585,     0 },
+		{  11585, -8192,     0,  8192,-11585,  8192,     0, -8192 },
+		{  11585,-11585, 11585,-11585, 11585,-11585, 11585,-11585 },
+		{  11585, -8192,     0,  8192,-11585,  8192,     0, -8192 },
+		{  11585,     0,-11585,     0, 11585,     0,-11585,     0 },
+		{  11585,  8192,     0, -8192,-11585, -8192,     0,  8192 },
+	},
+	.dft8_sin = {
+		{      0,     0,     0,     0,     0,     0,     0,     0 },
+		{      0,  8192, 11585,  8192,     0, -8192,-11585, -8192 },
+		{      0, 11585,     0,-11585,     0, 11585,     0,-11585 },
+		{      0,  8192,-11585,  8192,     0, -8192, 11585, -8192 },
+		{      0,     0,     0,     0,     0,     0,     0,     0 },
+		{      0, -8192, 11585, -8192,     0,  8192,-11585,  8192 },
+		{      0,-11585,     0, 11585,     0,-11585,     0, 11585 },
+		{      0, -8192,-11585, -8192,     0,  8192, 11585,  8192 },
+	},
+	.tw_cos = {
+		{  32767, 32757, 32728, 32678, 32609, 32521, 32412, 32285 },
+		{  32767, 32521, 31785, 30571, 28898, 26790, 24279, 21403 },
+		{  32767, 31971, 29621, 25832, 20787, 14732,  7962,   804 },
+		{  32767, 31113, 26319, 18868,  9512,  -804,-11039,-20159 },
+		{  32767, 29956, 22005, 10278, -3212,-16151,-26319,-31971 },
+		{  32767, 28510, 16846,   804,-15446,-27683,-32728,-29268 },
+		{  32767, 26790, 11039, -8739,-25329,-32678,-28105,-13279 },
+		{  32767, 24811,  4808,-17530,-31356,-29956,-14010,  8739 },
+	},
+	.tw_sin = {
+		{      0,   804,  1608,  2410,  3212,  4011,  4808,  5602 },
+		{      0,  4011,  7962, 11793, 15446, 18868, 22005, 24811 },
+		{      0,  7179, 14010, 20159, 25329, 29268, 31785, 32757 },
+		{      0, 10278, 19519, 26790, 31356, 32757, 30852, 25832 },
+		{      0, 13279, 24279, 31113, 32609, 28510, 19519,  7179 },
+		{      0, 16151, 28105, 32757, 28898, 17530,  1608,-14732 },
+		{      0, 18868, 30852, 31580, 20787,  2410,-16846,-29956 },
+		{      0, 21403, 32412, 27683,  9512,-13279,-29621,-31580 },
+	},
+	.fft_cos = {
+		{  11585, 11585, 11585, 11585, 11585, 11585, 11585, 11585 },
+		{  11362,  6436, -2260, -9632,-11362, -6436,  2260,  9632 },
+		{  10703, -4433,-10703,  4433, 10703, -4433,-10703,  4433 },
+		{   9632,-11362,  6436,  2260, -9632, 11362, -6436, -2260 },
+		{   8192, -8192,  8192, -8192,  8192, -8192,  8192, -8192 },
+		{   6436,  2260, -9632, 11362, -6436, -2260,  9632,-11362 },
+		{   4433, 10703, -4433,-10703,  4433, 10703, -4433,-10703 },
+		{   2260,  9632, 11362,  6436, -2260, -9632,-11362, -6436 },
+	},
+	.fft_sin = {
+		{      0,     0,     0,     0,     0,     0,     0,     0 },
+		{   2260,  9632, 11362,  6436, -2260, -9632,-11362, -6436 },
+		{   4433, 10703, -4433,-10703,  4433, 10703, -4433,-10703 },
+		{   6436,  2260, -9632, 11362, -6436, -2260,  9632,-11362 },
+		{   8192, -8192,  8192, -8192,  8192, -8192,  8192, -8192 },
+		{   9632,-11362,  6436,  2260, -9632, 11362, -6436, -2260 },
+		{  10703, -4433,-10703,  4433, 10703, -4433,-10703,  4433 },
+		{  11362,  6436, -2260, -9632,-11362, -6436,  2260,  9632 },
+	},
+	.win = {
+		// w[2*j]
+		{    201,  1005,  1809,  2611,  3412,  4210,  5007,  5800,  6590,  7375,  8157,  8933,  9704, 10469, 11228, 11980,
+		   12725, 13462, 14191, 14912, 15623, 16325, 17018, 17700, 18371, 19032, 19680, 20317, 20942, 21554, 22154, 22739 },
+		// w[127-2*j]
+		{  32766, 32752, 32717, 32663, 32589, 32495, 32382, 32250, 32098, 31926, 31736, 31526, 31297, 31050, 30783, 30498,
+		   30195, 29874, 29534, 29177, 28803, 28411, 28001, 27575, 27133, 26674, 26198, 25708, 25201, 24680, 24143, 23592 },
+		// w[63-2*j]
+		{  23027, 22448, 21856, 21250, 20631, 20000, 19357, 18703, 18037, 17360, 16673, 15976, 15269, 14553, 13828, 13094,
+		   12353, 11605, 10849, 10087,  9319,  8545,  7767,  6983,  6195,  5404,  4609,  3811,  3012,  2210,  1407,   603 },
+		// w[64+2*j]
+		{  23311, 23870, 24413, 24942, 25456, 25955, 26438, 26905, 27356, 27790, 28208, 28609, 28992, 29358, 29706, 30037,
+		   30349, 30643, 30919, 31176, 31414, 31633, 31833, 32014, 32176, 32318, 32441, 32545, 32628, 32692, 32737, 32761 },
+	},
+};
+
+const uint8_t mdct_band_start[MDCT_NUM_BANDS+1] = {
+	0, 4, 8, 12, 16, 20, 24, 28, 32, 40, 48, 56, 64, 80, 96, 112, 128
+};
+
+const uint16_t mdct_quant_step[MDCT_MAX_BITS+1] = {
+	0, 3269, 5014, 2400, 1373, 770, 426, 233, 126
+};
+
+/** @brief Bit allocation bias of each band (favors lower frequencies) */
+static const int8_t mdct_band_tilt[MDCT_NUM_BANDS] = {
+	3, 3, 3, 3, 3, 3, 2, 2, 2, 2, 1, 1, 0, 0, -1, -2
+};
+
+void mdct_band_bits(int alloc, const uint8_t *sf, uint8_t *bits)
+{
+	for (int b=0; b<MDCT_NUM_BANDS; b++) {
+		int v = sf[b] + alloc - 64 + mdct_band_tilt[b];
+		if (sf[b] == 0 || v <= 0)
+			bits[b] = 0;
+		else
+			bits[b] = v/2 < MDCT_MAX_BITS ? v/2 : MDCT_MAX_BITS;
+	}
+}
+
+int32_t mdct_dequant(int q, int step, int sf)
+{
+	// Amplitude of the band is 2^(sf/2). Calculate it with a 2.14 mantissa.
+	int64_t v = (int64_t)q * step * ((sf & 1) ? 23170 : 16384);
+	int shift = sf >> 1;
+	if (shift >= 26)
+		v <<= shift - 26;
+	else
+		v = (v + (1 << (25 - shift))) >> (26 - shift);
+	if (v > (1<<26)) v = 1<<26;
+	if (v < -(1<<26)) v = -(1<<26);
+	return v;
+}
+
+/** @brief Simple MSB-first bit reader */
+typedef struct {
+	const uint8_t *src;     ///< Compressed data
+	int nbits;              ///< Number of available bits
+	int pos;                ///< Current bit position
+} bitreader_t;
+
+static uint32_t br_read(bitreader_t *br, int n)
+{
+	uint32_t v = 0;
+	while (n--) {
+		int bit = 0;
+		if (br->pos < br->nbits)
+			bit = (br->src[br->pos >> 3] >> (7 - (br->pos & 7))) & 1;
+		v = (v << 1) | bit;
+		br->pos++;
+	}
+	return v;
+}
+
+int mdct_unpack_frame(const uint8_t *src, int nbytes, uint32_t seed, mdct_record_t *rec)
+{
+	bitreader_t br = { .src = src, .nbits = nbytes*8 };
+	uint8_t sf[MDCT_NUM_BANDS], bits[MDCT_NUM_BANDS];
+	int32_t coeffs[MDCT_FRAME_SIZE];
+
+	// Read the global allocation level and the scalefactors
+	int alloc = br_read(&br, MDCT_ALLOC_BITS);
+	sf[0] = br_read(&br, MDCT_SF_BITS);
+	for (int b=1; b<MDCT_NUM_BANDS; b++) {
+		int v = sf[b-1];
+		if (br_read(&br, 1)) {
+			if (!br_read(&br, 1))
+				v += br_read(&br, 1) ? -1 : 1;
+			else if (!br_read(&br, 1)) {
+				int neg = br_read(&br, 1);
+				int mag = 2 + br_read(&br, 1);
+				v += neg ? -mag : mag;
+			} else
+				v = br_read(&br, MDCT_SF_BITS);
+		}
+		sf[b] = v & ((1 << MDCT_SF_BITS) - 1);
+	}
+
+	// Dequantize the coefficients
+	mdct_band_bits(alloc, sf, bits);
+	for (int b=0; b<MDCT_NUM_BANDS; b++) {
+		int nb = bits[b];
+		for (int k=mdct_band_start[b]; k<mdct_band_start[b+1]; k++) {
+			if (nb >= 2) {
+				int q = br_read(&br, nb) - ((1 << (nb-1)) - 1);
+				coeffs[k] = mdct_dequant(q, mdct_quant_step[nb], sf[b]);
+			} else if (nb == 1) {
+				int q = br_read(&br, 1) ? -1 : 1;
+				coeffs[k] = mdct_dequant(q, mdct_quant_step[1], sf[b]);
+			} else if (sf[b]) {
+				// Noise filling
+				seed = seed * 1664525 + 1013904223;
+				coeffs[k] = mdct_dequant((seed >> 31) ? -1 : 1, MDCT_NOISE_STEP, sf[b]);
+			} else {
+				coeffs[k] = 0;
+			}
+		}
+	}
+
+	// Select the gain exponent so that the fixed point FFT cannot overflow.
+	// The FFT is scaled by 1/sqrt(8) on each pass, so its outputs are
+	// bounded by the L2 norm of the inputs. The pre-rotation preserves
+	// the norm, so we can calculate it directly on the coefficients.
+	uint64_t energy = 0;
+	for (int k=0; k<MDCT_FRAME_SIZE; k++)
+		energy += (int64_t)coeffs[k] * coeffs[k];
+	int gain = 0;
+	while (gain < MDCT_MAX_GAIN && energy > ((uint64_t)MDCT_RECORD_MAX_NORM * MDCT_RECORD_MAX_NORM) << (2*(gain+3)))
+		gain++;
+
+	// Fold the coefficients into complex values and pre-rotate them by
+	// exp(-i*pi*(n+1/4)/N). Notice that the rotation factors are
+	// the same values of the sine window at even positions.
+	int shift = 15 + gain + 3;
+	for (int n=0; n<64; n++) {
+		int64_t c = n < 32 ? mdct_tables.win[1][n] : mdct_tables.win[2][n-32];
+		int64_t s = n < 32 ? mdct_tables.win[0][n] : mdct_tables.win[3][n-32];
+		int64_t a = coeffs[2*n], b = coeffs[MDCT_FRAME_SIZE-1-2*n];
+		int64_t zr = a*c + b*s;
+		int64_t zi = b*c - a*s;
+		int idx = (n & 7) * 8 + (n >> 3);
+		rec->re[idx] = clamp16((zr + (1LL << (shift-1))) >> shift);
+		rec->im[idx] = clamp16((zi + (1LL << (shift-1))) >> shift);
+	}
+
+	return gain;
+}
+
+/** @brief Emulation of VMULF/VMACF: sum of products of 1.15 values, rounded */
+static inline int16_t fmac(int64_t acc) {
+	return clamp16((acc + 0x8000) >> 16);
+}
+
+/** @brief Emulation of VMULF followed by VMUDH (multiply by window and gain) */
+static inline int16_t wmul(int16_t x, int16_t w, int16_t g) {
+	return clamp16((int32_t)fmac(2 * x * w) * g);
+}
+
+void mdct_imdct(const mdct_record_t *rec, int gain, int16_t *state, int16_t *out, int stride)
+{
+	const mdct_tables_t *t = &mdct_tables;
+	int16_t br[8][8], bi[8][8], bnr[8][8];
+	int16_t yr[8][8], yi[8][8];
+	int16_t g = 1 << gain;
+
+	// First pass: 8-point DFTs on the columns, followed by the twiddle factors
+	for (int n1=0; n1<8; n1++) {
+		const int16_t *a = &rec->re[n1*8];
+		const int16_t *b = &rec->im[n1*8];
+		for (int k2=0; k2<8; k2++) {
+			int64_t accr = 0, acci = 0;
+			for (int n2=0; n2<8; n2++) {
+				accr += 2 * a[n2] * t->dft8_cos[n2][k2] + 2 * b[n2] * t->dft8_sin[n2][k2];
+				acci += 2 * b[n2] * t->dft8_cos[n2][k2] + 2 * a[n2] * t->dft8_sin[(8-n2) & 7][k2];
+			}
+			int16_t r = fmac(accr), i = fmac(acci), nr = clamp16(-r);
+			br[n1][k2] = fmac(2 * r * t->tw_cos[n1][k2] + 2 * i * t->tw_sin[n1][k2]);
+			bi[n1][k2] = fmac(2 * i * t->tw_cos[n1][k2] + 2 * nr * t->tw_sin[n1][k2]);
+			bnr[n1][k2] = clamp16(-br[n1][k2]);
+		}
+	}
+
+	// Second pass: 8-point DFTs on the rows, including the post-rotation
+	for (int k1=0; k1<8; k1++) {
+		for (int k2=0; k2<8; k2++) {
+			int64_t accr = 0, acci = 0;
+			for (int n1=0; n1<8; n1++) {
+				accr += 2 * br[n1][k2] * t->fft_cos[k1][n1] + 2 * bi[n1][k2] * t->fft_sin[k1][n1];
+				acci += 2 * bi[n1][k2] * t->fft_cos[k1][n1] + 2 * bnr[n1][k2] * t->fft_sin[k1][n1];
+			}
+			yr[k1][k2] = fmac(accr);
+			yi[k1][k2] = fmac(acci);
+		}
+	}
+
+	// Unfold the DCT-IV output, window and overlap-add with the previous frame.
+	// The state is made of four blocks of 32 samples (A,B,C,D), each one
+	// being the windowed contribution of this frame to the next one.
+	int16_t *sA = state, *sB = state+32, *sC = state+64, *sD = state+96;
+	const int16_t *P = t->win[0], *Q = t->win[1], *R = t->win[2], *S = t->win[3];
+	for (int k1=0; k1<8; k1++) {
+		for (int k2=0; k2<8; k2++) {
+			int16_t re = yr[k1][k2], im = yi[k1][k2];
+			int16_t nre = clamp16(-re), nim = clamp16(-im);
+			if (k1 >= 4) {
+				int j = (k1-4)*8 + k2;
+				out[(2*j)*stride]                   = clamp16(wmul(re, P[j], g) + sA[j]);
+				out[(MDCT_FRAME_SIZE-1-2*j)*stride] = clamp16(wmul(nre, Q[j], g) + sB[j]);
+				sA[j] = wmul(im, Q[j], g);
+				sB[j] = wmul(im, P[j], g);
+			} else {
+				int r = k1*8 + k2;
+				out[(MDCT_FRAME_SIZE/2-1-2*r)*stride] = clamp16(wmul(nim, R[r], g) + sC[r]);
+				out[(MDCT_FRAME_SIZE/2+2*r)*stride]   = clamp16(wmul(im, S[r], g) + sD[r]);
+				sC[r] = wmul(nre, S[r], g);
+				sD[r] = wmul(nre, R[r], g);
+			}
+		}
+	}
+}
+
+#ifdef N64
+
+DEFINE_RSP_UCODE(rsp_mdct);
+
+/** @brief Overlay ID of the MDCT ucode (0 if not registered yet) */
+static uint32_t mdct_overlay_id;
+
+void rsp_mdct_init(void)
+{
+	if (!mdct_overlay_id)
+		mdct_overlay_id = rspq_overlay_register(&rsp_mdct);
+}
+
+void rsp_mdct_close(void)
+{
+	if (mdct_overlay_id) {
+		rspq_overlay_unregister(mdct_overlay_id);
+		mdct_overlay_id = 0;
+	}
+}
+
+void rsp_mdct_decompress(mdct_record_t *records, const uint8_t *gains, int16_t *output,
+	bool stereo, int nframes, int16_t *state)
+{
+	int nrecords = nframes * (stereo ? 2 : 1);
+	assertf(mdct_overlay_id, "rsp_mdct_init() not called");
+	assertf(nframes > 0 && nrecords <= MDCT_RSP_MAX_RECORDS, "invalid number of frames: %d", nframes);
+
+	// Gains are passed within the command (4 bits each), so that
+	// the caller can immediately reuse the buffer.
+	uint32_t g[MDCT_RSP_MAX_RECORDS/8] = {0};
+	for (int i=0; i<nrecords; i++)
+		g[i/8] |= gains[i] << (28 - 4*(i%8));
+
+	rspq_write(mdct_overlay_id, 0x0,
+		PhysicalAddr(records),
+		PhysicalAddr(output) | (nframes-1) << 24,
+		PhysicalAddr(state)  | (stereo ? 1 : 0) << 31,
+		PhysicalAddr(&mdct_tables),
+		g[0], g[1], g[2], g[3]);
+}
+
+#endif /* N64 */
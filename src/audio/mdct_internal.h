@@ -0,0 +1,163 @@
+#ifndef LIBDRAGON_AUDIO_MDCT_INTERNAL_H
+#define LIBDRAGON_AUDIO_MDCT_INTERNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Number of new samples (per channel) produced by each MDCT frame.
+ *
+ * Each frame spans 2*MDCT_FRAME_SIZE samples with a sine window, and
+ * overlaps by half with the previous and next frames.
+ */
+#define MDCT_FRAME_SIZE         128
+/** @brief Number of bands in which the MDCT spectrum is split for quantization */
+#define MDCT_NUM_BANDS          16
+/** @brief Maximum number of bits used to quantize a single coefficient */
+#define MDCT_MAX_BITS           8
+/** @brief Number of bits used to store the global bit allocation level of a frame */
+#define MDCT_ALLOC_BITS         6
+/** @brief Number of bits used to store an absolute scalefactor */
+#define MDCT_SF_BITS            6
+/** @brief Maximum value of the gain exponent of a record */
+#define MDCT_MAX_GAIN           14
+
+/**
+ * @brief Input record for the IMDCT of one channel of one frame.
+ *
+ * The MDCT spectrum is folded into 64 complex values, pre-rotated and
+ * scaled so that they fit 16-bit fixed point (see #mdct_unpack_frame).
+ * The values are stored in the order expected by the first pass of the
+ * 64-point FFT (8x8 decomposition): re[n1*8+n2] is the real part
+ * of the input value at index n1+8*n2.
+ *
+ * A record has exactly the same size as the output samples it decodes
+ * to (per channel), so that it can be decoded in-place.
+ */
+typedef struct {
+	int16_t re[64];     ///< Real parts
+	int16_t im[64];     ///< Imaginary parts
+} mdct_record_t;
+
+_Static_assert(sizeof(mdct_record_t) == MDCT_FRAME_SIZE*2, "invalid mdct_record_t size");
+
+/**
+ * @brief Constant tables used by the IMDCT.
+ *
+ * These are used by both the RSP ucode (which loads them via DMA) and
+ * the reference C implementation, so that there is a single source of
+ * truth for the bit-exact results.
+ */
+typedef struct __attribute__((aligned(16))) {
+	int16_t dft8_cos[8][8];     ///< First pass: cos(2*pi*n2*k2/8) / sqrt(8), indexed by [n2][k2]
+	int16_t dft8_sin[8][8];     ///< First pass: sin(2*pi*n2*k2/8) / sqrt(8), indexed by [n2][k2]
+	int16_t tw_cos[8][8];       ///< Twiddle factors (real), indexed by [n1][k2]
+	int16_t tw_sin[8][8];       ///< Twiddle factors (imaginary), indexed by [n1][k2]
+	int16_t fft_cos[8][8];      ///< Second pass (with post-rotation), indexed by [k1][n1]
+	int16_t fft_sin[8][8];      ///< Second pass (with post-rotation), indexed by [k1][n1]
+	int16_t win[4][32];         ///< Sine window, in the four orders used by the unfolding
+} mdct_tables_t;
+
+_Static_assert(sizeof(mdct_tables_t) == 1024, "invalid mdct_tables_t size");
+
+/** @brief IMDCT constant tables */
+extern const mdct_tables_t mdct_tables;
+
+/** @brief First coefficient of each band (plus one sentinel at the end) */
+extern const uint8_t mdct_band_start[MDCT_NUM_BANDS+1];
+
+/** @brief Quantization step (in units of the band scalefactor, 4.12) for each bit count */
+extern const uint16_t mdct_quant_step[MDCT_MAX_BITS+1];
+
+/**
+ * @brief Calculate the number of bits used for each band.
+ *
+ * This is shared between the encoder and the decoder as the allocation
+ * is implicit in the bitstream: it only depends on the global allocation
+ * level of the frame and on the scalefactors.
+ *
+ * @param alloc     Global allocation level (0..63)
+ * @param sf        Scalefactors of each band (0 = silent band)
+ * @param bits      Output: number of bits per coefficient, for each band
+ */
+void mdct_band_bits(int alloc, const uint8_t *sf, uint8_t *bits);
+
+/**
+ * @brief Dequantize a coefficient.
+ *
+ * @param q         Quantized value (signed)
+ * @param step      Quantization step (4.12, see #mdct_quant_step)
+ * @param sf        Scalefactor of the band
+ * @return          The MDCT coefficient
+ */
+int32_t mdct_dequant(int q, int step, int sf);
+
+/**
+ * @brief Unpack a compressed frame into an IMDCT input record.
+ *
+ * This function parses the bitstream of one channel of one frame,
+ * dequantizes the coefficients and prepares the pre-rotated record
+ * for the IMDCT.
+ *
+ * @param src       Compressed frame data
+ * @param nbytes    Size of the compressed frame
+ * @param seed      Seed for the noise filling (frame index and channel)
+ * @param rec       Output record
+ * @return          The gain exponent of the record (0..MDCT_MAX_GAIN)
+ */
+int mdct_unpack_frame(const uint8_t *src, int nbytes, uint32_t seed, mdct_record_t *rec);
+
+/**
+ * @brief Reference implementation of the IMDCT.
+ *
+ * This is a bit-exact C implementation of the RSP ucode (rsp_mdct.S).
+ * It runs the inverse transform, applies the window and the overlap-add
+ * with the state of the previous frame, generating MDCT_FRAME_SIZE samples.
+ *
+ * @param rec       Input record
+ * @param gain      Gain exponent of the record
+ * @param state     Overlap-add state (MDCT_FRAME_SIZE samples), updated
+ * @param out       Output samples
+ * @param stride    Distance between two output samples (1 = mono, 2 = stereo)
+ */
+void mdct_imdct(const mdct_record_t *rec, int gain, int16_t *state, int16_t *out, int stride);
+
+#ifdef N64
+
+/** @brief Maximum number of records (frames * channels) that can be decoded by a single RSP command */
+#define MDCT_RSP_MAX_RECORDS    32
+
+/** @brief Register the RSP ucode for MDCT decompression (if not done yet) */
+void rsp_mdct_init(void);
+
+/** @brief Unregister the RSP ucode for MDCT decompression */
+void rsp_mdct_close(void);
+
+/**
+ * @brief Decode a batch of frames using the RSP.
+ *
+ * The command is enqueued in the current RSP queue. Records are decoded
+ * in-place: each record is overwritten by its output samples (interleaved
+ * in case of stereo), so @p records and @p output can be the same buffer.
+ *
+ * @param records   Input records (nframes * channels), 8-byte aligned
+ * @param gains     Gain exponents of the records
+ * @param output    Output buffer for samples, 8-byte aligned
+ * @param stereo    True if the records are stereo (interleaved per frame)
+ * @param nframes   Number of frames to decode
+ * @param state     Overlap-add state (MDCT_FRAME_SIZE samples per channel)
+ */
+void rsp_mdct_decompress(mdct_record_t *records, const uint8_t *gains, int16_t *output,
+	bool stereo, int nframes, int16_t *state);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
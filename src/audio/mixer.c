@@ -451,6 +451,38 @@ bool mixer_ch_playing(int ch) {
 	return c->ptr != 0;
 }
 
+void mixer_ch_update_batch(int first_ch, int num_channels, const mixer_ch_update_t *updates) {
+	assertf(first_ch >= 0 && first_ch + num_channels <= Mixer.num_channels,
+		"mixer_ch_update_batch: invalid channel range %d-%d", first_ch, first_ch+num_channels-1);
+	float inv_rate = 1.0f / (float)Mixer.sample_rate;
+
+	for (int i=0; i<num_channels; i++) {
+		const mixer_ch_update_t *u = &updates[i];
+		uint32_t mask = u->mask;
+		if (!mask) continue;
+
+		int ch = first_ch + i;
+		mixer_channel_t *c = &Mixer.channels[ch];
+
+		if (mask & MIXER_UPDATE_WAVE)
+			mixer_ch_play(ch, u->wave);
+		if (mask & (MIXER_UPDATE_POS | MIXER_UPDATE_FREQ | MIXER_UPDATE_VOL))
+			assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_ch_update_batch: cannot update secondary stereo channel %d", ch);
+		if (mask & MIXER_UPDATE_POS)
+			c->pos = MIXER_FX64(u->pos) << (c->flags & CH_FLAGS_BPS_SHIFT);
+		if (mask & MIXER_UPDATE_FREQ) {
+			assertf(u->freq >= 0, "mixer_ch_update_batch: cannot set negative frequency on channel %d: %f", ch, u->freq);
+			c->step = MIXER_FX64(u->freq * inv_rate) << (c->flags & CH_FLAGS_BPS_SHIFT);
+		}
+		if (mask & MIXER_UPDATE_VOL) {
+			Mixer.lvol[ch] = MIXER_FX15(u->lvol);
+			Mixer.rvol[ch] = MIXER_FX15(u->rvol);
+		}
+		if (mask & MIXER_UPDATE_STOP)
+			mixer_ch_stop(ch);
+	}
+}
+
 void mixer_ch_set_limits(int ch, int max_bits, float max_frequency, int max_buf_sz) {
 	assert(max_bits == 0 || max_bits == 8 || max_bits == 16);
 	assert(max_frequency >= 0);
@@ -6,6 +6,7 @@
 
 #include "wav64.h"
 #include "wav64internal.h"
+#include "mdct_internal.h"
 #include "mixer.h"
 #include "mixer_internal.h"
 #include "dragonfs.h"
@@ -19,6 +20,7 @@
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <malloc.h>
 #include <errno.h>
 #include <limits.h>
 #include <stdalign.h>
@@ -147,6 +149,16 @@ static inline void rsp_vadpcm_decompress(void *input, int16_t *output, bool ster
 
 #endif /* VADPCM_REFERENCE_DECODER */
 
+/** @brief Runtime state of a MDCT-compressed WAV64 (allocated in uncached memory) */
+typedef struct {
+	int16_t state[2][MDCT_FRAME_SIZE];   ///< Overlap-add state of each channel (used by RSP)
+	mdct_record_t prime[2];              ///< Scratch buffer used to prime the state after a seek
+	uint8_t *input;                      ///< Staging buffer for the compressed frames (cached)
+	int frame_bytes;                     ///< Size of a compressed frame (per channel)
+	int num_frames;                      ///< Number of frames in the file
+	int current_frame;                   ///< Next frame to decode
+} wav64_mdct_t;
+
 void raw_waveform_read(samplebuffer_t *sbuf, int base_rom_addr, int wpos, int wlen, int bps) {
 	uint32_t rom_addr = base_rom_addr + (wpos << bps);
 	uint8_t* ram_addr = (uint8_t*)samplebuffer_append(sbuf, wlen);
@@ -251,6 +263,83 @@ static void waveform_vadpcm_read(void *ctx, samplebuffer_t *sbuf, int wpos, int
 		rspq_highpri_end();
 }
 
+/**
+ * @brief Decode a batch of MDCT frames, starting from the current one.
+ *
+ * The CPU parses the bitstream and writes the IMDCT input records directly
+ * into the output buffer; the RSP then decodes them in-place.
+ */
+static void mdct_decode_frames(wav64_t *wav, wav64_mdct_t *mstate, mdct_record_t *records, int16_t *output, int nframes) {
+	int nch = wav->wave.channels;
+	int fbytes = mstate->frame_bytes;
+	int nrecords = nframes * nch;
+
+	// Fetch compressed data. Frames past the end of the file can be requested
+	// because of rounding: they decode to silence.
+	int avail = MAX(0, MIN(nframes, mstate->num_frames - mstate->current_frame));
+	uint8_t *input = mstate->input;
+	uint32_t t0 = TICKS_READ();
+	data_cache_hit_writeback_invalidate(input, ROUND_UP(nrecords * fbytes, 16));
+	if (avail)
+		dma_read(input, wav->rom_addr + mstate->current_frame * nch * fbytes, avail * nch * fbytes);
+	__wav64_profile_dma += TICKS_READ() - t0;
+	memset(input + avail * nch * fbytes, 0, (nframes - avail) * nch * fbytes);
+
+	uint8_t gains[MDCT_RSP_MAX_RECORDS];
+	for (int i=0; i<nrecords; i++) {
+		int frame = mstate->current_frame + i / nch;
+		gains[i] = mdct_unpack_frame(input + i * fbytes, fbytes, frame*2 + i%nch, &records[i]);
+	}
+
+	rsp_mdct_decompress(records, gains, output, nch==2, nframes, mstate->state[0]);
+	mstate->current_frame += nframes;
+}
+
+static void waveform_mdct_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
+	wav64_t *wav = (wav64_t*)ctx;
+	wav64_mdct_t *mstate = (wav64_mdct_t*)wav->ext;
+	bool highpri = false;
+
+	if (seeking) {
+		assertf(wpos % MDCT_FRAME_SIZE == 0,
+			"wav64: seeking to %x not supported (MDCT)\n", wpos);
+
+		// The RSP might still be decoding a previous request using the state
+		// or the prime buffer, so wait for it before touching them.
+		rspq_highpri_sync();
+		memset(mstate->state, 0, sizeof(mstate->state));
+
+		// Frame N covers blocks N-1 and N: decode it just to prime the
+		// overlap-add state, and discard its output.
+		mstate->current_frame = wpos / MDCT_FRAME_SIZE;
+		rspq_highpri_begin();
+		highpri = true;
+		mdct_decode_frames(wav, mstate, mstate->prime, (int16_t*)mstate->prime, 1);
+	}
+
+	wlen = ROUND_UP(wlen, MDCT_FRAME_SIZE);
+	int max_frames = MDCT_RSP_MAX_RECORDS / wav->wave.channels;
+	while (wlen > 0) {
+		int nframes = MIN(wlen / MDCT_FRAME_SIZE, max_frames);
+
+		// Acquire destination buffer from the sample buffer. The records
+		// have the same size of the decoded samples, so they are decoded in-place.
+		int16_t *dest = (int16_t*)samplebuffer_append(sbuf, nframes*MDCT_FRAME_SIZE);
+
+		// Switch to highpri as late as possible
+		if (!highpri) {
+			rspq_highpri_begin();
+			highpri = true;
+		}
+		mdct_decode_frames(wav, mstate, (mdct_record_t*)dest, dest, nframes);
+
+		wlen -= nframes*MDCT_FRAME_SIZE;
+	}
+
+	if (highpri)
+		rspq_highpri_end();
+}
+
 void wav64_open(wav64_t *wav, const char *fn) {
 	memset(wav, 0, sizeof(*wav));
 
@@ -306,6 +395,26 @@ void wav64_open(wav64_t *wav, const char *fn) {
 		assertf(head.loop_len == 0 || head.loop_len % 16 == 0, 
 			"wav64 %s: invalid loop length: %ld\n", fn, head.loop_len);
 	}	break;
+
+	case WAV64_FORMAT_MDCT: {
+		wav64_header_mdct_t mhead = {0};
+		dfs_read(&mhead, 1, sizeof(mhead), fh);
+		assertf(mhead.frame_size == MDCT_FRAME_SIZE,
+			"wav64 %s: unsupported MDCT frame size: %d\n", fn, mhead.frame_size);
+		assertf(head.loop_len == 0 || (head.len - head.loop_len) % MDCT_FRAME_SIZE == 0,
+			"wav64 %s: invalid loop length: %ld\n", fn, head.loop_len);
+
+		wav64_mdct_t *mstate = malloc_uncached(sizeof(wav64_mdct_t));
+		memset(mstate, 0, sizeof(*mstate));
+		mstate->frame_bytes = mhead.frame_bytes;
+		mstate->num_frames = mhead.num_frames;
+		mstate->input = memalign(16, ROUND_UP(MDCT_RSP_MAX_RECORDS * mhead.frame_bytes, 16));
+		rsp_mdct_init();
+
+		wav->ext = mstate;
+		wav->wave.read = waveform_mdct_read;
+		wav->wave.ctx = wav;
+	}	break;
 	
 	default:
 		assertf(0, "wav64 %s: invalid format: %02x\n", fn, head.format);
@@ -338,6 +447,8 @@ int wav64_get_bitrate(wav64_t *wav) {
 		switch (wav->format) {
 		case WAV64_FORMAT_VADPCM:
 			return wav->wave.frequency * wav->wave.channels * 72 / 16;
+		case WAV64_FORMAT_MDCT:
+			return wav->wave.frequency * wav->wave.channels * ((wav64_mdct_t*)wav->ext)->frame_bytes * 8 / MDCT_FRAME_SIZE;
 		}
 	}
 	return wav->wave.frequency * wav->wave.channels * wav->wave.bits;
@@ -350,6 +461,10 @@ void wav64_close(wav64_t *wav)
 		case WAV64_FORMAT_VADPCM:
 			free_uncached(wav->ext);
 			break;
+		case WAV64_FORMAT_MDCT:
+			free(((wav64_mdct_t*)wav->ext)->input);
+			free_uncached(wav->ext);
+			break;
 		}
 		wav->ext = NULL;
 	}
@@ -5,6 +5,7 @@
 #define WAV64_FILE_VERSION  2
 #define WAV64_FORMAT_RAW    0
 #define WAV64_FORMAT_VADPCM 1
+#define WAV64_FORMAT_MDCT   3
 
 /** @brief Header of a WAV64 file. */
 typedef struct __attribute__((packed)) {
@@ -37,6 +38,15 @@ typedef struct __attribute__((packed, aligned(8))) {
 	wav64_vadpcm_vector_t codebook[];	///< Codebook of the predictors
 } wav64_header_vadpcm_t;
 
+/** @brief Extended header for a WAV64 file with MDCT compression. */
+typedef struct __attribute__((packed)) {
+	uint16_t frame_size;				///< Number of samples per frame (MDCT_FRAME_SIZE)
+	uint16_t frame_bytes;				///< Size of a compressed frame (per channel)
+	uint32_t num_frames;				///< Number of frames in the file
+} wav64_header_mdct_t;
+
+_Static_assert(sizeof(wav64_header_mdct_t) == 8, "invalid wav64_header_mdct size");
+
 typedef struct samplebuffer_s samplebuffer_t;
 
 /**
@@ -11,25 +11,80 @@
 #include "libxm/xm_internal.h"
 #include <stdbool.h>
 
+/**
+ * @brief Source of the waveform data of a XM64 module.
+ * 
+ * Waveforms are streamed while playing via the mixer. Depending on where
+ * the XM64 module is stored, they are fetched in a different way: via PI DMA
+ * from ROM, via memcpy from a RAM buffer, or via buffered reads from a FILE
+ * for any other filesystem (eg: SD card).
+ */
+typedef struct xm64_source_s xm64_source_t;
+
+/** @brief Context of a waveform passed to the mixer read callback */
+typedef struct {
+	xm64_source_t *src;       ///< Source of the waveform data
+	xm_sample_t *samp;        ///< XM sample
+} xm64_wave_ctx_t;
+
+struct xm64_source_s {
+	/** @brief Read wlen samples starting at the specified byte offset into the sample buffer */
+	void (*read)(xm64_source_t *src, samplebuffer_t *sbuf, uint32_t offset, int wpos, int wlen, int bps);
+	uint32_t rom_addr;        ///< Base ROM address of the module (ROM source)
+	const uint8_t *buf;       ///< Module data (RAM source)
+	FILE *fh;                 ///< Handle used to stream waveforms (file source)
+	xm64_wave_ctx_t waves[];  ///< Context of each waveform
+};
+
+static void source_rom_read(xm64_source_t *src, samplebuffer_t *sbuf, uint32_t offset, int wpos, int wlen, int bps) {
+	raw_waveform_read(sbuf, src->rom_addr + offset, wpos, wlen, bps);
+}
+
+static void source_ram_read(xm64_source_t *src, samplebuffer_t *sbuf, uint32_t offset, int wpos, int wlen, int bps) {
+	uint8_t* ram_addr = (uint8_t*)samplebuffer_append(sbuf, wlen);
+	memcpy(ram_addr, src->buf + offset + (wpos << bps), wlen << bps);
+}
+
+static void source_file_read(xm64_source_t *src, samplebuffer_t *sbuf, uint32_t offset, int wpos, int wlen, int bps) {
+	uint8_t* ram_addr = (uint8_t*)samplebuffer_append(sbuf, wlen);
+	int bytes = wlen << bps;
+
+	fseek(src->fh, offset + (wpos << bps), SEEK_SET);
+	int n = fread(ram_addr, 1, bytes, src->fh);
+	// In case of a short read (truncated file), play silence rather than garbage.
+	if (n < bytes)
+		memset(ram_addr + n, 0, bytes - n);
+}
+
 static void wave_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
-	xm_sample_t *samp = (xm_sample_t*)ctx;
-	raw_waveform_read(sbuf, samp->data8_offset, wpos, wlen, samp->bits >> 4);
+	xm64_wave_ctx_t *wctx = (xm64_wave_ctx_t*)ctx;
+	xm_sample_t *samp = wctx->samp;
+	wctx->src->read(wctx->src, sbuf, samp->data8_offset, wpos, wlen, samp->bits >> 4);
 }
 
-static int tick(void *arg) {
-	xm64player_t *xmp = (xm64player_t*)arg;
+/** @brief Profile of CPU time spent in the XM64 tick, used for benchmarking purposes. */
+int64_t __xm64_profile_tick = 0;
+
+/** @brief Forget the state applied to the mixer channels (eg: after stopping them) */
+static void chstate_reset(xm64player_t *xmp) {
+	memset(xmp->chstate, 0, sizeof(xmp->chstate));
+}
+
+static int tick_internal(xm64player_t *xmp) {
 	xm_context_t *ctx = xmp->ctx;
 	int first_ch = xmp->first_ch;
+	float positions[ctx->module.num_channels];
 
 	for (int i=0;i<ctx->module.num_channels;i++) {
 		xm_channel_context_t *ch = &ctx->channels[i];
-		ch->sample_position = mixer_ch_get_pos(first_ch+i);
+		ch->sample_position = positions[i] = mixer_ch_get_pos(first_ch+i);
 	}
 
 	// If we're requested to stop playback, do it.
 	if (!xmp->playing || (!xmp->looping && ctx->loop_count > 0)) {
 		for (int i=0;i<ctx->module.num_channels;i++)
 			mixer_ch_stop(xmp->first_ch+i);
+		chstate_reset(xmp);
 		xmp->playing = false;
 		// Do not reschedule again
 		return 0;
@@ -43,15 +98,20 @@ static int tick(void *arg) {
 		// playing them.
 		for (int i=0;i<ctx->module.num_channels;i++)
 			mixer_ch_stop(first_ch+i);
+		chstate_reset(xmp);
 	}
 
 	assert(ctx->remaining_samples_in_tick <= 0);
 	xm_tick(ctx);
 
 	float gvol = ctx->global_volume * ctx->amplification;
+	mixer_ch_update_t updates[ctx->module.num_channels];
 
 	for (int i=0;i<ctx->module.num_channels;i++) {
 		xm_channel_context_t *ch = &ctx->channels[i];
+		mixer_ch_update_t *u = &updates[i];
+		u->mask = 0;
+
 		if (ch->sample) {
 			waveform_t *w = ch->sample->wave;
 
@@ -59,44 +119,68 @@ static int tick(void *arg) {
 			// control exposed via the xm.h API that we respect in case the
 			// user wants to mute some channels (usually for debugging).
 			bool muted = ch->muted || ch->instrument->muted;
-
-			// Play the waveform. Notice that the waveform might already
-			// be playing in this channel, in which case the play
-			// command only resets its position to 0, and keep the sample
+			float lvol = muted ? 0 : gvol * ch->actual_volume[0];
+			float rvol = muted ? 0 : gvol * ch->actual_volume[1];
+
+			// Most of the time, the same waveform keeps playing with the same
+			// parameters across ticks, so only send to the mixer what
+			// actually changed. If the waveform changed (or it finished
+			// playing), play it again: notice that the waveform might already
+			// be the last one played in this channel, in which case the play
+			// command only resets its position to 0, and keeps the sample
 			// buffer full, which is what we want.
-			// The mixer doesn't currently allow for mixer_ch_play() to keep
-			// the current position, but even if it did, xm_tick() might
-			// have changed it since last tick, because there is a XM effect
-			// to force the position in the sample. So it's better to
-			// set it every time with mixer_ch_set_pos.
-			mixer_ch_play(first_ch+i, w);
-			mixer_ch_set_pos(first_ch+i, ch->sample_position);
-
-			// Configure also frequency and volume that might have changed
-			// since last tick.
-			mixer_ch_set_freq(first_ch+i, ch->frequency);
-			mixer_ch_set_vol(first_ch+i,
-				muted ? 0 : gvol * ch->actual_volume[0],
-				muted ? 0 : gvol * ch->actual_volume[1]);
-		} else {
+			// xm_tick() might also have changed the position (there is a
+			// XM effect to force the position in the sample, and note
+			// triggers restart it), so check it against the position at the
+			// beginning of the tick.
+			if (w != xmp->chstate[i].wave || !mixer_ch_playing(first_ch+i)) {
+				u->mask = MIXER_UPDATE_WAVE | MIXER_UPDATE_POS | MIXER_UPDATE_FREQ | MIXER_UPDATE_VOL;
+			} else {
+				if (ch->sample_position != positions[i])
+					u->mask |= MIXER_UPDATE_POS;
+				if (ch->frequency != xmp->chstate[i].freq)
+					u->mask |= MIXER_UPDATE_FREQ;
+				if (lvol != xmp->chstate[i].lvol || rvol != xmp->chstate[i].rvol)
+					u->mask |= MIXER_UPDATE_VOL;
+			}
+
+			u->wave = w;
+			u->pos = ch->sample_position;
+			u->freq = ch->frequency;
+			u->lvol = lvol;
+			u->rvol = rvol;
+
+			xmp->chstate[i].wave = w;
+			xmp->chstate[i].freq = ch->frequency;
+			xmp->chstate[i].lvol = lvol;
+			xmp->chstate[i].rvol = rvol;
+		} else if (xmp->chstate[i].wave) {
 			// No sample in this channel: the channel is mute. Just stop it.
-			mixer_ch_stop(first_ch+i);
+			u->mask = MIXER_UPDATE_STOP;
+			xmp->chstate[i].wave = NULL;
 		}
 	}
 
+	mixer_ch_update_batch(first_ch, ctx->module.num_channels, updates);
+
 	// Schedule next tick according to the number of samples in this tick.
 	int delay = ceilf(ctx->remaining_samples_in_tick);
 	ctx->remaining_samples_in_tick -= delay;
 	return delay;
 }
 
-void xm64player_open(xm64player_t *player, const char *fn) {
-	memset(player, 0, sizeof(*player));
+static int tick(void *arg) {
+	uint32_t t0 = TICKS_READ();
+	int delay = tick_internal((xm64player_t*)arg);
+	__xm64_profile_tick += TICKS_READ() - t0;
+	return delay;
+}
 
+static void xm64player_open_internal(xm64player_t *player, FILE *fh, const char *fn, const void *buf) {
 	// No pending seek at the moment, we start from beginning anyway.
 	player->seek.patidx = -1;
 
-	player->fh = must_fopen(fn);
+	player->fh = fh;
 
 	// Load the XM context
 	int sample_rate = audio_get_frequency();
@@ -118,8 +202,9 @@ void xm64player_open(xm64player_t *player, const char *fn) {
 		assertf(0, "error loading XM64 file: %s\nFile corrupted", fn);
 	}
 
-	assertf(strncmp(fn, "rom:/", 5) == 0, "xm64player only supports files in ROM (rom:/)");
-	uint32_t base_rom_addr = dfs_rom_addr(fn+5);
+	// The state applied to the mixer channels is tracked in a fixed-size array
+	assertf(player->ctx->module.num_channels <= XM64_MAX_CHANNELS,
+		"XM64 file has too many channels: %s (%d, max %d)", fn, player->ctx->module.num_channels, XM64_MAX_CHANNELS);
 
 	// Count samples
 	int ninst = xm_get_number_of_instruments(player->ctx);
@@ -127,21 +212,40 @@ void xm64player_open(xm64player_t *player, const char *fn) {
 	for (int i=0;i<ninst;i++)
 		nwaves += xm_get_number_of_samples(player->ctx, i+1);
 
+	// Configure the source of waveform data. Waveforms in ROM are fetched via
+	// DMA, RAM buffers are just copied, and any other filesystem goes through
+	// a second FILE handle, so that streaming waveforms does not thrash
+	// the buffer used for streaming patterns.
+	xm64_source_t *src = malloc(sizeof(xm64_source_t) + sizeof(xm64_wave_ctx_t) * nwaves);
+	assert(src);
+	memset(src, 0, sizeof(xm64_source_t));
+	if (buf) {
+		src->read = source_ram_read;
+		src->buf = buf;
+	} else if (strncmp(fn, "rom:/", 5) == 0) {
+		src->read = source_rom_read;
+		src->rom_addr = dfs_rom_addr(fn+5);
+	} else {
+		src->read = source_file_read;
+		src->fh = must_fopen(fn);
+	}
+	player->src = src;
+
 	// Allocate waveforms (one per XM64's "samples" aka waveforms)
 	player->waves = malloc(sizeof(waveform_t) * nwaves);
 	assert(player->waves);
+	player->nwaves = nwaves;
 	int nw = 0;
 	for (int i=0;i<ninst;i++) {
 		xm_instrument_t *inst = &player->ctx->module.instruments[i];
 		for (int j=0;j<inst->num_samples;j++) {
 			xm_sample_t *samp = &inst->samples[j];
 
-			// Convert offset of samples from relative to absolute
-			samp->data8_offset += base_rom_addr;
-
 			// Initialize the waveform_t structures with information
 			// coming from the XM "sample".
-			samp->wave = &player->waves[nw++];
+			src->waves[nw].src = src;
+			src->waves[nw].samp = samp;
+			samp->wave = &player->waves[nw];
 			memset(samp->wave, 0, sizeof(waveform_t));
 			samp->wave->name = strdup(fn); // FIXME: maybe better use a proper name here
 			samp->wave->bits = samp->bits;
@@ -156,7 +260,8 @@ void xm64player_open(xm64player_t *player, const char *fn) {
 			if (samp->wave->bits == 8 && samp->wave->loop_len&1)
 				samp->wave->loop_len -= 1;
 			samp->wave->read = wave_read;
-			samp->wave->ctx = samp;
+			samp->wave->ctx = &src->waves[nw];
+			nw++;
 		}
 	}
 
@@ -164,6 +269,20 @@ void xm64player_open(xm64player_t *player, const char *fn) {
 	player->looping = true;
 }
 
+void xm64player_open(xm64player_t *player, const char *fn) {
+	memset(player, 0, sizeof(*player));
+	xm64player_open_internal(player, must_fopen(fn), fn, NULL);
+}
+
+void xm64player_open_buf(xm64player_t *player, const void *buf, int sz) {
+	memset(player, 0, sizeof(*player));
+
+	// Patterns are streamed through a FILE, so wrap the buffer in a memory stream.
+	FILE *fh = fmemopen((void*)buf, sz, "rb");
+	assertf(fh, "cannot open XM64 buffer: out of memory");
+	xm64player_open_internal(player, fh, "<memory>", buf);
+}
+
 int xm64player_num_channels(xm64player_t *player) {
 	return xm_get_number_of_channels(player->ctx);
 }
@@ -189,6 +308,12 @@ void xm64player_play(xm64player_t *player, int first_ch) {
 				mixer_ch_set_limits(first_ch+i, 0, 1e9, player->ctx->ctx_size_stream_sample_buf[i]);
 		}
 
+		// Stop the channels, so that they match the (empty) state tracked by
+		// the tick function, which only sends changes to the mixer.
+		for (int i=0; i<player->ctx->module.num_channels; i++)
+			mixer_ch_stop(first_ch+i);
+		chstate_reset(player);
+
 		mixer_add_event(0, tick, player);
 		player->first_ch = first_ch;
 		player->playing = true;
@@ -254,6 +379,13 @@ void xm64player_close(xm64player_t *player) {
 		player->fh = NULL;
 	}
 
+	if (player->src) {
+		if (player->src->fh)
+			fclose(player->src->fh);
+		free(player->src);
+		player->src = NULL;
+	}
+
 	if (player->waves) {
 		for (int i=0;i<player->nwaves;i++)
 			free((void*)player->waves[i].name);
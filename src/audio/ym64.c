@@ -6,11 +6,13 @@
 
 #include "ym64.h"
 #include "ay8910.h"
+#include "ay8910_internal.h"
 #include "../compress/lzh5_internal.h"
 #include "samplebuffer.h"
 #include "debug.h"
 #include "asset_internal.h"
 #include "utils.h"
+#include "rspq.h"
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
@@ -29,12 +31,37 @@ typedef struct __attribute__((packed)) {
 
 _Static_assert(sizeof(ym5header) == 22, "invalid header size");
 
+/** @brief Header of the chunk index of a seekable compressed YM64 file */
+typedef struct __attribute__((packed)) {
+	uint32_t chunk_frames;    ///< Number of audioframes per chunk
+	uint32_t nchunks;         ///< Number of chunks
+} ym64chunkheader;
+
 static int ymread(ym64player_t *player, void *buf, int sz) {
 	if (player->decoder)
 		return decompress_lzh5_read(player->decoder, buf, sz);
 	return fread(buf, 1, sz, player->f);
 }
 
+/**
+ * @brief Seek to an audioframe in a seekable compressed file.
+ *
+ * Each chunk is an independent LZH5 stream, so it is sufficient to restart
+ * the decoder at the beginning of the chunk, and skip the audioframes that
+ * precede the requested one.
+ */
+static void ym_chunk_seek(ym64player_t *player, int frame) {
+	int idx = frame / player->chunk_frames;
+	int skip = frame % player->chunk_frames;
+	assertf(frame >= 0 && idx < player->nchunks, "invalid YM64 seek position: %d (frames: %ld)", frame, player->nframes);
+
+	fseek(player->f, player->chunks[idx], SEEK_SET);
+	decompress_lzh5_init(player->decoder, player->f, DECOMPRESS_LZH5_DEFAULT_WINDOW_SIZE);
+	if (skip)
+		decompress_lzh5_read(player->decoder, NULL, skip * 16);
+	player->chunk_left = player->chunk_frames - skip;
+}
+
 static void ym_wave_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
 	ym64player_t *player = (ym64player_t*)ctx;
 
@@ -43,17 +70,32 @@ static void ym_wave_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bo
 	// and audioframes.
 	float f_samples_per_frame = player->wave.frequency / player->playfreq;
 
-	// If seeking was requested (and we can seek aka file not compressed),
-	// calculate the audioframe index corresponding to the seeking position
-	// and then seek the file there.
+	// If seeking was requested (and we can seek aka file not compressed, or
+	// compressed in chunks), calculate the audioframe index corresponding to
+	// the seeking position and then seek the file there.
 	// Notice that the position could theoretically be in the middle of an
 	// audioframe, but the current API should make it impossible to do:
 	// both ym64player_seek and the looping position are defined in terms of
 	// audioframes position not samples, so there should be no issue in
 	// converting them back from sample number.
-	if (seeking && !player->decoder) {
+	bool resync = false;
+	if (seeking && (!player->decoder || player->chunks)) {
 		player->curframe = ((float)wpos / f_samples_per_frame);
-		fseek(player->f, player->start_off + player->curframe * 16, SEEK_SET);
+		if (player->chunks) {
+			// Seeking to the end of the song (eg: because of rounding)
+			// needs no chunk, see below.
+			if (player->curframe < player->nframes)
+				ym_chunk_seek(player, player->curframe);
+		} else
+			fseek(player->f, player->start_off + player->curframe * 16, SEEK_SET);
+
+		// Restart the synthesizer from a clean state, so that the output after
+		// a seek (or a loop) does not depend on what was played before. Wait
+		// for the frames already enqueued first, as they update the state.
+		// All the registers are then written again, including the envelope shape.
+		rspq_highpri_sync();
+		ay8910_rsp_state_reset(player->rsp_state);
+		resync = true;
 	}
 
 	// Calculate the last audioframe to be reconstructed in this call. Notice
@@ -73,31 +115,55 @@ static void ym_wave_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bo
 	int16_t *out = samples;
 	const int num_channels = AY8910_OUTPUT_STEREO ? 2 : 1;
 
+	// The synthesis runs on the RSP, one command per audioframe. Enqueue
+	// all of them in a single highpri batch.
+	rspq_highpri_begin();
+
 	for (int i=0;i<nframes;i++) {
 		// Read 14 ay8910 registers (+ maybe 2 digidrums regs, unsupported)
 		uint8_t regs[16];
-		ymread(player, regs, 16);
+		if (player->chunks && player->curframe >= player->nframes) {
+			// Past the end of a chunked song (because of rounding), there is
+			// no chunk to decompress: just keep the registers unchanged.
+			memcpy(regs, player->regs, 16);
+		} else {
+			// Start decompressing the next chunk when the current one is over
+			if (player->chunks) {
+				if (player->chunk_left == 0)
+					ym_chunk_seek(player, player->curframe);
+				player->chunk_left--;
+			}
+			ymread(player, regs, 16);
+		}
 
 		// Iterate over the 14 ay8910 registers and see which ones
 		// changed since last tick.
+		bool env_restart = false;
 		for (int i=0;i<14;i++) {
-			if (player->regs[i] != regs[i]) {
+			if (player->regs[i] != regs[i] || resync) {
 				player->regs[i] = regs[i];
 				// Envelope register: the special value 0xFF means
 				// "don't touch". Writing the reg always restarts the
 				// envelope calculation, so it requires special handling.
 				if (i == 13 && regs[i] == 0xFF) continue;
+				if (i == 13) env_restart = true;
 				ay8910_write_addr(&player->ay, i);
 				ay8910_write_data(&player->ay, regs[i]);
 			}
 		}
 
 		// Generate the required number of samples, and store them into the
-		// sample buffer.
-		ay8910_gen(&player->ay, out, samples_per_frame);
+		// sample buffer. The state of the generators is kept by the RSP,
+		// the CPU only tracks the registers.
+		ay8910_rsp_frame_t frame;
+		ay8910_rsp_frame(&player->ay, &frame, samples_per_frame, env_restart);
+		rsp_ay8910_synth(&frame, player->rsp_state, out);
 		out += (int)samples_per_frame * num_channels;
 		player->curframe++;
+		resync = false;
 	}
+
+	rspq_highpri_end();
 }
 
 void ym64player_open(ym64player_t *player, const char *fn, ym64player_songinfo_t *info) {
@@ -132,7 +198,7 @@ void ym64player_open(ym64player_t *player, const char *fn, ym64player_songinfo_t
 
 	int loop_pos = 0;
 
-	if (strncmp(head, "YM6!", 4) == 0 || strncmp(head, "YM5!", 4) == 0) {
+	if (strncmp(head, "YM6!", 4) == 0 || strncmp(head, "YM5!", 4) == 0 || strncmp(head, "YM64", 4) == 0) {
 		assertf(strncmp(head+4, "LeOnArD!", 8) == 0, "invalid YM check string: %s", head+4);
 
 		ym5header h; char buf[512];
@@ -173,6 +239,22 @@ void ym64player_open(ym64player_t *player, const char *fn, ym64player_songinfo_t
 		do _ymread(&buf[i], 1);
 		while (buf[i++] != '\0');
 		if (info) strlcpy(info->comment, buf, sizeof(info->comment));
+
+		// Seekable compressed file: the header is followed by the index
+		// of the chunks, each one being an independent LZH5 stream.
+		if (strncmp(head, "YM64", 4) == 0) {
+			ym64chunkheader ch;
+			_ymread(&ch, sizeof(ch));
+			assertf(ch.chunk_frames > 0, "invalid YM64 chunk size");
+			assertf((uint64_t)ch.nchunks * ch.chunk_frames >= player->nframes,
+				"invalid YM64 chunk index: %ld chunks of %ld frames, song has %ld frames",
+				ch.nchunks, ch.chunk_frames, player->nframes);
+			player->chunk_frames = ch.chunk_frames;
+			player->nchunks = ch.nchunks;
+			player->chunks = malloc((ch.nchunks + 1) * sizeof(uint32_t));
+			_ymread(player->chunks, (ch.nchunks + 1) * sizeof(uint32_t));
+			player->decoder = malloc(DECOMPRESS_LZH5_STATE_SIZE + DECOMPRESS_LZH5_DEFAULT_WINDOW_SIZE);
+		}
 	} else if (strncmp(head, "YM3!", 4) == 0) {
 		assertf(0, "YM3 format cannot be played -- convert with audioconv64");
 	} else {
@@ -206,6 +288,9 @@ void ym64player_open(ym64player_t *player, const char *fn, ym64player_songinfo_t
 	};
 
 	ay8910_reset(&player->ay);
+	player->rsp_state = malloc_uncached(sizeof(ay8910_rsp_state_t));
+	ay8910_rsp_state_reset(player->rsp_state);
+	rsp_ay8910_init();
 	player->first_ch = -1;
 	debugf("ym64: loading %s (freq:%ld, wfreq:%ld)\n", fn, player->chipfreq/8, player->chipfreq/8/AY8910_DECIMATE);
 }
@@ -239,8 +324,8 @@ void ym64player_tell(ym64player_t *player, int *pos, float *secs) {
 }
 
 bool ym64player_seek(ym64player_t *player, int pos) {
-	// Cannot seek in a compressed file
-	if (player->decoder)
+	// Cannot seek in a compressed file, unless it is compressed in chunks
+	if (player->decoder && !player->chunks)
 		return false;
 
 	// If playing, seek through the mixer. Otherwise, at least record
@@ -260,8 +345,18 @@ void ym64player_close(ym64player_t *player) {
 		player->decoder = NULL;
 	}
 
+	if (player->chunks) {
+		free(player->chunks);
+		player->chunks = NULL;
+	}
+
 	if (player->f) {
 		fclose(player->f);
 		player->f = NULL;
 	}
+
+	if (player->rsp_state) {
+		free_uncached(player->rsp_state);
+		player->rsp_state = NULL;
+	}
 }
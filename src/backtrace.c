@@ -58,6 +58,7 @@
 #include <stdint.h>
 #include <stdalign.h>
 #include <stdlib.h>
+#include <malloc.h>
 #include <string.h>
 #include "backtrace.h"
 #include "backtrace_internal.h"
@@ -153,6 +154,19 @@ extern uint32_t inthandler_end[];
 /** @brief Address of the SYMT symbol table in the rompak. */
 static uint32_t SYMT_ROM = 0xFFFFFFFF;
 
+/** 
+ * @brief Copy of the symbol table in RDRAM (see #backtrace_symbols_cache_init).
+ * 
+ * When loaded, lookups are performed in memory instead of accessing the ROM.
+ * The symbol and string tables are optional (NULL if not cached).
+ */
+static struct {
+    symtable_header_t header;       ///< Header of the symbol table
+    addrtable_entry_t *addrtab;     ///< Address table (NULL if the cache is not loaded)
+    symtable_entry_t *symtab;       ///< Symbol table (optional)
+    char *strtab;                   ///< String table (optional)
+} symt_ram;
+
 /** @brief Placeholder used in frames where symbols are not available */
 static const char *UNKNOWN_SYMBOL = "???";
 
@@ -170,6 +184,9 @@ static bool is_valid_address(uint32_t addr)
  * If not found, return a null header.
  */
 static symtable_header_t symt_open(void) {
+    if (symt_ram.addrtab)
+        return symt_ram.header;
+
     if (SYMT_ROM == 0xFFFFFFFF) {
         SYMT_ROM = rompak_search_ext(".sym");
         if (!SYMT_ROM)
@@ -208,6 +225,8 @@ static symtable_header_t symt_open(void) {
 static addrtable_entry_t symt_addrtab_entry(symtable_header_t *symt, int idx)
 {
     assert(idx >= 0 && idx < symt->addrtab_size);
+    if (symt_ram.addrtab)
+        return symt_ram.addrtab[idx];
     return io_read(SYMT_ROM + symt->addrtab_off + idx * 4);
 }
 
@@ -257,6 +276,13 @@ static addrtable_entry_t symt_addrtab_search(symtable_header_t *symt, uint32_t a
  */
 static char* symt_string(symtable_header_t *symt, int sidx, int slen, char *buf, int size)
 {
+    if (symt_ram.strtab) {
+        int n = MIN(slen, size-1);
+        memcpy(buf, symt_ram.strtab + sidx, n);
+        buf[n] = 0;
+        return buf;
+    }
+
     // Align 2-byte phase of the RAM buffer with the ROM address. This is required
     // for dma_read.
     int tweak = (sidx ^ (uint32_t)buf) & 1;
@@ -278,6 +304,10 @@ static char* symt_string(symtable_header_t *symt, int sidx, int slen, char *buf,
  */
 static void symt_entry_fetch(symtable_header_t *symt, symtable_entry_t *entry, int idx)
 {
+    if (symt_ram.symtab) {
+        *entry = symt_ram.symtab[idx];
+        return;
+    }
     data_cache_hit_writeback_invalidate(entry, sizeof(symtable_entry_t));
     dma_read(entry, SYMT_ROM + symt->symtab_off + idx * sizeof(symtable_entry_t), sizeof(symtable_entry_t));
 }
@@ -301,6 +331,41 @@ static char* symt_entry_file(symtable_header_t *symt, symtable_entry_t *entry, u
     return symt_string(symt, entry->file_sidx, entry->file_len, buf, size);
 }
 
+/** @brief Allocate a buffer and fill it with a section of the symbol table */
+static void* symt_load(uint32_t offset, int size)
+{
+    void *buf = memalign(16, ROUND_UP(size, 16));
+    assertf(buf, "not enough memory to cache the symbol table (%d bytes)", size);
+    data_cache_hit_writeback_invalidate(buf, ROUND_UP(size, 16));
+    dma_read(buf, SYMT_ROM + offset, size);
+    return buf;
+}
+
+bool backtrace_symbols_cache_init(bool strings)
+{
+    if (!symt_ram.addrtab) {
+        symtable_header_t symt = symt_open();
+        if (!symt.head[0])
+            return false;
+        symt_ram.header = symt;
+        symt_ram.addrtab = symt_load(symt.addrtab_off, symt.addrtab_size * sizeof(addrtable_entry_t));
+    }
+    if (strings && !symt_ram.strtab) {
+        symtable_header_t *symt = &symt_ram.header;
+        symt_ram.symtab = symt_load(symt->symtab_off, symt->symtab_size * sizeof(symtable_entry_t));
+        symt_ram.strtab = symt_load(symt->strtab_off, symt->strtab_size);
+    }
+    return true;
+}
+
+void backtrace_symbols_cache_close(void)
+{
+    free(symt_ram.addrtab);
+    free(symt_ram.symtab);
+    free(symt_ram.strtab);
+    memset(&symt_ram, 0, sizeof(symt_ram));
+}
+
 char* __symbolize(void *vaddr, char *buf, int size)
 {
     symtable_header_t symt = symt_open();
@@ -450,7 +515,16 @@ bool __bt_analyze_func(bt_func_t *func, uint32_t *ptr, uint32_t func_start, bool
     return true;
 }
 
-static void backtrace_foreach(void (*cb)(void *arg, void *ptr), void *arg)
+/**
+ * @brief Walk the stack, calling a callback for each frame.
+ * 
+ * @param cb                Callback called for each frame. Return false to stop walking.
+ * @param arg               Argument passed to the callback
+ * @param func_start_cb     Optional function used to find the start of a function
+ *                          interrupted by an exception. If NULL, the symbol table
+ *                          in ROM is used.
+ */
+static void backtrace_foreach(bool (*cb)(void *arg, void *ptr), void *arg, uint32_t (*func_start_cb)(uint32_t addr))
 {
     /*
      * This function is called in very risky contexts, for instance as part of an exception
@@ -545,7 +619,8 @@ static void backtrace_foreach(void (*cb)(void *arg, void *ptr), void *arg)
                     
                     // Store the invalid address in the backtrace, so that it will appear in dumps.
                     // This makes it easier for the user to understand the reason for the exception.
-                    cb(arg, ra);
+                    if (!cb(arg, ra))
+                        return;
                     #if BACKTRACE_DEBUG
                     debugf("backtrace: %s, ra=%p, sp=%p, fp=%p ra_offset=%d, fp_offset=%d, stack_size=%d\n", 
                         "BT_INVALID", ra, sp, fp, func.ra_offset, func.fp_offset, func.stack_size);
@@ -563,7 +638,12 @@ static void backtrace_foreach(void (*cb)(void *arg, void *ptr), void *arg)
                 // The next frame might be a leaf function, for which we will not be able
                 // to find a stack frame. It is useful to try finding the function start.
                 // Try to open the symbol table: if we find it, we can search for the start
-                // address of the function.
+                // address of the function. If the caller provided a lookup function, use
+                // it instead, to avoid accessing the ROM.
+                if (func_start_cb) {
+                    func_start = func_start_cb((uint32_t)ra);
+                    break;
+                }
                 symtable_header_t symt = symt_open();
                 if (symt.head[0]) {
                     int idx;
@@ -588,22 +668,77 @@ static void backtrace_foreach(void (*cb)(void *arg, void *ptr), void *arg)
         }
 
         // Call the callback with this stack frame
-        cb(arg, ra);
+        if (!cb(arg, ra))
+            return;
     }
 }
 
 int backtrace(void **buffer, int size)
 {
     int i = -1; // skip backtrace itself
-    void cb(void *arg, void *ptr) {
+    bool cb(void *arg, void *ptr) {
         if (i >= 0 && i < size)
             buffer[i] = ptr;
         i++;
+        return i < size;
     }
-    backtrace_foreach(cb, NULL);
+    backtrace_foreach(cb, NULL, NULL);
     return i;
 }
 
+int __backtrace_interrupted(void **buffer, int size, uint32_t (*func_start_cb)(uint32_t addr))
+{
+    // Skip all frames until we walk back through the exception handler. The
+    // next frame is the one that was interrupted.
+    int i = -1;
+    bool cb(void *arg, void *ptr) {
+        if (i < 0) {
+            if ((uint32_t*)ptr >= inthandler && (uint32_t*)ptr < inthandler_end)
+                i = 0;
+            return true;
+        }
+        if (i < size)
+            buffer[i++] = ptr;
+        return i < size;
+    }
+    backtrace_foreach(cb, NULL, func_start_cb);
+    return i < 0 ? 0 : i;
+}
+
+uint32_t* __symt_func_starts(int *count)
+{
+    *count = 0;
+    symtable_header_t symt = symt_open();
+    if (!symt.head[0])
+        return NULL;
+
+    // Fetch the address table in chunks (unless cached), keeping only the
+    // function starts
+    uint32_t *funcs = NULL; int num_funcs = 0, max_funcs = 0;
+    uint32_t alignas(16) buf[256];
+    for (int i=0; i<symt.addrtab_size; i+=256) {
+        int n = MIN(256, symt.addrtab_size - i);
+        uint32_t *chunk = buf;
+        if (symt_ram.addrtab) {
+            chunk = &symt_ram.addrtab[i];
+        } else {
+            data_cache_hit_writeback_invalidate(buf, sizeof(buf));
+            dma_read(buf, SYMT_ROM + symt.addrtab_off + i*4, n*4);
+        }
+        for (int j=0; j<n; j++) {
+            if (!ADDRENTRY_IS_FUNC(chunk[j]))
+                continue;
+            if (num_funcs == max_funcs) {
+                max_funcs = max_funcs ? max_funcs * 2 : 256;
+                funcs = realloc(funcs, max_funcs * sizeof(uint32_t));
+            }
+            funcs[num_funcs++] = ADDRENTRY_ADDR(chunk[j]);
+        }
+    }
+    *count = num_funcs;
+    return funcs;
+}
+
 static void format_entry(void (*cb)(void *, backtrace_frame_t *), void *cb_arg, 
     symtable_header_t *symt, int idx, uint32_t addr, uint32_t offset, bool is_func, bool is_inline)
 {       
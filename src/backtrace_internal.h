@@ -19,6 +19,32 @@ typedef struct {
 
 bool __bt_analyze_func(bt_func_t *func, uint32_t *ptr, uint32_t func_start, bool from_exception);
 
+/**
+ * @brief Walk the call stack of the code interrupted by the current exception.
+ * 
+ * This must be called from within an exception or interrupt handler. The
+ * frames of the handler itself are skipped, so that the first returned
+ * address is the PC of the interrupted code, followed by its callers.
+ * 
+ * @param buffer            Array of pointers that will be filled with the frames
+ * @param size              Size of the buffer (maximum number of frames)
+ * @param func_start_cb     Optional function used to find the start of the
+ *                          interrupted function. If NULL, the symbol table is
+ *                          accessed from ROM via DMA, which is not safe if the
+ *                          interrupted code might be using PI DMA.
+ * @return                  Number of frames written in the buffer
+ */
+int __backtrace_interrupted(void **buffer, int size, uint32_t (*func_start_cb)(uint32_t addr));
+
+/**
+ * @brief Load the start addresses of all functions from the symbol table.
+ * 
+ * @param count     Output number of addresses
+ * @return          Sorted array of addresses (allocated with malloc), or NULL
+ *                  if the symbol table is not available.
+ */
+uint32_t* __symt_func_starts(int *count);
+
 
 /**
  * @brief Return the symbol associated to a given address.
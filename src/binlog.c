@@ -0,0 +1,191 @@
+/**
+ * @file binlog.c
+ * @brief Binary deferred-format logging
+ * @ingroup binlog
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "binlog.h"
+#include "n64sys.h"
+#include "interrupt.h"
+#include "debug.h"
+#include "usb.h"
+#include "utils.h"
+#include "alloc_internal.h"
+
+/** @brief Header of the dump file (all fields are big-endian) */
+typedef struct {
+    uint32_t magic;             ///< Magic identifier (#BINLOG_MAGIC)
+    uint32_t version;           ///< Version of the format (#BINLOG_VERSION)
+    uint32_t ticks_per_second;  ///< Frequency of the timestamps
+    uint32_t num_bytes;         ///< Number of bytes of messages following the header
+    uint32_t num_dropped;       ///< Number of messages dropped because the buffer was full
+} binlog_header_t;
+
+_Static_assert(sizeof(binlog_header_t) == 20, "invalid binlog_header_t size");
+
+/**
+ * @brief Buffer of messages, filled linearly.
+ *
+ * Each message is made by the address of the format string (32-bit), the
+ * timestamp (32-bit, in ticks), the number of arguments (8-bit), the type of
+ * each argument (8-bit each, see BINLOG_ARG_*), and then the values of the
+ * arguments. Values are packed without any alignment: 32-bit integers take
+ * 4 bytes, 64-bit integers and doubles take 8 bytes, strings take 1 byte of
+ * length followed by the characters.
+ *
+ * This is not a ring buffer: messages are appended one after the other, and
+ * are never overwritten. When the buffer is full, new messages are dropped
+ * (and counted) until #binlog_reset is called.
+ */
+static uint8_t *buffer;
+static int buffer_size;             ///< Size of the buffer
+static volatile int buffer_used;    ///< Number of bytes used in the buffer
+static volatile uint32_t num_dropped;   ///< Number of dropped messages
+
+void binlog_init(int size)
+{
+    assertf(!buffer, "binlog_init already called");
+    assertf(size > 0, "invalid binlog size: %d", size);
+
+    buffer = malloc(size);
+    assertf(buffer, "not enough memory for binlog buffer (%d bytes)", size);
+    buffer_size = size;
+    binlog_reset();
+}
+
+void binlog_reset(void)
+{
+    disable_interrupts();
+    buffer_used = 0;
+    num_dropped = 0;
+    enable_interrupts();
+}
+
+int binlog_size(void)
+{
+    return buffer_used;
+}
+
+/** @brief Return the size of a string argument as stored in the log */
+static int str_len(const char *s)
+{
+    int len = s ? strlen(s) : 0;
+    return MIN(len, 255);
+}
+
+void __binlog_write(const char *fmt, int nargs, const uint8_t *tags, ...)
+{
+    if (!buffer)
+        return;
+
+    // First pass: calculate the size of the message
+    va_list args;
+    va_start(args, tags);
+    int size = 4 + 4 + 1 + nargs;
+    for (int i=0; i<nargs; i++) {
+        switch (tags[i]) {
+        case BINLOG_ARG_I32:    va_arg(args, uint32_t); size += 4; break;
+        case BINLOG_ARG_I64:    va_arg(args, uint64_t); size += 8; break;
+        case BINLOG_ARG_DOUBLE: va_arg(args, double);   size += 8; break;
+        case BINLOG_ARG_STR:    size += 1 + str_len(va_arg(args, const char*)); break;
+        }
+    }
+    va_end(args);
+
+    // Reserve space in the buffer. This can be called from interrupt
+    // handlers, so keep interrupts disabled while writing.
+    disable_interrupts();
+    if (buffer_used + size > buffer_size) {
+        num_dropped++;
+        enable_interrupts();
+        return;
+    }
+    uint8_t *ptr = buffer + buffer_used;
+    buffer_used += size;
+
+    // Second pass: serialize the message
+    uint32_t addr = (uint32_t)fmt;
+    uint32_t ts = TICKS_READ();
+    memcpy(ptr, &addr, 4); ptr += 4;
+    memcpy(ptr, &ts, 4); ptr += 4;
+    *ptr++ = nargs;
+    memcpy(ptr, tags, nargs); ptr += nargs;
+
+    va_start(args, tags);
+    for (int i=0; i<nargs; i++) {
+        switch (tags[i]) {
+        case BINLOG_ARG_I32: {
+            uint32_t v = va_arg(args, uint32_t);
+            memcpy(ptr, &v, 4); ptr += 4;
+        }   break;
+        case BINLOG_ARG_I64: {
+            uint64_t v = va_arg(args, uint64_t);
+            memcpy(ptr, &v, 8); ptr += 8;
+        }   break;
+        case BINLOG_ARG_DOUBLE: {
+            double v = va_arg(args, double);
+            memcpy(ptr, &v, 8); ptr += 8;
+        }   break;
+        case BINLOG_ARG_STR: {
+            const char *s = va_arg(args, const char*);
+            int len = str_len(s);
+            *ptr++ = len;
+            memcpy(ptr, s, len); ptr += len;
+        }   break;
+        }
+    }
+    va_end(args);
+    enable_interrupts();
+}
+
+/** @brief Serialize the dump through a generic write function */
+static void binlog_serialize(void (*write)(void *arg, const void *data, int size), void *arg)
+{
+    binlog_header_t header = {
+        .magic = BINLOG_MAGIC,
+        .version = BINLOG_VERSION,
+        .ticks_per_second = TICKS_PER_SECOND,
+        .num_bytes = buffer_used,
+        .num_dropped = num_dropped,
+    };
+    write(arg, &header, sizeof(header));
+    write(arg, buffer, header.num_bytes);
+}
+
+void binlog_dump(FILE *out)
+{
+    assertf(buffer, "binlog_init must be called before dumping");
+    void write(void *arg, const void *data, int size) {
+        fwrite(data, 1, size, out);
+    }
+    binlog_serialize(write, NULL);
+}
+
+void binlog_dump_usb(void)
+{
+    assertf(buffer, "binlog_init must be called before dumping");
+
+    // USB packets cannot be streamed, so serialize into a temporary buffer
+    int size = sizeof(binlog_header_t) + buffer_used;
+    uint8_t *buf = __alloc_scratch(size);
+    assertf(buf, "not enough memory to dump the binary log");
+    uint8_t *ptr = buf;
+    void copy(void *arg, const void *data, int sz) { memcpy(ptr, data, sz); ptr += sz; }
+    binlog_serialize(copy, NULL);
+    usb_write(DATATYPE_RAWBINARY, buf, ptr - buf);
+    __free_scratch(buf);
+}
+
+void binlog_close(void)
+{
+    disable_interrupts();
+    free(buffer);
+    buffer = NULL;
+    buffer_size = 0;
+    buffer_used = 0;
+    enable_interrupts();
+}
@@ -5,8 +5,10 @@
 #include <string.h>
 #ifdef N64
 #include "debug.h"
+#include "../alloc_internal.h"
 #else
-
+#define __alloc_scratch(size)   malloc(size)
+#define __free_scratch(ptr)     free(ptr)
 #endif
 
 #if defined(__GNUC__) || defined(__clang__)
@@ -181,14 +183,16 @@ int shr_unpack(uint8_t *dst, uint8_t *src)
 
 void* decompress_shrinkler_full(const char *fn, FILE *fp, size_t cmp_size, size_t size)
 {
-    void *in = malloc(cmp_size);
+    // The input buffer is temporary: allocate it as scratch, so that it does
+    // not leave a hole below the output buffer.
+    void *in = __alloc_scratch(cmp_size);
     fread(in, 1, cmp_size, fp);
 
     void *out = malloc(size);
-    if (!out) return 0;
+    if (!out) { __free_scratch(in); return 0; }
     int dec_size = shr_unpack(out, in); (void)dec_size;
     assertf(dec_size == size, "Shrinkler size:%d exp:%d", dec_size, size);
-    free(in);
+    __free_scratch(in);
     return out;
 }
 
@@ -8,6 +8,10 @@
 #include "interrupt.h"
 #include "joybus.h"
 #include "joybus_internal.h"
+#include "controller_internal.h"
+#include "display_internal.h"
+#include "n64sys.h"
+#include "timer.h"
 #include "debug.h"
 #include <string.h>
 #include <stdbool.h>
@@ -36,6 +40,14 @@
  * return a number signifying the polar direction that the D-Pad is being
  * pressed in.
  *
+ * By default, the background scan is started at the vertical blank interrupt,
+ * so the sample returned by #controller_scan is as old as the time elapsed
+ * since then. If the game reads the controllers at a known point of the frame,
+ * #controller_poll_schedule delays the scan so that it completes just before
+ * that point, reducing input lag. #controller_get_latency_stats reports the
+ * age of the samples, and the time elapsed between the read of a sample and
+ * the display of the first frame drawn after it was scanned.
+ *
  * To perform direct reads to the controllers, call #controller_read.  This will
  * return a structure consisting of all button states on all controllers currently
  * inserted. Note that this function takes about 10% of a frame's worth of time.
@@ -61,24 +73,76 @@
  * @{
  */
 
-/** @brief The sampled controller data just read by autoscan */
-static volatile struct controller_data next;
+/** @brief Initial estimate of the duration of an autoscan (PIF roundtrip), in microseconds */
+#define POLL_ESTIMATE_US    2000
+/** @brief Margin between the end of a scheduled autoscan and the sampling point, in microseconds */
+#define POLL_GUARD_US       200
+/** @brief Duration of a NTSC/MPAL video field, in microseconds */
+#define FIELD_US_NTSC       16683
+/** @brief Duration of a PAL video field, in microseconds */
+#define FIELD_US_PAL        20000
+
+/** @brief A controller sample read by autoscan */
+typedef struct {
+    struct controller_data data;    ///< Controller data
+    uint32_t ticks;                 ///< Time at which the read completed (0: no sample yet)
+} controller_sample_t;
+
+/** @brief The samples read by autoscan (double buffered, written under interrupt) */
+static controller_sample_t samples[2];
+/** @brief Index of the most recent sample in #samples */
+static volatile int sample_ready = 0;
 /** @brief The current sampled controller data accessible via get_keys_* functions */
 static struct controller_data current;
+/** @brief Time at which the current sampled controller data was read */
+static uint32_t current_ticks;
 /** @brief The previously sampled controller data */
 static struct controller_data prev;
 /** @brief True if there is a pending controller autoscan */
 static volatile bool controller_autoscan_in_progress = false;
 /** @brief True if the module was initialized */
 static bool controller_inited = false;
+/** @brief Time at which the pending autoscan was started */
+static uint32_t poll_start_ticks;
+/** @brief Time of the last vertical blank interrupt */
+static volatile uint32_t vi_ticks;
+/** @brief Offset of the sampling point from the vertical blank (in ticks), or -1 to scan at the vertical blank */
+static int poll_offset = -1;
+/** @brief Estimated duration of an autoscan (in ticks) */
+static int poll_estimate;
+/** @brief Timer used to start the scheduled autoscans */
+static timer_link_t poll_timer;
+/** @brief True if an autoscan is scheduled on #poll_timer but was not started yet */
+static volatile bool poll_scheduled = false;
+/** @brief Latency statistics */
+static controller_latency_stats_t stats;
+/** @brief Sum of the input-to-display latencies (to compute the average) */
+static uint64_t latency_sum;
 
 static void controller_interrupt_update(uint64_t *output, void *ctx)
 {
-    memcpy((void*)&next, output, sizeof(struct controller_data));
+    uint32_t now = TICKS_READ();
+
+    // Write the sample into the buffer not being read by controller_scan,
+    // then publish it. Autoscans are at most one per frame, so controller_scan
+    // has always finished copying the other buffer by the time it is reused.
+    int idx = sample_ready ^ 1;
+    memcpy(&samples[idx].data, output, sizeof(struct controller_data));
+    samples[idx].ticks = now ? now : 1;
+    sample_ready = idx;
     controller_autoscan_in_progress = false;
+
+    // Track the duration of the autoscans. The estimate decays slowly,
+    // so that it follows the slowest of the recent ones.
+    int duration = TICKS_DISTANCE(poll_start_ticks, now);
+    poll_estimate -= poll_estimate / 16;
+    if (duration > poll_estimate)
+        poll_estimate = duration;
+    stats.poll_us = TICKS_TO_US(duration);
 }
 
-static void controller_interrupt(void) 
+/** @brief Start an autoscan, unless the previous one is still in progress */
+static void controller_poll_start(void)
 {
     static const unsigned long long SI_read_con_block[8] =
     {
@@ -91,13 +155,74 @@ static void controller_interrupt(void)
         0,
         1
     };
-    
-    if (!controller_autoscan_in_progress) {    
-        controller_autoscan_in_progress = true;
-        joybus_exec_async(SI_read_con_block, controller_interrupt_update, NULL);
+
+    if (controller_autoscan_in_progress) {
+        stats.missed++;
+        return;
+    }
+    controller_autoscan_in_progress = true;
+    poll_start_ticks = TICKS_READ();
+    stats.polls++;
+    joybus_exec_async(SI_read_con_block, controller_interrupt_update, NULL);
+}
+
+static void controller_poll_timer(int ovfl)
+{
+    poll_scheduled = false;
+    controller_poll_start();
+}
+
+static void controller_interrupt(void) 
+{
+    vi_ticks = TICKS_READ();
+
+    // If the autoscan scheduled in the previous frame did not start yet (eg:
+    // the timer was delayed by other interrupts), start it now: restarting
+    // the timer would postpone it again, and the controllers would never
+    // be scanned.
+    if (poll_scheduled) {
+        poll_scheduled = false;
+        controller_poll_start();
+        return;
+    }
+
+    // Start the autoscan right away, or schedule it to complete just
+    // before the sampling point.
+    int delay = poll_offset - poll_estimate - TICKS_FROM_US(POLL_GUARD_US);
+    if (poll_offset < 0 || delay <= 0) {
+        controller_poll_start();
+        return;
     }
+    poll_timer.set = delay;
+    poll_scheduled = true;
+    restart_timer(&poll_timer);
 }
 
+/** @brief Return the time at which the controller data used to draw a frame was read */
+static uint32_t controller_frame_input(void)
+{
+    return current_ticks;
+}
+
+/** @brief Account the input-to-display latency of a frame being displayed */
+static void controller_frame_shown(uint32_t input_ticks)
+{
+    if (!input_ticks)
+        return;
+    uint32_t latency = TICKS_TO_US(TICKS_DISTANCE(input_ticks, TICKS_READ()));
+    stats.frames++;
+    stats.latency_us = latency;
+    if (latency > stats.latency_max_us)
+        stats.latency_max_us = latency;
+    latency_sum += latency;
+}
+
+/** @brief Latency hooks installed into the display module */
+static const display_latency_hooks_t controller_latency_hooks = {
+    .frame_input = controller_frame_input,
+    .frame_shown = controller_frame_shown,
+};
+
 /** 
  * @brief Initialize the controller subsystem.
  * 
@@ -110,11 +235,100 @@ void controller_init( void )
 {
     memset(&prev, 0, sizeof(struct controller_data));
     memset(&current, 0, sizeof(struct controller_data));
-    memset((void*)&next, 0, sizeof(struct controller_data));
+    memset(samples, 0, sizeof(samples));
+    current_ticks = 0;
+    poll_estimate = TICKS_FROM_US(POLL_ESTIMATE_US);
+    controller_reset_latency_stats();
+    __display_latency_hooks = &controller_latency_hooks;
     register_VI_handler(controller_interrupt);
     controller_inited = true;
 }
 
+/**
+ * @brief Close the controller subsystem.
+ *
+ * Stops the background scan of the controllers, and the accounting of the
+ * input-to-display latency. #controller_init can be called again afterwards.
+ */
+void controller_close( void )
+{
+    disable_interrupts();
+    unregister_VI_handler(controller_interrupt);
+    if (poll_offset >= 0)
+        stop_timer(&poll_timer);
+    poll_offset = -1;
+    poll_scheduled = false;
+    if (__display_latency_hooks == &controller_latency_hooks)
+        __display_latency_hooks = NULL;
+    controller_inited = false;
+    enable_interrupts();
+}
+
+/**
+ * @brief Schedule the background scan against the video frame
+ *
+ * By default, the background scan of the controllers is started at the
+ * vertical blank interrupt. If the game calls #controller_scan at a known
+ * point of the frame (eg: after waiting for a free framebuffer), the data is
+ * then as old as the time elapsed since the vertical blank.
+ *
+ * This function delays the start of the background scan, so that it completes
+ * just before the sampling point, with a small margin. The duration of the
+ * scan (the PIF roundtrip) is measured at runtime. If the sampling point is
+ * too close to the vertical blank, the scan starts at the vertical blank.
+ * The sampling point must come before the next vertical blank, that is
+ * within 16683 us (NTSC/MPAL) or 20000 us (PAL).
+ *
+ * @note The timer subsystem must be initialized (see #timer_init).
+ *
+ * @param[in] offset_us
+ *            Time of the sampling point after the vertical blank interrupt,
+ *            in microseconds, or -1 to go back to scanning at the vertical blank.
+ */
+void controller_poll_schedule( int offset_us )
+{
+    assertf(controller_inited, "controller_init() was not called");
+    int field_us = get_tv_type() == TV_PAL ? FIELD_US_PAL : FIELD_US_NTSC;
+    assertf(offset_us < field_us,
+        "sampling point (%d us) must come before the next vertical blank (%d us)", offset_us, field_us);
+
+    disable_interrupts();
+    if (offset_us < 0) {
+        if (poll_offset >= 0)
+            stop_timer(&poll_timer);
+        poll_offset = -1;
+        poll_scheduled = false;
+    } else {
+        if (poll_offset < 0)
+            start_timer(&poll_timer, 0, TF_ONE_SHOT | TF_DISABLED, controller_poll_timer);
+        poll_offset = TICKS_FROM_US(offset_us);
+    }
+    enable_interrupts();
+}
+
+/**
+ * @brief Get the latency statistics of the background scan
+ *
+ * @param[out] out
+ *             Structure that receives the statistics
+ */
+void controller_get_latency_stats( controller_latency_stats_t *out )
+{
+    disable_interrupts();
+    *out = stats;
+    out->latency_avg_us = stats.frames ? latency_sum / stats.frames : 0;
+    enable_interrupts();
+}
+
+/** @brief Reset the latency statistics of the background scan */
+void controller_reset_latency_stats( void )
+{
+    disable_interrupts();
+    memset(&stats, 0, sizeof(stats));
+    latency_sum = 0;
+    enable_interrupts();
+}
+
 /**
  * @brief Read the controller button status for all controllers
  *
@@ -236,15 +450,28 @@ void controller_read_gc_origin( struct controller_origin_data * outdata )
  * This function is very fast. In fact, controllers are read in background
  * asynchronously under interrupt, so this function just synchronizes the
  * internal state.
+ *
+ * @see #controller_poll_schedule
  */
 void controller_scan( void )
 {
     assertf(controller_inited, "controller_init() was not called");
     prev = current;
 
-    disable_interrupts();
-    memcpy(&current, (void*)&next, sizeof(struct controller_data));
-    enable_interrupts();
+    // No need to disable interrupts: autoscan writes into the other buffer
+    controller_sample_t *sample = &samples[sample_ready];
+    memcpy(&current, &sample->data, sizeof(struct controller_data));
+    current_ticks = sample->ticks;
+
+    if (current_ticks) {
+        uint32_t now = TICKS_READ();
+        stats.scans++;
+        stats.sample_age_us = TICKS_TO_US(TICKS_DISTANCE(current_ticks, now));
+        // The sample was read before the last vertical blank: the autoscan
+        // of this frame has not completed yet.
+        if (TICKS_BEFORE(current_ticks, vi_ticks))
+            stats.late++;
+    }
 }
 
 /**
@@ -617,78 +844,224 @@ static uint8_t __calc_data_crc( uint8_t *data )
 }
 
 /**
- * @brief Read a chunk of data from a mempak
+ * @brief Number of mempak accesses kept in flight by batched transfers
  *
- * Given a controller and an address, read 32 bytes from a mempak and
- * return them in data.
+ * Each mempak access is a separate joybus message (the PIF executes a single
+ * command per channel in each message), but queueing them asynchronously
+ * allows the SI to process them back-to-back. The queue is shared with the
+ * messages queued under interrupt (#JOYBUS_IRQ_MSGS), so only part of it is
+ * used. A group is complete before the next one is queued.
+ */
+#define MEMPAK_PIPELINE_DEPTH   4
+
+/* The ring buffer of joybus holds one message less than its size */
+_Static_assert(MEMPAK_PIPELINE_DEPTH + JOYBUS_IRQ_MSGS <= MAX_JOYBUS_MSGS - 1,
+    "mempak transfers could overflow the joybus queue");
+
+/**
+ * @brief Build the joybus message for a mempak read or write access
  *
+ * @param[out] block
+ *             The 64-byte joybus message
  * @param[in]  controller
- *             Which controller to read the data from (0-3)
+ *             Which controller to access (0-3)
  * @param[in]  address
- *             A 32 byte aligned offset to read from on the mempak
- * @param[out] data
- *             Buffer to place 32 bytes of data read from the mempak
- *
- * @retval 0  if reading was successful
- * @retval -1 if the controller was out of range
- * @retval -2 if there was no mempak present in the controller
- * @retval -3 if the mempak returned invalid data
+ *             A 32 byte aligned offset on the mempak
+ * @param[in]  data
+ *             32 bytes of data to write, or NULL for a read access
  */
-int read_mempak_address( int controller, uint16_t address, uint8_t *data )
+static void __mempak_access_block( uint8_t *block, int controller, uint16_t address, const uint8_t *data )
 {
-    uint8_t output[64];
-    uint8_t SI_read_mempak_block[64];
-    int ret;
-
-    /* Controller must be in range */
-    if( controller < 0 || controller > 3 ) { return -1; }
-
     /* Last byte must be 0x01 to signal to the SI to process data */
-    memset( SI_read_mempak_block, 0, 64 );
-    SI_read_mempak_block[56] = 0xfe;
-    SI_read_mempak_block[63] = 0x01;
+    memset( block, 0, 64 );
+    block[56] = 0xfe;
+    block[63] = 0x01;
 
-    /* Start command at the correct channel to read from the right mempak */
-    SI_read_mempak_block[controller]     = 0x03;
-    SI_read_mempak_block[controller + 1] = 0x21;
-    SI_read_mempak_block[controller + 2] = 0x02;
+    /* Start command at the correct channel to access the right mempak */
+    if( data )
+    {
+        block[controller]     = 0x23;
+        block[controller + 1] = 0x01;
+        block[controller + 2] = 0x03;
+    }
+    else
+    {
+        block[controller]     = 0x03;
+        block[controller + 1] = 0x21;
+        block[controller + 2] = 0x02;
+    }
 
     /* Calculate CRC on address */
-    uint16_t read_address = __calc_address_crc( address );
-    SI_read_mempak_block[controller + 3] = (read_address >> 8) & 0xFF;
-    SI_read_mempak_block[controller + 4] = read_address & 0xFF;
-
-    /* Leave room for 33 bytes (32 bytes + CRC) to come back */
-    memset( &SI_read_mempak_block[controller + 5], 0xFF, 33 );
-
-    joybus_exec( SI_read_mempak_block, &output );
+    uint16_t crc_address = __calc_address_crc( address );
+    block[controller + 3] = (crc_address >> 8) & 0xFF;
+    block[controller + 4] = crc_address & 0xFF;
 
-    /* Copy data correctly out of command */
-    memcpy( data, &output[controller + 5], 32 );
+    if( data )
+    {
+        /* Place the data to be written, and leave room for CRC to come back */
+        memcpy( &block[controller + 5], data, 32 );
+        block[controller + 5 + 32] = 0xFF;
+    }
+    else
+    {
+        /* Leave room for 33 bytes (32 bytes + CRC) to come back */
+        memset( &block[controller + 5], 0xFF, 33 );
+    }
+}
 
+/**
+ * @brief Check the reply of a mempak read or write access
+ *
+ * @param[in] output
+ *            The 64-byte joybus reply
+ * @param[in] controller
+ *            Which controller was accessed (0-3)
+ *
+ * @retval 0  if the access was successful
+ * @retval -2 if there was no mempak present in the controller
+ * @retval -3 if the mempak returned invalid data
+ */
+static int __mempak_access_result( const uint8_t *output, int controller )
+{
     /* Validate CRC */
-    uint8_t crc = __calc_data_crc( &output[controller + 5] );
+    uint8_t crc = __calc_data_crc( (uint8_t *)&output[controller + 5] );
 
     if( crc == output[controller + 5 + 32] )
     {
-        /* Data was read successfully */
-        ret = 0;
+        /* Access was successful */
+        return 0;
+    }
+    else if( crc == (output[controller + 5 + 32] ^ 0xFF) )
+    {
+        /* Pak not present! */
+        return -2;
     }
     else
     {
-        if( crc == (output[controller + 5 + 32] ^ 0xFF) )
+        /* Pak returned bad data */
+        return -3;
+    }
+}
+
+/**
+ * @brief State of a mempak access in a batched transfer
+ */
+typedef struct
+{
+    /** @brief Controller being accessed */
+    int controller;
+    /** @brief Destination of the data for reads, NULL for writes */
+    uint8_t *data;
+    /** @brief Result of the access */
+    volatile int ret;
+} mempak_access_t;
+
+/**
+ * @brief Joybus completion callback of a mempak access in a batched transfer
+ *
+ * @note This is called under interrupt
+ */
+static void __mempak_access_done( uint64_t *output, void *ctx )
+{
+    mempak_access_t *access = ctx;
+    const uint8_t *out = (const uint8_t *)output;
+
+    if( access->data )
+    {
+        memcpy( access->data, &out[access->controller + 5], 32 );
+    }
+    access->ret = __mempak_access_result( out, access->controller );
+}
+
+/**
+ * @brief Read or write consecutive 32-byte chunks of a mempak
+ *
+ * Accesses are queued to joybus in groups of #MEMPAK_PIPELINE_DEPTH, so
+ * that they are executed back-to-back without waiting for the CPU.
+ *
+ * @param[in]  controller
+ *             Which controller to access (0-3)
+ * @param[in]  address
+ *             A 32 byte aligned offset of the first chunk on the mempak
+ * @param      data
+ *             Buffer of count * 32 bytes to read into or to write from
+ * @param[in]  count
+ *             Number of chunks to transfer
+ * @param[in]  write
+ *             True to write the chunks, false to read them
+ *
+ * @retval 0  if the transfer was successful
+ * @retval -1 if the controller was out of range
+ * @retval -2 if there was no mempak present in the controller
+ * @retval -3 if the mempak returned invalid data
+ */
+static int __mempak_transfer( int controller, uint16_t address, uint8_t *data, int count, bool write )
+{
+    mempak_access_t accesses[MEMPAK_PIPELINE_DEPTH];
+    uint8_t block[64];
+
+    /* Controller must be in range */
+    if( controller < 0 || controller > 3 ) { return -1; }
+
+    for( int i = 0; i < count; i += MEMPAK_PIPELINE_DEPTH )
+    {
+        int num = count - i < MEMPAK_PIPELINE_DEPTH ? count - i : MEMPAK_PIPELINE_DEPTH;
+
+        for( int j = 0; j < num; j++ )
         {
-            /* Pak not present! */
-            ret = -2;
+            uint8_t *chunk = data + (i + j) * 32;
+            mempak_access_t *access = &accesses[j];
+
+            access->controller = controller;
+            access->data = write ? NULL : chunk;
+            access->ret = -3;
+
+            __mempak_access_block( block, controller, address + (i + j) * 32, write ? chunk : NULL );
+
+            if( j < num - 1 )
+            {
+                joybus_exec_async( block, __mempak_access_done, access );
+            }
+            else
+            {
+                /* The blocking call is executed after the pending accesses,
+                   so all of them are complete when it returns */
+                uint64_t output[JOYBUS_BLOCK_DWORDS];
+                joybus_exec( block, output );
+                __mempak_access_done( output, access );
+            }
         }
-        else
+
+        for( int j = 0; j < num; j++ )
         {
-            /* Pak returned bad data */
-            ret = -3;
+            if( accesses[j].ret ) { return accesses[j].ret; }
         }
     }
 
-    return ret;
+    return 0;
+}
+
+/**
+ * @brief Read a chunk of data from a mempak
+ *
+ * Given a controller and an address, read 32 bytes from a mempak and
+ * return them in data.
+ *
+ * @param[in]  controller
+ *             Which controller to read the data from (0-3)
+ * @param[in]  address
+ *             A 32 byte aligned offset to read from on the mempak
+ * @param[out] data
+ *             Buffer to place 32 bytes of data read from the mempak
+ *
+ * @retval 0  if reading was successful
+ * @retval -1 if the controller was out of range
+ * @retval -2 if there was no mempak present in the controller
+ * @retval -3 if the mempak returned invalid data
+ */
+int read_mempak_address( int controller, uint16_t address, uint8_t *data )
+{
+    return __mempak_transfer( controller, address, data, 1, false );
 }
 
 /**
@@ -710,59 +1083,49 @@ int read_mempak_address( int controller, uint16_t address, uint8_t *data )
  */
 int write_mempak_address( int controller, uint16_t address, uint8_t *data )
 {
-    uint8_t output[64];
-    uint8_t SI_write_mempak_block[64];
-    int ret;
-
-    /* Controller must be in range */
-    if( controller < 0 || controller > 3 ) { return -1; }
-
-    /* Last byte must be 0x01 to signal to the SI to process data */
-    memset( SI_write_mempak_block, 0, 64 );
-    SI_write_mempak_block[56] = 0xfe;
-    SI_write_mempak_block[63] = 0x01;
-
-    /* Start command at the correct channel to write from the right mempak */
-    SI_write_mempak_block[controller]     = 0x23;
-    SI_write_mempak_block[controller + 1] = 0x01;
-    SI_write_mempak_block[controller + 2] = 0x03;
-
-    /* Calculate CRC on address */
-    uint16_t write_address = __calc_address_crc( address );
-    SI_write_mempak_block[controller + 3] = (write_address >> 8) & 0xFF;
-    SI_write_mempak_block[controller + 4] = write_address & 0xFF;
-
-    /* Place the data to be written */
-    memcpy( &SI_write_mempak_block[controller + 5], data, 32 );
-
-    /* Leave room for CRC to come back */
-    SI_write_mempak_block[controller + 5 + 32] = 0xFF;
-
-    joybus_exec( SI_write_mempak_block, &output );
-
-    /* Calculate CRC on output */
-    uint8_t crc = __calc_data_crc( &output[controller + 5] );
+    return __mempak_transfer( controller, address, data, 1, true );
+}
 
-    if( crc == output[controller + 5 + 32] )
-    {
-        /* Data was written successfully */
-        ret = 0;
-    }
-    else
-    {
-        if( crc == (output[controller + 5 + 32] ^ 0xFF) )
-        {
-            /* Pak not present! */
-            ret = -2;
-        }
-        else
-        {
-            /* Pak returned bad data */
-            ret = -3;
-        }
-    }
+/**
+ * @brief Read multiple consecutive chunks of data from a mempak
+ *
+ * @see #read_mempak_address
+ *
+ * @param[in]  controller
+ *             Which controller to read the data from (0-3)
+ * @param[in]  address
+ *             A 32 byte aligned offset to read from on the mempak
+ * @param[out] data
+ *             Buffer to place count * 32 bytes of data read from the mempak
+ * @param[in]  count
+ *             Number of 32-byte chunks to read
+ *
+ * @return 0 on success, or the same error codes of #read_mempak_address
+ */
+int __read_mempak_blocks( int controller, uint16_t address, uint8_t *data, int count )
+{
+    return __mempak_transfer( controller, address, data, count, false );
+}
 
-    return ret;
+/**
+ * @brief Write multiple consecutive chunks of data to a mempak
+ *
+ * @see #write_mempak_address
+ *
+ * @param[in]  controller
+ *             Which controller to write the data to (0-3)
+ * @param[in]  address
+ *             A 32 byte aligned offset to write to on the mempak
+ * @param[in]  data
+ *             Buffer to source count * 32 bytes of data to write to the mempak
+ * @param[in]  count
+ *             Number of 32-byte chunks to write
+ *
+ * @return 0 on success, or the same error codes of #write_mempak_address
+ */
+int __write_mempak_blocks( int controller, uint16_t address, const uint8_t *data, int count )
+{
+    return __mempak_transfer( controller, address, (uint8_t *)data, count, true );
 }
 
 /**
@@ -0,0 +1,15 @@
+/**
+ * @file controller_internal.h
+ * @brief Controller Subsystem internal API
+ * @ingroup controller
+ */
+
+#ifndef __LIBDRAGON_CONTROLLER_INTERNAL_H
+#define __LIBDRAGON_CONTROLLER_INTERNAL_H
+
+#include <stdint.h>
+
+int __read_mempak_blocks( int controller, uint16_t address, uint8_t *data, int count );
+int __write_mempak_blocks( int controller, uint16_t address, const uint8_t *data, int count );
+
+#endif
@@ -0,0 +1,264 @@
+/**
+ * @file cpuprof.c
+ * @brief Statistical CPU profiler
+ * @ingroup cpuprof
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpuprof.h"
+#include "backtrace.h"
+#include "backtrace_internal.h"
+#include "timer.h"
+#include "interrupt.h"
+#include "debug.h"
+#include "usb.h"
+#include "utils.h"
+#include "alloc_internal.h"
+
+/** @brief Header of the dump file (all fields are big-endian) */
+typedef struct {
+    uint32_t magic;             ///< Magic identifier (#CPUPROF_MAGIC)
+    uint32_t version;           ///< Version of the format (#CPUPROF_VERSION)
+    uint32_t hz;                ///< Sampling frequency
+    uint32_t max_depth;         ///< Maximum number of frames per sample
+    uint32_t num_samples;       ///< Number of samples following the header
+    uint32_t num_overwritten;   ///< Number of samples lost because the ring buffer was full
+} cpuprof_header_t;
+
+_Static_assert(sizeof(cpuprof_header_t) == 24, "invalid cpuprof_header_t size");
+
+/**
+ * @brief Ring buffer of samples.
+ *
+ * Each sample occupies a fixed-size slot of 1+max_depth words: the first word
+ * is the number of frames, followed by the frames themselves (the sampled PC
+ * first, then the callers).
+ */
+static uint32_t *ring;
+static int ring_size;           ///< Number of slots in the ring buffer
+static int ring_depth;          ///< Maximum number of frames in each slot
+static volatile int ring_head;  ///< Index of the next slot to write
+static volatile int ring_count; ///< Number of valid slots
+static volatile uint32_t ring_overwritten;  ///< Number of overwritten samples
+static timer_link_t *prof_timer;    ///< Sampling timer (NULL if stopped)
+static int prof_hz;             ///< Sampling frequency
+
+/**
+ * @brief Start addresses of all functions, loaded from the symbol table.
+ *
+ * The backtrace needs to know where the interrupted function begins to walk
+ * through leaf functions. Looking it up in the symbol table requires PI DMA,
+ * which cannot be done from the interrupt as the interrupted code might be
+ * using the PI itself, so we keep a copy in RDRAM.
+ */
+static uint32_t *func_starts;
+static int num_func_starts;     ///< Number of entries in #func_starts
+
+/** @brief Find the index of the function containing the specified address (or -1) */
+static int func_index(uint32_t addr)
+{
+    int min = 0, max = num_func_starts;
+    while (min < max) {
+        int mid = (min + max) / 2;
+        if (func_starts[mid] <= addr)
+            min = mid + 1;
+        else
+            max = mid;
+    }
+    return min - 1;
+}
+
+/** @brief Find the start address of the function containing the specified address */
+static uint32_t func_start(uint32_t addr)
+{
+    int idx = func_index(addr);
+    return idx >= 0 ? func_starts[idx] : 0;
+}
+
+/** @brief Timer callback: take a sample of the interrupted code */
+static void cpuprof_sample(int ovfl)
+{
+    uint32_t *slot = &ring[ring_head * (1 + ring_depth)];
+    slot[0] = __backtrace_interrupted((void**)&slot[1], ring_depth,
+        num_func_starts ? func_start : NULL);
+    if (slot[0] == 0)
+        return;
+
+    if (++ring_head == ring_size)
+        ring_head = 0;
+    if (ring_count < ring_size)
+        ring_count++;
+    else
+        ring_overwritten++;
+}
+
+void cpuprof_init(int max_samples, int max_depth)
+{
+    assertf(!ring, "cpuprof_init already called");
+    assertf(max_samples > 0 && max_depth > 0, "invalid cpuprof parameters");
+
+    ring_size = max_samples;
+    ring_depth = max_depth;
+    ring = malloc(ring_size * (1 + ring_depth) * sizeof(uint32_t));
+    assertf(ring, "not enough memory for %d samples", max_samples);
+    func_starts = __symt_func_starts(&num_func_starts);
+    if (!func_starts)
+        debugf("cpuprof: symbol table not found, backtraces through leaf functions might be wrong\n");
+    cpuprof_reset();
+}
+
+void cpuprof_start(int hz)
+{
+    assertf(ring, "cpuprof_init must be called first");
+    assertf(hz > 0, "invalid sampling frequency: %d", hz);
+    if (prof_timer)
+        cpuprof_stop();
+    prof_hz = hz;
+    prof_timer = new_timer(TIMER_TICKS(1000000 / hz), TF_CONTINUOUS, cpuprof_sample);
+}
+
+void cpuprof_stop(void)
+{
+    if (prof_timer) {
+        delete_timer(prof_timer);
+        prof_timer = NULL;
+    }
+}
+
+void cpuprof_reset(void)
+{
+    disable_interrupts();
+    ring_head = 0;
+    ring_count = 0;
+    ring_overwritten = 0;
+    enable_interrupts();
+}
+
+int cpuprof_num_samples(void)
+{
+    return ring_count;
+}
+
+/** @brief Return the slot of the i-th sample, from the oldest one */
+static uint32_t* cpuprof_slot(int i)
+{
+    int idx = ring_head - ring_count + i;
+    if (idx < 0) idx += ring_size;
+    return &ring[idx * (1 + ring_depth)];
+}
+
+/** @brief Serialize the samples calling the specified function for each chunk of data */
+static void cpuprof_serialize(void (*write)(void *arg, const void *data, int size), void *arg)
+{
+    assertf(!prof_timer, "cpuprof_stop must be called before dumping");
+
+    cpuprof_header_t header = {
+        .magic = CPUPROF_MAGIC,
+        .version = CPUPROF_VERSION,
+        .hz = prof_hz,
+        .max_depth = ring_depth,
+        .num_samples = ring_count,
+        .num_overwritten = ring_overwritten,
+    };
+    write(arg, &header, sizeof(header));
+    for (int i=0; i<ring_count; i++) {
+        uint32_t *slot = cpuprof_slot(i);
+        write(arg, slot, (1 + slot[0]) * sizeof(uint32_t));
+    }
+}
+
+void cpuprof_dump(FILE *out)
+{
+    void write(void *arg, const void *data, int size) {
+        fwrite(data, 1, size, out);
+    }
+    cpuprof_serialize(write, NULL);
+}
+
+void cpuprof_dump_usb(void)
+{
+    // USB packets cannot be streamed, so serialize into a temporary buffer
+    int size = 0;
+    void count(void *arg, const void *data, int sz) { size += sz; }
+    cpuprof_serialize(count, NULL);
+
+    uint8_t *buf = __alloc_scratch(size);
+    assertf(buf, "not enough memory to dump the profile");
+    uint8_t *ptr = buf;
+    void copy(void *arg, const void *data, int sz) { memcpy(ptr, data, sz); ptr += sz; }
+    cpuprof_serialize(copy, NULL);
+    usb_write(DATATYPE_RAWBINARY, buf, size);
+    __free_scratch(buf);
+}
+
+void cpuprof_report(FILE *out, int max_funcs)
+{
+    assertf(!prof_timer, "cpuprof_stop must be called before reporting");
+    if (!num_func_starts) {
+        fprintf(out, "cpuprof: symbol table not found, cannot produce a report\n");
+        return;
+    }
+
+    // Count self and total samples for each function. We use the function
+    // start table to index functions.
+    int *self = calloc(num_func_starts * 2, sizeof(int));
+    int *total = self + num_func_starts;
+    for (int i=0; i<ring_count; i++) {
+        uint32_t *slot = cpuprof_slot(i);
+        int fidx[slot[0]];
+        for (int j=0; j<slot[0]; j++) {
+            fidx[j] = func_index(slot[1+j]);
+            if (fidx[j] < 0) continue;
+            if (j == 0) self[fidx[j]]++;
+            // Count recursive functions only once per sample
+            bool dup = false;
+            for (int k=0; k<j && !dup; k++)
+                dup = fidx[k] == fidx[j];
+            if (!dup) total[fidx[j]]++;
+        }
+    }
+
+    // Sort the functions by self samples (and then total samples)
+    int num = 0;
+    int *order = malloc(num_func_starts * sizeof(int));
+    for (int i=0; i<num_func_starts; i++)
+        if (total[i]) order[num++] = i;
+    int cmp(const void *a, const void *b) {
+        int ia = *(const int*)a, ib = *(const int*)b;
+        if (self[ia] != self[ib]) return self[ib] - self[ia];
+        return total[ib] - total[ia];
+    }
+    qsort(order, num, sizeof(int), cmp);
+
+    fprintf(out, "cpuprof: %d samples at %d Hz", ring_count, prof_hz);
+    if (ring_overwritten)
+        fprintf(out, " (%ld older samples overwritten)", ring_overwritten);
+    fprintf(out, "\n  self%%  total%%  function\n");
+
+    int cur = 0;
+    void cb(void *arg, backtrace_frame_t *frame) {
+        if (frame->is_inline) return;
+        fprintf(out, "%6.2f  %6.2f  %s\n",
+            self[cur] * 100.0f / ring_count, total[cur] * 100.0f / ring_count, frame->func);
+    }
+    for (int i=0; i<num && i<max_funcs; i++) {
+        cur = order[i];
+        void *addr = (void*)func_starts[cur];
+        backtrace_symbols_cb(&addr, 1, 0, cb, NULL);
+    }
+
+    free(order);
+    free(self);
+}
+
+void cpuprof_close(void)
+{
+    cpuprof_stop();
+    free(ring);
+    ring = NULL;
+    free(func_starts);
+    func_starts = NULL;
+    num_func_starts = 0;
+}
@@ -28,6 +28,9 @@
 #include "fatfs/ff.h"
 #include "fatfs/ffconf.h"
 #include "fatfs/diskio.h"
+#include "diskcache.h"
+#include "debug_internal.h"
+#include "cop0.h"
 
 /**
  * @defgroup debug Debugging Support
@@ -53,6 +56,15 @@
  *    stored within the ROM image (dragonfs), these debugging features
  *    allow access to an external filesystem in both read and write mode.
  *    Currently, this is possibly on SD cards (#DEBUG_FEATURE_FILE_SD).
+ *    Small accesses to the SD card go through a sector cache with
+ *    read-ahead and write coalescing (see #debug_set_sdfs_cache).
+ *
+ * Writing to the logging channels is slow (especially USB), and by default it
+ * happens synchronously within the call to #debugf. #debug_init_async makes
+ * logging asynchronous: messages are appended to a ring buffer, which is then
+ * drained at each vblank (VI interrupt), writing at most a fixed number of bytes
+ * each time. Messages that do not fit in the buffer are dropped, and counted
+ * (see #debug_get_dropped).
  *
  * All the debugging features can be disabled at compile-time using
  * the standard "NDEBUG" macro. This is suggested when building
@@ -75,9 +87,43 @@ static char sdfs_logic_drive[3] = { 0 };
 /** @brief debug writer functions (USB, SD, IS64) */
 static void (*debug_writer[3])(const uint8_t *buf, int size) = { 0 };
 
+/** @brief index of the SD log writer in #debug_writer (always written synchronously) */
+#define DEBUG_WRITER_SDLOG       2
+
+/**
+ * @brief Nesting count of the cart commands in progress on the main thread.
+ *
+ * SD card commands are sequences of accesses to the cart registers, run with
+ * interrupts enabled. On some flashcarts (eg: SC64, 64drive) USB shares the
+ * same command interface, so the asynchronous log must not be drained from
+ * the VI interrupt while one of these sequences is in progress.
+ */
+static volatile int cart_busy = 0;
+
+/** @brief Maximum time the VI interrupt waits for the USB flashcart (ms) */
+#define ASYNC_LOG_USB_TIMEOUT_MS 2
+
 /** @brief internal backtrace printing function */
 void __debug_backtrace(FILE *out, bool skip_exception);
 
+/**
+ * @brief Ring buffer of the asynchronous log.
+ *
+ * The buffer has a single producer (#__stderr_write, called with interrupts
+ * enabled) and a single consumer (#async_log_drain, called with interrupts
+ * disabled), so it does not need any locking: the producer only moves the
+ * write index and the consumer only moves the read index. Indices are
+ * free-running and wrapped with the mask.
+ */
+static struct {
+	uint8_t *buf;              ///< Buffer (NULL if asynchronous logging is disabled)
+	uint32_t mask;             ///< Size of the buffer minus one (size is a power of two)
+	volatile uint32_t widx;    ///< Write index
+	volatile uint32_t ridx;    ///< Read index
+	int budget;                ///< Maximum number of bytes written at each vblank
+	volatile uint32_t dropped; ///< Number of bytes dropped because the buffer was full
+} async_log;
+
 /*********************************************************************
  * Log writers
  *********************************************************************/
@@ -139,10 +185,88 @@ static void sdlog_write(const uint8_t *data, int len)
 	if (in_write) return;
 
 	in_write = true;
+	cart_busy++;
 	fwrite(data, 1, len, sdlog_file);
+	cart_busy--;
 	in_write = false;
 }
 
+/*********************************************************************
+ * Asynchronous log
+ *********************************************************************/
+
+/** @brief Write data to all the channels drained from the ring buffer */
+static void async_log_write(const uint8_t *data, int len)
+{
+	for (int i=0; i<DEBUG_WRITER_SDLOG; i++)
+		if (debug_writer[i])
+			debug_writer[i](data, len);
+}
+
+/** @brief Append a message to the ring buffer, or drop it if it does not fit */
+static void async_log_push(const uint8_t *data, int len)
+{
+	uint32_t widx = async_log.widx;
+	uint32_t size = async_log.mask + 1;
+
+	if (len > size - (widx - async_log.ridx)) {
+		// Drop the whole message rather than truncating it. The counter is
+		// also updated by the sync path under interrupt, so protect it.
+		disable_interrupts();
+		async_log.dropped += len;
+		enable_interrupts();
+		return;
+	}
+
+	uint32_t off = widx & async_log.mask;
+	uint32_t n = MIN(len, size - off);
+	memcpy(async_log.buf + off, data, n);
+	memcpy(async_log.buf, data + n, len - n);
+
+	// Publish the data only after it has been written
+	MEMORY_BARRIER();
+	async_log.widx = widx + len;
+}
+
+/**
+ * @brief Write pending data from the ring buffer to the log channels
+ *
+ * @note This function must be called with interrupts disabled.
+ *
+ * @param budget    Maximum number of bytes to write
+ */
+static void async_log_drain(int budget)
+{
+	uint32_t widx = async_log.widx;
+	MEMORY_BARRIER();
+
+	while (async_log.ridx != widx && budget > 0) {
+		uint32_t ridx = async_log.ridx;
+		uint32_t off = ridx & async_log.mask;
+		uint32_t n = MIN(widx - ridx, async_log.mask + 1 - off);
+		n = MIN(n, budget);
+
+		async_log_write(async_log.buf + off, n);
+		async_log.ridx = ridx + n;
+		budget -= n;
+	}
+}
+
+/** @brief VI interrupt handler that drains the ring buffer */
+static void async_log_vi(void)
+{
+	// The channels are accessed through PI: if it is busy (DMA or IO
+	// in progress), or the main thread is in the middle of a cart command,
+	// wait for the next vblank.
+	if (cart_busy || (*PI_STATUS & 3))
+		return;
+
+	// Do not stall the interrupt for long if the USB host is not reading
+	int limit = usb_set_timeout_limit(ASYNC_LOG_USB_TIMEOUT_MS);
+	async_log_drain(async_log.budget);
+	usb_set_timeout_limit(limit);
+}
+
 /*********************************************************************
  * FAT backend
  *********************************************************************/
@@ -162,12 +286,21 @@ typedef struct
 } fat_disk_t;
 
 static fat_disk_t fat_disks[FF_VOLUMES] = {0};
+static diskcache_t *fat_caches[FF_VOLUMES] = {0};
+
+/** @brief Size of the sector cache created by #debug_init_sdfs (0 = disabled) */
+static int sdfs_cache_sectors = 16;
+/** @brief Number of sectors read ahead on sequential reads */
+static int sdfs_cache_readahead = 8;
 
 DSTATUS disk_initialize(BYTE pdrv)
 {
+	DSTATUS res = STA_NOINIT;
+	cart_busy++;
 	if (fat_disks[pdrv].disk_initialize)
-		return fat_disks[pdrv].disk_initialize();
-	return STA_NOINIT;
+		res = fat_disks[pdrv].disk_initialize();
+	cart_busy--;
+	return res;
 }
 
 DSTATUS disk_status(BYTE pdrv)
@@ -177,33 +310,68 @@ DSTATUS disk_status(BYTE pdrv)
 	return STA_NOINIT;
 }
 
-DRESULT disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count)
+static DRESULT fat_disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count)
 {
 	_Static_assert(FF_MIN_SS == 512, "this function assumes sector size == 512");
 	_Static_assert(FF_MAX_SS == 512, "this function assumes sector size == 512");
-	if (fat_disks[pdrv].disk_read && PhysicalAddr(buff) < 0x00800000)
+	if (fat_disks[pdrv].disk_read && PhysicalAddr(buff) < 0x00800000) {
+		if (fat_caches[pdrv])
+			return diskcache_read(fat_caches[pdrv], buff, sector, count);
 		return fat_disks[pdrv].disk_read(buff, sector, count);
-	if (fat_disks[pdrv].disk_read_sdram && io_accessible(PhysicalAddr(buff)))
+	}
+	if (fat_disks[pdrv].disk_read_sdram && io_accessible(PhysicalAddr(buff))) {
+		// Reads to SDRAM bypass the cache: write back modified sectors first
+		if (fat_caches[pdrv] && diskcache_flush(fat_caches[pdrv]) != RES_OK)
+			return RES_ERROR;
 		return fat_disks[pdrv].disk_read_sdram(buff, sector, count);
+	}
 	return RES_PARERR;
 }
 
-DRESULT disk_write(BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count)
+static DRESULT fat_disk_write(BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count)
 {
 	_Static_assert(FF_MIN_SS == 512, "this function assumes sector size == 512");
 	_Static_assert(FF_MAX_SS == 512, "this function assumes sector size == 512");
+	if (fat_caches[pdrv])
+		return diskcache_write(fat_caches[pdrv], buff, sector, count);
 	if (fat_disks[pdrv].disk_write)
 		return fat_disks[pdrv].disk_write(buff, sector, count);
 	return RES_PARERR;
 }
 
-DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff)
+static DRESULT fat_disk_ioctl(BYTE pdrv, BYTE cmd, void* buff)
 {
+	if (cmd == CTRL_SYNC && fat_caches[pdrv] && diskcache_flush(fat_caches[pdrv]) != RES_OK)
+		return RES_ERROR;
 	if (fat_disks[pdrv].disk_ioctl)
 		return fat_disks[pdrv].disk_ioctl(cmd, buff);
 	return RES_PARERR;
 }
 
+DRESULT disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count)
+{
+	cart_busy++;
+	DRESULT res = fat_disk_read(pdrv, buff, sector, count);
+	cart_busy--;
+	return res;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count)
+{
+	cart_busy++;
+	DRESULT res = fat_disk_write(pdrv, buff, sector, count);
+	cart_busy--;
+	return res;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff)
+{
+	cart_busy++;
+	DRESULT res = fat_disk_ioctl(pdrv, cmd, buff);
+	cart_busy--;
+	return res;
+}
+
 DWORD get_fattime(void)
 {
 	time_t t = time(NULL);
@@ -272,6 +440,52 @@ static fat_disk_t fat_disk_sd =
 	fat_disk_ioctl_default
 };
 
+/** @brief Memory backing the RAM disk */
+static uint8_t *ramdisk_buf;
+/** @brief Number of sectors in the RAM disk */
+static LBA_t ramdisk_sectors;
+
+static DSTATUS fat_disk_initialize_ram(void)
+{
+	return ramdisk_buf ? 0 : STA_NOINIT;
+}
+
+static DRESULT fat_disk_read_ram(BYTE* buff, LBA_t sector, UINT count)
+{
+	if (sector + count > ramdisk_sectors)
+		return RES_PARERR;
+	memcpy(buff, ramdisk_buf + sector * 512, count * 512);
+	return RES_OK;
+}
+
+static DRESULT fat_disk_write_ram(const BYTE* buff, LBA_t sector, UINT count)
+{
+	if (sector + count > ramdisk_sectors)
+		return RES_PARERR;
+	memcpy(ramdisk_buf + sector * 512, buff, count * 512);
+	return RES_OK;
+}
+
+static DRESULT fat_disk_ioctl_ram(BYTE cmd, void* buff)
+{
+	switch (cmd)
+	{
+		case GET_SECTOR_COUNT: *(LBA_t*)buff = ramdisk_sectors; return RES_OK;
+		case GET_BLOCK_SIZE:   *(DWORD*)buff = 1; return RES_OK;
+		default:               return fat_disk_ioctl_default(cmd, buff);
+	}
+}
+
+static fat_disk_t fat_disk_ram =
+{
+	fat_disk_initialize_ram,
+	fat_disk_status_default,
+	fat_disk_read_ram,
+	NULL,
+	fat_disk_write_ram,
+	fat_disk_ioctl_ram
+};
+
 /*********************************************************************
  * FAT newlib wrappers
  *********************************************************************/
@@ -513,9 +727,28 @@ static bool usb_initialize_once(void) {
 
 static int __stderr_write(char *buf, unsigned int len)
 {
-	for (int i=0; i<sizeof(debug_writer) / sizeof(debug_writer[0]); i++)
-		if (debug_writer[i])
-			debug_writer[i]((uint8_t*)buf, len);
+	if (async_log.buf) {
+		if (C0_STATUS() & C0_STATUS_IE) {
+			async_log_push((uint8_t*)buf, len);
+		} else {
+			// Interrupts are disabled, or we are within an interrupt or
+			// exception handler (eg: an assertion or a crash): the ring buffer
+			// might never be drained, so write synchronously after flushing it.
+			disable_interrupts();
+			async_log_drain(INT32_MAX);
+			async_log_write((uint8_t*)buf, len);
+			enable_interrupts();
+		}
+
+		// FatFs is not reentrant, so it cannot be accessed from the VI
+		// interrupt. The SD log goes through the stdio buffer of the file anyway.
+		if (debug_writer[DEBUG_WRITER_SDLOG])
+			debug_writer[DEBUG_WRITER_SDLOG]((uint8_t*)buf, len);
+	} else {
+		for (int i=0; i<sizeof(debug_writer) / sizeof(debug_writer[0]); i++)
+			if (debug_writer[i])
+				debug_writer[i]((uint8_t*)buf, len);
+	}
 
 	// Pretend stderr is written correctly even if it isn't. 
 	// There's really no benefit in bubbling up I/O errors
@@ -570,16 +803,87 @@ bool debug_init_sdlog(const char *fn, const char *openfmt)
 		return false;
 
 	hook_init_once();
-	debug_writer[2] = sdlog_write;
+	debug_writer[DEBUG_WRITER_SDLOG] = sdlog_write;
+	return true;
+}
+
+bool debug_init_async(int size, int budget)
+{
+	assertf(!async_log.buf, "asynchronous logging already initialized");
+	assertf(budget > 0, "invalid budget: %d", budget);
+
+	// Round the size up to a power of two, so that indices can be wrapped
+	// with a mask. Add some padding as isviewer_write reads data in words.
+	uint32_t sz = 1;
+	while (sz < size) sz <<= 1;
+	uint8_t *buf = malloc(sz + 4);
+	if (!buf)
+		return false;
+
+	async_log.mask = sz - 1;
+	async_log.widx = async_log.ridx = 0;
+	async_log.budget = budget;
+	async_log.dropped = 0;
+
+	// Flush stderr before switching, so that pending data is written in order
+	fflush(stderr);
+	disable_interrupts();
+	async_log.buf = buf;
+	enable_interrupts();
+
+	register_VI_handler(async_log_vi);
 	return true;
 }
 
+void debug_flush(void)
+{
+	fflush(stderr);
+	if (async_log.buf) {
+		disable_interrupts();
+		async_log_drain(INT32_MAX);
+		enable_interrupts();
+	}
+}
+
+uint32_t debug_get_dropped(void)
+{
+	return async_log.dropped;
+}
+
+void debug_set_sdfs_cache(int num_sectors, int readahead)
+{
+	assertf(num_sectors >= 0 && readahead >= 0, "invalid cache configuration: %d sectors, %d readahead", num_sectors, readahead);
+	sdfs_cache_sectors = num_sectors;
+	sdfs_cache_readahead = readahead;
+}
+
+/** @brief Create the sector cache of the mounted disk (if enabled) */
+static void sdfs_cache_init(void)
+{
+	fat_disk_t *disk = &fat_disks[FAT_VOLUME_SD];
+	if (sdfs_cache_sectors > 0 && !fat_caches[FAT_VOLUME_SD])
+		fat_caches[FAT_VOLUME_SD] = diskcache_new(sdfs_cache_sectors, sdfs_cache_readahead,
+			disk->disk_read, disk->disk_write);
+}
+
+/** @brief Write back and free the sector cache of the mounted disk */
+static void sdfs_cache_close(void)
+{
+	if (fat_caches[FAT_VOLUME_SD])
+	{
+		diskcache_flush(fat_caches[FAT_VOLUME_SD]);
+		diskcache_free(fat_caches[FAT_VOLUME_SD]);
+		fat_caches[FAT_VOLUME_SD] = NULL;
+	}
+}
+
 bool debug_init_sdfs(const char *prefix, int npart)
 {
 	if (!sd_initialize_once())
 		return false;
 
 	fat_disks[FAT_VOLUME_SD] = fat_disk_sd;
+	sdfs_cache_init();
 
 	if (npart >= 0) {
 		sdfs_logic_drive[0] = '0' + npart;
@@ -593,6 +897,40 @@ bool debug_init_sdfs(const char *prefix, int npart)
 	if (res != FR_OK)
 	{
 		debugf("Cannot mount SD FAT filesystem: %d\n", res);
+		sdfs_cache_close();
+		return false;
+	}
+
+	strlcpy(sdfs_prefix, prefix, sizeof(sdfs_prefix));
+	attach_filesystem(sdfs_prefix, &fat_fs);
+	enabled_features |= DEBUG_FEATURE_FILE_SD;
+	return true;
+}
+
+bool __debug_init_ramfs(const char *prefix, void *buf, int size)
+{
+	ramdisk_buf = buf;
+	ramdisk_sectors = size / 512;
+	fat_disks[FAT_VOLUME_SD] = fat_disk_ram;
+	sdfs_cache_init();
+	sdfs_logic_drive[0] = '\0';
+
+	// If the memory does not contain a filesystem yet, format it with
+	// a single FAT and no partition table
+	FRESULT res = f_mount(&sd_fat, sdfs_logic_drive, 1);
+	if (res == FR_NO_FILESYSTEM)
+	{
+		BYTE work[FF_MAX_SS];
+		MKFS_PARM opt = { .fmt = FM_FAT | FM_SFD, .n_fat = 1 };
+		res = f_mkfs(sdfs_logic_drive, &opt, work, sizeof(work));
+		if (res == FR_OK)
+			res = f_mount(&sd_fat, sdfs_logic_drive, 1);
+	}
+	if (res != FR_OK)
+	{
+		debugf("Cannot create RAM FAT filesystem: %d\n", res);
+		sdfs_cache_close();
+		ramdisk_buf = NULL;
 		return false;
 	}
 
@@ -602,12 +940,23 @@ bool debug_init_sdfs(const char *prefix, int npart)
 	return true;
 }
 
+bool __debug_get_sdfs_cache_stats(diskcache_stats_t *stats)
+{
+	if (!fat_caches[FAT_VOLUME_SD])
+		return false;
+	diskcache_get_stats(fat_caches[FAT_VOLUME_SD], stats);
+	return true;
+}
+
 void debug_close_sdfs(void)
 {
 	if (enabled_features & DEBUG_FEATURE_FILE_SD)
 	{
 		detach_filesystem(sdfs_prefix);
 		f_mount(NULL, sdfs_logic_drive, 0);
+		sdfs_cache_close();
+		ramdisk_buf = NULL;
+		enabled_features &= ~DEBUG_FEATURE_FILE_SD;
 	}
 }
 
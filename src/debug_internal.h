@@ -0,0 +1,32 @@
+/**
+ * @file debug_internal.h
+ * @brief Debugging Support (internal API)
+ * @ingroup debug
+ */
+
+#ifndef __LIBDRAGON_DEBUG_INTERNAL_H
+#define __LIBDRAGON_DEBUG_INTERNAL_H
+
+#include <stdbool.h>
+#include "diskcache.h"
+
+/**
+ * @brief Mount a FAT filesystem on a RAM disk, in place of the SD card.
+ *
+ * If the memory does not already contain a FAT volume, it is formatted.
+ * The volume is accessed through the same path (sector cache included)
+ * used for the SD card.
+ * This allows to test the filesystem layer without a SD card.
+ * Unmount it with #debug_close_sdfs.
+ *
+ * @param prefix    Prefix of the filesystem (eg: "ram:/")
+ * @param buf       Memory backing the disk
+ * @param size      Size of the memory in bytes
+ * @return          true if the filesystem was created and mounted
+ */
+bool __debug_init_ramfs(const char *prefix, void *buf, int size);
+
+/** @brief Get the statistics of the sector cache of the mounted filesystem (false if disabled) */
+bool __debug_get_sdfs_cache_stats(diskcache_stats_t *stats);
+
+#endif
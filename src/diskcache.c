@@ -0,0 +1,295 @@
+/**
+ * @file diskcache.c
+ * @brief Sector cache for FatFs disks
+ * @ingroup debug
+ *
+ * FatFs (configured with FF_FS_TINY) accesses the FAT, the directories and
+ * the partial sectors of files one sector at a time, through the sector
+ * window of the filesystem object. On a SD card each of these accesses is
+ * a full command roundtrip, so walking a directory or appending small
+ * chunks to a file issues many small, often repeated, commands.
+ *
+ * This module sits between the FatFs disk functions and the disk backend,
+ * and only caches single-sector accesses. Multi-sector accesses are file
+ * data read or written directly from/to the user buffer, which would just
+ * thrash the cache: they go straight to the disk.
+ *
+ * The module has no dependency on the N64 hardware, so that it can also be
+ * compiled and tested on the host on top of a RAM disk (see tests/host,
+ * `make test-host` and `make bench-host`).
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "diskcache.h"
+
+/** @brief Size of a sector */
+#define SECTOR_SIZE             512
+
+/** @brief Minimum number of sectors that can be coalesced into a single write */
+#define DISKCACHE_MIN_COALESCE  8
+
+/** @brief A line of the cache (a single sector) */
+typedef struct {
+    LBA_t sector;               ///< Sector number
+    uint32_t stamp;             ///< Time of the last access (for LRU)
+    bool valid;                 ///< True if the line contains a sector
+    bool dirty;                 ///< True if the sector must be written back
+} diskcache_line_t;
+
+/** @brief A disk cache */
+struct diskcache_s {
+    diskcache_read_fn read;     ///< Function to read from the disk
+    diskcache_write_fn write;   ///< Function to write to the disk
+    int num_lines;              ///< Number of lines
+    int readahead;              ///< Number of sectors to read ahead
+    diskcache_line_t *lines;    ///< Lines of the cache
+    uint8_t *data;              ///< Sector data of the lines
+    uint8_t *staging;           ///< Buffer for multi-sector disk commands
+    int staging_sectors;        ///< Size of the staging buffer in sectors
+    uint32_t clock;             ///< LRU clock
+    LBA_t next_seq;             ///< Sector following the last read (to detect sequential reads)
+    diskcache_stats_t stats;    ///< Statistics
+};
+
+static uint8_t *line_data(diskcache_t *dc, int idx)
+{
+    return dc->data + idx * SECTOR_SIZE;
+}
+
+static int line_find(diskcache_t *dc, LBA_t sector)
+{
+    for (int i=0; i<dc->num_lines; i++)
+        if (dc->lines[i].valid && dc->lines[i].sector == sector)
+            return i;
+    return -1;
+}
+
+static void line_touch(diskcache_t *dc, int idx)
+{
+    dc->lines[idx].stamp = ++dc->clock;
+}
+
+DRESULT diskcache_flush(diskcache_t *dc)
+{
+    // Sort the dirty lines by sector number, so that consecutive sectors
+    // can be written with a single command.
+    int order[dc->num_lines];
+    int n = 0;
+    for (int i=0; i<dc->num_lines; i++) {
+        if (!dc->lines[i].dirty)
+            continue;
+        int j = n++;
+        while (j > 0 && dc->lines[order[j-1]].sector > dc->lines[i].sector) {
+            order[j] = order[j-1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    int i = 0;
+    while (i < n) {
+        LBA_t sector = dc->lines[order[i]].sector;
+        int run = 1;
+        while (i+run < n && run < dc->staging_sectors &&
+               dc->lines[order[i+run]].sector == sector + run)
+            run++;
+
+        const uint8_t *src = line_data(dc, order[i]);
+        if (run > 1) {
+            for (int k=0; k<run; k++)
+                memcpy(dc->staging + k*SECTOR_SIZE, line_data(dc, order[i+k]), SECTOR_SIZE);
+            src = dc->staging;
+        }
+
+        dc->stats.disk_writes++;
+        dc->stats.sectors_written += run;
+        DRESULT res = dc->write(src, sector, run);
+        if (res != RES_OK)
+            return res;
+
+        for (int k=0; k<run; k++)
+            dc->lines[order[i+k]].dirty = false;
+        i += run;
+    }
+    return RES_OK;
+}
+
+/**
+ * @brief Allocate a line, evicting the least recently used one.
+ *
+ * If the evicted line is dirty, all the dirty lines are written back,
+ * so that they are coalesced as much as possible.
+ *
+ * @return Index of the line, or -1 if the write back failed
+ */
+static int line_alloc(diskcache_t *dc, LBA_t sector)
+{
+    int victim = 0;
+    for (int i=0; i<dc->num_lines; i++) {
+        if (!dc->lines[i].valid) {
+            victim = i;
+            break;
+        }
+        if ((int32_t)(dc->lines[i].stamp - dc->lines[victim].stamp) < 0)
+            victim = i;
+    }
+
+    if (dc->lines[victim].dirty && diskcache_flush(dc) != RES_OK)
+        return -1;
+
+    dc->lines[victim].sector = sector;
+    dc->lines[victim].valid = true;
+    dc->lines[victim].dirty = false;
+    line_touch(dc, victim);
+    return victim;
+}
+
+DRESULT diskcache_read(diskcache_t *dc, BYTE* buff, LBA_t sector, UINT count)
+{
+    bool sequential = (sector == dc->next_seq);
+    dc->next_seq = sector + count;
+
+    if (count > 1) {
+        dc->stats.disk_reads++;
+        dc->stats.sectors_read += count;
+        DRESULT res = dc->read(buff, sector, count);
+        if (res != RES_OK)
+            return res;
+
+        // Dirty lines are newer than the disk contents
+        for (int i=0; i<dc->num_lines; i++) {
+            diskcache_line_t *l = &dc->lines[i];
+            if (l->dirty && l->sector >= sector && l->sector < sector + count)
+                memcpy(buff + (l->sector - sector) * SECTOR_SIZE, line_data(dc, i), SECTOR_SIZE);
+        }
+        return RES_OK;
+    }
+
+    int idx = line_find(dc, sector);
+    if (idx >= 0) {
+        dc->stats.hits++;
+        line_touch(dc, idx);
+        memcpy(buff, line_data(dc, idx), SECTOR_SIZE);
+        return RES_OK;
+    }
+    dc->stats.misses++;
+
+    // On a sequential miss, read also the next sectors with the same command.
+    // If that fails (eg: the end of the disk was reached), fall back to
+    // reading the single sector.
+    if (sequential && dc->readahead > 0) {
+        int n = 1 + dc->readahead;
+
+        // Allocate the lines before reading into the staging buffer: evicting
+        // a dirty line flushes the cache, which coalesces the writes in the
+        // same buffer. Sectors already in cache are skipped, as they might
+        // have been modified.
+        int lines[n];
+        for (int k=0; k<n; k++) {
+            lines[k] = -1;
+            if (k > 0 && line_find(dc, sector + k) >= 0)
+                continue;
+            lines[k] = line_alloc(dc, sector + k);
+            if (lines[k] < 0) {
+                for (int j=0; j<k; j++)
+                    if (lines[j] >= 0) dc->lines[lines[j]].valid = false;
+                return RES_ERROR;
+            }
+        }
+
+        dc->stats.disk_reads++;
+        dc->stats.sectors_read += n;
+        if (dc->read(dc->staging, sector, n) == RES_OK) {
+            memcpy(buff, dc->staging, SECTOR_SIZE);
+            for (int k=0; k<n; k++)
+                if (lines[k] >= 0)
+                    memcpy(line_data(dc, lines[k]), dc->staging + k*SECTOR_SIZE, SECTOR_SIZE);
+            return RES_OK;
+        }
+        for (int k=0; k<n; k++)
+            if (lines[k] >= 0) dc->lines[lines[k]].valid = false;
+    }
+
+    idx = line_alloc(dc, sector);
+    if (idx < 0)
+        return RES_ERROR;
+    dc->stats.disk_reads++;
+    dc->stats.sectors_read++;
+    DRESULT res = dc->read(line_data(dc, idx), sector, 1);
+    if (res != RES_OK) {
+        dc->lines[idx].valid = false;
+        return res;
+    }
+    memcpy(buff, line_data(dc, idx), SECTOR_SIZE);
+    return RES_OK;
+}
+
+DRESULT diskcache_write(diskcache_t *dc, const BYTE* buff, LBA_t sector, UINT count)
+{
+    if (count > 1) {
+        // Cached copies of these sectors are superseded by the new data
+        for (int i=0; i<dc->num_lines; i++) {
+            diskcache_line_t *l = &dc->lines[i];
+            if (l->valid && l->sector >= sector && l->sector < sector + count)
+                l->valid = l->dirty = false;
+        }
+        dc->stats.disk_writes++;
+        dc->stats.sectors_written += count;
+        return dc->write(buff, sector, count);
+    }
+
+    int idx = line_find(dc, sector);
+    if (idx < 0) {
+        idx = line_alloc(dc, sector);
+        if (idx < 0)
+            return RES_ERROR;
+    } else {
+        line_touch(dc, idx);
+    }
+    memcpy(line_data(dc, idx), buff, SECTOR_SIZE);
+    dc->lines[idx].dirty = true;
+    return RES_OK;
+}
+
+diskcache_t *diskcache_new(int num_sectors, int readahead, diskcache_read_fn read, diskcache_write_fn write)
+{
+    if (num_sectors < 1)
+        return NULL;
+    // Read-ahead sectors must fit in the cache together with the requested one
+    if (readahead > num_sectors - 1)
+        readahead = num_sectors - 1;
+    if (readahead < 0)
+        readahead = 0;
+
+    diskcache_t *dc = calloc(1, sizeof(diskcache_t));
+    if (!dc)
+        return NULL;
+    dc->read = read;
+    dc->write = write;
+    dc->num_lines = num_sectors;
+    dc->readahead = readahead;
+    dc->staging_sectors = readahead + 1 > DISKCACHE_MIN_COALESCE ? readahead + 1 : DISKCACHE_MIN_COALESCE;
+    dc->next_seq = (LBA_t)-1;
+    dc->lines = calloc(num_sectors, sizeof(diskcache_line_t));
+    dc->data = malloc(num_sectors * SECTOR_SIZE);
+    dc->staging = malloc(dc->staging_sectors * SECTOR_SIZE);
+    if (!dc->lines || !dc->data || !dc->staging) {
+        diskcache_free(dc);
+        return NULL;
+    }
+    return dc;
+}
+
+void diskcache_free(diskcache_t *dc)
+{
+    free(dc->lines);
+    free(dc->data);
+    free(dc->staging);
+    free(dc);
+}
+
+void diskcache_get_stats(diskcache_t *dc, diskcache_stats_t *stats)
+{
+    *stats = dc->stats;
+}
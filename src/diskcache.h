@@ -0,0 +1,67 @@
+/**
+ * @file diskcache.h
+ * @brief Sector cache for FatFs disks
+ * @ingroup debug
+ */
+#ifndef __LIBDRAGON_DISKCACHE_H
+#define __LIBDRAGON_DISKCACHE_H
+
+#include <stdint.h>
+#include "fatfs/ff.h"
+#include "fatfs/diskio.h"
+
+/// @cond
+typedef struct diskcache_s diskcache_t;
+/// @endcond
+
+/** @brief Function used by the cache to read sectors from the disk */
+typedef DRESULT (*diskcache_read_fn)(BYTE* buff, LBA_t sector, UINT count);
+/** @brief Function used by the cache to write sectors to the disk */
+typedef DRESULT (*diskcache_write_fn)(const BYTE* buff, LBA_t sector, UINT count);
+
+/** @brief Statistics of a disk cache */
+typedef struct {
+    uint32_t hits;              ///< Single-sector reads served by the cache
+    uint32_t misses;            ///< Single-sector reads that required a disk access
+    uint32_t disk_reads;        ///< Number of read commands sent to the disk
+    uint32_t disk_writes;       ///< Number of write commands sent to the disk
+    uint32_t sectors_read;      ///< Number of sectors read from the disk
+    uint32_t sectors_written;   ///< Number of sectors written to the disk
+} diskcache_stats_t;
+
+/**
+ * @brief Create a sector cache on top of a disk
+ *
+ * The cache keeps the last @p num_sectors single-sector accesses in an LRU
+ * set. Sequential single-sector misses also read the next @p readahead
+ * sectors with the same disk command. Single-sector writes are kept in the
+ * cache and written back by #diskcache_flush (or when evicted), merging
+ * consecutive sectors into a single disk command.
+ *
+ * Multi-sector accesses (file data transferred directly from/to the
+ * user buffer) bypass the cache.
+ *
+ * @param num_sectors   Number of sectors in the cache
+ * @param readahead     Number of sectors read ahead on sequential misses
+ * @param read          Function to read sectors from the disk
+ * @param write         Function to write sectors to the disk
+ * @return              The new cache, or NULL if out of memory
+ */
+diskcache_t *diskcache_new(int num_sectors, int readahead, diskcache_read_fn read, diskcache_write_fn write);
+
+/** @brief Free a cache. Pending writes are discarded: call #diskcache_flush first. */
+void diskcache_free(diskcache_t *dc);
+
+/** @brief Read sectors through the cache */
+DRESULT diskcache_read(diskcache_t *dc, BYTE* buff, LBA_t sector, UINT count);
+
+/** @brief Write sectors through the cache */
+DRESULT diskcache_write(diskcache_t *dc, const BYTE* buff, LBA_t sector, UINT count);
+
+/** @brief Write all the modified sectors to the disk */
+DRESULT diskcache_flush(diskcache_t *dc);
+
+/** @brief Get the statistics of the cache */
+void diskcache_get_stats(diskcache_t *dc, diskcache_stats_t *stats);
+
+#endif
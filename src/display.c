@@ -11,6 +11,7 @@
 #include "n64sys.h"
 #include "vi.h"
 #include "display.h"
+#include "display_internal.h"
 #include "interrupt.h"
 #include "utils.h"
 #include "debug.h"
@@ -45,6 +46,10 @@ static uint32_t frame_times[FPS_WINDOW];
 static int frame_times_index = 0;
 /** @brief Current duration of the frame window (time elapsed for FPS_WINDOW frames) */
 static uint32_t frame_times_duration;
+/** @brief Time at which the input used to draw each surface was read (see #__display_latency_hooks) */
+static uint32_t input_ticks[NUM_BUFFERS];
+
+const display_latency_hooks_t *__display_latency_hooks = NULL;
 
 /** @brief Get the next buffer index (with wraparound) */
 static inline int buffer_next(int idx) {
@@ -72,6 +77,8 @@ static void __display_callback()
     if (ready_mask & (1 << next)) {
         now_showing = next;
         ready_mask &= ~(1 << next);
+        if (__display_latency_hooks)
+            __display_latency_hooks->frame_shown(input_ticks[next]);
     }
 
     vi_write_dram_register(__safe_buffer[now_showing] + (interlaced && !field ? __width * __bitdepth : 0));
@@ -360,6 +367,7 @@ void display_show( surface_t* surf )
 
     drawing_mask &= ~(1 << i);
     ready_mask |= 1 << i;
+    input_ticks[i] = __display_latency_hooks ? __display_latency_hooks->frame_input() : 0;
 
     /* Record the time at which this frame was (asked to be) shown */
     uint32_t old_ticks = frame_times[frame_times_index];
@@ -0,0 +1,23 @@
+/**
+ * @file display_internal.h
+ * @brief Display Subsystem internal API
+ * @ingroup display
+ */
+
+#ifndef __LIBDRAGON_DISPLAY_INTERNAL_H
+#define __LIBDRAGON_DISPLAY_INTERNAL_H
+
+#include <stdint.h>
+
+/** @brief Hooks used to measure the input-to-display latency */
+typedef struct {
+    /** @brief Called by #display_show: return the time at which the input used to draw the frame was read (0: unknown) */
+    uint32_t (*frame_input)(void);
+    /** @brief Called under interrupt when the frame starts being displayed, with the value returned by frame_input */
+    void (*frame_shown)(uint32_t input_ticks);
+} display_latency_hooks_t;
+
+/** @brief Latency hooks (installed by #controller_init), or NULL */
+extern const display_latency_hooks_t *__display_latency_hooks;
+
+#endif
@@ -40,6 +40,14 @@
  * maximum.  Directories can be 100 levels deep at maximum.  There can be 4 files open
  * simultaneously.
  *
+ * 'mkdfs' stores files with identical contents only once, so multiple directory
+ * entries can refer to the same data in ROM. By default, file contents are laid
+ * out in directory order; the '--order' option accepts a manifest (a list of paths,
+ * one per line, eg: recorded by logging the files opened while loading a level) to
+ * place files that are loaded together next to each other, so that they can be
+ * read with sequential PI accesses. In Makefiles using n64.mk, the manifest can be
+ * passed via the MKDFS_FLAGS variable.
+ *
  * When DFS is initialized, it will register itself with newlib using 'rom:/' as a prefix.
  * Files can be accessed either with standard POSIX functions (open, fopen) using the 'rom:/'
  * prefix or the lower-level DFS API calls without prefix. In most cases, it is not necessary
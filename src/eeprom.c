@@ -7,7 +7,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include "eeprom.h"
+#include "eeprom_internal.h"
 #include "joybus.h"
+#include "joybus_internal.h"
 
 /**
  * @brief Read the status of the EEPROM.
@@ -108,19 +110,18 @@ void eeprom_read( uint8_t block, uint8_t * dest )
 }
 
 /**
- * @brief Write a block to EEPROM.
- *
- * @param[in] block
- *            Block to write data to. Joybus accesses EEPROM in 8-byte blocks.
+ * @brief Prepare the Joybus command block to write a block to EEPROM.
  *
- * @param[in] src
- *            Source buffer for the eight bytes of data to write to EEPROM.
- *
- * @return the EEPROM status byte
+ * @param[out] input
+ *             Joybus command block
+ * @param[in]  block
+ *             Block to write data to
+ * @param[in]  src
+ *             Source buffer for the eight bytes of data to write to EEPROM.
  */
-uint8_t eeprom_write( uint8_t block, const uint8_t * src )
+static void eeprom_write_command( uint64_t * input, uint8_t block, const uint8_t * src )
 {
-    uint64_t input[JOYBUS_BLOCK_DWORDS] =
+    const uint64_t command[JOYBUS_BLOCK_DWORDS] =
     {
         0x000000000a010500 | block,
         0x0000000000000000,
@@ -131,15 +132,63 @@ uint8_t eeprom_write( uint8_t block, const uint8_t * src )
         0,
         1
     };
-    uint64_t output[JOYBUS_BLOCK_DWORDS];
 
+    memcpy( input, command, JOYBUS_BLOCK_SIZE );
     memcpy( &input[1], src, EEPROM_BLOCK_SIZE );
+}
+
+/**
+ * @brief Write a block to EEPROM.
+ *
+ * @param[in] block
+ *            Block to write data to. Joybus accesses EEPROM in 8-byte blocks.
+ *
+ * @param[in] src
+ *            Source buffer for the eight bytes of data to write to EEPROM.
+ *
+ * @return the EEPROM status byte
+ */
+uint8_t eeprom_write( uint8_t block, const uint8_t * src )
+{
+    uint64_t input[JOYBUS_BLOCK_DWORDS];
+    uint64_t output[JOYBUS_BLOCK_DWORDS];
+
+    eeprom_write_command( input, block, src );
 
     joybus_exec( input, output );
 
     return output[2] >> 56;
 }
 
+/**
+ * @brief Write a block to EEPROM in background.
+ *
+ * The write command is queued to Joybus and the function returns immediately;
+ * the source buffer can be reused as soon as the function returns. The callback
+ * is called under interrupt when the command has been executed (the status byte
+ * is in the top byte of the third word of the output block).
+ *
+ * After a write, EEPROM is busy for approximately 15 milliseconds, so the caller
+ * should throttle subsequent writes accordingly.
+ *
+ * @param[in] block
+ *            Block to write data to
+ * @param[in] src
+ *            Source buffer for the eight bytes of data to write to EEPROM.
+ * @param[in] callback
+ *            Completion callback (can be NULL)
+ * @param[in] ctx
+ *            Opaque context passed to the callback
+ */
+void __eeprom_write_async( uint8_t block, const uint8_t * src, void (*callback)(uint64_t *output, void *ctx), void *ctx )
+{
+    uint64_t input[JOYBUS_BLOCK_DWORDS];
+
+    eeprom_write_command( input, block, src );
+
+    joybus_exec_async( input, callback, ctx );
+}
+
 /**
  * @brief Read a buffer of bytes from EEPROM.
  *
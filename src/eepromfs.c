@@ -9,6 +9,7 @@
 #include "libdragon.h"
 #include "system.h"
 #include "utils.h"
+#include "eeprom_internal.h"
 
 /**
  * @brief EEPROM Filesystem file descriptor.
@@ -64,18 +65,83 @@ static eepfs_file_t * eepfs_files = NULL;
  */
 static uint16_t eepfs_files_checksum = 0;
 
+/** @brief Maximum number of EEPROM blocks (16k EEPROM) */
+#define EEPFS_MAX_BLOCKS 256
+
 /**
- * @brief Calculates a CRC-16 checksum from an array of bytes.
+ * @brief Commit journal.
  * 
- * CRC-16/CCITT-FALSE, CRC-16/IBM-3740:
- * poly=0x1021, init=0xFFFF, xorout=0x0000
+ * Commits that span multiple blocks are made atomic with a journal stored
+ * in the EEPROM blocks not used by the files. The journal is made of a
+ * header block, followed by the index blocks (the numbers of the target
+ * blocks, one byte each) and by the data blocks. A commit first writes the
+ * new contents of the blocks into the journal, then the header (with the
+ * number of blocks, a generation counter and a CRC of the whole journal),
+ * then the blocks in place, and finally clears the header.
  * 
- * @see https://stackoverflow.com/a/23726131
+ * If the commit is interrupted (eg: the console is turned off) before the
+ * header is written, the header does not validate and the previous contents
+ * are still in place. If it is interrupted after that, #eepfs_init finds a
+ * valid header and completes the commit. Either way, the files are never
+ * left in an intermediate state.
+ * 
+ * A commit larger than the journal is split into multiple transactions,
+ * each of them atomic. Single-block commits are written directly in place.
  */
-static uint16_t calculate_crc16(const uint8_t * data, size_t len)
+typedef struct eepfs_journal_t
+{
+    /** @brief First block of the journal (the header) */
+    size_t start_block;
+    /** @brief Number of index blocks */
+    size_t index_blocks;
+    /** @brief Maximum number of blocks in a transaction (0 if there is no room for the journal) */
+    size_t max_blocks;
+    /** @brief Generation counter of the transactions */
+    uint8_t generation;
+    /** @brief Index (target blocks) followed by the data of the transaction in progress */
+    uint8_t * buf;
+    /** @brief Number of blocks in the transaction in progress (0 if none) */
+    size_t count;
+    /** @brief Number of EEPROM writes already performed for the transaction */
+    size_t step;
+} eepfs_journal_t;
+
+/** @brief First magic byte of the journal header */
+#define EEPFS_JOURNAL_MAGIC0 'e'
+/** @brief Second magic byte of the journal header */
+#define EEPFS_JOURNAL_MAGIC1 'j'
+
+/** @brief The commit journal (see #eepfs_journal_t) */
+static eepfs_journal_t eepfs_journal;
+
+/**
+ * @brief RAM shadow of the whole EEPROM.
+ * 
+ * Loaded by #eepfs_init. Reads are served from the shadow, and writes
+ * are diffed against it so that only changed blocks are written.
+ */
+static uint8_t * eepfs_shadow = NULL;
+
+/** @brief Bitmap of the blocks changed in the shadow and not yet written to EEPROM */
+static volatile uint32_t eepfs_dirty[EEPFS_MAX_BLOCKS / 32];
+
+/** @brief True if dirty blocks are being written in background */
+static volatile bool eepfs_async = false;
+
+/** @brief True if a background block write has been issued and not completed yet */
+static volatile bool eepfs_async_inflight = false;
+
+/** @brief True if #eepfs_vi_tick is registered as VI handler */
+static bool eepfs_vi_registered = false;
+
+/**
+ * @brief Updates a CRC-16 checksum with an array of bytes.
+ * 
+ * @see #calculate_crc16
+ */
+static uint16_t update_crc16(uint16_t crc, const uint8_t * data, size_t len)
 {
     uint8_t x;
-    uint16_t crc = 0xFFFF;
 
     while ( len-- )
     {
@@ -92,6 +158,19 @@ static uint16_t calculate_crc16(const uint8_t * data, size_t len)
     return crc;
 }
 
+/**
+ * @brief Calculates a CRC-16 checksum from an array of bytes.
+ * 
+ * CRC-16/CCITT-FALSE, CRC-16/IBM-3740:
+ * poly=0x1021, init=0xFFFF, xorout=0x0000
+ * 
+ * @see https://stackoverflow.com/a/23726131
+ */
+static uint16_t calculate_crc16(const uint8_t * data, size_t len)
+{
+    return update_crc16(0xFFFF, data, len);
+}
+
 /**
  * @brief Generates a signature based on the filesystem configuration.
  * 
@@ -204,6 +283,311 @@ static const eepfs_file_t * eepfs_get_file(int handle)
     return NULL;
 }
 
+/**
+ * @brief Updates the RAM shadow with new contents for a range of blocks.
+ * 
+ * Blocks whose contents actually change are marked as dirty. The bytes of
+ * the last block beyond the end of the source buffer are left untouched.
+ * 
+ * @param[in] start_block
+ *            First block to update
+ * @param[in] src
+ *            New contents, or NULL to fill the blocks with zeroes
+ * @param[in] len
+ *            Number of bytes to update
+ */
+static void eepfs_shadow_update(size_t start_block, const uint8_t * src, size_t len)
+{
+    uint8_t block_buf[EEPROM_BLOCK_SIZE];
+
+    for ( size_t block = start_block; len > 0; ++block )
+    {
+        uint8_t * const shadow = &eepfs_shadow[block * EEPROM_BLOCK_SIZE];
+        const size_t block_len = MIN(len, EEPROM_BLOCK_SIZE);
+
+        memcpy(block_buf, shadow, EEPROM_BLOCK_SIZE);
+        if ( src ) memcpy(block_buf, src, block_len);
+        else memset(block_buf, 0, block_len);
+
+        if ( memcmp(block_buf, shadow, EEPROM_BLOCK_SIZE) != 0 )
+        {
+            /* The background commit must not see a half-updated block */
+            disable_interrupts();
+            memcpy(shadow, block_buf, EEPROM_BLOCK_SIZE);
+            eepfs_dirty[block / 32] |= 1u << (block % 32);
+            enable_interrupts();
+        }
+
+        if ( src ) src += block_len;
+        len -= block_len;
+    }
+}
+
+/**
+ * @brief Returns the first dirty block (or -1 if there are none), and the number of dirty blocks.
+ */
+static int eepfs_find_dirty(int * count)
+{
+    int first = -1;
+    *count = 0;
+
+    for ( int i = 0; i < EEPFS_MAX_BLOCKS / 32; ++i )
+    {
+        const uint32_t bits = eepfs_dirty[i];
+        if ( bits )
+        {
+            if ( first < 0 ) first = i * 32 + __builtin_ctz(bits);
+            *count += __builtin_popcount(bits);
+        }
+    }
+
+    return first;
+}
+
+/** @brief Clears the dirty bit of a block */
+static void eepfs_clear_dirty(int block)
+{
+    disable_interrupts();
+    eepfs_dirty[block / 32] &= ~(1u << (block % 32));
+    enable_interrupts();
+}
+
+/** @brief Returns the data area of the journal buffer */
+static uint8_t * eepfs_journal_data(void)
+{
+    return eepfs_journal.buf + eepfs_journal.index_blocks * EEPROM_BLOCK_SIZE;
+}
+
+/**
+ * @brief Builds the journal header block for a transaction.
+ * 
+ * @param[out] header
+ *             Header block
+ * @param[in]  count
+ *             Number of blocks in the transaction (0 for an empty journal)
+ * @param[in]  index
+ *             Target blocks of the transaction
+ * @param[in]  data
+ *             New contents of the target blocks
+ */
+static void eepfs_journal_header(uint8_t * header, size_t count, const uint8_t * index, const uint8_t * data)
+{
+    header[0] = EEPFS_JOURNAL_MAGIC0;
+    header[1] = EEPFS_JOURNAL_MAGIC1;
+    header[2] = eepfs_journal.generation;
+    header[3] = count;
+
+    uint16_t crc = update_crc16(0xFFFF, header, 4);
+    crc = update_crc16(crc, index, count);
+    crc = update_crc16(crc, data, count * EEPROM_BLOCK_SIZE);
+    header[4] = crc >> 8;
+    header[5] = crc & 0xFF;
+    header[6] = 0;
+    header[7] = 0;
+}
+
+/**
+ * @brief Starts a journal transaction with the first dirty blocks.
+ * 
+ * The contents of the blocks are copied, so that the shadow can be
+ * changed again while the transaction is in progress.
+ */
+static void eepfs_journal_begin(void)
+{
+    uint8_t * const index = eepfs_journal.buf;
+    uint8_t * const data = eepfs_journal_data();
+    size_t count = 0;
+
+    memset(index, 0, eepfs_journal.index_blocks * EEPROM_BLOCK_SIZE);
+    for ( int block = 1; block < eepfs_journal.start_block && count < eepfs_journal.max_blocks; ++block )
+    {
+        if ( eepfs_dirty[block / 32] & (1u << (block % 32)) )
+        {
+            disable_interrupts();
+            memcpy(&data[count * EEPROM_BLOCK_SIZE], &eepfs_shadow[block * EEPROM_BLOCK_SIZE], EEPROM_BLOCK_SIZE);
+            eepfs_dirty[block / 32] &= ~(1u << (block % 32));
+            enable_interrupts();
+            index[count++] = block;
+        }
+    }
+
+    eepfs_journal.generation++;
+    eepfs_journal.count = count;
+    eepfs_journal.step = 0;
+}
+
+/**
+ * @brief Performs the next step of the commit of the dirty blocks.
+ * 
+ * A step writes a single block, using the specified function. See
+ * #eepfs_journal_t for the sequence of writes of a transaction.
+ * 
+ * @param[in] write
+ *            Function used to write a block to EEPROM
+ * 
+ * @return true if a block was written, false if the commit is complete
+ */
+static bool eepfs_commit_step(void (*write)(uint8_t block, const uint8_t * src))
+{
+    if ( eepfs_journal.count == 0 )
+    {
+        int count;
+        const int block = eepfs_find_dirty(&count);
+
+        if ( block < 0 )
+        {
+            return false;
+        }
+
+        /* A single block is atomic by itself. Without room for
+           the journal, blocks can only be written in place. */
+        if ( count == 1 || eepfs_journal.max_blocks == 0 )
+        {
+            eepfs_clear_dirty(block);
+            write(block, &eepfs_shadow[block * EEPROM_BLOCK_SIZE]);
+            return true;
+        }
+
+        eepfs_journal_begin();
+    }
+
+    const size_t count = eepfs_journal.count;
+    const size_t index_blocks = DIVIDE_CEIL(count, EEPROM_BLOCK_SIZE);
+    const uint8_t * const index = eepfs_journal.buf;
+    const uint8_t * const data = eepfs_journal_data();
+    const size_t data_start = eepfs_journal.start_block + 1 + eepfs_journal.index_blocks;
+    size_t step = eepfs_journal.step++;
+    uint8_t header[EEPROM_BLOCK_SIZE];
+
+    /* Write the new contents of the blocks into the journal */
+    if ( step < count )
+    {
+        write(data_start + step, &data[step * EEPROM_BLOCK_SIZE]);
+        return true;
+    }
+    step -= count;
+
+    /* Write the numbers of the target blocks */
+    if ( step < index_blocks )
+    {
+        write(eepfs_journal.start_block + 1 + step, &index[step * EEPROM_BLOCK_SIZE]);
+        return true;
+    }
+    step -= index_blocks;
+
+    /* Write the header: from now on, the transaction is committed */
+    if ( step == 0 )
+    {
+        eepfs_journal_header(header, count, index, data);
+        write(eepfs_journal.start_block, header);
+        return true;
+    }
+    step -= 1;
+
+    /* Write the blocks in place */
+    if ( step < count )
+    {
+        write(index[step], &data[step * EEPROM_BLOCK_SIZE]);
+        return true;
+    }
+
+    /* Clear the header, so that the journal is not replayed over later
+       writes performed in place */
+    eepfs_journal_header(header, 0, index, data);
+    eepfs_journal.count = 0;
+    write(eepfs_journal.start_block, header);
+    return true;
+}
+
+/**
+ * @brief Completes a transaction found in the journal at startup.
+ * 
+ * If the console was turned off during a commit, after the journal header
+ * was written, the blocks are written again in place.
+ */
+static void eepfs_journal_replay(void)
+{
+    const uint8_t * const header = &eepfs_shadow[eepfs_journal.start_block * EEPROM_BLOCK_SIZE];
+    const uint8_t * const index = header + EEPROM_BLOCK_SIZE;
+    const uint8_t * const data = index + eepfs_journal.index_blocks * EEPROM_BLOCK_SIZE;
+
+    if ( header[0] != EEPFS_JOURNAL_MAGIC0 || header[1] != EEPFS_JOURNAL_MAGIC1 )
+    {
+        return;
+    }
+
+    /* Continue with the generation found in EEPROM */
+    eepfs_journal.generation = header[2];
+    const size_t count = header[3];
+    if ( count == 0 || count > eepfs_journal.max_blocks )
+    {
+        return;
+    }
+
+    /* An interrupted write of the journal does not validate */
+    uint8_t expected[EEPROM_BLOCK_SIZE];
+    eepfs_journal_header(expected, count, index, data);
+    if ( memcmp(header, expected, EEPROM_BLOCK_SIZE) != 0 )
+    {
+        return;
+    }
+    for ( size_t i = 0; i < count; ++i )
+    {
+        if ( index[i] == 0 || index[i] >= eepfs_journal.start_block )
+        {
+            return;
+        }
+    }
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        memcpy(&eepfs_shadow[index[i] * EEPROM_BLOCK_SIZE], &data[i * EEPROM_BLOCK_SIZE], EEPROM_BLOCK_SIZE);
+        eeprom_write(index[i], &data[i * EEPROM_BLOCK_SIZE]);
+    }
+
+    eepfs_journal_header(expected, 0, index, data);
+    memcpy(&eepfs_shadow[eepfs_journal.start_block * EEPROM_BLOCK_SIZE], expected, EEPROM_BLOCK_SIZE);
+    eeprom_write(eepfs_journal.start_block, expected);
+}
+
+/** @brief Writes a block to EEPROM, waiting for completion. */
+static void eepfs_write_block_sync(uint8_t block, const uint8_t * src)
+{
+    eeprom_write(block, src);
+}
+
+/** @brief Joybus completion callback of background block writes. */
+static void eepfs_write_block_done(uint64_t * output, void * ctx)
+{
+    eepfs_async_inflight = false;
+}
+
+/** @brief Writes a block to EEPROM in background. */
+static void eepfs_write_block_async(uint8_t block, const uint8_t * src)
+{
+    eepfs_async_inflight = true;
+    __eeprom_write_async(block, src, eepfs_write_block_done, NULL);
+}
+
+/**
+ * @brief VI interrupt handler that drives background commits.
+ * 
+ * Each EEPROM block write keeps the EEPROM busy for about 15 milliseconds,
+ * so background commits write at most one block per frame.
+ */
+static void eepfs_vi_tick(void)
+{
+    if ( !eepfs_async || eepfs_async_inflight )
+    {
+        return;
+    }
+
+    if ( !eepfs_commit_step(eepfs_write_block_async) )
+    {
+        eepfs_async = false;
+    }
+}
+
 /**
  * @brief Initializes the EEPROM filesystem.
  * 
@@ -220,6 +604,16 @@ static const eepfs_file_t * eepfs_get_file(int handle)
  * You can mitigate this by ensuring that your files are aligned to the
  * 8-byte block size and minimizing wasted space with packed structs.
  * 
+ * The blocks not used by the files hold a journal that makes commits
+ * atomic: if the console is turned off while writing a file, the file
+ * keeps either the previous or the new contents. A commit that changes
+ * more blocks than the journal can hold is split into multiple atomic
+ * steps. The journal uses one header block and one index block every
+ * 8 data blocks, so to make every write of a file of N blocks atomic,
+ * leave at least N + N/8 + 2 blocks free. If a previous commit was
+ * interrupted after it was recorded in the journal, this function
+ * completes it.
+ * 
  * Each file will take up a minimum of 1 block, plus the filesystem itself
  * reserves the first block of EEPROM, so the entry count has a practical
  * limit of the number of available EEPROM blocks minus 1:
@@ -297,23 +691,68 @@ int eepfs_init(const eepfs_entry_t * entries, size_t count)
     }
 
     /* Ensure the filesystem will actually fit in available EEPROM */
-    if ( total_blocks > eeprom_total_blocks() )
+    const size_t eeprom_capacity = eeprom_total_blocks();
+    if ( total_blocks > eeprom_capacity )
     {
         eepfs_close();
         return EEPFS_EBADFS;
     }
 
+    /* Load the whole EEPROM into the RAM shadow */
+    eepfs_shadow = malloc(eeprom_capacity * EEPROM_BLOCK_SIZE);
+    if ( eepfs_shadow == NULL )
+    {
+        eepfs_close();
+        return EEPFS_ENOMEM;
+    }
+    eeprom_read_bytes(eepfs_shadow, 0, eeprom_capacity * EEPROM_BLOCK_SIZE);
+    memset((void *)eepfs_dirty, 0, sizeof(eepfs_dirty));
+
     /* Calculate and store the CRC-16 checksum for the declared entries */
     const size_t entries_size = sizeof(eepfs_entry_t) * count;
     eepfs_files_checksum = calculate_crc16((void *)entries, entries_size);
 
+    /* Size the journal to the blocks left after the files: a header,
+       the index blocks and the data blocks. A journal of a single block
+       would be useless, as single-block commits are atomic anyway. */
+    const size_t free_blocks = eeprom_capacity - total_blocks;
+    size_t journal_blocks = free_blocks > 2 ? free_blocks - 2 : 0;
+    while ( journal_blocks > 0 &&
+            1 + DIVIDE_CEIL(journal_blocks, EEPROM_BLOCK_SIZE) + journal_blocks > free_blocks )
+    {
+        journal_blocks--;
+    }
+    if ( journal_blocks < 2 ) journal_blocks = 0;
+
+    memset(&eepfs_journal, 0, sizeof(eepfs_journal));
+    eepfs_journal.start_block = total_blocks;
+    eepfs_journal.index_blocks = DIVIDE_CEIL(journal_blocks, EEPROM_BLOCK_SIZE);
+    eepfs_journal.max_blocks = journal_blocks;
+    if ( journal_blocks > 0 )
+    {
+        eepfs_journal.buf = malloc((eepfs_journal.index_blocks + journal_blocks) * EEPROM_BLOCK_SIZE);
+        if ( eepfs_journal.buf == NULL )
+        {
+            eepfs_close();
+            return EEPFS_ENOMEM;
+        }
+
+        /* Complete a commit interrupted by a power loss. If the signature
+           does not match, the journal belongs to something else. */
+        if ( eepfs_verify_signature() )
+        {
+            eepfs_journal_replay();
+        }
+    }
+
     return EEPFS_ESUCCESS;
 }
 
 /**
  * @brief De-initializes the EEPROM filesystem.
  * 
- * This cleans up the file lookup table.
+ * This completes any pending background write (see #eepfs_flush)
+ * and cleans up the file lookup table.
  * 
  * You probably won't ever need to call this.
  * 
@@ -327,6 +766,21 @@ int eepfs_close(void)
         return EEPFS_EBADFS;
     }
 
+    /* Complete pending writes and free the shadow */
+    if ( eepfs_shadow != NULL )
+    {
+        eepfs_flush();
+        free(eepfs_shadow);
+        eepfs_shadow = NULL;
+    }
+    free(eepfs_journal.buf);
+    memset(&eepfs_journal, 0, sizeof(eepfs_journal));
+    if ( eepfs_vi_registered )
+    {
+        unregister_VI_handler(eepfs_vi_tick);
+        eepfs_vi_registered = false;
+    }
+
     /* Clear the file descriptor table */
     free(eepfs_files);
     eepfs_files = NULL;
@@ -338,6 +792,11 @@ int eepfs_close(void)
 
 /**
  * @brief Reads an entire file from the EEPROM filesystem.
+ * 
+ * The file is read from the RAM shadow of the EEPROM, so this
+ * does not access the EEPROM at all and is very fast. It also
+ * returns data written by #eepfs_write_async that has not been
+ * committed yet.
  *
  * @param[in]  path
  *             Path of file in EEPROM filesystem to read from
@@ -365,7 +824,7 @@ int eepfs_read(const char * path, void * dest, size_t size)
     }
 
     const size_t start_bytes = file->start_block * EEPROM_BLOCK_SIZE;
-    eeprom_read_bytes(dest, start_bytes, file->num_bytes);
+    memcpy(dest, &eepfs_shadow[start_bytes], file->num_bytes);
 
     return EEPFS_ESUCCESS;
 }
@@ -373,8 +832,12 @@ int eepfs_read(const char * path, void * dest, size_t size)
 /**
  * @brief Writes an entire file to the EEPROM filesystem.
  * 
+ * The contents are compared against the RAM shadow of the EEPROM,
+ * and only the blocks that actually changed are written.
+ * 
  * Each EEPROM block write takes approximately 15 milliseconds;
- * this operation may block for a while!
+ * this operation may block for a while if many blocks changed!
+ * See #eepfs_write_async for a non-blocking alternative.
  *
  * @param[in] path
  *            Path of file in EEPROM filesystem to write to
@@ -401,12 +864,125 @@ int eepfs_write(const char * path, const void * src, size_t size)
         return EEPFS_EBADINPUT;
     }
 
-    const size_t start_bytes = file->start_block * EEPROM_BLOCK_SIZE;
-    eeprom_write_bytes(src, start_bytes, file->num_bytes);
+    eepfs_shadow_update(file->start_block, src, file->num_bytes);
+    eepfs_flush();
+
+    return EEPFS_ESUCCESS;
+}
+
+/**
+ * @brief Writes an entire file to the EEPROM filesystem in background.
+ * 
+ * The contents are compared against the RAM shadow of the EEPROM, and
+ * the blocks that changed are written in background, one per frame (from
+ * the VI interrupt), so the function returns immediately. Subsequent
+ * reads return the new contents even before they are committed.
+ * 
+ * Use #eepfs_busy to check whether the commit is complete, or #eepfs_flush
+ * to wait for it. If the commit is interrupted (eg: the console is turned
+ * off), the file will contain either the previous or the new contents at the
+ * next boot, as long as the changed blocks fit in the journal (see #eepfs_init).
+ * 
+ * Background writes require VI interrupts, that are active after
+ * #display_init. Without them, the data is only written by #eepfs_flush
+ * or by the next synchronous operation.
+ *
+ * @param[in] path
+ *            Path of file in EEPROM filesystem to write to
+ * @param[in] src
+ *            Buffer of data to be written
+ * @param[in]  size
+ *             Size of the source buffer (in bytes)
+ *
+ * @return EEPFS_ESUCCESS on success or a negative error otherwise
+ */
+int eepfs_write_async(const char * path, const void * src, size_t size)
+{
+    const int handle = eepfs_find_handle(path);
+    const eepfs_file_t * file = eepfs_get_file(handle);
+
+    if ( file == NULL )
+    {
+        /* File does not exist, return error code */
+        return EEPFS_ENOFILE;
+    }
+    if ( src == NULL || file->num_bytes != size ) 
+    {
+        /* Unusable source buffer */
+        return EEPFS_EBADINPUT;
+    }
+
+    eepfs_shadow_update(file->start_block, src, file->num_bytes);
+
+    /* Start the background commit */
+    if ( !eepfs_vi_registered )
+    {
+        register_VI_handler(eepfs_vi_tick);
+        eepfs_vi_registered = true;
+    }
+    eepfs_async = true;
 
     return EEPFS_ESUCCESS;
 }
 
+/**
+ * @brief Checks whether a background write is in progress.
+ * 
+ * @retval true if some data written by #eepfs_write_async has not been committed yet
+ * @retval false if all writes have been committed to EEPROM
+ */
+bool eepfs_busy(void)
+{
+    return eepfs_async || eepfs_async_inflight;
+}
+
+/**
+ * @brief Waits until all the pending writes are committed to EEPROM.
+ * 
+ * The blocks not yet written by the background commit are written
+ * synchronously, so this function may block for a while.
+ */
+void eepfs_flush(void)
+{
+    if ( eepfs_shadow == NULL )
+    {
+        return;
+    }
+
+    /* Stop the background commit. A block write already issued by it
+       is queued to Joybus before the ones performed here. */
+    disable_interrupts();
+    eepfs_async = false;
+    enable_interrupts();
+
+    while ( eepfs_commit_step(eepfs_write_block_sync) ) {}
+}
+
+/**
+ * @brief Simulates a power loss during the commit of the pending writes.
+ * 
+ * Only the first @p num_writes EEPROM writes of the commit are performed,
+ * and the rest of the commit is discarded. This is used by the tests: the
+ * filesystem must then be closed and initialized again, to see what is
+ * actually stored in EEPROM.
+ * 
+ * @param[in] num_writes
+ *            Number of EEPROM writes to perform
+ */
+void __eepfs_flush_interrupted(int num_writes)
+{
+    disable_interrupts();
+    eepfs_async = false;
+    enable_interrupts();
+
+    while ( num_writes-- > 0 && eepfs_commit_step(eepfs_write_block_sync) ) {}
+
+    disable_interrupts();
+    memset((void *)eepfs_dirty, 0, sizeof(eepfs_dirty));
+    enable_interrupts();
+    eepfs_journal.count = 0;
+}
+
 /**
  * @brief Erases a file in the EEPROM filesystem.
  * 
@@ -434,17 +1010,10 @@ int eepfs_erase(const char * path)
         return EEPFS_ENOFILE;
     }
 
+    /* Fill the whole blocks with zeroes (including padding) */
     const size_t num_blocks = DIVIDE_CEIL(file->num_bytes, EEPROM_BLOCK_SIZE);
-    size_t current_block = file->start_block;
-
-    /* eeprom_buf is initialized to all zeroes */
-    const uint8_t eeprom_buf[EEPROM_BLOCK_SIZE] = {0};
-
-    /* Write the blocks in with zeroes */
-    while ( current_block < file->start_block + num_blocks )
-    {
-        eeprom_write(current_block++, eeprom_buf);
-    }
+    eepfs_shadow_update(file->start_block, NULL, num_blocks * EEPROM_BLOCK_SIZE);
+    eepfs_flush();
 
     return EEPFS_ESUCCESS;
 }
@@ -477,13 +1046,10 @@ bool eepfs_verify_signature(void)
     /* Generate the expected signature for the filesystem */
     const uint64_t signature = eepfs_generate_signature();
 
-    /* Read the signature block out of EEPROM */
-    uint8_t eeprom_buf[EEPROM_BLOCK_SIZE];
-    eeprom_read(0, eeprom_buf);
-
     /* If the signatures don't match, we can be pretty sure
-       that the data in EEPROM is not the expected filesystem */
-    return memcmp(eeprom_buf, (uint8_t *)&signature, EEPROM_BLOCK_SIZE) == 0;
+       that the data in EEPROM is not the expected filesystem. */
+    return eepfs_shadow != NULL &&
+        memcmp(eepfs_shadow, (uint8_t *)&signature, EEPROM_BLOCK_SIZE) == 0;
 }
 
 /**
@@ -505,6 +1071,13 @@ bool eepfs_verify_signature(void)
  */
 void eepfs_wipe(void)
 {
+    /* Stop any pending commit: everything is going to be rewritten */
+    disable_interrupts();
+    eepfs_async = false;
+    memset((void *)eepfs_dirty, 0, sizeof(eepfs_dirty));
+    enable_interrupts();
+    eepfs_journal.count = 0;
+
     /* Write the filesystem signature into the first block */
     const uint64_t signature = eepfs_generate_signature();
     eeprom_write(0, (uint8_t *)&signature);
@@ -520,5 +1093,12 @@ void eepfs_wipe(void)
     {
         eeprom_write(current_block++, eeprom_buf);
     }
+
+    /* Keep the shadow in sync */
+    if ( eepfs_shadow != NULL )
+    {
+        memset(eepfs_shadow, 0, eeprom_capacity * EEPROM_BLOCK_SIZE);
+        memcpy(eepfs_shadow, &signature, EEPROM_BLOCK_SIZE);
+    }
 }
 
@@ -86,8 +86,6 @@ typedef struct {
     void *context;                                                     ///< callback context
 } joybus_msg_t;
 
-#define MAX_JOYBUS_MSGS            8    ///< Maximum number of pending joybus messages
-
 /**
  * @anchor JOYBUS_STATE
  * @name Joybus internal state machine values
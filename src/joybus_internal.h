@@ -9,6 +9,18 @@
 
 #include <stdint.h>
 
+#define MAX_JOYBUS_MSGS            8    ///< Maximum number of pending joybus messages
+
+/**
+ * @brief Maximum number of joybus messages queued under interrupt
+ *
+ * These are queued by the controller autoscan and by the asynchronous
+ * EEPROM writes of eepfs, each of which keeps at most one message in
+ * flight. Code that queues several messages at once must leave room for
+ * them, as they can be queued at any time.
+ */
+#define JOYBUS_IRQ_MSGS            2
+
 void joybus_exec_async(const void * input, void (*callback)(uint64_t *output, void *ctx), void *ctx);
 
 #endif
@@ -6,6 +6,7 @@
 #include <string.h>
 #include "libdragon.h"
 #include "regsinternal.h"
+#include "controller_internal.h"
 
 /**
  * @defgroup cpak Controller Pak Filesystem Routines
@@ -27,6 +28,17 @@
  * first using #delete_mempak_entry.  Code should be careful to check how many blocks
  * are free before writing using #get_mempak_free_space.
  *
+ * The TOC and the entry table of each Controller Pak are cached in RAM, so that
+ * enumerating entries or reading notes does not read them again every time. The
+ * cache is checked against the ID block of the header at each call, so that a
+ * different Controller Pak is detected; #validate_mempak always reloads it, so it
+ * should be called whenever a Controller Pak is (re)inserted, as two Controller
+ * Paks formatted by #format_mempak have identical headers. Raw writes to the
+ * filesystem sectors via #write_mempak_sector are taken into account, while raw
+ * writes via #write_mempak_address are not. The cache is only used for reads:
+ * #write_mempak_entry_data and #delete_mempak_entry always reload the tables
+ * from the Controller Pak before modifying them.
+ *
  * @{
  */
 
@@ -45,6 +57,45 @@
 #define BLOCK_VALID_LAST    0x7F
 /** @} */
 
+/** @brief Address of the ID block in the Controller Pak header */
+#define MEMPAK_ID_ADDRESS   0x20
+/** @brief First sector of the entry table */
+#define MEMPAK_NOTES_SECTOR 3
+
+/**
+ * @brief Cached filesystem tables of a Controller Pak
+ */
+typedef struct
+{
+    /** @brief Whether the cached data is valid */
+    bool valid;
+    /** @brief Sector of the valid TOC (1 or 2) */
+    int toc;
+    /** @brief ID block of the header, used to detect a Controller Pak change */
+    uint8_t id[32];
+    /** @brief Contents of the valid TOC */
+    uint8_t toc_data[MEMPAK_BLOCK_SIZE];
+    /** @brief Contents of the entry table (16 entries of 32 bytes) */
+    uint8_t notes[2 * MEMPAK_BLOCK_SIZE];
+} mempak_cache_t;
+
+/** @brief Cached filesystem tables, for each controller */
+static mempak_cache_t mempak_cache[4];
+
+/**
+ * @brief Invalidate the cached filesystem tables of a Controller Pak
+ *
+ * @param[in] controller
+ *            The controller (0-3) whose cache should be invalidated
+ */
+static void __invalidate_cache( int controller )
+{
+    if( controller >= 0 && controller <= 3 )
+    {
+        mempak_cache[controller].valid = false;
+    }
+}
+
 /**
  * @brief Read a sector from a Controller Pak
  *
@@ -68,13 +119,10 @@ int read_mempak_sector( int controller, int sector, uint8_t *sector_data )
     if( sector_data == 0 ) { return -1; }
 
     /* Sectors are 256 bytes, a Controller Pak reads 32 bytes at a time */
-    for( int i = 0; i < 8; i++ )
+    if( __read_mempak_blocks( controller, sector * MEMPAK_BLOCK_SIZE, sector_data, 8 ) )
     {
-        if( read_mempak_address( controller, (sector * MEMPAK_BLOCK_SIZE) + (i * 32), sector_data + (i * 32) ) )
-        {
-            /* Failed to read a block */
-            return -2;
-        }
+        /* Failed to read a block */
+        return -2;
     }
 
     return 0;
@@ -102,14 +150,14 @@ int write_mempak_sector( int controller, int sector, uint8_t *sector_data )
     if( sector < 0 || sector >= 128 ) { return -1; }
     if( sector_data == 0 ) { return -1; }
 
+    /* Writing the filesystem sectors makes the cached tables stale */
+    if( sector <= MEMPAK_NOTES_SECTOR + 1 ) { __invalidate_cache( controller ); }
+
     /* Sectors are 256 bytes, a Controller Pak writes 32 bytes at a time */
-    for( int i = 0; i < 8; i++ )
+    if( __write_mempak_blocks( controller, sector * MEMPAK_BLOCK_SIZE, sector_data, 8 ) )
     {
-        if( write_mempak_address( controller, (sector * MEMPAK_BLOCK_SIZE) + (i * 32), sector_data + (i * 32) ) )
-        {
-            /* Failed to read a block */
-            return -2;
-        }
+        /* Failed to write a block */
+        return -2;
     }
 
     return 0;
@@ -645,6 +693,9 @@ static int __get_note_block( uint8_t *sector, int inode, int block )
 /**
  * @brief Retrieve the sector number of the first valid TOC found
  *
+ * This also loads the TOC and the entry table into the cache, unless
+ * they are already cached for the Controller Pak currently inserted.
+ *
  * @param[in] controller
  *            The controller (0-3) to inspect for a valid TOC
  *
@@ -657,6 +708,28 @@ static int __get_valid_toc( int controller )
 {
     /* We will need only one sector at a time */
     uint8_t data[MEMPAK_BLOCK_SIZE];
+    int toc;
+
+    if( controller < 0 || controller > 3 ) { return -2; }
+    mempak_cache_t *cache = &mempak_cache[controller];
+
+    /* If the ID block did not change, the cached tables are still valid */
+    if( cache->valid )
+    {
+        if( read_mempak_address( controller, MEMPAK_ID_ADDRESS, data ) )
+        {
+            /* Couldn't read header */
+            cache->valid = false;
+            return -2;
+        }
+
+        if( memcmp( data, cache->id, 32 ) == 0 )
+        {
+            return cache->toc;
+        }
+
+        cache->valid = false;
+    }
 
     /* First check to see that the header block is valid */
     if( read_mempak_sector( controller, 0, data ) )
@@ -671,23 +744,25 @@ static int __get_valid_toc( int controller )
         return -3;
     }
 
+    memcpy( cache->id, &data[MEMPAK_ID_ADDRESS], 32 );
+
     /* Try to read the first TOC */
-    if( read_mempak_sector( controller, 1, data ) )
+    if( read_mempak_sector( controller, 1, cache->toc_data ) )
     {
         /* Couldn't read header */
         return -2;
     }
 
-    if( __validate_toc( data ) )
+    if( __validate_toc( cache->toc_data ) )
     {
         /* First TOC is bad.  Maybe the second works? */
-        if( read_mempak_sector( controller, 2, data ) )
+        if( read_mempak_sector( controller, 2, cache->toc_data ) )
         {
             /* Couldn't read header */
             return -2;
         }
 
-        if( __validate_toc( data ) )
+        if( __validate_toc( cache->toc_data ) )
         {
             /* Second TOC is bad, nothing good on this memcard */
             return -3;
@@ -695,21 +770,33 @@ static int __get_valid_toc( int controller )
         else
         {
             /* Found a good TOC! */
-            return 2;
+            toc = 2;
         }
     }
     else
     {
         /* Found a good TOC! */
-        return 1;
+        toc = 1;
+    }
+
+    /* Grab the entry table, that spans two sectors */
+    if( __read_mempak_blocks( controller, MEMPAK_NOTES_SECTOR * MEMPAK_BLOCK_SIZE, cache->notes, 16 ) )
+    {
+        /* Couldn't read note database */
+        return -2;
     }
+
+    cache->toc = toc;
+    cache->valid = true;
+    return toc;
 }
 
 /**
  * @brief Return whether a Controller Pak is valid
  *
  * This function will return whether the Controller Pak in a particular controller
- * is formatted and valid.
+ * is formatted and valid. It also reloads the cached filesystem tables, so it
+ * should be called whenever a Controller Pak might have been changed.
  *
  * @param[in] controller
  *            The controller (0-3) to validate
@@ -720,6 +807,7 @@ static int __get_valid_toc( int controller )
  */
 int validate_mempak( int controller )
 {
+    __invalidate_cache( controller );
     int toc = __get_valid_toc( controller );
 
     if( toc == 1 || toc == 2 )
@@ -753,7 +841,6 @@ int validate_mempak( int controller )
  */
 int get_mempak_entry( int controller, int entry, entry_structure_t *entry_data )
 {
-    uint8_t data[MEMPAK_BLOCK_SIZE];
     int toc;
 
     if( entry < 0 || entry > 15 ) { return -1; }
@@ -766,29 +853,16 @@ int get_mempak_entry( int controller, int entry, entry_structure_t *entry_data )
         return -2;
     }
 
-    /* Entries are spread across two sectors, but we can luckly grab just one
-       with a single Controller Pak read */
-    if( read_mempak_address( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry * 32), data ) )
-    {
-        /* Couldn't read note database */
-        return -2;
-    }
-
-    if( __read_note( data, entry_data ) )
+    /* Entries are spread across two sectors, which are cached along with the TOC */
+    const mempak_cache_t *cache = &mempak_cache[controller];
+    if( __read_note( (uint8_t *)&cache->notes[entry * 32], entry_data ) )
     {
         /* Note is most likely empty, don't bother getting length */
         return 0;
     }
 
-    /* Grab the TOC sector */
-    if( read_mempak_sector( controller, toc, data ) )
-    {
-        /* Couldn't read TOC */
-        return -2;
-    }
-
     /* Get the length of the entry */
-    int blocks = __get_num_pages( data, entry_data->inode );
+    int blocks = __get_num_pages( (uint8_t *)cache->toc_data, entry_data->inode );
 
     if( blocks > 0 )
     {
@@ -818,7 +892,6 @@ int get_mempak_entry( int controller, int entry, entry_structure_t *entry_data )
  */
 int get_mempak_free_space( int controller )
 {
-    uint8_t data[MEMPAK_BLOCK_SIZE];
     int toc;
 
     /* Make sure Controller Pak is valid */
@@ -828,14 +901,8 @@ int get_mempak_free_space( int controller )
         return -2;
     }
 
-    /* Grab the valid TOC to get free space */
-    if( read_mempak_sector( controller, toc, data ) )
-    {
-        /* Couldn't read TOC */
-        return -2;
-    }
-
-    return __get_free_space( data );
+    /* The valid TOC is cached */
+    return __get_free_space( mempak_cache[controller].toc_data );
 }
 
 /**
@@ -949,7 +1016,6 @@ int format_mempak( int controller )
 int read_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *data )
 {
     int toc;
-    uint8_t tocdata[MEMPAK_BLOCK_SIZE];
 
     /* Some serious sanity checking */
     if( entry == 0 || data == 0 ) { return -1; }
@@ -964,12 +1030,8 @@ int read_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *d
         return -2;
     }
 
-    /* Grab the valid TOC to get free space */
-    if( read_mempak_sector( controller, toc, tocdata ) )
-    {
-        /* Couldn't read TOC */
-        return -2;
-    }
+    /* The valid TOC is cached */
+    uint8_t *tocdata = mempak_cache[controller].toc_data;
 
     /* Now loop through blocks and grab each one */
     for( int i = 0; i < entry->blocks; i++ )
@@ -1021,19 +1083,19 @@ int write_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *
     if( __validate_region( entry->region ) ) { return -1; }
     if( strlen( entry->name ) == 0 ) { return -1; }
 
-    /* Grab valid TOC */
+    /* The cache is only trusted for reads: reload the TOC and the entry
+       table from the Controller Pak, so that the new TOC is never built
+       from stale tables */
+    __invalidate_cache( controller );
     if( (toc = __get_valid_toc( controller )) <= 0 )
     {
         /* Bad Controller Pak or was removed, return */
         return -2;
     }
 
-    /* Grab the valid TOC to get free space */
-    if( read_mempak_sector( controller, toc, sector ) )
-    {
-        /* Couldn't read TOC */
-        return -2;
-    }
+    /* Work on a copy of the TOC, as the cache is updated only once written */
+    mempak_cache_t *cache = &mempak_cache[controller];
+    memcpy( sector, cache->toc_data, MEMPAK_BLOCK_SIZE );
 
     /* Verify that we have enough free space */
     if( __get_free_space( sector ) < entry->blocks )
@@ -1080,6 +1142,9 @@ int write_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *
         entry->game_id = 0x4535;
     }
 
+    /* Until the write is complete, the cached tables might not match the Controller Pak */
+    cache->valid = false;
+
     /* Loop through allocated blocks and write data to sectors */
     for( int i = 0; i < entry->blocks; i++ )
     {
@@ -1097,14 +1162,8 @@ int write_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *
     {
         entry_structure_t tmp_entry;
 
-        if( read_mempak_address( controller, (3 * MEMPAK_BLOCK_SIZE) + (i * 32), tmp_data ) )
-        {
-            /* Couldn't read note database */
-            return -2;
-        }
-
         /* See if we can write to this note */
-        __read_note( tmp_data, &tmp_entry );
+        __read_note( &cache->notes[i * 32], &tmp_entry );
         if( tmp_entry.valid == 0 )
         {
             entry->entry_id = i;
@@ -1140,12 +1199,17 @@ int write_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *
     __write_note( entry, tmp_data );
 
     /* Store entry to empty slot on Controller Pak */
-    if( write_mempak_address( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry->entry_id * 32), tmp_data ) )
+    if( write_mempak_address( controller, (MEMPAK_NOTES_SECTOR * MEMPAK_BLOCK_SIZE) + (entry->entry_id * 32), tmp_data ) )
     {
         /* Couldn't update note database */
         return -2;
     }
 
+    /* Both TOCs now match, so the cached tables can be updated */
+    memcpy( cache->toc_data, sector, MEMPAK_BLOCK_SIZE );
+    memcpy( &cache->notes[entry->entry_id * 32], tmp_data, 32 );
+    cache->valid = true;
+
     return 0;
 }
 
@@ -1176,14 +1240,18 @@ int delete_mempak_entry( int controller, entry_structure_t *entry )
     if( entry->entry_id > 15 ) { return -1; }
     if( entry->inode < BLOCK_VALID_FIRST || entry->inode > BLOCK_VALID_LAST ) { return -1; }
 
-    /* Ensure that the entry passed in matches what's on the Controller Pak */
-    if( read_mempak_address( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry->entry_id * 32), data ) )
+    /* Reload the TOC and the entry table from the Controller Pak: the cache
+       is only trusted for reads, and the new TOC must not be built from it */
+    __invalidate_cache( controller );
+    if( (toc = __get_valid_toc( controller )) <= 0 )
     {
-        /* Couldn't read note database */
+        /* Bad mempak or was removed, return */
         return -2;
     }
+    mempak_cache_t *cache = &mempak_cache[controller];
 
-    if( __read_note( data, &tmp_entry ) )
+    /* Ensure that the entry passed in matches what's on the Controller Pak */
+    if( __read_note( &cache->notes[entry->entry_id * 32], &tmp_entry ) )
     {
         /* Couldn't parse entry, can't be valid */
         return -2;
@@ -1195,27 +1263,20 @@ int delete_mempak_entry( int controller, entry_structure_t *entry )
         return -2;
     }
 
+    /* Until the deletion is complete, the cached tables might not match the Controller Pak */
+    cache->valid = false;
+
     /* The entry matches, so blank it */
     memset( data, 0, 32 );
-    if( write_mempak_address( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry->entry_id * 32), data ) )
+    if( write_mempak_address( controller, (MEMPAK_NOTES_SECTOR * MEMPAK_BLOCK_SIZE) + (entry->entry_id * 32), data ) )
     {
         /* Couldn't update note database */
         return -2;
     }
+    memset( &cache->notes[entry->entry_id * 32], 0, 32 );
 
-    /* Grab the first valid TOC entry */
-    if( (toc = __get_valid_toc( controller )) <= 0 )
-    {
-        /* Bad mempak or was removed, return */
-        return -2;
-    }
-
-    /* Grab the valid TOC to erase sectors */
-    if( read_mempak_sector( controller, toc, data ) )
-    {
-        /* Couldn't read TOC */
-        return -2;
-    }
+    /* Grab a copy of the valid TOC to erase sectors */
+    memcpy( data, cache->toc_data, MEMPAK_BLOCK_SIZE );
 
     /* Erase all blocks out of the TOC */
     int tally = 0;
@@ -1268,6 +1329,10 @@ int delete_mempak_entry( int controller, entry_structure_t *entry )
         return -2;
     }
 
+    /* Both TOCs now match, so the cached tables can be updated */
+    memcpy( cache->toc_data, data, MEMPAK_BLOCK_SIZE );
+    cache->valid = true;
+
     return 0;
 }
 
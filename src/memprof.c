@@ -0,0 +1,422 @@
+/**
+ * @file memprof.c
+ * @brief Heap allocation profiler
+ * @ingroup memprof
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include "memprof.h"
+#include "backtrace.h"
+#include "interrupt.h"
+#include "debug.h"
+#include "usb.h"
+#include "alloc_internal.h"
+
+/** @brief Maximum number of frames recorded for each call site */
+#define MEMPROF_MAX_DEPTH       16
+/** @brief Number of frames of the profiler itself at the top of the backtraces */
+#define MEMPROF_SKIP_FRAMES     2
+/** @brief Empty entry of the site hash table */
+#define SITE_NONE               0xFFFF
+
+/// @cond
+// With the allocation hooks (--wrap), the linker resolves these to the real
+// allocator. They are weak so that the module still links without the hooks,
+// in which case #memprof_init reports the problem.
+extern void *__real_malloc(size_t size) __attribute__((weak));
+extern void *__real_calloc(size_t num, size_t size) __attribute__((weak));
+extern void *__real_realloc(void *ptr, size_t size) __attribute__((weak));
+extern void *__real_memalign(size_t align, size_t size) __attribute__((weak));
+extern void __real_free(void *ptr) __attribute__((weak));
+/// @endcond
+
+/** @brief Header of the dump file (all fields are big-endian) */
+typedef struct {
+    uint32_t magic;             ///< Magic identifier (#MEMPROF_MAGIC)
+    uint32_t version;           ///< Version of the format (#MEMPROF_VERSION)
+    uint32_t max_depth;         ///< Maximum number of frames per call site
+    uint32_t num_sites;         ///< Number of call sites following the header
+    uint32_t live_bytes;        ///< Bytes currently allocated
+    uint32_t peak_bytes;        ///< Peak of bytes allocated at the same time
+    uint32_t num_allocs;        ///< Number of allocations
+    uint32_t num_frees;         ///< Number of frees
+    uint32_t untracked;         ///< Allocations not tracked (tables full, or made while busy)
+} memprof_header_t;
+
+_Static_assert(sizeof(memprof_header_t) == 36, "invalid memprof_header_t size");
+
+/** @brief A live allocation (entry of the allocation hash table) */
+typedef struct {
+    uint32_t ptr;               ///< Address of the allocation (0: empty entry)
+    uint32_t size;              ///< Requested size
+    uint16_t site;              ///< Index of the call site
+} alloc_entry_t;
+
+/** @brief A call site. The frames are stored in #site_frames. */
+typedef struct {
+    uint32_t hash;              ///< Hash of the frames
+    int depth;                  ///< Number of frames
+    int live_allocs;            ///< Number of live allocations
+    int live_bytes;             ///< Bytes currently allocated
+    int peak_bytes;             ///< Peak of bytes allocated at the same time
+    int num_allocs;             ///< Number of allocations
+} site_t;
+
+static bool memprof_on;             ///< True if the profiler is running
+static volatile bool memprof_busy;  ///< True while the profiler is allocating or walking the stack
+static alloc_entry_t *allocs;       ///< Hash table of the live allocations (open addressing)
+static int alloc_bits;              ///< Log2 of the size of #allocs
+static int max_allocs;              ///< Maximum number of live allocations
+static site_t *sites;               ///< Call sites
+static uint32_t *site_frames;       ///< Frames of the call sites (#site_depth per site)
+static uint16_t *site_index;        ///< Hash table of the call sites (indices into #sites)
+static int site_bits;               ///< Log2 of the size of #site_index
+static int max_sites;               ///< Maximum number of call sites
+static int site_depth;              ///< Number of frames recorded for each call site
+static memprof_stats_t stats;       ///< Global statistics
+
+/** @brief Return the home slot of an address in the allocation table */
+static int alloc_slot(uint32_t ptr)
+{
+    return ((ptr >> 3) * 2654435761u) >> (32 - alloc_bits);
+}
+
+/** @brief Find a live allocation (or -1) */
+static int alloc_find(uint32_t ptr)
+{
+    int mask = (1 << alloc_bits) - 1;
+    for (int i = alloc_slot(ptr); allocs[i].ptr; i = (i + 1) & mask)
+        if (allocs[i].ptr == ptr)
+            return i;
+    return -1;
+}
+
+/** @brief Remove an entry from the allocation table, shifting back the following ones */
+static void alloc_remove(int i)
+{
+    int mask = (1 << alloc_bits) - 1;
+    for (int j = (i + 1) & mask; allocs[j].ptr; j = (j + 1) & mask) {
+        // Move the entry into the hole, unless its home slot is in (i, j]
+        int k = alloc_slot(allocs[j].ptr);
+        bool stays = i < j ? (k > i && k <= j) : (k > i || k <= j);
+        if (!stays) {
+            allocs[i] = allocs[j];
+            i = j;
+        }
+    }
+    allocs[i].ptr = 0;
+}
+
+/** @brief Find the call site with the specified frames, creating it if needed (-1 if full) */
+static int site_get(const uint32_t *frames, int depth)
+{
+    uint32_t hash = 2166136261u;
+    for (int i=0; i<depth; i++)
+        hash = (hash ^ frames[i]) * 16777619u;
+
+    int mask = (1 << site_bits) - 1;
+    int i = (hash * 2654435761u) >> (32 - site_bits);
+    for (; site_index[i] != SITE_NONE; i = (i + 1) & mask) {
+        site_t *s = &sites[site_index[i]];
+        if (s->hash == hash && s->depth == depth &&
+            !memcmp(&site_frames[site_index[i] * site_depth], frames, depth * sizeof(uint32_t)))
+            return site_index[i];
+    }
+
+    if (stats.num_sites == max_sites)
+        return -1;
+    int idx = stats.num_sites++;
+    sites[idx] = (site_t){ .hash = hash, .depth = depth };
+    memcpy(&site_frames[idx * site_depth], frames, depth * sizeof(uint32_t));
+    site_index[i] = idx;
+    return idx;
+}
+
+/** @brief Record a new allocation */
+__attribute__((noinline))
+static void memprof_track(void *ptr, size_t size)
+{
+    if (!memprof_on || !ptr)
+        return;
+
+    // An allocation made while another one is being tracked (eg: from an
+    // interrupt handler) cannot be backtraced: just count it.
+    if (memprof_busy) {
+        disable_interrupts();
+        stats.num_allocs++;
+        stats.untracked++;
+        enable_interrupts();
+        return;
+    }
+
+    memprof_busy = true;
+    void *frames[MEMPROF_SKIP_FRAMES + MEMPROF_MAX_DEPTH];
+    int depth = backtrace(frames, MEMPROF_SKIP_FRAMES + site_depth) - MEMPROF_SKIP_FRAMES;
+    if (depth < 0) depth = 0;
+
+    disable_interrupts();
+    stats.num_allocs++;
+    int site = site_get((uint32_t*)frames + MEMPROF_SKIP_FRAMES, depth);
+    if (site < 0 || stats.live_allocs == max_allocs) {
+        stats.untracked++;
+    } else {
+        int mask = (1 << alloc_bits) - 1;
+        int i = alloc_slot((uint32_t)ptr);
+        while (allocs[i].ptr)
+            i = (i + 1) & mask;
+        allocs[i] = (alloc_entry_t){ .ptr = (uint32_t)ptr, .size = size, .site = site };
+
+        site_t *s = &sites[site];
+        s->num_allocs++;
+        s->live_allocs++;
+        s->live_bytes += size;
+        if (s->live_bytes > s->peak_bytes)
+            s->peak_bytes = s->live_bytes;
+        stats.live_allocs++;
+        stats.live_bytes += size;
+        if (stats.live_bytes > stats.peak_bytes)
+            stats.peak_bytes = stats.live_bytes;
+    }
+    enable_interrupts();
+    memprof_busy = false;
+}
+
+/** @brief Record the release of an allocation */
+static void memprof_untrack(void *ptr)
+{
+    if (!memprof_on || !ptr)
+        return;
+
+    disable_interrupts();
+    stats.num_frees++;
+    // Allocations made before memprof_init or not tracked are not found
+    int i = alloc_find((uint32_t)ptr);
+    if (i >= 0) {
+        site_t *s = &sites[allocs[i].site];
+        s->live_allocs--;
+        s->live_bytes -= allocs[i].size;
+        stats.live_allocs--;
+        stats.live_bytes -= allocs[i].size;
+        alloc_remove(i);
+    }
+    enable_interrupts();
+}
+
+/// @cond
+void *__wrap_malloc(size_t size)
+{
+    void *ptr = __real_malloc(size);
+    memprof_track(ptr, size);
+    return ptr;
+}
+
+void *__wrap_calloc(size_t num, size_t size)
+{
+    void *ptr = __real_calloc(num, size);
+    memprof_track(ptr, num * size);
+    return ptr;
+}
+
+void *__wrap_memalign(size_t align, size_t size)
+{
+    void *ptr = __real_memalign(align, size);
+    memprof_track(ptr, size);
+    return ptr;
+}
+
+void *__wrap_realloc(void *old, size_t size)
+{
+    void *ptr = __real_realloc(old, size);
+    // On failure, the old allocation is still valid
+    if (ptr || !size)
+        memprof_untrack(old);
+    memprof_track(ptr, size);
+    return ptr;
+}
+
+void __wrap_free(void *ptr)
+{
+    memprof_untrack(ptr);
+    __real_free(ptr);
+}
+/// @endcond
+
+void memprof_init(int max_allocs_, int max_sites_, int depth)
+{
+    assertf(__real_malloc, "memprof requires the allocation hooks\n"
+        "Set N64_MEMPROF=1 in the Makefile (or link with --wrap for malloc, calloc, realloc, memalign and free)");
+    assertf(!memprof_on, "memprof_init already called");
+    assertf(max_allocs_ > 0 && max_sites_ > 0 && max_sites_ < SITE_NONE, "invalid memprof parameters");
+    assertf(depth > 0 && depth <= MEMPROF_MAX_DEPTH, "invalid memprof depth: %d (max: %d)", depth, MEMPROF_MAX_DEPTH);
+
+    // Keep the hash tables at most half full
+    alloc_bits = 1; while ((1 << alloc_bits) < max_allocs_ * 2) alloc_bits++;
+    site_bits = 1; while ((1 << site_bits) < max_sites_ * 2) site_bits++;
+    max_allocs = max_allocs_;
+    max_sites = max_sites_;
+    site_depth = depth;
+
+    // The tables are allocated with the real allocator, so they are not tracked
+    allocs = __real_calloc(1 << alloc_bits, sizeof(alloc_entry_t));
+    sites = __real_calloc(max_sites, sizeof(site_t));
+    site_frames = __real_calloc(max_sites * depth, sizeof(uint32_t));
+    site_index = __real_malloc((1 << site_bits) * sizeof(uint16_t));
+    assertf(allocs && sites && site_frames && site_index, "not enough memory for the memprof tables");
+    memset(site_index, 0xFF, (1 << site_bits) * sizeof(uint16_t));
+
+    memset(&stats, 0, sizeof(stats));
+    memprof_on = true;
+}
+
+void memprof_get_stats(memprof_stats_t *out)
+{
+    disable_interrupts();
+    *out = stats;
+    enable_interrupts();
+}
+
+/** @brief Return true if site a must be listed before site b */
+static bool site_before(const site_t *a, const site_t *b)
+{
+    if (a->live_bytes != b->live_bytes)
+        return a->live_bytes > b->live_bytes;
+    return a->peak_bytes > b->peak_bytes;
+}
+
+int memprof_get_sites(memprof_site_t *out, int max)
+{
+    int order[max];
+    int num = 0;
+
+    // Keep the indices of the best sites, sorted (insertion sort)
+    disable_interrupts();
+    for (int i=0; i<stats.num_sites; i++) {
+        int j = num < max ? num++ : max;
+        while (j > 0 && site_before(&sites[i], &sites[order[j-1]])) {
+            if (j < max)
+                order[j] = order[j-1];
+            j--;
+        }
+        if (j < max)
+            order[j] = i;
+    }
+    for (int i=0; i<num; i++) {
+        site_t *s = &sites[order[i]];
+        out[i] = (memprof_site_t){
+            .live_allocs = s->live_allocs,
+            .live_bytes = s->live_bytes,
+            .peak_bytes = s->peak_bytes,
+            .num_allocs = s->num_allocs,
+            .depth = s->depth,
+            .frames = (void**)&site_frames[order[i] * site_depth],
+        };
+    }
+    enable_interrupts();
+    return num;
+}
+
+/** @brief Serialize the call sites calling the specified function for each chunk of data */
+static void memprof_serialize(void (*write)(void *arg, const void *data, int size), void *arg)
+{
+    memprof_header_t header = {
+        .magic = MEMPROF_MAGIC,
+        .version = MEMPROF_VERSION,
+        .max_depth = site_depth,
+        .num_sites = stats.num_sites,
+        .live_bytes = stats.live_bytes,
+        .peak_bytes = stats.peak_bytes,
+        .num_allocs = stats.num_allocs,
+        .num_frees = stats.num_frees,
+        .untracked = stats.untracked,
+    };
+    write(arg, &header, sizeof(header));
+    for (int i=0; i<header.num_sites; i++) {
+        site_t *s = &sites[i];
+        uint32_t rec[5] = { s->live_allocs, s->live_bytes, s->peak_bytes, s->num_allocs, s->depth };
+        write(arg, rec, sizeof(rec));
+        write(arg, &site_frames[i * site_depth], s->depth * sizeof(uint32_t));
+    }
+}
+
+void memprof_dump(FILE *out)
+{
+    assertf(memprof_on, "memprof_init must be called first");
+    void write(void *arg, const void *data, int size) {
+        fwrite(data, 1, size, out);
+    }
+    memprof_busy = true;
+    memprof_serialize(write, NULL);
+    memprof_busy = false;
+}
+
+void memprof_dump_usb(void)
+{
+    assertf(memprof_on, "memprof_init must be called first");
+    memprof_busy = true;
+
+    // USB packets cannot be streamed, so serialize into a temporary buffer
+    int size = 0;
+    void count(void *arg, const void *data, int sz) { size += sz; }
+    memprof_serialize(count, NULL);
+
+    uint8_t *buf = __alloc_scratch(size);
+    assertf(buf, "not enough memory to dump the allocations");
+    uint8_t *ptr = buf;
+    void copy(void *arg, const void *data, int sz) { memcpy(ptr, data, sz); ptr += sz; }
+    memprof_serialize(copy, NULL);
+    usb_write(DATATYPE_RAWBINARY, buf, size);
+    __free_scratch(buf);
+
+    memprof_busy = false;
+}
+
+void memprof_report(FILE *out, int max)
+{
+    assertf(memprof_on, "memprof_init must be called first");
+    memprof_site_t list[max];
+    int num = memprof_get_sites(list, max);
+
+    memprof_busy = true;
+    fprintf(out, "memprof: %d bytes in %d allocations (peak: %d bytes), %d call sites",
+        stats.live_bytes, stats.live_allocs, stats.peak_bytes, stats.num_sites);
+    if (stats.untracked)
+        fprintf(out, " (%d allocations not tracked)", stats.untracked);
+    fprintf(out, "\n    live  allocs      peak  call site\n");
+
+    bool first;
+    void cb(void *arg, backtrace_frame_t *frame) {
+        if (first)
+            fprintf(out, "  %s (%s:%d)\n", frame->func, frame->source_file, frame->source_line);
+        else
+            fprintf(out, "%28s<- %s (%s:%d)\n", "", frame->func, frame->source_file, frame->source_line);
+        first = false;
+    }
+    for (int i=0; i<num; i++) {
+        if (!list[i].live_allocs)
+            break;
+        fprintf(out, "%8d  %6d  %8d", list[i].live_bytes, list[i].live_allocs, list[i].peak_bytes);
+        first = true;
+        if (!list[i].depth || !backtrace_symbols_cb(list[i].frames, list[i].depth, 0, cb, NULL))
+            fprintf(out, "  ???\n");
+    }
+    memprof_busy = false;
+}
+
+void memprof_close(void)
+{
+    disable_interrupts();
+    memprof_on = false;
+    enable_interrupts();
+
+    __real_free(allocs);
+    __real_free(sites);
+    __real_free(site_frames);
+    __real_free(site_index);
+    allocs = NULL;
+    sites = NULL;
+    site_frames = NULL;
+    site_index = NULL;
+}
@@ -359,6 +359,9 @@
 
 #include "rdpq.h"
 #include "rdpq_internal.h"
+#include "rdpq_tex.h"
+#include "rdpq_tex_internal.h"
+#include "rdpq_sprite_internal.h"
 #include "rdpq_constants.h"
 #include "rdpq_debug_internal.h"
 #include "rspq.h"
@@ -368,6 +371,7 @@
 #include "interrupt.h"
 #include "utils.h"
 #include "rdp.h"
+#include "alloc.h"
 #include <string.h>
 #include <math.h>
 #include <float.h>
@@ -468,6 +472,7 @@ void rdpq_init()
     rdpq_config = RDPQ_CFG_DEFAULT;
     rdpq_tracking.autosync = 0;
     rdpq_tracking.mode_freeze = false;
+    __rdpq_tex_invalidate();
 
     // Register an interrupt handler for DP interrupts, and activate them.
     register_DP_handler(__rdpq_interrupt);
@@ -490,6 +495,8 @@ void rdpq_close()
         return;
     
     rspq_overlay_unregister(RDPQ_OVL_ID);
+    __rdpq_sprite_vq_close();
+    __rdpq_tex_invalidate();
 
     set_DP_interrupt( 0 );
     unregister_DP_handler(__rdpq_interrupt);
@@ -663,7 +670,7 @@ void __rdpq_block_next_buffer(void)
 
         // Allocate RDP static buffer.
         int memsz = sizeof(rdpq_block_t) + st->bufsize*sizeof(uint32_t);
-        rdpq_block_t *b = malloc_uncached(memsz);
+        rdpq_block_t *b = slab_alloc_uncached(memsz);
 
         // Chain the block to the current one (if any)
         b->next = NULL;
@@ -740,6 +747,10 @@ rdpq_block_t* __rdpq_block_end()
 /** @brief Run a block (called by #rspq_block_run). */
 void __rdpq_block_run(rdpq_block_t *block)
 {
+    // The block might load palettes or textures into TMEM, so forget what
+    // we know about the contents of TMEM.
+    __rdpq_tex_invalidate();
+
     // We are about to run a block that contains rdpq commands.
     // During creation, we tracked some state for the block 
     // and saved it into the block structure; set it as current,
@@ -785,11 +796,14 @@ void __rdpq_block_run(rdpq_block_t *block)
  */
 void __rdpq_block_free(rdpq_block_t *block)
 {
-    // Go through the chain and free all nodes
+    // Go through the chain and free all nodes. Their size follows the
+    // same growth as in #__rdpq_block_next_buffer.
+    int bufsize = RDPQ_BLOCK_MIN_SIZE;
     while (block) {
         void *b = block;
         block = block->next;
-        free_uncached(b);
+        slab_free_uncached(b, sizeof(rdpq_block_t) + bufsize*sizeof(uint32_t));
+        if (bufsize < RDPQ_BLOCK_MAX_SIZE) bufsize *= 2;
     }
 }
 
@@ -12,6 +12,80 @@
 #include "rdpq_tex.h"
 #include "sprite.h"
 #include "sprite_internal.h"
+#include "atlas.h"
+#include "atlas_internal.h"
+#include "rdpq_tex_internal.h"
+#include "rspq/rspq_internal.h"
+#include "n64sys.h"
+#include "utils.h"
+#include <stdlib.h>
+
+DEFINE_RSP_UCODE(rsp_vq);
+
+/** @brief Overlay ID of the VQ expansion ucode (0 if not registered yet) */
+static uint32_t vq_overlay_id;
+/** @brief Scratch buffer where VQ-compressed sprites are expanded */
+static void *vq_scratch;
+/** @brief Size of the scratch buffer for VQ-compressed sprites */
+static int vq_scratch_size;
+
+surface_t rdpq_sprite_vq_expand(sprite_t *sprite)
+{
+    sprite_vq_t vq;
+    bool is_vq = __sprite_vq_info(sprite, &vq);
+    assertf(is_vq, "sprite is not VQ-compressed");
+    assertf(!rspq_in_block(), "VQ-compressed sprites cannot be expanded within a block");
+
+    if (!vq_overlay_id)
+        vq_overlay_id = rspq_overlay_register(&rsp_vq);
+
+    int size = vq.pitch * vq.block_lines * 2;
+    if (size > vq_scratch_size) {
+        // Grow the scratch buffer. RDP might still be reading the old one.
+        if (vq_scratch) {
+            rspq_wait();
+            free_uncached(vq_scratch);
+        }
+        vq_scratch = malloc_uncached_aligned(8, size);
+        vq_scratch_size = size;
+    } else {
+        // Make sure RDP has finished loading the previous contents of the
+        // scratch buffer before overwriting it.
+        rdpq_fence();
+    }
+
+    tex_format_t fmt = sprite_get_format(sprite);
+    rspq_write(vq_overlay_id, 0x0,
+        PhysicalAddr(vq.codebook),
+        PhysicalAddr(vq.indices),
+        PhysicalAddr(vq_scratch),
+        (fmt == FMT_CI8 ? 1u << 31 : 0) | (vq.block_lines << 16) | vq.blocks_per_line);
+
+    surface_t surf = surface_make(vq_scratch, fmt, sprite->width, sprite->height, vq.pitch);
+    surf.flags |= SURFACE_FLAGS_TMEMLAYOUT;
+    return surf;
+}
+
+void __rdpq_sprite_vq_close(void)
+{
+    if (vq_overlay_id) {
+        rspq_overlay_unregister(vq_overlay_id);
+        vq_overlay_id = 0;
+    }
+    if (vq_scratch) {
+        free_uncached(vq_scratch);
+        vq_scratch = NULL;
+        vq_scratch_size = 0;
+    }
+}
+
+/** @brief Return the surface of the main image of a sprite, expanding VQ-compressed sprites */
+static surface_t sprite_get_main_surface(sprite_t *sprite)
+{
+    if (__builtin_expect(__sprite_vq_info(sprite, NULL), 0))
+        return rdpq_sprite_vq_expand(sprite);
+    return sprite_get_pixels(sprite);
+}
 
 static void sprite_upload_palette(sprite_t *sprite, int palidx, bool set_mode)
 {
@@ -27,10 +101,20 @@ static void sprite_upload_palette(sprite_t *sprite, int palidx, bool set_mode)
     if (tlut_mode != TLUT_NONE) {
         // Load the palette (if any). We account for sprites being CI4
         // but without embedded palette: mksprite doesn't create sprites like
-        // this today, but it could in the future (eg: sharing a palette across
-        // multiple sprites).
+        // this today, but it could in the future.
         uint16_t *pal = sprite_get_palette(sprite);
-        if (pal) rdpq_tex_upload_tlut(pal, palidx*16, fmt == FMT_CI4 ? 16 : 256);
+        if (!pal) return;
+
+        // If the sprite carries the palette identifier, we can skip loading
+        // it when it is already in TMEM (eg: sprites with a shared palette).
+        const struct sprite_palette_s *info = __sprite_palette_info(sprite);
+        if (info) {
+            assertf(palidx*16 + info->num_colors <= 256,
+                "shared palette (%d colors) does not fit the TLUT area when loaded at palette %d", info->num_colors, palidx);
+            __rdpq_tex_upload_tlut_shared(pal, palidx*16, info->num_colors, info->id);
+        } else {
+            rdpq_tex_upload_tlut(pal, palidx*16, fmt == FMT_CI4 ? 16 : 256);
+        }
     }
 }
 
@@ -40,13 +124,26 @@ int __rdpq_sprite_upload(rdpq_tile_t tile, sprite_t *sprite, const rdpq_texparms
     assertf(sprite_fits_tmem(sprite), "sprite doesn't fit in TMEM");
 
     // Load main sprite surface
-    surface_t surf = sprite_get_pixels(sprite);
+    surface_t surf = sprite_get_main_surface(sprite);
 
     // If no texparms were provided but the sprite contains some, use them
     rdpq_texparms_t parms_builtin;
     if (!parms && sprite_get_texparms(sprite, &parms_builtin))
         parms = &parms_builtin;
 
+    // If the sprite uses a bank of a shared palette, the tile must point to it.
+    // The whole palette is loaded starting from the requested palette index.
+    const struct sprite_palette_s *palinfo = __sprite_palette_info(sprite);
+    int palidx = parms ? parms->palette : 0;
+    rdpq_texparms_t parms_bank;
+    if (palinfo && palinfo->bank) {
+        if (parms) parms_bank = *parms;
+        else memset(&parms_bank, 0, sizeof(parms_bank));
+        parms_bank.palette += palinfo->bank;
+        assertf(parms_bank.palette < 16, "palette bank out of range: %d", parms_bank.palette);
+        parms = &parms_bank;
+    }
+
     // Check for detail texture
     sprite_detail_t detail; rdpq_texparms_t detailtexparms = {0};
     surface_t detailsurf = sprite_get_detail_pixels(sprite, &detail, &detailtexparms);
@@ -118,7 +215,7 @@ int __rdpq_sprite_upload(rdpq_tile_t tile, sprite_t *sprite, const rdpq_texparms
     }
 
     // Upload the palette and configure the render mode
-    sprite_upload_palette(sprite, parms ? parms->palette : 0, set_mode);
+    sprite_upload_palette(sprite, palidx, set_mode);
 
     return rdpq_tex_multi_end();
 }
@@ -130,10 +227,64 @@ int rdpq_sprite_upload(rdpq_tile_t tile, sprite_t *sprite, const rdpq_texparms_t
 
 void rdpq_sprite_blit(sprite_t *sprite, float x0, float y0, const rdpq_blitparms_t *parms)
 {
-    // Upload the palette and configure the render mode
-    sprite_upload_palette(sprite, 0, true);
+    const struct sprite_palette_s *palinfo = __sprite_palette_info(sprite);
+    if (palinfo && palinfo->bank) {
+        // Blits always draw with palette 0, so load there just the bank of
+        // the shared palette used by the sprite.
+        uint32_t id = palinfo->id ^ (palinfo->bank * 0x9E3779B9);
+        rdpq_mode_tlut(rdpq_tlut_from_format(sprite_get_format(sprite)));
+        __rdpq_tex_upload_tlut_shared(sprite_get_palette(sprite) + palinfo->bank*16, 0, 16, id ? id : 1);
+    } else {
+        // Upload the palette and configure the render mode
+        sprite_upload_palette(sprite, 0, true);
+    }
 
     // Get the sprite surface
-    surface_t surf = sprite_get_pixels(sprite);
+    surface_t surf = sprite_get_main_surface(sprite);
     rdpq_tex_blit(&surf, x0, y0, parms);
 }
+
+/** @brief Large texture loader for atlas pages, that are already fully loaded in TMEM */
+static void ltd_atlas(rdpq_tile_t tile, const surface_t *tex, int s0, int t0, int s1, int t1, 
+    void (*draw_cb)(rdpq_tile_t tile, int s0, int t0, int s1, int t1), bool filtering)
+{
+    draw_cb(tile, s0, t0, s1, t1);
+}
+
+void rdpq_atlas_blit(atlas_t *atlas, int idx, float x0, float y0, const rdpq_blitparms_t *parms)
+{
+    static const rdpq_blitparms_t default_parms = {0};
+    if (!parms) parms = &default_parms;
+    assertf(!parms->nx && !parms->ny, "texture repetition is not supported for atlas images");
+
+    const atlas_image_t *img = atlas_get_image(atlas, idx);
+
+    // Upload the page, unless it is still in TMEM: that is, nothing was loaded
+    // into TMEM since we uploaded it. While recording a block, we cannot know
+    // what will be in TMEM when the block is run, so always upload it.
+    if (rspq_in_block()) {
+        rdpq_sprite_upload(parms->tile, atlas->pages[img->page], NULL);
+        rdpq_atlas_invalidate(atlas);
+    } else if (atlas->loaded_page != img->page || atlas->loaded_tile != parms->tile ||
+               atlas->loaded_gen != __rdpq_tex_generation()) {
+        rdpq_sprite_upload(parms->tile, atlas->pages[img->page], NULL);
+        atlas->loaded_page = img->page;
+        atlas->loaded_tile = parms->tile;
+        atlas->loaded_gen = __rdpq_tex_generation();
+    }
+
+    // Blit the image as a sub-rect of the page
+    rdpq_blitparms_t img_parms = *parms;
+    img_parms.s0 += img->x;
+    img_parms.t0 += img->y;
+    if (!img_parms.width)  img_parms.width = img->width - parms->s0;
+    if (!img_parms.height) img_parms.height = img->height - parms->t0;
+    surface_t surf = sprite_get_pixels(atlas->pages[img->page]);
+    __rdpq_tex_blit(&surf, x0, y0, &img_parms, ltd_atlas);
+}
+
+void rdpq_atlas_invalidate(atlas_t *atlas)
+{
+    atlas->loaded_page = -1;
+    atlas->loaded_tile = -1;
+}
@@ -9,4 +9,7 @@ typedef struct rdpq_texparms_s rdpq_texparms_t;
 
 int __rdpq_sprite_upload(rdpq_tile_t tile, sprite_t *sprite, const rdpq_texparms_t *parms, bool set_mode);
 
+/** @brief Unregister the VQ expansion ucode and free the scratch buffer (called by #rdpq_close) */
+void __rdpq_sprite_vq_close(void);
+
 #endif
@@ -12,8 +12,10 @@
 #include "rdpq_rect.h"
 #include "rdpq_tex.h"
 #include "rdpq_tex_internal.h"
+#include "rspq/rspq_internal.h"
 #include "utils.h"
 #include <math.h>
+#include <string.h>
 
 /** @brief Non-zero if we are doing a multi-texture upload */
 typedef struct rdpq_multi_upload_s {
@@ -28,6 +30,79 @@ tex_loader_t last_tload;
 /** @brief Address in TMEM where the palettes must be loaded */
 #define TMEM_PALETTE_ADDR   0x800
 
+/** 
+ * @brief Palettes currently resident in TMEM, one entry per 16-color bank.
+ * 
+ * A palette loaded via #__rdpq_tex_upload_tlut_shared is recorded at the bank
+ * where it begins. Any other write to the palette area of TMEM invalidates
+ * the affected entries.
+ */
+static struct {
+    uint32_t id;        ///< Identifier of the palette starting at this bank (0 = none)
+    int num_banks;      ///< Number of banks spanned by the palette
+} tlut_resident[16];
+
+/** @brief Forget the resident palettes overlapping the specified range of colors */
+static void tlut_invalidate_range(int color_idx, int num_colors)
+{
+    int first = color_idx / 16, last = (color_idx + num_colors - 1) / 16;
+    for (int b=0; b<16; b++) {
+        if (tlut_resident[b].id && b <= last && b + tlut_resident[b].num_banks - 1 >= first)
+            tlut_resident[b].id = 0;
+    }
+}
+
+void __rdpq_tex_tlut_invalidate(void)
+{
+    memset(tlut_resident, 0, sizeof(tlut_resident));
+}
+
+/**
+ * @brief Generation of TMEM contents, incremented at every TMEM load or tile
+ *        configuration done via rdpq_tex, and whenever TMEM contents become unknown.
+ */
+static uint32_t tmem_generation;
+
+uint32_t __rdpq_tex_generation(void)
+{
+    return tmem_generation;
+}
+
+void __rdpq_tex_invalidate(void)
+{
+    __rdpq_tex_tlut_invalidate();
+    tmem_generation++;
+}
+
+void __rdpq_tex_upload_tlut_shared(uint16_t *tlut, int color_idx, int num_colors, uint32_t id)
+{
+    // While recording a block, we cannot know what will be in TMEM when the
+    // block is run, so always load the palette
+    if (rspq_in_block()) {
+        rdpq_tex_upload_tlut(tlut, color_idx, num_colors);
+        return;
+    }
+
+    int bank = color_idx / 16;
+    if (color_idx % 16 == 0 && tlut_resident[bank].id == id)
+        return;
+
+    rdpq_tex_upload_tlut(tlut, color_idx, num_colors);
+    if (color_idx % 16 == 0) {
+        tlut_resident[bank].id = id;
+        tlut_resident[bank].num_banks = (num_colors + 15) / 16;
+    }
+}
+
+/** @brief Invalidate resident palettes if a texture upload might have overwritten them */
+static void tlut_check_texture_upload(const surface_t *tex, int tmem_end)
+{
+    tex_format_t fmt = surface_get_format(tex);
+    // RGBA32 and YUV16 textures are split between low and high half of TMEM
+    if (fmt == FMT_RGBA32 || fmt == FMT_YUV16 || tmem_end > TMEM_PALETTE_ADDR)
+        __rdpq_tex_tlut_invalidate();
+}
+
 /// @brief Calculates the first power of 2 that is equal or larger than size
 /// @param x input in units
 /// @return Power of 2 that is equal or larger than x
@@ -140,7 +215,13 @@ static int texload_set_rect(tex_loader_t *tload, int s0, int t0, int s1, int t1)
                 TEX_FORMAT_PIX2BYTES(fmt, width) == tload->tex->stride &&
                 (tload->tex->stride & stride_mask) == 0;
 
-            if (can_load_block_width) {
+            if (tload->tex->flags & SURFACE_FLAGS_TMEMLAYOUT) {
+                // Textures stored in TMEM layout are loaded with dxt=0, so there is no
+                // precision issue and we can always load any number of lines.
+                assertf(tload->rect.tmem_pitch == tload->tex->stride,
+                    "Invalid stride for texture in TMEM layout (%d, expected %d)", tload->tex->stride, tload->rect.tmem_pitch);
+                tload->rect.block_max_lines = 4096;
+            } else if (can_load_block_width) {
                 // If the requirements are satisfied, we need to compute the maximum number of lines
                 // that can be loaded with LOAD_BLOCK. In fact, RDP uses fixed point precision;
                 // the DXT parameter in the LOAD_BLOCK command is a 1.10 fixed point number, so
@@ -263,6 +344,31 @@ static void texload_block(tex_loader_t *tload, int s0, int t0, int s1, int t1)
     rdpq_set_tile_size_fx(tload->tile, s0, t0, s1, t1);
 }
 
+static void texload_block_tmem(tex_loader_t *tload, int s0, int t0, int s1, int t1)
+{
+    rdpq_tile_t tile_internal = (tload->tile + 1) & 7;
+    if (tload->load_mode != TEX_LOAD_BLOCK) {
+        // The texture is stored in RDRAM in TMEM layout: lines are padded to the TMEM pitch,
+        // and odd lines are already swizzled. So we can load it as a raw sequence of 16-bit
+        // texels with dxt=0, that makes the RDP copy it as-is, whatever the width.
+        rdpq_set_texture_image_raw(surface_get_placeholder_index(tload->tex), PhysicalAddr(tload->tex->buffer), FMT_RGBA16, tload->tex->stride/2, tload->tex->height);
+        rdpq_set_tile(tile_internal, FMT_RGBA16, tload->tmem_addr, 0, NULL);
+        rdpq_set_tile(tload->tile, surface_get_format(tload->tex), tload->tmem_addr, tload->rect.tmem_pitch, &(tload->tileparms));
+        tload->load_mode = TEX_LOAD_BLOCK;
+    }
+
+    rdpq_load_block_fx(tile_internal, 0, t0, tload->rect.tmem_pitch * (t1 - t0) / 2, 0);
+
+    if (TEX_FORMAT_BITDEPTH(surface_get_format(tload->tex)) == 4) {
+        s0 &= ~1; s1 = (s1+1) & ~1;
+    }
+    s0 = s0*4 + tload->rect.s0fx;
+    t0 = t0*4 + tload->rect.t0fx;
+    s1 = s1*4 + tload->rect.s1fx;
+    t1 = t1*4 + tload->rect.t1fx;
+    rdpq_set_tile_size_fx(tload->tile, s0, t0, s1, t1);
+}
+
 static void texload_tile_4bpp(tex_loader_t *tload, int s0, int t0, int s1, int t1)
 {
     rdpq_tile_t tile_internal = (tload->tile + 1) & 7;
@@ -319,6 +425,13 @@ int tex_loader_load(tex_loader_t *tload, int s0, int t0, int s1, int t1)
 {
     assertf(s0 <= s1, "Invalid texture load: s0:%d s1:%d", s0, s1);
     assertf(t0 <= t1, "Invalid texture load: t0:%d t1:%d", t0, t1);
+    tmem_generation++;
+    if (tload->tex->flags & SURFACE_FLAGS_TMEMLAYOUT) {
+        // Swizzling depends on the line parity, so we can only load full lines
+        // starting from an even line.
+        assertf(s0 == 0 && s1 >= tload->tex->width && (t0 & 1) == 0,
+            "Textures in TMEM layout can only be loaded in full lines starting from an even line: (%d,%d)-(%d,%d)", s0, t0, s1, t1);
+    }
     int mem = texload_set_rect(tload, s0, t0, s1, t1);
     if (tload->rect.can_load_block && (t0 & 1) == 0)
         tload->load_block(tload, s0, t0, s1, t1);
@@ -331,6 +444,15 @@ tex_loader_t tex_loader_init(rdpq_tile_t tile, const surface_t *tex) {
     int bpp = TEX_FORMAT_BITDEPTH(surface_get_format(tex));
     bool is_4bpp = bpp == 4;
     bool is_8bpp = bpp == 8;
+    if (tex->flags & SURFACE_FLAGS_TMEMLAYOUT) {
+        assertf(bpp != 32, "TMEM layout is not supported for 32-bit textures");
+        return (tex_loader_t){
+            .tex = tex,
+            .tile = tile,
+            .load_block = texload_block_tmem,
+            .load_tile = texload_block_tmem,
+        };
+    }
     return (tex_loader_t){
         .tex = tex,
         .tile = tile,
@@ -375,10 +497,13 @@ int rdpq_tex_upload_sub(rdpq_tile_t tile, const surface_t *tex, const rdpq_texpa
     }
 
     int nbytes = tex_loader_load(&last_tload, s0, t0, s1, t1);
+    if (!multi_upload.used)
+        tlut_check_texture_upload(tex, (parms ? parms->tmem_addr : 0) + nbytes);
 
     if (multi_upload.used) {
         rdpq_set_tile_autotmem(nbytes);
         multi_upload.bytes += nbytes;
+        tlut_check_texture_upload(tex, multi_upload.bytes);
 
         #ifndef NDEBUG
         // Do a best-effort check to make sure we don't exceed TMEM size. This is not 100%
@@ -405,6 +530,7 @@ int rdpq_tex_reuse_sub(rdpq_tile_t tile, const rdpq_texparms_t *parms, int s0, i
     assertf(multi_upload.used, "Reusing existing texture needs to be done through multi-texture upload");
     assertf(last_tload.tex, "Reusing existing texture is not possible without uploading at least one texture first");  
     assertf(parms == NULL || parms->tmem_addr == 0, "Do not specify a TMEM address while reusing an existing texture");
+    tmem_generation++;
 
     // Check if just copying a tile descriptor is enough
     if(!s0 && !t0 && s1 == last_tload.rect.width && t1 == last_tload.rect.height){
@@ -464,16 +590,24 @@ static void ltd_texloader(rdpq_tile_t tile, const surface_t *tex, int s0, int t0
 
     // Calculate the optimal height for a strip, based on strips of maximum length.
     int tile_h = tex_loader_calc_max_height(&tload, tex->width);
+    tlut_check_texture_upload(tex, tile_h * tload.rect.tmem_pitch);
     
+    // Textures in TMEM layout must be loaded in full lines, starting from an even line
+    bool tmem_layout = tex->flags & SURFACE_FLAGS_TMEMLAYOUT;
+    int ls0 = tmem_layout ? 0 : s0;
+    int ls1 = tmem_layout ? tex->width : s1;
+    assertf(!tmem_layout || tile_h >= 4, "Texture in TMEM layout is too wide to be drawn in strips (%d)", tex->width);
+
     // Go through the surface
     while (t0 < t1) 
     {
         // Calculate the height of the current strip
         int tm = filtering ? MAX(t0 - 1, 0) : t0;
+        if (tmem_layout) tm &= ~1;
         int tn = MIN(tm + tile_h, t1);
 
         // Load the current strip
-        tex_loader_load(&tload, s0, tm, s1, tn);
+        tex_loader_load(&tload, ls0, tm, ls1, tn);
 
         // Call the draw callback for this strip
         int tx = (!filtering || tn == t1) ? tn : tn - 1;
@@ -671,6 +805,10 @@ void rdpq_tex_blit(const surface_t *surf, float x0, float y0, const rdpq_blitpar
 
 void rdpq_tex_upload_tlut(uint16_t *tlut, int color_idx, int num_colors)
 {
+    tmem_generation++;
+    if (!rspq_in_block())
+        tlut_invalidate_range(color_idx, num_colors);
+
     rdpq_set_texture_image_raw(0, PhysicalAddr(tlut), FMT_RGBA16, num_colors, 1);
     rdpq_set_tile(RDPQ_TILE_INTERNAL, FMT_I4, TMEM_PALETTE_ADDR + color_idx*2*4, num_colors, NULL);
     rdpq_load_tlut_raw(RDPQ_TILE_INTERNAL, 0, num_colors);
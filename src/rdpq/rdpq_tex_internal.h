@@ -29,4 +29,33 @@ typedef void (*large_tex_draw)(rdpq_tile_t tile, const surface_t *tex, int s0, i
 
 void __rdpq_tex_blit(const surface_t *surf, float x0, float y0, const rdpq_blitparms_t *parms, large_tex_draw ltd);
 
+/**
+ * @brief Load a palette into TMEM, unless it is already there
+ * 
+ * This is like #rdpq_tex_upload_tlut, but the palette is identified by @p id
+ * (eg: a hash of its contents). The load is skipped if the same palette was
+ * loaded at the same position and TMEM was not overwritten since then.
+ * 
+ * @param tlut          Pointer to the color entries to load
+ * @param color_idx     First color entry in TMEM that will be written to
+ * @param num_colors    Number of color entries to load
+ * @param id            Identifier of the palette (must not be 0)
+ */
+void __rdpq_tex_upload_tlut_shared(uint16_t *tlut, int color_idx, int num_colors, uint32_t id);
+
+/** @brief Forget all palettes tracked by #__rdpq_tex_upload_tlut_shared */
+void __rdpq_tex_tlut_invalidate(void);
+
+/**
+ * @brief Return the current generation of TMEM contents
+ * 
+ * The generation changes every time rdpq_tex loads TMEM or configures a tile,
+ * so a cached upload (eg: the page of an atlas) is still valid only if the
+ * generation did not change since it was done.
+ */
+uint32_t __rdpq_tex_generation(void);
+
+/** @brief Forget everything known about TMEM contents (resident palettes and generation) */
+void __rdpq_tex_invalidate(void);
+
 #endif
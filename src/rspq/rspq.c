@@ -196,6 +196,7 @@
 #include "interrupt.h"
 #include "utils.h"
 #include "n64sys.h"
+#include "alloc.h"
 #include "debug.h"
 #include <stdlib.h>
 #include <stdint.h>
@@ -942,7 +943,7 @@ void rspq_next_buffer(void) {
         if (rspq_block_size < RSPQ_BLOCK_MAX_SIZE) rspq_block_size *= 2;
 
         // Allocate a new chunk of the block and switch to it.
-        uint32_t *rspq2 = malloc_uncached(rspq_block_size*sizeof(uint32_t));
+        uint32_t *rspq2 = slab_alloc_uncached(rspq_block_size*sizeof(uint32_t));
         volatile uint32_t *prev = rspq_switch_buffer(rspq2, rspq_block_size, true);
 
         // Terminate the previous chunk with a JUMP op to the new chunk.
@@ -1106,7 +1107,7 @@ void rspq_block_begin(void)
 
     // Allocate a new block (at minimum size) and initialize it.
     rspq_block_size = RSPQ_BLOCK_MIN_SIZE;
-    rspq_block = malloc_uncached(sizeof(rspq_block_t) + rspq_block_size*sizeof(uint32_t));
+    rspq_block = slab_alloc_uncached(sizeof(rspq_block_t) + rspq_block_size*sizeof(uint32_t));
     rspq_block->nesting_level = 0;
     rspq_block->rdp_block = NULL;
 
@@ -1145,6 +1146,7 @@ void rspq_block_free(rspq_block_t *block)
 
     // Start from the commands in the first chunk of the block
     int size = RSPQ_BLOCK_MIN_SIZE;
+    int memsz = sizeof(rspq_block_t) + size*sizeof(uint32_t);
     void *start = block;
     uint32_t *ptr = block->cmds + size;
     while (1) {
@@ -1155,17 +1157,18 @@ void rspq_block_free(rspq_block_t *block)
         // If the last command is a JUMP
         if (cmd>>24 == RSPQ_CMD_JUMP) {
             // Free the memory of the current chunk.
-            free_uncached(start);
+            slab_free_uncached(start, memsz);
             // Get the pointer to the next chunk
             start = UncachedAddr(0x80000000 | (cmd & 0xFFFFFF));
             if (size < RSPQ_BLOCK_MAX_SIZE) size *= 2;
+            memsz = size*sizeof(uint32_t);
             ptr = (uint32_t*)start + size;
             continue;
         }
         // If the last command is a RET
         if (cmd>>24 == RSPQ_CMD_RET) {
             // This is the last chunk, free it and exit
-            free_uncached(start);
+            slab_free_uncached(start, memsz);
             return;
         }
         // The last command is neither a JUMP nor a RET:
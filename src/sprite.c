@@ -14,6 +14,45 @@
 
 static sprite_t *last_spritemap = NULL;
 
+/** @brief Return the stride of an image stored in a sprite, which depends on its layout */
+static int sprite_stride(sprite_t *sprite, tex_format_t format, int width)
+{
+    int stride = TEX_FORMAT_PIX2BYTES(format, width);
+    // In TMEM layout, each line is padded to the TMEM pitch
+    if (sprite->flags & SPRITE_FLAGS_TMEMLAYOUT)
+        stride = ROUND_UP(stride, 8);
+    return stride;
+}
+
+/** @brief Create a surface pointing to an image stored in a sprite */
+static surface_t sprite_make_surface(sprite_t *sprite, void *pixels, tex_format_t format, int width, int height)
+{
+    surface_t surf = surface_make(pixels, format, width, height, sprite_stride(sprite, format, width));
+    if (sprite->flags & SPRITE_FLAGS_TMEMLAYOUT)
+        surf.flags |= SURFACE_FLAGS_TMEMLAYOUT;
+    return surf;
+}
+
+bool __sprite_vq_info(sprite_t *sprite, sprite_vq_t *vq)
+{
+    // Read the bitdepth field without triggering the deprecation warning
+    if (!(sprite->flags & SPRITE_FLAGS_EXT) || ((uint8_t*)sprite)[4] != SPRITE_VQ_MARKER)
+        return false;
+    if (vq) {
+        // Each codebook entry holds 2x2 texels, and the expanded image has
+        // its lines padded to the TMEM pitch.
+        tex_format_t format = sprite_get_format(sprite);
+        int entry_size = TEX_FORMAT_PIX2BYTES(format, 4);
+        vq->pitch = ROUND_UP(TEX_FORMAT_PIX2BYTES(format, sprite->width), 8);
+        vq->blocks_per_line = vq->pitch * 2 / entry_size;
+        vq->block_lines = (sprite->height + 1) / 2;
+        vq->index_stride = ROUND_UP(vq->blocks_per_line, 8);
+        vq->codebook = sprite->data;
+        vq->indices = (uint8_t*)sprite->data + 256 * entry_size;
+    }
+    return true;
+}
+
 /** @brief Access the sprite extended structure, or NULL if the structure does not exist */
 __attribute__((noinline))
 sprite_ext_t *__sprite_ext(sprite_t *sprite)
@@ -23,11 +62,15 @@ sprite_ext_t *__sprite_ext(sprite_t *sprite)
 
     uint8_t *data = (uint8_t*)sprite->data;
     tex_format_t format = sprite_get_format(sprite);
-    data += ROUND_UP(TEX_FORMAT_PIX2BYTES(format, sprite->width) * sprite->height, 8);
+    sprite_vq_t vq;
+    if (__sprite_vq_info(sprite, &vq))
+        data = vq.indices + ROUND_UP(vq.index_stride * vq.block_lines, 8);
+    else
+        data += ROUND_UP(sprite_stride(sprite, format, sprite->width) * sprite->height, 8);
 
     // Access extended header
     sprite_ext_t *sx = (sprite_ext_t*)data;
-    assertf(sx->version == 4, "Invalid sprite version (%d); please regenerate your asset files", sx->version);
+    assertf(sx->version == 4 || sx->version == 5, "Invalid sprite version (%d); please regenerate your asset files", sx->version);
     return sx;
 }
 
@@ -90,7 +133,9 @@ void sprite_free(sprite_t *s)
 }
 
 surface_t sprite_get_pixels(sprite_t *sprite) {
-    return surface_make_linear(sprite->data, sprite_get_format(sprite),
+    assertf(!__sprite_vq_info(sprite, NULL),
+        "VQ-compressed sprites must be expanded with rdpq_sprite_vq_expand");
+    return sprite_make_surface(sprite, sprite->data, sprite_get_format(sprite),
         sprite->width, sprite->height);
 }
 
@@ -114,7 +159,7 @@ surface_t sprite_get_lod_pixels(sprite_t *sprite, int num_level) {
     // Return the surface that refers to this LOD
     tex_format_t fmt = lod->fmt_file_pos >> 24;
     void *pixels = (void*)sprite + (lod->fmt_file_pos & 0x00FFFFFF);
-    return surface_make_linear(pixels, fmt, lod->width, lod->height);
+    return sprite_make_surface(sprite, pixels, fmt, lod->width, lod->height);
 }
 
 void sprite_get_detail_texparms(sprite_t *sprite, rdpq_texparms_t *parms) {
@@ -163,6 +208,14 @@ uint16_t* sprite_get_palette(sprite_t *sprite) {
     return (void*)sprite + sx->pal_file_pos;
 }
 
+const struct sprite_palette_s *__sprite_palette_info(sprite_t *sprite) {
+    sprite_ext_t *sx = __sprite_ext(sprite);
+    // Version 4 sprites do not have the palette information
+    if (!sx || sx->version < 5 || !sx->palette.id)
+        return NULL;
+    return &sx->palette;
+}
+
 surface_t sprite_get_tile(sprite_t *sprite, int h, int v) {
     static int tile_width = 0, tile_height = 0;
 
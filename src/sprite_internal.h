@@ -20,7 +20,7 @@
  */
 typedef struct sprite_ext_s {
     uint16_t size;              ///< Size of the structure itself (for forward compatibility)
-    uint16_t version;           ///< Version of the structure (currently 1)
+    uint16_t version;           ///< Version of the structure (currently 5)
     uint32_t pal_file_pos;      ///< Position of the palette in the file
     /// Information on LODs
     struct sprite_lod_s {
@@ -49,9 +49,59 @@ typedef struct sprite_ext_s {
         bool              use_main_texture; ///< True if the detail texture is the same as the LOD0 of the main texture
         uint8_t           padding[3];    ///< Padding
     } detail;                    ///< Detail texture parameters
+    /// @brief Palette information (version 5+)
+    struct sprite_palette_s {
+        uint32_t id;                ///< Hash of the palette colors loaded into TMEM (0 = no palette)
+        uint16_t num_colors;        ///< Number of colors loaded into TMEM
+        uint8_t  bank;              ///< 16-color bank of the palette used by the image (CI4 shared palettes)
+        uint8_t  padding;           ///< Padding
+    } palette;                   ///< Palette information
 } sprite_ext_t;
 
-_Static_assert(sizeof(sprite_ext_t) == 124, "invalid sizeof(sprite_ext_t)");
+_Static_assert(sizeof(sprite_ext_t) == 132, "invalid sizeof(sprite_ext_t)");
+
+/**
+ * @brief Return the information on the sprite palette
+ * 
+ * The palette identifier allows to skip loading the palette into TMEM when it is
+ * already there, which happens when drawing multiple times the same sprite, or
+ * sprites converted with a shared palette (mksprite --shared-palette).
+ * 
+ * @param sprite        Sprite to access
+ * @return              Palette information, or NULL if not available (sprites
+ *                      without palette or created by older versions of mksprite)
+ */
+const struct sprite_palette_s *__sprite_palette_info(sprite_t *sprite);
+
+/** 
+ * @brief Value of the (otherwise unused) bitdepth byte of the header of VQ-compressed sprites
+ * 
+ * VQ-compressed sprites (mksprite --vq) store 2x2 blocks of texels as 8-bit
+ * indices into a codebook of 256 entries. The data of the main image is made
+ * by the codebook, followed by the indices, one line of blocks at a time
+ * (each line padded to 8 bytes). The sprite must be expanded via RSP before
+ * it can be used (see #rdpq_sprite_vq_expand).
+ */
+#define SPRITE_VQ_MARKER                    0x56
+
+/** @brief Information on the VQ-compressed data of a sprite */
+typedef struct {
+    void *codebook;             ///< Codebook (256 entries of 2x2 texels)
+    uint8_t *indices;           ///< Indices of the blocks in the codebook
+    int blocks_per_line;        ///< Number of blocks per line (including padding)
+    int block_lines;            ///< Number of lines of blocks
+    int index_stride;           ///< Size in bytes of a line of indices
+    int pitch;                  ///< Pitch of the expanded image (the TMEM pitch)
+} sprite_vq_t;
+
+/**
+ * @brief Return the information on the VQ-compressed data of a sprite
+ * 
+ * @param sprite        Sprite to access
+ * @param vq            Filled with the VQ information (can be NULL)
+ * @return              True if the sprite is VQ-compressed, false otherwise
+ */
+bool __sprite_vq_info(sprite_t *sprite, sprite_vq_t *vq);
 
 /** @brief Convert a sprite from the old format with implicit texture format */ 
 bool __sprite_upgrade(sprite_t *sprite);
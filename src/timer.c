@@ -42,160 +42,175 @@
 /** @brief Refcount of #timer_init vs #timer_close calls. */
 static int timer_init_refcount = 0;
 
-/** @brief Internal linked list of timers */
+/**
+ * @brief Queue of active timers, ordered by deadline.
+ *
+ * The queue is a pairing heap built on the links embedded in the timers, so
+ * that it does not need any allocation (timers can be started from within
+ * callbacks, under interrupt). The root is the first timer to expire;
+ * insertion is O(1), and removing a timer (either the root or any other
+ * one, via #stop_timer) is O(log n) amortized.
+ */
 static timer_link_t *TI_timers = NULL;
 
 /** @brief Timer callback expects a context parameter */
 #define TF_CONTEXT     0x20
 
-/** @brief Timer is the special overflow timer. */
-#define TF_OVERFLOW    0x40
-
-/** @brief Timer has been called once in this interrupt. */
-#define TF_CALLED      0x80
+/** @brief Timer is in the queue (#TI_timers) */
+#define TF_QUEUED      0x40
 
-/** @brief Update the compare register to match the first expiring timer. */
-__attribute__((noinline))
-static void timer_update_compare(timer_link_t *head, uint32_t now)
+/** @brief Meld two heaps (detached from any sibling list), returning the new root */
+static timer_link_t *heap_meld(timer_link_t *a, timer_link_t *b)
 {
-	uint32_t smallest = 0xFFFFFFFF;
-
-	while (head)
+	if (!a) return b;
+	if (!b) return a;
+	if (TICKS_BEFORE(b->left, a->left))
 	{
-		/* See how much time is left before the timer expires. Notice that
-		   the subtraction is also safe with overflows. */
-		uint32_t left = head->left - now;
-		if (left < smallest)
-			smallest = left;
-
-		/* Go to next */
-		head = head->next;
+		timer_link_t *t = a; a = b; b = t;
 	}
 
-	/* set compare to shortest time left */
-	C0_WRITE_COMPARE(now + smallest);
+	/* b becomes the first child of a */
+	b->prev = a;
+	b->next = a->child;
+	if (a->child)
+		a->child->prev = b;
+	a->child = b;
+	return a;
 }
 
-/**
- * @brief Process linked list of timers
- *
- * Walk the linked list of timers and call the callbacks of any that
- * have expired.
- *
- * @note This function will remove one-shot timers from the list after
- *       they have fired.
- *
- * @param[in] head
- *            Head of the linked list of timers
- *
- * @retval 1 The list needs reprocessing
- * @retval 0 All timer operations were handled successfully
- */
-static int __proc_timers(timer_link_t * thead)
+/** @brief Meld a list of sibling heaps into one, with the two-pass pairing algorithm */
+static timer_link_t *heap_merge_pairs(timer_link_t *first)
 {
-	timer_link_t *head = thead;
-	timer_link_t *last = 0;
-	uint32_t start = C0_COMPARE();
-	uint32_t now = TICKS_READ();
+	/* First pass: meld pairs left to right, collecting the results
+	   in a reversed list. */
+	timer_link_t *list = NULL;
+	while (first)
+	{
+		timer_link_t *a = first;
+		timer_link_t *b = first->next;
+		first = b ? b->next : NULL;
+
+		a->next = a->prev = NULL;
+		if (b)
+			b->next = b->prev = NULL;
+		a = heap_meld(a, b);
+		a->next = list;
+		list = a;
+	}
 
-	while (head)
+	/* Second pass: meld the results right to left */
+	timer_link_t *root = NULL;
+	while (list)
 	{
-		/* Consider a timer as expired if its deadline is at the
-		 * COMPARE value (time at which the interrupt triggered) or up to 5
-		 * microseconds after. This 5 microseconds window is useful to cluster
-		 * timers that expire close to each other; eg: if the client creates
-		 * many timers with the same period, they will be created in a fast
-		 * sequence and have a little delay between each other. */
-		if (!(head->flags & TF_CALLED) && 
-			!(head->flags & TF_DISABLED) &&
-			TICKS_DISTANCE(start, head->left) >= 0 && 
-			TICKS_DISTANCE(head->left, now+TIMER_TICKS(5)) >= 0)
-		{
-			/* yes - timed out, do callback */
-			head->ovfl = TICKS_DISTANCE(head->left, now);
-
-			/* invoke the appropriate callback function */
-			if (head->flags & TF_CONTEXT && head->callback_with_context)
-				head->callback_with_context(head->ovfl, head->ctx);
-			else if (head->callback)
-				head->callback(head->ovfl);
-
-			if (head->flags & TF_DISABLED)
-			{
-				/* Timer was disabled during the callback. We need to
-				 * reprocess the list to see if there are other timers
-				 * that need to be called. */
-				return 1;
-			}
+		timer_link_t *a = list;
+		list = list->next;
+		a->next = NULL;
+		root = heap_meld(root, a);
+	}
+	return root;
+}
 
-			/* reset ticks if continuous */
-			if (head->flags & TF_CONTINUOUS)
-			{
-				head->left += head->set;
-				last = head;
-
-				/* Special case: the internal overflow timer has a period
-				 * of 2**32, so next occurrence will look exactly like the
-				 * current one. Since we're going to reprocess the list, we
-				 * would keep executing it many times until we eventually
-				 * exit the 5 microseconds window.
-				 * So we mark this timer as already called (TF_CALLED) and
-				 * avoid calling it again. 
-				 *
-				 * Notice that we do this only for overflow because other timers
-				 * with a short period might actually be called multiple times
-				 * under interrupt. For instance, if a continuous timer with
-				 * a short period is followed by a very slow one-shot timer,
-				 * when the latter is finished the former might need to fire again.
-				 */
-				if (head->flags & TF_OVERFLOW)
-					head->flags |= TF_CALLED;
-			}
-			else
-			{
-				/* one-shot, remove from list */
-				if (last)
-					last->next = head->next;
-				else
-					TI_timers = head->next;
-			}
+/** @brief Add a timer to the queue */
+static void heap_insert(timer_link_t *timer)
+{
+	timer->next = timer->prev = timer->child = NULL;
+	timer->flags |= TF_QUEUED;
+	TI_timers = heap_meld(TI_timers, timer);
+}
 
-			/* Go through timer list again. If the callback was slow, maybe
-			   other timers have expired. */
-			return 1;
-		}
+/** @brief Remove a timer from the queue */
+static void heap_remove(timer_link_t *timer)
+{
+	timer_link_t *sub = heap_merge_pairs(timer->child);
 
-		/* Go to next */
-		last = head;
-		head = head->next;
+	if (timer == TI_timers)
+	{
+		TI_timers = sub;
 	}
-
-	/* Clear the TF_CALLED flag from the overflow timer (if any) */
-	while (thead) {
-		thead->flags &= ~TF_CALLED;
-		thead = thead->next;
+	else
+	{
+		/* Detach from the parent or from the previous sibling */
+		if (timer->prev->child == timer)
+			timer->prev->child = timer->next;
+		else
+			timer->prev->next = timer->next;
+		if (timer->next)
+			timer->next->prev = timer->prev;
+		TI_timers = heap_meld(TI_timers, sub);
 	}
-	return 0;							// exit timer callback
+
+	timer->next = timer->prev = timer->child = NULL;
+	timer->flags &= ~TF_QUEUED;
+}
+
+/** @brief Update the compare register to match the first expiring timer. */
+__attribute__((noinline))
+static void timer_update_compare(void)
+{
+	/* With no timers, set compare as far as possible in the future */
+	C0_WRITE_COMPARE(TI_timers ? TI_timers->left : TICKS_READ() - 1);
 }
 
 /**
- * @brief Poll the timer list and run callbacks for expired timers
+ * @brief Run the callbacks of the expired timers
  *
  * This function is called by the interrupt handler whenever 
- * compare == count, and also when inserting into or removing
- * from the timers list to improve handling timers with tiny delays
+ * compare == count, and also when inserting into the queue to
+ * improve handling timers with tiny delays.
+ *
+ * Expired timers are extracted from the queue in deadline order. One-shot
+ * timers are left out of the queue after they have fired, while continuous
+ * timers are queued again with their next deadline.
  */
 static void timer_poll(void)
 {
 	uint32_t loop_count = 0;
-	while (__proc_timers(TI_timers)) {
-		++loop_count; (void)loop_count; // avoid warning (loop_count is used in assertf)
-		assertf(loop_count < 1000, "timer interrupt is stuck in an infinite loop.\n"
-			"Check continuous timers with a very short period.\n");
+	timer_link_t *head;
+
+	/* Consider a timer as expired if its deadline is up to 5 microseconds
+	 * after the current time. This 5 microseconds window is useful to cluster
+	 * timers that expire close to each other; eg: if the client creates
+	 * many timers with the same period, they will be created in a fast
+	 * sequence and have a little delay between each other. The current time
+	 * is read again after each callback: if the callback was slow, maybe
+	 * other timers have expired. */
+	while ((head = TI_timers) && 
+		   TICKS_DISTANCE(head->left, TICKS_READ()+TIMER_TICKS(5)) >= 0)
+	{
+		heap_remove(head);
+
+		/* yes - timed out, do callback */
+		head->ovfl = TICKS_DISTANCE(head->left, TICKS_READ());
+
+		/* invoke the appropriate callback function */
+		if (head->flags & TF_CONTEXT && head->callback_with_context)
+			head->callback_with_context(head->ovfl, head->ctx);
+		else if (head->callback)
+			head->callback(head->ovfl);
+
+		/* The callback might have stopped or restarted the timer itself */
+		if (head->flags & (TF_DISABLED | TF_QUEUED))
+			continue;
+
+		/* reset ticks if continuous */
+		if (head->flags & TF_CONTINUOUS)
+		{
+			head->left += head->set;
+
+			/* A continuous timer with a very short period might need to fire
+			 * again immediately. This is fine as long as it does not happen
+			 * forever. */
+			if (TICKS_DISTANCE(head->left, TICKS_READ()+TIMER_TICKS(5)) >= 0) {
+				++loop_count; (void)loop_count; // avoid warning (loop_count is used in assertf)
+				assertf(loop_count < 1000, "timer interrupt is stuck in an infinite loop.\n"
+					"Check continuous timers with a very short period.\n");
+			}
+			heap_insert(head);
+		}
 	}
 
 	// Update counter for next interrupt.
-	timer_update_compare(TI_timers, TICKS_READ());
+	timer_update_compare();
 }
 
 /**
@@ -259,9 +274,7 @@ timer_link_t *new_timer(int ticks, int flags, timer_callback1_t callback)
 
 		if (!(flags & TF_DISABLED))
 		{
-			timer->next = TI_timers;
-			TI_timers = timer;
-			timer_update_compare(TI_timers, now);
+			heap_insert(timer);
 			timer_poll();
 		}
 
@@ -303,9 +316,7 @@ timer_link_t *new_timer_context(int ticks, int flags, timer_callback2_t callback
 
 		if (!(flags & TF_DISABLED))
 		{
-			timer->next = TI_timers;
-			TI_timers = timer;
-			timer_update_compare(TI_timers, now);
+			heap_insert(timer);
 			timer_poll();
 		}
 
@@ -315,8 +326,12 @@ timer_link_t *new_timer_context(int ticks, int flags, timer_callback2_t callback
 }
 
 /**
- * @brief Start a timer (not currently in the list)
+ * @brief Start a timer
  * 
+ * If the timer is still running, it is stopped and started again with the
+ * new settings. For this reason, a timer structure that was not created via
+ * #new_timer must be zero-initialized before its first use.
+ *
  * If you need to associate some data with the timer, consider using
  * #start_timer_context to include a pointer in the callback.
  *
@@ -336,6 +351,10 @@ void start_timer(timer_link_t *timer, int ticks, int flags, timer_callback1_t ca
 	{
 		disable_interrupts();
 
+		/* The timer might still be running: remove it before overwriting its flags */
+		if (timer->flags & TF_QUEUED)
+			heap_remove(timer);
+
 		uint32_t now = TICKS_READ();
 		timer->left = now + (int32_t)ticks;
 		timer->set = ticks;
@@ -345,19 +364,23 @@ void start_timer(timer_link_t *timer, int ticks, int flags, timer_callback1_t ca
 
 		if (!(flags & TF_DISABLED))
 		{
-			timer->next = TI_timers;
-			TI_timers = timer;
-			timer_update_compare(TI_timers, now);
+			heap_insert(timer);
 			timer_poll();
 		}
+		else
+			timer_update_compare();
 
 		enable_interrupts();
 	}
 }
 
 /**
- * @brief Start a timer (not currently in the list) with context
+ * @brief Start a timer with context
  * 
+ * If the timer is still running, it is stopped and started again with the
+ * new settings. For this reason, a timer structure that was not created via
+ * #new_timer_context must be zero-initialized before its first use.
+ *
  * If you don't need the context, consider using #start_timer instead.
  *
  * @param[in] timer
@@ -378,6 +401,10 @@ void start_timer_context(timer_link_t *timer, int ticks, int flags, timer_callba
 	{
 		disable_interrupts();
 
+		/* The timer might still be running: remove it before overwriting its flags */
+		if (timer->flags & TF_QUEUED)
+			heap_remove(timer);
+
 		uint32_t now = TICKS_READ();
 		timer->left = now + (int32_t)ticks;
 		timer->set = ticks;
@@ -385,13 +412,13 @@ void start_timer_context(timer_link_t *timer, int ticks, int flags, timer_callba
 		timer->callback_with_context = callback;
 		timer->ctx = ctx;
 
-		if (flags & TF_DISABLED)
+		if (!(flags & TF_DISABLED))
 		{
-			timer->next = TI_timers;
-			TI_timers = timer;
-			timer_update_compare(TI_timers, now);
+			heap_insert(timer);
 			timer_poll();
 		}
+		else
+			timer_update_compare();
 
 		enable_interrupts();
 	}
@@ -409,13 +436,15 @@ void restart_timer(timer_link_t *timer)
 	{
 		disable_interrupts();
 
+		/* The timer might still be running: remove it before rescheduling it */
+		if (timer->flags & TF_QUEUED)
+			heap_remove(timer);
+
 		uint32_t now = TICKS_READ();
 		timer->left = now + (int32_t)timer->set;
 		timer->flags &= ~TF_DISABLED;
 
-		timer->next = TI_timers;
-		TI_timers = timer;
-		timer_update_compare(TI_timers, now);
+		heap_insert(timer);
 		timer_poll();
 
 		enable_interrupts();
@@ -436,32 +465,14 @@ void restart_timer(timer_link_t *timer)
  */
 void stop_timer(timer_link_t *timer)
 {
-	timer_link_t *head;
-	timer_link_t *last = 0;
-
 	assertf(timer_init_refcount > 0, "timer module not initialized");
 	if (timer)
 	{
 		disable_interrupts();
-		head = TI_timers;
-		while (head)
-		{
-			if (head == timer)
-			{
-				/* remove from list */
-				if (last)
-					last->next = head->next;
-				else
-					TI_timers = head->next;
-
-				break;
-			}
-
-			last = head;
-			head = head->next;
-		}
+		if (timer->flags & TF_QUEUED)
+			heap_remove(timer);
 		timer->flags |= TF_DISABLED;
-		timer_update_compare(TI_timers, TICKS_READ());
+		timer_update_compare();
 		enable_interrupts();
 	}
 }
@@ -508,13 +519,12 @@ void timer_close(void)
 	set_TI_interrupt(0);
 	unregister_TI_handler(timer_poll);
 
-	timer_link_t *head = TI_timers;
-	while (head)
+	while (TI_timers)
 	{
-		timer_link_t *last = head;
-		head = head->next;
+		timer_link_t *head = TI_timers;
+		heap_remove(head);
 
-		if (last->flags & TF_CONTINUOUS)
+		if (head->flags & TF_CONTINUOUS)
 		{
 			/* Only free if it is a continuous timer as one-shot timers are
 			 * freed by the user.  If we free a timer here, the user will
@@ -523,10 +533,9 @@ void timer_close(void)
 			 * condition by ensuring that the timer system never frees a 
 			 * one shot timer.
 			 */
-			free(last);
+			free(head);
 		}
 	}
-	TI_timers = 0;
 	enable_interrupts();
 }
 
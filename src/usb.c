@@ -241,6 +241,7 @@ static s8 usb_cart = CART_NONE;
 static u8 usb_buffer_align[BUFFER_SIZE+16]; // IDO doesn't support GCC's __attribute__((aligned(x))), so this is a workaround
 static u8* usb_buffer;
 static char usb_didtimeout = FALSE;
+static u32 usb_timeout_limit = 0;
 static int usb_datatype = 0;
 static int usb_datasize = 0;
 static int usb_dataleft = 0;
@@ -400,6 +401,8 @@ static u32 usb_timeout_start(void)
 
 static char usb_timeout_check(u32 start_ticks, u32 duration)
 {
+    if (usb_timeout_limit && duration > usb_timeout_limit)
+        duration = usb_timeout_limit;
 #ifndef LIBDRAGON
     u64 current_ticks = (u64)osGetCount();
     u64 timeout_ticks = OS_USEC_TO_CYCLES((u64)duration * 1000);
@@ -708,6 +711,21 @@ void usb_purge(void)
 }
 
 
+/*==============================
+    usb_set_timeout_limit
+    Limits how long any USB operation waits for the flashcart
+    @param The limit in milliseconds, or 0 to restore the default timeouts
+    @return The previous limit
+==============================*/
+
+int usb_set_timeout_limit(int ms)
+{
+    int prev = usb_timeout_limit;
+    usb_timeout_limit = ms;
+    return prev;
+}
+
+
 /*==============================
     usb_timedout
     Checks if the USB timed out recently
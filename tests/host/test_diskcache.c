@@ -0,0 +1,302 @@
+/*
+ * Host test and benchmark of the FatFs sector cache (src/diskcache.c).
+ *
+ * The cache and FatFs are compiled for the host and run on top of a RAM disk,
+ * whose contents are checked against a shadow copy written without the
+ * cache. The benchmark runs the same FatFs workload with and without the
+ * cache, and reports the number of disk commands, which is what dominates
+ * the time spent on a real SD card.
+ *
+ * Usage: test_diskcache [--bench]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "diskcache.h"
+
+#define SECTOR_SIZE     512
+#define DISK_SECTORS    4096
+
+static uint8_t disk[DISK_SECTORS * SECTOR_SIZE];
+static uint8_t shadow[DISK_SECTORS * SECTOR_SIZE];
+static diskcache_t *cache;
+static int disk_commands;
+static int num_failed;
+
+#define CHECK(cond, msg, ...) ({ \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: FAILED: " msg "\n", __FILE__, __LINE__, ##__VA_ARGS__); \
+		num_failed++; \
+		return; \
+	} \
+})
+
+static DRESULT ram_read(BYTE* buff, LBA_t sector, UINT count)
+{
+	if (sector + count > DISK_SECTORS)
+		return RES_PARERR;
+	disk_commands++;
+	memcpy(buff, disk + sector * SECTOR_SIZE, count * SECTOR_SIZE);
+	return RES_OK;
+}
+
+static DRESULT ram_write(const BYTE* buff, LBA_t sector, UINT count)
+{
+	if (sector + count > DISK_SECTORS)
+		return RES_PARERR;
+	disk_commands++;
+	memcpy(disk + sector * SECTOR_SIZE, buff, count * SECTOR_SIZE);
+	return RES_OK;
+}
+
+/* FatFs disk functions: the volume goes through the cache when there is one */
+DSTATUS disk_initialize(BYTE pdrv) { return 0; }
+DSTATUS disk_status(BYTE pdrv) { return 0; }
+
+DRESULT disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count)
+{
+	return cache ? diskcache_read(cache, buff, sector, count) : ram_read(buff, sector, count);
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count)
+{
+	return cache ? diskcache_write(cache, buff, sector, count) : ram_write(buff, sector, count);
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff)
+{
+	switch (cmd) {
+	case CTRL_SYNC:         return cache ? diskcache_flush(cache) : RES_OK;
+	case GET_SECTOR_COUNT:  *(LBA_t*)buff = DISK_SECTORS; return RES_OK;
+	case GET_SECTOR_SIZE:   *(WORD*)buff = SECTOR_SIZE; return RES_OK;
+	case GET_BLOCK_SIZE:    *(DWORD*)buff = 1; return RES_OK;
+	}
+	return RES_PARERR;
+}
+
+DWORD get_fattime(void)
+{
+	return ((DWORD)(2024 - 1980) << 25) | (1 << 21) | (1 << 16);
+}
+
+/* Fill a sector with a pattern identifying its number and a version */
+static void fill_sector(uint8_t *buf, LBA_t sector, int version)
+{
+	for (int i=0; i<SECTOR_SIZE; i++)
+		buf[i] = (uint8_t)(sector * 7 + version * 13 + i);
+}
+
+static void cache_write(LBA_t sector, int count, int version)
+{
+	uint8_t buf[count * SECTOR_SIZE];
+	for (int k=0; k<count; k++) {
+		fill_sector(buf + k*SECTOR_SIZE, sector + k, version);
+		memcpy(shadow + (sector + k) * SECTOR_SIZE, buf + k*SECTOR_SIZE, SECTOR_SIZE);
+	}
+	diskcache_write(cache, buf, sector, count);
+}
+
+static bool cache_check(LBA_t sector, int count)
+{
+	uint8_t buf[count * SECTOR_SIZE];
+	if (diskcache_read(cache, buf, sector, count) != RES_OK)
+		return false;
+	return !memcmp(buf, shadow + sector * SECTOR_SIZE, count * SECTOR_SIZE);
+}
+
+static void reset_disk(void)
+{
+	for (int s=0; s<DISK_SECTORS; s++)
+		fill_sector(disk + s * SECTOR_SIZE, s, 0);
+	memcpy(shadow, disk, sizeof(disk));
+}
+
+/* Evicting a dirty line during a read-ahead must not clobber the sectors read ahead */
+static void test_readahead_evicts_dirty(void)
+{
+	reset_disk();
+	cache = diskcache_new(16, 8, ram_read, ram_write);
+	for (int s=40; s<48; s++)
+		cache_write(s, 1, 1);
+	for (int s=0; s<32; s++)
+		CHECK(cache_check(s, 1), "sequential read of sector %d returned wrong data", s);
+	CHECK(diskcache_flush(cache) == RES_OK, "flush failed");
+	CHECK(!memcmp(disk, shadow, sizeof(disk)), "disk contents differ after flush");
+	diskcache_free(cache);
+	cache = NULL;
+}
+
+/* Multi-sector reads must see the dirty sectors still in cache */
+static void test_multisector_sees_dirty(void)
+{
+	reset_disk();
+	cache = diskcache_new(8, 4, ram_read, ram_write);
+	cache_write(10, 1, 1);
+	cache_write(12, 1, 1);
+	CHECK(cache_check(8, 8), "multi-sector read returned stale data");
+	cache_write(9, 4, 2);
+	CHECK(cache_check(8, 8), "multi-sector write not visible");
+	CHECK(diskcache_flush(cache) == RES_OK, "flush failed");
+	CHECK(!memcmp(disk, shadow, sizeof(disk)), "disk contents differ after flush");
+	diskcache_free(cache);
+	cache = NULL;
+}
+
+/* Random accesses, checked against the shadow disk */
+static void test_random(int num_sectors, int readahead)
+{
+	reset_disk();
+	cache = diskcache_new(num_sectors, readahead, ram_read, ram_write);
+	srand(num_sectors * 100 + readahead);
+	LBA_t seq = 0;
+	for (int i=0; i<200000; i++) {
+		int op = rand() % 100;
+		// Accesses are concentrated on a small area, with sequential runs
+		LBA_t sector = (op & 1) ? seq++ % 256 : rand() % 256;
+		int count = (rand() % 8 == 0) ? 1 + rand() % 12 : 1;
+		if (sector + count > 256)
+			count = 1;
+		if (op < 35)
+			cache_write(sector, count, i);
+		else if (op < 99)
+			CHECK(cache_check(sector, count), "read of %d sectors at %d returned wrong data (op %d)", count, (int)sector, i);
+		else
+			CHECK(diskcache_flush(cache) == RES_OK, "flush failed");
+	}
+	CHECK(diskcache_flush(cache) == RES_OK, "flush failed");
+	CHECK(!memcmp(disk, shadow, sizeof(disk)), "disk contents differ after flush (%d sectors, readahead %d)", num_sectors, readahead);
+	diskcache_free(cache);
+	cache = NULL;
+}
+
+/* Read back the files written by #fatfs_workload. Return false on mismatch. */
+static bool fatfs_verify(void)
+{
+	char name[64], line[64], buf[64];
+	FIL f;
+	for (int d=0; d<4; d++) {
+		for (int i=0; i<8; i++) {
+			snprintf(name, sizeof(name), "dir%d/log%d.txt", d, i);
+			if (f_open(&f, name, FA_READ) != FR_OK) {
+				fprintf(stderr, "cannot open %s\n", name);
+				return false;
+			}
+			for (int r=0; r<64; r++) {
+				int len = snprintf(line, sizeof(line), "record %d of file %d/%d\n", r, d, i);
+				UINT br;
+				if (f_read(&f, buf, len, &br) != FR_OK || br != len || memcmp(buf, line, len)) {
+					fprintf(stderr, "wrong contents in %s (record %d)\n", name, r);
+					f_close(&f);
+					return false;
+				}
+			}
+			f_close(&f);
+		}
+	}
+	return true;
+}
+
+/*
+ * A FatFs workload similar to what a game does on sd:/ during development:
+ * create a directory tree, append small records to log files, and read
+ * everything back. The files are then checked again without the cache.
+ * Return the number of disk commands of the workload (0 on error).
+ */
+static int fatfs_workload(int cache_sectors, int readahead)
+{
+	static FATFS fs;
+	static uint8_t work[FF_MAX_SS * 4];
+	memset(disk, 0, sizeof(disk));
+
+	MKFS_PARM opt = { .fmt = FM_FAT | FM_SFD };
+	if (f_mkfs("", &opt, work, sizeof(work)) != FR_OK) {
+		fprintf(stderr, "f_mkfs failed\n");
+		return 0;
+	}
+
+	cache = cache_sectors ? diskcache_new(cache_sectors, readahead, ram_read, ram_write) : NULL;
+	disk_commands = 0;
+	bool ok = f_mount(&fs, "", 1) == FR_OK;
+
+	char name[64], line[64];
+	FIL f;
+	for (int d=0; ok && d<4; d++) {
+		snprintf(name, sizeof(name), "dir%d", d);
+		f_mkdir(name);
+		for (int i=0; ok && i<8; i++) {
+			snprintf(name, sizeof(name), "dir%d/log%d.txt", d, i);
+			ok = f_open(&f, name, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK;
+			for (int r=0; ok && r<64; r++) {
+				UINT bw;
+				int len = snprintf(line, sizeof(line), "record %d of file %d/%d\n", r, d, i);
+				ok = f_write(&f, line, len, &bw) == FR_OK && bw == len;
+			}
+			f_close(&f);
+		}
+	}
+	ok = ok && fatfs_verify();
+	f_unmount("");
+
+	if (cache) {
+		ok = ok && diskcache_flush(cache) == RES_OK;
+		diskcache_free(cache);
+		cache = NULL;
+	}
+	int commands = disk_commands;
+
+	// Everything must have reached the disk
+	ok = ok && f_mount(&fs, "", 1) == FR_OK && fatfs_verify();
+	f_unmount("");
+	return ok ? commands : 0;
+}
+
+static void test_fatfs(void)
+{
+	CHECK(fatfs_workload(16, 8), "FatFs workload failed through the cache");
+	CHECK(fatfs_workload(0, 0), "FatFs workload failed without the cache");
+}
+
+static void bench_fatfs(void)
+{
+	printf("FatFs workload over a %d KiB RAM disk:\n", DISK_SECTORS * SECTOR_SIZE / 1024);
+
+	clock_t t0 = clock();
+	int base = fatfs_workload(0, 0);
+	clock_t t1 = clock();
+	printf("  no cache:                        %6d commands (%.2f ms)\n", base, (t1 - t0) * 1000.0 / CLOCKS_PER_SEC);
+
+	static const int configs[][2] = { {8, 0}, {16, 0}, {16, 8}, {32, 8}, {64, 16} };
+	for (int i=0; i<sizeof(configs)/sizeof(configs[0]); i++) {
+		t0 = clock();
+		int n = fatfs_workload(configs[i][0], configs[i][1]);
+		t1 = clock();
+		printf("  cache %2d sectors, readahead %2d: %6d commands (%5.1f%%, %.2f ms)\n",
+			configs[i][0], configs[i][1], n, n * 100.0 / base, (t1 - t0) * 1000.0 / CLOCKS_PER_SEC);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	bool bench = argc > 1 && !strcmp(argv[1], "--bench");
+
+	test_readahead_evicts_dirty();
+	test_multisector_sees_dirty();
+	test_random(1, 0);
+	test_random(8, 0);
+	test_random(16, 8);
+	test_random(32, 31);
+	test_fatfs();
+
+	if (num_failed) {
+		fprintf(stderr, "%d tests failed\n", num_failed);
+		return 1;
+	}
+	printf("diskcache: all tests passed\n");
+
+	if (bench)
+		bench_fatfs();
+	return 0;
+}
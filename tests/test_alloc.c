@@ -0,0 +1,180 @@
+#include "../src/alloc_internal.h"
+
+void test_alloc_arena(TestContext *ctx) {
+	arena_t *arena = arena_new("test_arena", 1024, 0);
+	ASSERT(arena, "arena_new failed");
+	DEFER(arena_free(arena));
+
+	// Allocations are 16-byte aligned and rounded to 16 bytes
+	uint8_t *a = arena_alloc(arena, 5);
+	uint8_t *b = arena_alloc(arena, 20);
+	ASSERT(a && b, "arena_alloc failed");
+	ASSERT_EQUAL_HEX((uint32_t)a & 15, 0, "allocation not aligned");
+	ASSERT_EQUAL_SIGNED(b - a, 16, "allocations not contiguous");
+	ASSERT_EQUAL_SIGNED(arena_get_used(arena), 48, "invalid used size");
+
+	uint8_t *c = arena_alloc_aligned(arena, 256, 16);
+	ASSERT_EQUAL_HEX((uint32_t)c & 255, 0, "allocation not aligned to 256 bytes");
+
+	// Fill the arena
+	ASSERT(!arena_alloc(arena, 1024), "allocation larger than the arena succeeded");
+	arena_reset(arena);
+	ASSERT_EQUAL_SIGNED(arena_get_used(arena), 0, "arena not reset");
+	ASSERT(arena_alloc(arena, 1024) == a, "arena not rewound");
+	ASSERT(!arena_alloc(arena, 1), "allocation in full arena succeeded");
+}
+
+void test_alloc_pool(TestContext *ctx) {
+	pool_t *pool = pool_new("test_pool", 24, 8, ALLOC_UNCACHED);
+	ASSERT(pool, "pool_new failed");
+	DEFER(pool_free(pool));
+
+	void *objs[8];
+	for (int i=0; i<8; i++) {
+		objs[i] = pool_alloc(pool);
+		ASSERT(objs[i], "pool_alloc failed");
+		ASSERT(objs[i] == UncachedAddr(objs[i]), "object not uncached");
+		ASSERT_EQUAL_HEX((uint32_t)objs[i] & 15, 0, "object not aligned");
+		memset(objs[i], i, 24);
+	}
+	ASSERT(!pool_alloc(pool), "allocation from exhausted pool succeeded");
+	ASSERT_EQUAL_SIGNED(pool_get_used(pool), 8, "invalid number of used objects");
+
+	for (int i=0; i<8; i++)
+		ASSERT_EQUAL_HEX(((uint8_t*)objs[i])[23], i, "object %d overwritten", i);
+
+	// Released objects are reused
+	pool_release(pool, objs[3]);
+	pool_release(pool, objs[5]);
+	ASSERT_EQUAL_SIGNED(pool_get_used(pool), 6, "invalid number of used objects");
+	ASSERT(pool_alloc(pool) == objs[5], "released object not reused");
+	ASSERT(pool_alloc(pool) == objs[3], "released object not reused");
+	ASSERT(!pool_alloc(pool), "allocation from exhausted pool succeeded");
+}
+
+void test_alloc_frame(TestContext *ctx) {
+	frame_arena_init(256, 0);
+	DEFER(frame_arena_close());
+
+	// Allocations of the previous frame are still valid in the next one
+	uint8_t *f0 = frame_alloc(64);
+	memset(f0, 0xAA, 64);
+	frame_arena_next();
+	uint8_t *f1 = frame_alloc(64);
+	ASSERT(f1 < f0 || f1 >= f0 + 64, "previous frame overwritten");
+	ASSERT_EQUAL_HEX(f0[63], 0xAA, "previous frame overwritten");
+
+	// Two frames later, the memory is reused
+	frame_arena_next();
+	ASSERT(frame_alloc(64) == f0, "frame arena not reused");
+}
+
+void test_alloc_scratch(TestContext *ctx) {
+	arena_t *scratch = arena_new("test_scratch", 256, 0);
+	DEFER(arena_free(scratch));
+	alloc_set_scratch(scratch);
+	DEFER(alloc_set_scratch(NULL));
+
+	// Small buffers come from the scratch arena, large ones from the heap
+	void *a = __alloc_scratch(64);
+	void *b = __alloc_scratch(1024);
+	void *c = __alloc_scratch(64);
+	ASSERT_EQUAL_SIGNED(arena_get_used(scratch), 128, "scratch buffers not allocated from the arena");
+	__free_scratch(c);
+	__free_scratch(b);
+	__free_scratch(a);
+	ASSERT_EQUAL_SIGNED(arena_get_used(scratch), 0, "scratch buffers not freed");
+}
+
+void test_alloc_stats(TestContext *ctx) {
+	heap_stats_t h0, h1;
+	heap_get_stats(&h0);
+
+	arena_t *a1 = arena_new("test_stats", 4096, 0);
+	DEFER(arena_free(a1));
+	pool_t *p1 = pool_new("test_stats", 32, 16, 0);
+	DEFER(pool_free(p1));
+	arena_t *a2 = arena_new("test_other", 1024, 0);
+	DEFER(arena_free(a2));
+
+	arena_alloc(a1, 1000);
+	pool_alloc(p1);
+	pool_alloc(p1);
+
+	alloc_tag_stats_t stats[16];
+	int n = alloc_get_tag_stats(stats, 16);
+	ASSERT(n >= 2 && n <= 16, "invalid number of tags: %d", n);
+	bool found = false;
+	for (int i=0; i<n; i++) {
+		if (strcmp(stats[i].tag, "test_stats")) continue;
+		found = true;
+		ASSERT_EQUAL_SIGNED(stats[i].size, 4096 + 32*16, "invalid tag size");
+		ASSERT_EQUAL_SIGNED(stats[i].used, 1008 + 32*2, "invalid tag usage");
+	}
+	ASSERT(found, "tag not found");
+
+	// With a short array, the number of tags is still reported
+	ASSERT_EQUAL_SIGNED(alloc_get_tag_stats(stats, 1), n, "invalid number of tags");
+
+	heap_get_stats(&h1);
+	ASSERT(h1.used >= h0.used + 4096 + 32*16 + 1024, "heap usage not updated (%d -> %d)", h0.used, h1.used);
+	ASSERT(h1.peak >= h1.total, "peak lower than current heap size");
+	ASSERT_EQUAL_SIGNED(h1.used + h1.free, h1.total, "inconsistent heap stats");
+	ASSERT(h1.fragmented >= 0 && h1.fragmented <= h1.free, "inconsistent fragmentation");
+}
+
+void test_alloc_slab(TestContext *ctx) {
+	slab_stats_t s0, s1;
+	slab_get_stats(&s0);
+
+	// Sizes of the same class share the chunks
+	uint8_t *a = slab_alloc_uncached(600);
+	ASSERT(a == UncachedAddr(a), "slab memory is not uncached");
+	ASSERT_EQUAL_HEX((uint32_t)a & 15, 0, "slab memory is not aligned");
+	memset(a, 0xAA, 600);
+	slab_free_uncached(a, 600);
+	uint8_t *b = slab_alloc_uncached(640);
+	ASSERT(a == b, "freed chunk not reused");
+	slab_free_uncached(b, 640);
+
+	// Allocations of different sizes do not overlap
+	int sizes[] = { 8, 264, 1024, 1500, 16768, 32768 };
+	uint8_t *ptrs[6];
+	for (int i=0; i<6; i++) {
+		ptrs[i] = slab_alloc_uncached(sizes[i]);
+		memset(ptrs[i], i, sizes[i]);
+	}
+	for (int i=0; i<6; i++) {
+		for (int j=0; j<sizes[i]; j++)
+			if (ptrs[i][j] != i) ASSERT(0, "allocation %d overwritten at %d", i, j);
+		slab_free_uncached(ptrs[i], sizes[i]);
+	}
+
+	// Large allocations are served by malloc_uncached
+	void *big = slab_alloc_uncached(40000);
+	ASSERT(big, "large allocation failed");
+	slab_free_uncached(big, 40000);
+
+	// Chunks of blocks (a power of two, possibly plus a small header) waste
+	// at most the headroom of their class
+	int chunk_sizes[] = { 256+8, 4096, 4096+8, 32768+8 };
+	for (int i=0; i<4; i++) {
+		slab_stats_t sa, sb;
+		slab_get_stats(&sa);
+		void *p = slab_alloc_uncached(chunk_sizes[i]);
+		slab_get_stats(&sb);
+		slab_free_uncached(p, chunk_sizes[i]);
+		ASSERT_EQUAL_SIGNED(sb.large, sa.large, "chunk of %d bytes not served by the slabs", chunk_sizes[i]);
+		ASSERT(sb.used - sa.used <= chunk_sizes[i] + 16, "chunk of %d bytes wastes %d bytes",
+			chunk_sizes[i], sb.used - sa.used - chunk_sizes[i]);
+	}
+
+	slab_get_stats(&s1);
+	ASSERT_EQUAL_SIGNED(s1.allocs - s0.allocs, 13, "invalid number of allocations");
+	ASSERT_EQUAL_SIGNED(s1.frees - s0.frees, 13, "invalid number of frees");
+	ASSERT_EQUAL_SIGNED(s1.large - s0.large, 1, "invalid number of large allocations");
+	ASSERT(s1.recycled - s0.recycled >= 1, "chunks not recycled");
+	ASSERT_EQUAL_SIGNED(s1.used, s0.used, "slab memory leaked");
+	ASSERT(s1.peak >= s0.used + 264 + 1024 + 1536 + 20480 + 32768, "invalid peak: %d", s1.peak);
+	ASSERT(s1.reserved >= s1.peak, "reserved memory lower than peak");
+}
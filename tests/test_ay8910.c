@@ -0,0 +1,60 @@
+#include <malloc.h>
+#include <string.h>
+#include "../src/audio/ay8910_internal.h"
+
+void test_ay8910_rsp(TestContext *ctx)
+{
+    rspq_init();
+    DEFER(rspq_close());
+    rsp_ay8910_init();
+    DEFER(rsp_ay8910_close());
+
+    const int nframes = 64;
+    const int max_samples = 300;
+
+    ay8910_rsp_state_t *state = malloc_uncached(sizeof(ay8910_rsp_state_t));
+    DEFER(free_uncached(state));
+    ay8910_rsp_state_reset(state);
+
+    // Leave one extra sample before and after the output, to check that
+    // the RSP does not overwrite them when the output is not 8-byte aligned.
+    int16_t *out = malloc_uncached((max_samples+2) * 2 * sizeof(int16_t));
+    DEFER(free_uncached(out));
+    int16_t expected[(max_samples+2) * 2] __attribute__((aligned(8)));
+
+    AY8910 ay;
+    ay8910_reset(&ay);
+
+    SRAND(0x59384B31);
+    for (int f=0; f<nframes; f++) {
+        // Write some random registers. Use short periods so that
+        // tones, noise and envelope all change state within a frame.
+        bool env_restart = false;
+        int nregs = RANDN(6);
+        for (int i=0; i<nregs; i++) {
+            int reg = RANDN(14);
+            uint8_t val = RANDN(256);
+            if (reg == 1 || reg == 3 || reg == 5 || reg == 12) val = 0;
+            if (reg == 13) env_restart = true;
+            ay8910_write_addr(&ay, reg);
+            ay8910_write_data(&ay, val);
+        }
+
+        ay8910_rsp_frame_t frame;
+        int nsamples = RANDN(max_samples) + 1;
+        ay8910_rsp_frame(&ay, &frame, nsamples, env_restart);
+
+        int off = RANDN(2);
+        for (int i=0; i<(max_samples+2)*2; i++)
+            out[i] = expected[i] = RANDN(65536);
+
+        // The CPU emulator is the reference. The frame must be prepared
+        // before running it, as it updates the envelope state.
+        ay8910_gen(&ay, expected + off*2, nsamples);
+        rsp_ay8910_synth(&frame, state, out + off*2);
+        rspq_wait();
+
+        ASSERT_EQUAL_MEM((uint8_t*)out, (uint8_t*)expected, (max_samples+2) * 2 * sizeof(int16_t),
+            "invalid samples (frame=%d, nsamples=%d, off=%d)", f, nsamples, off);
+    }
+}
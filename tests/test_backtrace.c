@@ -205,3 +205,49 @@ void test_backtrace_analyze(TestContext *ctx)
     ASSERT_EQUAL_UNSIGNED(func.ra_offset, 0, "invalid RA offset");
     ASSERT_EQUAL_UNSIGNED(func.fp_offset, 0, "invalid FP offset");
 }
+
+void test_backtrace_symbols_cache(TestContext *ctx)
+{
+    // Collect the return addresses of a real call stack to symbolize
+    btt_start(ctx, btt_b1, (const char*[]) { NULL });
+    if (ctx->result == TEST_FAILED) return;
+    void *addrs[8];
+    int num_addrs = bt_buf_len < 8 ? bt_buf_len : 8;
+    memcpy(addrs, bt_buf, num_addrs * sizeof(void*));
+
+    const int num_iters = 32;
+    char expected[8][64];
+    int run(bool check) {
+        int i = 0;
+        void cb(void *user, backtrace_frame_t *frame) {
+            if (frame->is_inline) return;
+            if (check) ASSERT_EQUAL_STR(expected[i], frame->func, "invalid symbol with cache");
+            else snprintf(expected[i], sizeof(expected[i]), "%s", frame->func);
+            i++;
+        }
+        uint32_t t0 = TICKS_READ();
+        for (int j=0; j<num_iters && ctx->result != TEST_FAILED; j++) {
+            i = 0;
+            backtrace_symbols_cb(addrs, num_addrs, 0, cb, NULL);
+        }
+        return TICKS_SINCE(t0);
+    }
+
+    // Benchmark symbolization from ROM, then with the address table
+    // cached, and finally with the whole symbol table cached.
+    int ticks_rom = run(false);
+    DEFER(backtrace_symbols_cache_close());
+    ASSERT(backtrace_symbols_cache_init(false), "symbol table not found");
+    int ticks_addr = run(true);
+    if (ctx->result == TEST_FAILED) return;
+    ASSERT(backtrace_symbols_cache_init(true), "symbol table not found");
+    int ticks_full = run(true);
+    if (ctx->result == TEST_FAILED) return;
+
+    int lookups = num_iters * num_addrs;
+    debugf("backtrace_symbols_cb lookups/sec: rom=%lld addrtab=%lld full=%lld\n",
+        (long long)lookups * TICKS_PER_SECOND / ticks_rom,
+        (long long)lookups * TICKS_PER_SECOND / ticks_addr,
+        (long long)lookups * TICKS_PER_SECOND / ticks_full);
+    ASSERT(ticks_full < ticks_rom, "cached symbolization is not faster (%d vs %d ticks)", ticks_full, ticks_rom);
+}
@@ -0,0 +1,39 @@
+
+void test_binlog(TestContext *ctx) {
+	binlog_init(64);
+	DEFER(binlog_close());
+
+	// Each message has a 9-byte header, followed by one type byte per
+	// argument, and the argument values.
+	binlogf("no arguments\n");
+	ASSERT_EQUAL_SIGNED(binlog_size(), 9, "invalid message size");
+
+	int a = 1; int64_t b = 2; float c = 3.0f;
+	binlogf("%d %lld %f %s\n", a, b, c, "abc");
+	ASSERT_EQUAL_SIGNED(binlog_size(), 9 + (9 + 4 + 4+8+8+4), "invalid message size");
+
+	// Dump the log and check the header and the first message
+	uint8_t dump[128];
+	FILE *f = fmemopen(dump, sizeof(dump), "wb");
+	ASSERT(f, "fmemopen failed");
+	binlog_dump(f);
+	int size = ftell(f);
+	fclose(f);
+	ASSERT_EQUAL_SIGNED(size, 20 + binlog_size(), "invalid dump size");
+	ASSERT_EQUAL_HEX(*(uint32_t*)&dump[0], BINLOG_MAGIC, "invalid magic");
+	ASSERT_EQUAL_HEX(*(uint32_t*)&dump[12], binlog_size(), "invalid size in header");
+	const char *fmt = (const char*)(*(uint32_t*)&dump[20]);
+	ASSERT(strcmp(fmt, "no arguments\n") == 0, "invalid format string address");
+
+	// Messages that do not fit are dropped
+	for (int i=0; i<8; i++)
+		binlogf("%d\n", i);
+	ASSERT(binlog_size() <= 64, "buffer overflow");
+	f = fmemopen(dump, sizeof(dump), "wb");
+	binlog_dump(f);
+	fclose(f);
+	ASSERT(*(uint32_t*)&dump[16] > 0, "no messages were dropped");
+
+	binlog_reset();
+	ASSERT_EQUAL_SIGNED(binlog_size(), 0, "reset failed");
+}
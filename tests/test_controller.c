@@ -0,0 +1,42 @@
+#include "../src/vi.h"
+
+void test_controller_poll_schedule(TestContext *ctx) {
+	timer_init();
+	DEFER(timer_close());
+	controller_init();
+	DEFER(controller_close());
+	controller_poll_schedule(12000);
+	controller_reset_latency_stats();
+
+	// Wait for a few frames, so that the duration of the scan is measured
+	wait_ms(100);
+	controller_latency_stats_t stats;
+	controller_get_latency_stats(&stats);
+	ASSERT(stats.polls >= 4, "background scan not running (%lu polls)", stats.polls);
+	ASSERT_EQUAL_SIGNED(stats.missed, 0, "background scans skipped");
+	ASSERT(stats.poll_us > 0 && stats.poll_us < 10000, "invalid scan duration: %lu us", stats.poll_us);
+
+	// The scan must start well after the vertical blank, and complete
+	// before the sampling point.
+	vi_wait_for_vblank();
+	uint32_t t0 = TICKS_READ();
+	uint32_t polls = stats.polls;
+	do controller_get_latency_stats(&stats); while (stats.polls == polls && TICKS_SINCE(t0) < TICKS_FROM_MS(40));
+	uint32_t start = TICKS_TO_US(TICKS_SINCE(t0));
+	ASSERT(start > 4000 && start < 12000, "scan started at %lu us", start);
+
+	while (TICKS_SINCE(t0) < TICKS_FROM_US(12000)) {}
+	controller_scan();
+	controller_get_latency_stats(&stats);
+	ASSERT_EQUAL_SIGNED(stats.scans, 1, "sample not returned");
+	ASSERT_EQUAL_SIGNED(stats.late, 0, "sample of the frame not ready at the sampling point");
+	ASSERT(stats.sample_age_us < 4000, "sample too old: %lu us", stats.sample_age_us);
+
+	// A sampling point right before the next vertical blank must still get
+	// a scan every frame
+	controller_poll_schedule(16000);
+	controller_reset_latency_stats();
+	wait_ms(100);
+	controller_get_latency_stats(&stats);
+	ASSERT(stats.polls >= 4, "background scan not running at the end of the frame (%lu polls)", stats.polls);
+}
@@ -4,6 +4,7 @@
 
 #include <sys/stat.h>
 #include <unistd.h>
+#include "../src/debug_internal.h"
 
 void test_debug_sdfs(TestContext *ctx) {
 
@@ -97,3 +98,74 @@ void test_debug_sdfs(TestContext *ctx) {
 
 #undef ROM_FILE
 #undef SD_FILE
+
+void test_debug_sdfs_cache(TestContext *ctx) {
+	const int disk_size = 512*1024;
+	void *disk = calloc(1, disk_size);
+	DEFER(free(disk));
+
+	debug_set_sdfs_cache(16, 8);
+	DEFER(debug_set_sdfs_cache(16, 8));
+	ASSERT(__debug_init_ramfs("ram:/", disk, disk_size), "cannot create RAM filesystem");
+	DEFER(debug_close_sdfs());
+
+	static uint8_t data[16*1024], back[16*1024];
+	for (int i=0; i<sizeof(data); i++)
+		data[i] = RANDN(256);
+
+	// Write several files in small unbuffered chunks, so that the
+	// same sectors are written many times.
+	for (int f=0; f<8; f++) {
+		char fn[32]; sprintf(fn, "ram:/file%d.bin", f);
+		FILE *fp = fopen(fn, "wb");
+		ASSERT(fp, "cannot create file: %s", fn);
+		setvbuf(fp, NULL, _IONBF, 0);
+		int off = 0;
+		while (off < sizeof(data)) {
+			int n = RANDN(100) + 1;
+			if (n > sizeof(data) - off) n = sizeof(data) - off;
+			ASSERT_EQUAL_SIGNED(fwrite(data + off, 1, n, fp), n, "invalid write size");
+			off += n;
+		}
+		fclose(fp);
+	}
+
+	diskcache_stats_t stats;
+	ASSERT(__debug_get_sdfs_cache_stats(&stats), "cache not enabled");
+	ASSERT(stats.disk_writes < stats.sectors_written, "writes were not coalesced (%lu commands, %lu sectors)",
+		stats.disk_writes, stats.sectors_written);
+
+	// Read them back in small chunks
+	for (int f=0; f<8; f++) {
+		char fn[32]; sprintf(fn, "ram:/file%d.bin", f);
+		FILE *fp = fopen(fn, "rb");
+		ASSERT(fp, "cannot open file: %s", fn);
+		setvbuf(fp, NULL, _IONBF, 0);
+		int off = 0;
+		while (off < sizeof(back)) {
+			int n = RANDN(700) + 1;
+			if (n > sizeof(back) - off) n = sizeof(back) - off;
+			n = fread(back + off, 1, n, fp);
+			if (!n) break;
+			off += n;
+		}
+		fclose(fp);
+		ASSERT_EQUAL_SIGNED(off, sizeof(data), "invalid file size: %s", fn);
+		ASSERT_EQUAL_MEM(back, data, sizeof(data), "invalid data in file: %s", fn);
+	}
+
+	ASSERT(__debug_get_sdfs_cache_stats(&stats), "cache not enabled");
+	ASSERT(stats.hits > 0, "no cache hits");
+	ASSERT(stats.sectors_read > stats.disk_reads, "no read-ahead");
+
+	// Remount without cache: all the modified sectors must have been written back
+	debug_close_sdfs();
+	debug_set_sdfs_cache(0, 0);
+	ASSERT(__debug_init_ramfs("ram:/", disk, disk_size), "cannot mount RAM filesystem");
+	FILE *fp = fopen("ram:/file7.bin", "rb");
+	ASSERT(fp, "cannot open file after remount");
+	int sz = fread(back, 1, sizeof(back), fp);
+	fclose(fp);
+	ASSERT_EQUAL_SIGNED(sz, sizeof(data), "invalid file size after remount");
+	ASSERT_EQUAL_MEM(back, data, sizeof(data), "invalid data after remount");
+}
@@ -88,3 +88,25 @@ void test_dfs_rom_addr(TestContext *ctx) {
 
 	ASSERT_EQUAL_MEM(buf1, buf2, 128, "DMA ROM access is different");
 }
+
+void test_dfs_dedup(TestContext *ctx) {
+	// counter_copy.dat has the same contents of counter.dat, so mkdfs
+	// stores them only once.
+	uint32_t rom1 = dfs_rom_addr("counter.dat");
+	uint32_t rom2 = dfs_rom_addr("counter_copy.dat");
+	ASSERT(rom1 != 0, "counter.dat not found by dfs_rom_addr");
+	ASSERT(rom2 != 0, "counter_copy.dat not found by dfs_rom_addr");
+	ASSERT_EQUAL_HEX(rom1, rom2, "identical files were not deduplicated");
+
+	int fh = dfs_open("counter_copy.dat");
+	ASSERT(fh >= 0, "counter_copy.dat not found");
+	DEFER(dfs_close(fh));
+	ASSERT_EQUAL_SIGNED(dfs_size(fh), 4096, "invalid size of deduplicated file");
+
+	uint8_t buf[16] __attribute__((aligned(16)));
+	dfs_seek(fh, 16, SEEK_SET);
+	dfs_read(buf, 1, 16, fh);
+	ASSERT_EQUAL_MEM(buf,
+		(uint8_t*)"\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f",
+		16, "invalid read from deduplicated file");
+}
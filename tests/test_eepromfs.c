@@ -1,3 +1,5 @@
+#include "../src/eeprom_internal.h"
+
 void test_eepromfs(TestContext *ctx) {
     // Skip these tests if no EEPROM is present
     const size_t eeprom_capacity = eeprom_total_blocks();
@@ -99,3 +101,93 @@ void test_eepromfs(TestContext *ctx) {
     eepfs_wipe();
     ASSERT(eepfs_verify_signature() == true, "expected valid eepfs signature"); 
 }
+
+void test_eepromfs_async(TestContext *ctx) {
+    // Skip these tests if no EEPROM is present
+    const size_t eeprom_capacity = eeprom_total_blocks();
+    if (eeprom_capacity == 0) {
+        SKIP("EEPROM not found; skipping eepfs tests");
+    }
+
+    uint8_t file1_src[256] = {0};
+    uint8_t file1_dst[256] = {0};
+
+    const eepfs_entry_t eeprom_files[] = {
+        { "/file1", sizeof(file1_dst) },
+    };
+    const size_t eeprom_files_count = sizeof(eeprom_files) / sizeof(eepfs_entry_t);
+
+    int result;
+
+    result = eepfs_init(eeprom_files, eeprom_files_count);
+    ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs init failed");
+    DEFER(eepfs_close());
+    eepfs_wipe();
+    ASSERT(eepfs_busy() == false, "eepfs busy after wipe");
+
+    // Background write: data must be readable immediately
+    for (int i = 0; i < sizeof(file1_src); i++) {
+        file1_src[i] = i ^ 0x5A;
+    }
+    result = eepfs_write_async("file1", file1_src, sizeof(file1_src));
+    ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs async write failed");
+    ASSERT(eepfs_busy() == true, "eepfs not busy after async write");
+    result = eepfs_read("file1", file1_dst, sizeof(file1_dst));
+    ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs read failed");
+    result = memcmp(file1_src, file1_dst, sizeof(file1_src));
+    ASSERT_EQUAL_SIGNED(result, 0, "eepfs async write/read mismatch");
+
+    // After flushing, the data must be in EEPROM (file1 starts at block 1)
+    eepfs_flush();
+    ASSERT(eepfs_busy() == false, "eepfs busy after flush");
+    memset(file1_dst, 0, sizeof(file1_dst));
+    eeprom_read_bytes(file1_dst, EEPROM_BLOCK_SIZE, sizeof(file1_dst));
+    result = memcmp(file1_src, file1_dst, sizeof(file1_src));
+    ASSERT_EQUAL_SIGNED(result, 0, "eepfs async write/EEPROM mismatch");
+    ASSERT(eepfs_verify_signature() == true, "expected valid eepfs signature");
+
+    result = eepfs_close();
+    ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs close failed");
+
+    // A commit interrupted by a power loss must leave either the previous or
+    // the new contents of the file. Use a file that fits in the journal.
+    uint8_t file2_old[64], file2_new[64], file2_dst[64];
+    const eepfs_entry_t eeprom_files2[] = {
+        { "/file2", sizeof(file2_dst) },
+    };
+    for (int i = 0; i < sizeof(file2_old); i++) {
+        file2_old[i] = i;
+        file2_new[i] = ~i;
+    }
+
+    bool found_new = false;
+    for (int num_writes = 0; num_writes < 24; num_writes += 3) {
+        result = eepfs_init(eeprom_files2, 1);
+        ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs init failed");
+        if (num_writes == 0) eepfs_wipe();
+        result = eepfs_write("file2", file2_old, sizeof(file2_old));
+        ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs write failed");
+
+        result = eepfs_write_async("file2", file2_new, sizeof(file2_new));
+        ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs async write failed");
+        __eepfs_flush_interrupted(num_writes);
+        eepfs_close();
+
+        result = eepfs_init(eeprom_files2, 1);
+        ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs init failed");
+        ASSERT(eepfs_verify_signature() == true, "expected valid eepfs signature after interrupted commit (writes=%d)", num_writes);
+        result = eepfs_read("file2", file2_dst, sizeof(file2_dst));
+        ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs read failed");
+        bool is_old = memcmp(file2_dst, file2_old, sizeof(file2_dst)) == 0;
+        bool is_new = memcmp(file2_dst, file2_new, sizeof(file2_dst)) == 0;
+        ASSERT(is_old || is_new, "file mixes previous and new contents after interrupted commit (writes=%d)", num_writes);
+        ASSERT(!(found_new && is_old), "commit rolled back after it was completed (writes=%d)", num_writes);
+        found_new |= is_new;
+        eepfs_close();
+    }
+    ASSERT(found_new, "interrupted commit never completed");
+
+    // Reopen for the deferred eepfs_close
+    result = eepfs_init(eeprom_files, eeprom_files_count);
+    ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs init failed");
+}
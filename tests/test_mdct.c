@@ -0,0 +1,62 @@
+#include <malloc.h>
+#include <string.h>
+#include "../src/audio/mdct_internal.h"
+
+static void mdct_test_decode(TestContext *ctx, int channels, int nframes, int frame_bytes)
+{
+    int nrecords = nframes * channels;
+    int nsamples = nframes * MDCT_FRAME_SIZE * channels;
+
+    uint8_t *data = malloc(nrecords * frame_bytes);
+    DEFER(free(data));
+    for (int i=0; i<nrecords * frame_bytes; i++)
+        data[i] = RANDN(256);
+
+    mdct_record_t *records = malloc_uncached(nrecords * sizeof(mdct_record_t));
+    DEFER(free_uncached(records));
+    int16_t *expected = malloc(nsamples * sizeof(int16_t));
+    DEFER(free(expected));
+    int16_t *state = malloc_uncached(2 * MDCT_FRAME_SIZE * sizeof(int16_t));
+    DEFER(free_uncached(state));
+    int16_t exp_state[2][MDCT_FRAME_SIZE];
+
+    for (int i=0; i<MDCT_FRAME_SIZE; i++)
+        for (int ch=0; ch<2; ch++)
+            state[ch*MDCT_FRAME_SIZE + i] = exp_state[ch][i] = RANDN(65536) - 32768;
+
+    // Decode with the reference implementation
+    uint8_t gains[MDCT_RSP_MAX_RECORDS];
+    for (int i=0; i<nrecords; i++) {
+        int f = i / channels, ch = i % channels;
+        mdct_record_t rec;
+        gains[i] = mdct_unpack_frame(data + i*frame_bytes, frame_bytes, f*2+ch, &rec);
+        records[i] = rec;
+        mdct_imdct(&rec, gains[i], exp_state[ch], expected + f*MDCT_FRAME_SIZE*channels + ch, channels);
+    }
+
+    // Decode in-place with the RSP
+    rsp_mdct_decompress(records, gains, (int16_t*)records, channels == 2, nframes, state);
+    rspq_wait();
+
+    ASSERT_EQUAL_MEM((uint8_t*)records, (uint8_t*)expected, nsamples * sizeof(int16_t),
+        "invalid samples (channels=%d, nframes=%d)", channels, nframes);
+    ASSERT_EQUAL_MEM((uint8_t*)state, (uint8_t*)exp_state, channels * MDCT_FRAME_SIZE * sizeof(int16_t),
+        "invalid state (channels=%d, nframes=%d)", channels, nframes);
+}
+
+void test_wav64_mdct(TestContext *ctx)
+{
+    rspq_init();
+    DEFER(rspq_close());
+    rsp_mdct_init();
+    DEFER(rsp_mdct_close());
+
+    SRAND(0x4D444354);
+    mdct_test_decode(ctx, 1, 1, 26);
+    if (ctx->result == TEST_FAILED) return;
+    mdct_test_decode(ctx, 1, MDCT_RSP_MAX_RECORDS, 26);
+    if (ctx->result == TEST_FAILED) return;
+    mdct_test_decode(ctx, 2, 1, 64);
+    if (ctx->result == TEST_FAILED) return;
+    mdct_test_decode(ctx, 2, MDCT_RSP_MAX_RECORDS/2, 128);
+}
@@ -0,0 +1,68 @@
+__attribute__((noinline))
+static void *memprof_test_alloc_a(int size) {
+	void *ptr = malloc(size);
+	assert(ptr);
+	return ptr;
+}
+
+__attribute__((noinline))
+static void *memprof_test_alloc_b(int size) {
+	void *ptr = malloc(size);
+	assert(ptr);
+	return ptr;
+}
+
+void test_memprof(TestContext *ctx) {
+	memprof_init(64, 16, 4);
+	DEFER(memprof_close());
+
+	memprof_stats_t stats;
+	memprof_get_stats(&stats);
+	ASSERT_EQUAL_SIGNED(stats.live_allocs, 0, "allocations tracked before memprof_init");
+
+	void *a[3];
+	for (int i=0; i<3; i++)
+		a[i] = memprof_test_alloc_a(100);
+	void *b = memprof_test_alloc_b(1000);
+
+	memprof_get_stats(&stats);
+	ASSERT_EQUAL_SIGNED(stats.live_allocs, 4, "invalid number of live allocations");
+	ASSERT_EQUAL_SIGNED(stats.live_bytes, 1300, "invalid live bytes");
+	ASSERT_EQUAL_SIGNED(stats.num_sites, 2, "allocations not grouped by call site");
+
+	// Sites are sorted by live bytes, and the first frame is the caller of malloc
+	memprof_site_t sites[4];
+	int n = memprof_get_sites(sites, 4);
+	ASSERT_EQUAL_SIGNED(n, 2, "invalid number of sites");
+	ASSERT_EQUAL_SIGNED(sites[0].live_bytes, 1000, "invalid live bytes of site B");
+	ASSERT_EQUAL_SIGNED(sites[1].live_bytes, 300, "invalid live bytes of site A");
+	ASSERT_EQUAL_SIGNED(sites[1].live_allocs, 3, "invalid live allocations of site A");
+	ASSERT(sites[0].depth > 0 && sites[1].depth > 0, "empty backtraces");
+	ASSERT((uint32_t)sites[0].frames[0] - (uint32_t)memprof_test_alloc_b < 0x100,
+		"invalid call site for B: %p", sites[0].frames[0]);
+	ASSERT((uint32_t)sites[1].frames[0] - (uint32_t)memprof_test_alloc_a < 0x100,
+		"invalid call site for A: %p", sites[1].frames[0]);
+
+	// realloc moves the allocation to the site that called it
+	a[0] = realloc(a[0], 200);
+	ASSERT(a[0], "realloc failed");
+	memprof_get_stats(&stats);
+	ASSERT_EQUAL_SIGNED(stats.live_allocs, 4, "invalid number of live allocations after realloc");
+	ASSERT_EQUAL_SIGNED(stats.live_bytes, 1400, "invalid live bytes after realloc");
+
+	for (int i=0; i<3; i++)
+		free(a[i]);
+	free(b);
+	memprof_get_stats(&stats);
+	ASSERT_EQUAL_SIGNED(stats.live_allocs, 0, "allocations not released");
+	ASSERT_EQUAL_SIGNED(stats.live_bytes, 0, "live bytes not released");
+	ASSERT_EQUAL_SIGNED(stats.peak_bytes, 1400, "invalid peak bytes");
+	ASSERT_EQUAL_SIGNED(stats.num_frees, 5, "invalid number of frees");
+
+	// The peak of each site is kept after the release
+	n = memprof_get_sites(sites, 4);
+	ASSERT_EQUAL_SIGNED(n, 3, "invalid number of sites after realloc");
+	ASSERT_EQUAL_SIGNED(sites[0].peak_bytes, 1000, "invalid peak of site B");
+	ASSERT_EQUAL_SIGNED(sites[1].peak_bytes, 300, "invalid peak of site A");
+	ASSERT_EQUAL_SIGNED(sites[2].peak_bytes, 200, "invalid peak of the realloc site");
+}
@@ -1,3 +1,5 @@
+#include "../src/sprite_internal.h"
+
 
 
 void test_rdpq_sprite_upload(TestContext *ctx)
@@ -77,3 +79,248 @@ void test_rdpq_sprite_lod(TestContext *ctx)
         return color_from_packed32(0);
     });
 }
+
+void test_rdpq_sprite_shared_palette(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    // Load two CI4 sprites converted with a shared palette made of two banks
+    sprite_t *s1 = sprite_load("rom:/shared/grass1.rgba32.sprite");
+    DEFER(sprite_free(s1));
+    sprite_t *s2 = sprite_load("rom:/shared/grass2.rgba32.sprite");
+    DEFER(sprite_free(s2));
+
+    const struct sprite_palette_s *pal1 = __sprite_palette_info(s1);
+    const struct sprite_palette_s *pal2 = __sprite_palette_info(s2);
+    ASSERT(pal1 && pal2, "palette information not found");
+    ASSERT_EQUAL_HEX(pal1->id, pal2->id, "sprites do not share the palette");
+    ASSERT_EQUAL_SIGNED(pal1->num_colors, 32, "invalid number of colors in the shared palette");
+
+    surface_t s1surf = sprite_get_pixels(s1);
+    surface_t s2surf = sprite_get_pixels(s2);
+    uint16_t palette[32];
+    memcpy(palette, sprite_get_palette(s1), sizeof(palette));
+
+    // Corrupt the palette of the second sprite. Since the shared palette is
+    // already in TMEM after uploading the first sprite, it must not be loaded
+    // again, so the second sprite must still be drawn correctly.
+    uint16_t *s2pal = sprite_get_palette(s2);
+    memset(s2pal, 0, sizeof(palette));
+    data_cache_hit_writeback(s2pal, sizeof(palette));
+
+    surface_t fb = surface_alloc(FMT_RGBA32, s1surf.width + s2surf.width, s1surf.height);
+    DEFER(surface_free(&fb));
+    surface_clear(&fb, 0);
+
+    rdpq_attach(&fb, NULL);
+    rdpq_set_mode_standard();
+    rdpq_sprite_upload(TILE0, s1, NULL);
+    rdpq_texture_rectangle(TILE0, 0, 0, s1surf.width, s1surf.height, 0, 0);
+    rdpq_sprite_upload(TILE0, s2, NULL);
+    rdpq_texture_rectangle(TILE0, s1surf.width, 0, s1surf.width + s2surf.width, s2surf.height, 0, 0);
+    rdpq_detach_wait();
+
+    ASSERT_SURFACE(&fb, {
+        surface_t *s = &s1surf; int bank = pal1->bank;
+        if (x >= s1surf.width) { x -= s1surf.width; s = &s2surf; bank = pal2->bank; }
+        uint8_t px = ((uint8_t*)s->buffer)[y * s->stride + x/2];
+        px = (x & 1) ? px & 0xF : px >> 4;
+        color_t c = color_from_packed16(palette[bank*16 + px]);
+        c.a = 0xE0;
+        return c;
+    });
+}
+
+void test_rdpq_sprite_tmem_layout(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    // Load an I4 sprite stored in TMEM layout. Its lines are 12 bytes,
+    // so in linear layout it could not be loaded with LOAD_BLOCK.
+    sprite_t *s1 = sprite_load("rom:/tmem/grass1.i4.sprite");
+    DEFER(sprite_free(s1));
+    surface_t s1surf = sprite_get_pixels(s1);
+    ASSERT(s1surf.flags & SURFACE_FLAGS_TMEMLAYOUT, "surface not in TMEM layout");
+    ASSERT_EQUAL_SIGNED(s1surf.stride, 16, "invalid stride of TMEM layout");
+
+    surface_t fb = surface_alloc(FMT_RGBA32, s1surf.width, s1surf.height);
+    DEFER(surface_free(&fb));
+    surface_clear(&fb, 0);
+
+    rdpq_attach(&fb, NULL);
+    rdpq_set_mode_standard();
+    rdpq_sprite_upload(TILE0, s1, NULL);
+    rdpq_texture_rectangle(TILE0, 0, 0, s1surf.width, s1surf.height, 0, 0);
+    rdpq_detach_wait();
+
+    ASSERT_SURFACE(&fb, {
+        // Odd lines have the 32-bit words swapped
+        int offset = y * s1surf.stride + x/2;
+        if (y & 1) offset ^= 4;
+        uint8_t px = ((uint8_t*)s1surf.buffer)[offset];
+        px = (x & 1) ? px & 0xF : px >> 4;
+        px |= px << 4;
+        return RGBA32(px, px, px, 0xE0);
+    });
+}
+
+void test_rdpq_sprite_tmem_layout_bench(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    // Compare the time required to upload about the same amount of texels with
+    // LOAD_TILE, LOAD_BLOCK on a linear texture, and LOAD_BLOCK with dxt=0 on a
+    // texture in TMEM layout. A linear 60x32 RGBA16 texture is loaded with
+    // LOAD_TILE, because with a pitch of 15 words LOAD_BLOCK is only accurate
+    // up to 19 lines.
+    const int num_uploads = 512;
+    surface_t tex_tile = surface_alloc(FMT_RGBA16, 60, 32);
+    DEFER(surface_free(&tex_tile));
+    surface_t tex_block = surface_alloc(FMT_RGBA16, 64, 30);
+    DEFER(surface_free(&tex_block));
+    surface_t tex_tmem = surface_alloc(FMT_RGBA16, 60, 32);
+    DEFER(surface_free(&tex_tmem));
+    tex_tmem.flags |= SURFACE_FLAGS_TMEMLAYOUT;
+
+    surface_t fb = surface_alloc(FMT_RGBA16, 32, 32);
+    DEFER(surface_free(&fb));
+    rdpq_attach(&fb, NULL);
+    rspq_wait();
+
+    int bench(surface_t *tex) {
+        uint32_t t0 = TICKS_READ();
+        for (int i=0; i<num_uploads; i++)
+            rdpq_tex_upload(TILE0, tex, NULL);
+        rspq_wait();
+        return TICKS_SINCE(t0);
+    }
+
+    int ticks_tile = bench(&tex_tile);
+    int ticks_block = bench(&tex_block);
+    int ticks_tmem = bench(&tex_tmem);
+    rdpq_detach_wait();
+
+    debugf("Upload of %d textures (~3840 bytes each): LOAD_TILE: %d us, LOAD_BLOCK: %d us, TMEM layout: %d us\n",
+        num_uploads, TICKS_TO_US(ticks_tile), TICKS_TO_US(ticks_block), TICKS_TO_US(ticks_tmem));
+}
+
+void test_rdpq_sprite_vq(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    // Load a RGBA16 sprite compressed with VQ. The image is 24x24, so it is
+    // made by 12x12 blocks of 2x2 texels.
+    sprite_t *s1 = sprite_load("rom:/vq/grass1.rgba32.sprite");
+    DEFER(sprite_free(s1));
+    ASSERT_EQUAL_SIGNED(s1->width, 24, "invalid sprite width");
+    ASSERT_EQUAL_SIGNED(s1->height, 24, "invalid sprite height");
+
+    // Reconstruct the expected image from the codebook and the indices
+    const uint16_t *codebook = (const uint16_t*)s1->data;
+    const uint8_t *indices = (const uint8_t*)s1->data + 256*8;
+    const int index_stride = 16;
+    uint16_t expected(int x, int y) {
+        int k = indices[(y/2)*index_stride + x/2];
+        return codebook[k*4 + (y&1)*2 + (x&1)];
+    }
+
+    // Expand the sprite via RSP and check the result, which is in TMEM layout
+    surface_t surf = rdpq_sprite_vq_expand(s1);
+    rspq_wait();
+    ASSERT(surf.flags & SURFACE_FLAGS_TMEMLAYOUT, "surface not in TMEM layout");
+    ASSERT_EQUAL_SIGNED(surf.stride, 48, "invalid stride of expanded surface");
+    for (int y=0; y<24; y++) {
+        for (int x=0; x<24; x++) {
+            int offset = y * surf.stride + x*2;
+            if (y & 1) offset ^= 4;
+            uint16_t px = *(uint16_t*)(surf.buffer + offset);
+            ASSERT_EQUAL_HEX(px, expected(x, y), "invalid expanded texel at (%d,%d)", x, y);
+        }
+    }
+
+    // Draw the sprite, which is expanded transparently
+    surface_t fb = surface_alloc(FMT_RGBA16, 24, 24);
+    DEFER(surface_free(&fb));
+    surface_clear(&fb, 0);
+
+    rdpq_attach(&fb, NULL);
+    rdpq_set_mode_copy(false);
+    rdpq_sprite_blit(s1, 0, 0, NULL);
+    rdpq_detach_wait();
+
+    uint16_t *pixels = fb.buffer;
+    for (int y=0; y<24; y++) {
+        for (int x=0; x<24; x++) {
+            ASSERT_EQUAL_HEX(pixels[y*24 + x], expected(x, y), "invalid drawn texel at (%d,%d)", x, y);
+        }
+    }
+}
+
+void test_rdpq_atlas(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    atlas_t *atlas = atlas_load("rom:/atlas/grass.atlas");
+    DEFER(atlas_free(atlas));
+    ASSERT_EQUAL_SIGNED(atlas_get_num_images(atlas), 3, "invalid number of images");
+    ASSERT_EQUAL_SIGNED(atlas_get_num_pages(atlas), 2, "invalid number of pages");
+    ASSERT_EQUAL_SIGNED(atlas_find(atlas, "grass3.rgba32"), -1, "missing image found");
+
+    // Find two images sharing a page (a, b), and the image on the other page (c)
+    int idx[3];
+    const char *names[3] = { "grass1.rgba32", "grass2.rgba32", "grass1sq.rgba32" };
+    for (int i=0; i<3; i++) {
+        idx[i] = atlas_find(atlas, names[i]);
+        ASSERT(idx[i] >= 0, "image %s not found", names[i]);
+    }
+    int a = -1, b = -1, c = -1;
+    for (int i=0; i<3; i++) {
+        for (int j=i+1; j<3; j++) {
+            if (atlas_get_image(atlas, idx[i])->page == atlas_get_image(atlas, idx[j])->page) {
+                a = idx[i]; b = idx[j]; c = idx[3-i-j];
+            }
+        }
+    }
+    ASSERT(a >= 0, "no two images share a page");
+
+    // Another texture used to clobber TMEM between the blits
+    sprite_t *other = sprite_load("rom:/grass1.rgba32.sprite");
+    DEFER(sprite_free(other));
+
+    // Draw the images in 24x24 slots: slot N contains image slot_idx[N]
+    const int slot_idx[5] = { a, b, b, c, c };
+    surface_t fb = surface_alloc(FMT_RGBA32, 24*5, 24);
+    DEFER(surface_free(&fb));
+    surface_clear(&fb, 0);
+
+    rdpq_attach(&fb, NULL);
+    rdpq_set_mode_standard();
+
+    // The page of b is already in TMEM, but another texture was loaded since
+    rdpq_atlas_blit(atlas, a, 0, 0, NULL);
+    rdpq_sprite_upload(TILE0, other, NULL);
+    rdpq_atlas_blit(atlas, b, 24, 0, NULL);
+
+    // While recording a block, the page must be uploaded even if it looks
+    // resident, as TMEM might contain anything when the block is run
+    rspq_block_begin();
+    rdpq_atlas_blit(atlas, b, 48, 0, NULL);
+    rspq_block_t *block = rspq_block_end();
+    DEFER(rspq_block_free(block));
+
+    // Running the block overwrites the page of c
+    rdpq_atlas_blit(atlas, c, 72, 0, NULL);
+    rspq_block_run(block);
+    rdpq_atlas_blit(atlas, c, 96, 0, NULL);
+    rdpq_detach_wait();
+
+    ASSERT_SURFACE(&fb, {
+        int slot = x / 24; x -= slot * 24;
+        surface_t img = atlas_get_pixels(atlas, slot_idx[slot]);
+        if (x >= img.width || y >= img.height)
+            return color_from_packed32(0);
+        color_t col = color_from_packed32(((uint32_t*)img.buffer)[y * img.stride/4 + x]);
+        col.a = 0xE0;
+        return col;
+    });
+}
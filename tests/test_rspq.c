@@ -515,6 +515,81 @@ void test_rspq_block(TestContext *ctx)
     TEST_RSPQ_EPILOG(0, rspq_timeout);
 }
 
+static void create_free_blocks(void)
+{
+    // Number of commands of the blocks, spanning from one to seven chunks.
+    // Each block also records as many RDP commands, whose chunks (a power
+    // of two plus a header) go up to the largest size of rdpq blocks.
+    const int num_cmds[] = { 16, 100, 500, 2000, 6000 };
+
+    for (int j = 0; j < sizeof(num_cmds) / sizeof(num_cmds[0]); j++) {
+        rspq_block_begin();
+        for (int i = 0; i < num_cmds[j]; i++) {
+            rspq_test_8(1);
+            rspq_test_send_rdp(i);
+        }
+        rspq_block_free(rspq_block_end());
+    }
+}
+
+void test_rspq_block_alloc(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    rdpq_init();
+    DEFER(rdpq_close());
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    const int num_cycles = 20;
+
+    // Populate the slabs
+    create_free_blocks();
+
+    slab_stats_t s0, s1;
+    slab_get_stats(&s0);
+    uint32_t t0 = TICKS_READ();
+    for (int n = 0; n < num_cycles; n++)
+        create_free_blocks();
+    uint32_t t1 = TICKS_READ();
+    slab_get_stats(&s1);
+
+    ASSERT(s1.allocs > s0.allocs, "blocks not allocated from the slabs");
+    ASSERT_EQUAL_SIGNED(s1.frees - s0.frees, s1.allocs - s0.allocs, "chunks not freed");
+    ASSERT_EQUAL_SIGNED(s1.recycled - s0.recycled, s1.allocs - s0.allocs, "chunks not recycled");
+    ASSERT_EQUAL_SIGNED(s1.pages, s0.pages, "slabs grew in steady state");
+    ASSERT_EQUAL_SIGNED(s1.large, s0.large, "block chunks too large for the slabs");
+    ASSERT_EQUAL_SIGNED(s1.used, s0.used, "slab memory leaked");
+    LOG("block create/free cycle: %lu us (%d chunks)\n",
+        TICKS_TO_US(TICKS_DISTANCE(t0, t1)) / num_cycles, (s1.allocs - s0.allocs) / num_cycles);
+
+    // Compare the cost of the chunk allocations alone with malloc_uncached
+    // (same sizes as the chunks of a large block).
+    const int n_sizes = 8;
+    int sizes[n_sizes];
+    void *ptrs[n_sizes];
+    for (int i = 0, size = RSPQ_BLOCK_MIN_SIZE; i < n_sizes; i++) {
+        sizes[i] = size*sizeof(uint32_t);
+        if (size < RSPQ_BLOCK_MAX_SIZE) size *= 2;
+    }
+
+    t0 = TICKS_READ();
+    for (int n = 0; n < num_cycles; n++) {
+        for (int i = 0; i < n_sizes; i++) ptrs[i] = malloc_uncached(sizes[i]);
+        for (int i = 0; i < n_sizes; i++) free_uncached(ptrs[i]);
+    }
+    t1 = TICKS_READ();
+    uint32_t t2 = TICKS_READ();
+    for (int n = 0; n < num_cycles; n++) {
+        for (int i = 0; i < n_sizes; i++) ptrs[i] = slab_alloc_uncached(sizes[i]);
+        for (int i = 0; i < n_sizes; i++) slab_free_uncached(ptrs[i], sizes[i]);
+    }
+    uint32_t t3 = TICKS_READ();
+    LOG("%d chunks: malloc_uncached %lu us, slab %lu us\n", n_sizes,
+        TICKS_TO_US(TICKS_DISTANCE(t0, t1)) / num_cycles, TICKS_TO_US(TICKS_DISTANCE(t2, t3)) / num_cycles);
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
+
 void test_rspq_wait_sync_in_block(TestContext *ctx)
 {
     TEST_RSPQ_PROLOG();
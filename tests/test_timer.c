@@ -340,7 +340,7 @@ void test_timer_continuous_short(TestContext *ctx) {
 	timer_init();
 	DEFER(timer_close());
 
-	timer_link_t t2;
+	timer_link_t t2 = {0};
 
 	volatile int cb_called = 0;
 	void cb2(int ovlf) {
@@ -360,3 +360,112 @@ void test_timer_continuous_short(TestContext *ctx) {
 		ASSERT_EQUAL_SIGNED(cb_called, 50, "invalid number of calls to timer callback");
 	}
 }
+
+void test_timer_start_running(TestContext *ctx) {
+	timer_init();
+	DEFER(timer_close());
+
+	volatile int cb1_called = 0;
+	void cb1(int ovlf) {
+		cb1_called++;
+	}
+
+	timer_link_t *tt1 = new_timer(TICKS_FROM_MS(2), TF_ONE_SHOT, cb1);
+	DEFER(delete_timer(tt1));
+
+	// Start the timer again while it is still queued: it must be
+	// rescheduled, not inserted a second time.
+	start_timer(tt1, TICKS_FROM_MS(3), TF_ONE_SHOT, cb1);
+	wait_ms(2);
+	ASSERT_EQUAL_SIGNED(cb1_called, 0, "timer 1 called with the old deadline?");
+	wait_ms(2);
+	ASSERT_EQUAL_SIGNED(cb1_called, 1, "timer 1 not called");
+	wait_ms(3);
+	ASSERT_EQUAL_SIGNED(cb1_called, 1, "timer 1 called again?");
+
+	// Same, but disable it: it must not fire anymore.
+	start_timer(tt1, TICKS_FROM_MS(2), TF_ONE_SHOT, cb1);
+	start_timer(tt1, TICKS_FROM_MS(2), TF_ONE_SHOT | TF_DISABLED, cb1);
+	wait_ms(4);
+	ASSERT_EQUAL_SIGNED(cb1_called, 1, "disabled timer 1 called?");
+}
+
+void test_timer_stress(TestContext *ctx) {
+	timer_init();
+	DEFER(timer_close());
+
+	#define NUM_STRESS_TIMERS   1000
+	#define NUM_STRESS_CLUSTER  250
+	#define NUM_STRESS_CONT     250
+	static timer_link_t timers[NUM_STRESS_TIMERS];
+	static volatile int fired[NUM_STRESS_TIMERS];
+
+	volatile uint32_t last_deadline = 0;
+	volatile bool ordered = true;
+	volatile uint32_t cluster_start = 0, cluster_end = 0;
+	uint32_t cluster_deadline;
+
+	void cb(int ovfl, void *ctx) {
+		timer_link_t *t = ctx;
+		int idx = t - timers;
+		fired[idx]++;
+		// Timers must fire in deadline order
+		if (last_deadline && TICKS_BEFORE(t->left, last_deadline))
+			ordered = false;
+		last_deadline = t->left;
+		if (t->left == cluster_deadline) {
+			if (!cluster_start) cluster_start = TICKS_READ();
+			cluster_end = TICKS_READ();
+		}
+	}
+
+	// Schedule all the timers at fixed absolute deadlines, starting 20ms
+	// from now, so that the time spent creating them does not matter.
+	//  * One-shot timers at random deadlines in the next 10ms
+	//  * A cluster of one-shot timers expiring all at the same time
+	//  * Continuous timers with random periods
+	uint32_t base = TICKS_READ() + TICKS_FROM_MS(20);
+	cluster_deadline = base + TICKS_FROM_MS(5);
+	int periods[NUM_STRESS_CONT];
+	memset((void*)fired, 0, sizeof(fired));
+
+	disable_interrupts();
+	for (int i=0; i<NUM_STRESS_TIMERS; i++) {
+		int cont = i - (NUM_STRESS_TIMERS - NUM_STRESS_CONT);
+		uint32_t deadline;
+		if (i < NUM_STRESS_CLUSTER)
+			deadline = cluster_deadline;
+		else if (cont < 0)
+			deadline = base + RANDN(TICKS_FROM_MS(10));
+		else {
+			periods[cont] = TICKS_FROM_MS(1) + RANDN(TICKS_FROM_MS(2));
+			deadline = base + periods[cont];
+		}
+		start_timer_context(&timers[i], deadline - TICKS_READ(),
+			cont < 0 ? TF_ONE_SHOT : TF_CONTINUOUS, cb, &timers[i]);
+	}
+	enable_interrupts();
+	DEFER(for (int i=0; i<NUM_STRESS_TIMERS; i++) stop_timer(&timers[i]));
+
+	// Wait for all the one-shot timers to expire, then stop the continuous ones
+	while (TICKS_BEFORE(TICKS_READ(), base + TICKS_FROM_MS(12))) {}
+	for (int i=NUM_STRESS_TIMERS-NUM_STRESS_CONT; i<NUM_STRESS_TIMERS; i++)
+		stop_timer(&timers[i]);
+
+	ASSERT(ordered, "timers did not fire in deadline order");
+	for (int i=0; i<NUM_STRESS_TIMERS-NUM_STRESS_CONT; i++)
+		ASSERT_EQUAL_SIGNED(fired[i], 1, "one-shot timer %d fired %d times", i, fired[i]);
+	for (int i=0; i<NUM_STRESS_CONT; i++) {
+		int expected = TICKS_FROM_MS(12) / periods[i];
+		int n = fired[NUM_STRESS_TIMERS-NUM_STRESS_CONT+i];
+		ASSERT(n >= expected-1 && n <= expected+1,
+			"continuous timer %d (period %d) fired %d times, expected %d", i, periods[i], n, expected);
+	}
+
+	LOG("%d timers expiring together processed in %d us\n", NUM_STRESS_CLUSTER,
+		(int)TIMER_MICROS(cluster_end - cluster_start));
+
+	#undef NUM_STRESS_TIMERS
+	#undef NUM_STRESS_CLUSTER
+	#undef NUM_STRESS_CONT
+}
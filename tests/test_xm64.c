@@ -0,0 +1,44 @@
+#include <malloc.h>
+#include "xm64.h"
+
+void test_xm64_tick_bench(TestContext *ctx)
+{
+    audio_init(44100, 4);
+    DEFER(audio_close());
+    mixer_init(XM64_MAX_CHANNELS);
+    DEFER(mixer_close());
+
+    // A dense module: 16 channels, most of them playing all the time.
+    xm64player_t xm;
+    xm64player_open(&xm, "rom:/Caverns16bit.xm64");
+    DEFER(xm64player_close(&xm));
+    ASSERT_EQUAL_SIGNED(xm64player_num_channels(&xm), 16, "unexpected number of channels");
+    xm64player_play(&xm, 0);
+
+    // Mix a few seconds of music, one audio buffer at a time, and measure
+    // the time spent in the XM64 tick compared to the whole mixing.
+    const int nsamples = 512;
+    const int nbufs = 10 * 44100 / nsamples;
+    int16_t *out = malloc_uncached(nsamples * 2 * sizeof(int16_t));
+    DEFER(free_uncached(out));
+
+    extern int64_t __xm64_profile_tick;
+    __xm64_profile_tick = 0;
+    int silent = 0;
+    uint32_t t0 = TICKS_READ();
+    for (int i=0; i<nbufs; i++) {
+        mixer_poll(out, nsamples);
+        bool zero = true;
+        for (int j=0; j<nsamples*2 && zero; j++)
+            zero = out[j] == 0;
+        silent += zero;
+    }
+    uint32_t ticks_mix = TICKS_SINCE(t0);
+
+    // Do not check the exact output, but the module must be playing
+    ASSERT(silent < nbufs / 10, "too many silent buffers: %d/%d", silent, nbufs);
+
+    debugf("XM64 tick on 16 channels: %d us for %d ms of music (mixing: %d us, %d%%)\n",
+        (int)TICKS_TO_US(__xm64_profile_tick), nbufs * nsamples * 1000 / 44100,
+        (int)TICKS_TO_US(ticks_mix), (int)(__xm64_profile_tick * 100 / ticks_mix));
+}
@@ -0,0 +1,80 @@
+#include <malloc.h>
+#include <string.h>
+#include "ym64.h"
+#include "../src/audio/ay8910_internal.h"
+
+// Decode the audioframe f with the waveform callback, and return the
+// registers written for it.
+static void ym64_read_frame(ym64player_t *player, samplebuffer_t *sbuf, int f, bool seeking, uint8_t *regs)
+{
+    // Request a sample in the middle of the frame, so that the player
+    // converts it back to the same frame despite the rounding errors.
+    float spf = player->wave.frequency / player->playfreq;
+    int wpos = (f + 0.5) * spf;
+
+    // Wait for the RSP to be done with the samples of the previous frame,
+    // so that the sample buffer can be reused.
+    rspq_highpri_sync();
+    samplebuffer_flush(sbuf);
+    player->wave.read(player->wave.ctx, sbuf, wpos, 1, seeking);
+    memcpy(regs, player->regs, 14);
+}
+
+void test_ym64_seek_chunked(TestContext *ctx)
+{
+    rspq_init();
+    DEFER(rspq_close());
+    DEFER(rsp_ay8910_close());
+
+    ym64player_t player;
+    ym64player_open(&player, "rom:/darkness.ym64", NULL);
+    DEFER(ym64player_close(&player));
+    ASSERT(player.chunks != NULL, "file is not compressed in chunks");
+    ASSERT(player.nchunks >= 4, "too few chunks: %d", player.nchunks);
+
+    int spf = player.wave.frequency / player.playfreq + 1;
+    int bps = player.wave.bits / 8 * player.wave.channels;
+    uint8_t *mem = malloc_uncached(spf * bps);
+    DEFER(free_uncached(mem));
+    samplebuffer_t sbuf;
+    samplebuffer_init(&sbuf, mem, spf * bps);
+    samplebuffer_set_bps(&sbuf, player.wave.bits * player.wave.channels);
+    DEFER(rspq_highpri_sync());
+
+    // Decode the first chunks sequentially, as a reference
+    const int cf = player.chunk_frames;
+    const int nframes = 3*cf + 7;
+    uint8_t (*ref)[14] = malloc(nframes * 14);
+    DEFER(free(ref));
+    for (int f=0; f<nframes; f++) {
+        ym64_read_frame(&player, &sbuf, f, f == 0, ref[f]);
+        ASSERT_EQUAL_SIGNED(player.curframe, f+1, "invalid current frame");
+    }
+
+    // Seek around the chunk boundaries, and to random positions. After the
+    // seek, the registers must match those decoded sequentially, also when
+    // continuing into the next chunk.
+    int seeks[] = { 0, 1, cf-1, cf, cf+1, 2*cf-1, 2*cf, 3*cf, 5, 3*cf+1, cf+1 };
+    uint8_t regs[14];
+    for (int i=0; i<sizeof(seeks)/sizeof(seeks[0]) + 16; i++) {
+        int f = i < sizeof(seeks)/sizeof(seeks[0]) ? seeks[i] : RANDN(nframes - 4);
+        for (int j=0; j<4; j++) {
+            ym64_read_frame(&player, &sbuf, f+j, j == 0, regs);
+            ASSERT_EQUAL_MEM(regs, ref[f+j], 14, "invalid registers at frame %d (seek to %d)", f+j, f);
+        }
+    }
+
+    // Seek into the last chunk, up to the last frame of the song
+    int last = player.nframes - 1;
+    int first = (last / cf) * cf;
+    uint8_t (*tail)[14] = malloc((last - first + 1) * 14);
+    DEFER(free(tail));
+    for (int f=first; f<=last; f++)
+        ym64_read_frame(&player, &sbuf, f, f == first, tail[f-first]);
+    ym64_read_frame(&player, &sbuf, last, true, regs);
+    ASSERT_EQUAL_MEM(regs, tail[last-first], 14, "invalid registers at the last frame");
+
+    // Seeking at the end of the song must keep the registers unchanged
+    ym64_read_frame(&player, &sbuf, player.nframes, true, regs);
+    ASSERT_EQUAL_MEM(regs, tail[last-first], 14, "invalid registers at the end of the song");
+}
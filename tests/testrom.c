@@ -205,12 +205,20 @@ int assert_equal_mem(TestContext *ctx, const char *file, int line, const uint8_t
 #include "test_cop1.c"
 #include "test_constructors.c"
 #include "test_backtrace.c"
+#include "test_binlog.c"
+#include "test_alloc.c"
+#include "test_controller.c"
+#include "test_memprof.c"
 #include "test_rspq.c"
 #include "test_rdpq.c"
 #include "test_rdpq_tri.c"
 #include "test_rdpq_tex.c"
 #include "test_rdpq_attach.c"
 #include "test_rdpq_sprite.c"
+#include "test_mdct.c"
+#include "test_ay8910.c"
+#include "test_ym64.c"
+#include "test_xm64.c"
 
 /**********************************************************************
  * MAIN
@@ -244,12 +252,17 @@ static const struct Testsuite
 	TEST_FUNC(test_timer_context,            186, TEST_FLAGS_RESET_COUNT),
 	TEST_FUNC(test_timer_disabled_start,     733, TEST_FLAGS_RESET_COUNT),
 	TEST_FUNC(test_timer_disabled_restart,   733, TEST_FLAGS_RESET_COUNT),
+	TEST_FUNC(test_timer_start_running,        0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_timer_stress,              0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_irq_reentrancy,           230, TEST_FLAGS_RESET_COUNT),
 	TEST_FUNC(test_dfs_read,                 948, TEST_FLAGS_IO),
 	TEST_FUNC(test_dfs_rom_addr,              25, TEST_FLAGS_IO),
+	TEST_FUNC(test_dfs_dedup,                  0, TEST_FLAGS_IO),
 	TEST_FUNC(test_eepromfs,                   0, TEST_FLAGS_IO),
+	TEST_FUNC(test_eepromfs_async,             0, TEST_FLAGS_IO),
 	TEST_FUNC(test_cache_invalidate,        1763, TEST_FLAGS_NONE),
 	TEST_FUNC(test_debug_sdfs,                 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_debug_sdfs_cache,           0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_dma_read_misalign,      18591, TEST_FLAGS_NONE),
 	TEST_FUNC(test_cop1_denormalized_float,    0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_backtrace_analyze,          0, TEST_FLAGS_NO_BENCHMARK),
@@ -259,6 +272,16 @@ static const struct Testsuite
 	TEST_FUNC(test_backtrace_exception_leaf,   0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_backtrace_exception_fp,     0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_backtrace_invalidptr,       0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_backtrace_symbols_cache,    0, TEST_FLAGS_NO_BENCHMARK | TEST_FLAGS_IO),
+	TEST_FUNC(test_binlog,                     0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_alloc_arena,                0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_alloc_pool,                 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_alloc_frame,                0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_alloc_scratch,              0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_alloc_stats,                0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_alloc_slab,                 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_controller_poll_schedule,   0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_memprof,                    0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_queue_single,          0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_queue_multiple,        0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_queue_rapid,           0, TEST_FLAGS_NO_BENCHMARK),
@@ -272,6 +295,7 @@ static const struct Testsuite
 	TEST_FUNC(test_rspq_flush,                 0, TEST_FLAGS_NO_BENCHMARK | TEST_FLAGS_NO_EMULATOR),
 	TEST_FUNC(test_rspq_rapid_flush,           0, TEST_FLAGS_NO_BENCHMARK | TEST_FLAGS_NO_EMULATOR),
 	TEST_FUNC(test_rspq_block,                 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_block_alloc,           0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_wait_sync_in_block,    0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_highpri_basic,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_highpri_multiple,      0, TEST_FLAGS_NO_BENCHMARK),
@@ -319,6 +343,15 @@ static const struct Testsuite
 	TEST_FUNC(test_rdpq_tex_multi_i4,          0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_sprite_upload,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_sprite_lod,            0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_sprite_shared_palette, 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_sprite_tmem_layout,    0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_sprite_tmem_layout_bench, 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_sprite_vq,             0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_atlas,                 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_wav64_mdct,                 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_ay8910_rsp,                 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_ym64_seek_chunked,          0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_xm64_tick_bench,            0, TEST_FLAGS_NO_BENCHMARK),
 };
 
 int main() {
@@ -7,10 +7,22 @@
 #include <assert.h>
 #include <dirent.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+#define STBDS_NO_SHORT_NAMES
+#define STB_DS_IMPLEMENTATION
+#include "../common/stb_ds.h"
+#include "../common/batch.h"
 
 bool flag_verbose = false;
 bool flag_debug = false;
+int flag_jobs = 0;
+char *flag_cache = NULL;
 
 #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
 	#define LE32_TO_HOST(i) __builtin_bswap32(i)
@@ -72,16 +84,20 @@ void usage(void) {
 	printf("   -o / --output <dir>       Specify output directory\n");
 	printf("   -v / --verbose            Verbose mode\n");
 	printf("   -d / --debug              Dump uncompressed files in output directory for debugging\n");
+	printf("   -j / --jobs <N>           Number of parallel conversions (default: number of CPUs)\n");
+	printf("   --cache <file>            Cache file used to skip files whose input and options did not change\n");
 	printf("\n");
 	printf("WAV/MP3 options:\n");
 	printf("   --wav-mono                Force mono output\n");
 	printf("   --wav-resample <N>        Resample to a different sample rate\n");
-	printf("   --wav-compress <0|1>      Enable compression: 0=none, 1=vadpcm (default)\n");
+	printf("   --wav-compress <0|1|3>    Enable compression: 0=none, 1=vadpcm (default), 3=mdct\n");
+	printf("   --wav-mdct-kbps <N>       Bitrate of MDCT compression in kbps (default: ~10:1)\n");
 	printf("   --wav-loop <true|false>   Activate playback loop by default\n");
 	printf("   --wav-loop-offset <N>     Set looping offset (in samples; default: 0)\n");
 	printf("\n");
 	printf("YM options:\n");
 	printf("   --ym-compress <true|false>  Compress output file\n");
+	printf("   --ym-seekable <true|false>  Compress output file in independent chunks, to allow seeking\n");
 	printf("\n");
 }
 
@@ -93,28 +109,186 @@ char* changeext(const char* fn, char *ext) {
 	return strdup(buf);
 }
 
-void convert(char *infn, char *outfn1) {
-	char *ext = strrchr(infn, '.');
-	if (!ext) {
-		fprintf(stderr, "unknown file type: %s\n", infn);
+// Return the output filename for an input file, or NULL if the type is not supported
+char* conv_outfn(const char *infn, const char *outfn1) {
+	const char *ext = strrchr(infn, '.');
+	if (!ext)
+		return NULL;
+	if (strcasecmp(ext, ".wav") == 0 || strcasecmp(ext, ".aiff") == 0 || strcasecmp(ext, ".mp3") == 0)
+		return changeext(outfn1, ".wav64");
+	if (strcasecmp(ext, ".xm") == 0)
+		return changeext(outfn1, ".xm64");
+	if (strcasecmp(ext, ".ym") == 0)
+		return changeext(outfn1, ".ym64");
+	return NULL;
+}
+
+int convert(const char *infn, const char *outfn) {
+	const char *ext = strrchr(infn, '.');
+	if (strcasecmp(ext, ".xm") == 0)
+		return xm_convert(infn, outfn);
+	if (strcasecmp(ext, ".ym") == 0)
+		return ym_convert(infn, outfn);
+	return wav_convert(infn, outfn);
+}
+
+/************************************************************************************
+ *  JOBS
+ ************************************************************************************/
+
+/** @brief A conversion queued while walking the input files */
+typedef struct {
+	char *infn;			///< Input file
+	char *outfn;		///< Output file
+	uint64_t hash;		///< Hash of the input file and the conversion options
+	bool failed;		///< True if the conversion failed
+} conv_job_t;
+
+conv_job_t *jobs = NULL;
+hash_cache_t *cache = NULL;
+bool cache_loaded = false;
+int num_converted = 0, num_skipped = 0, num_failed = 0;
+
+// Hash all the inputs of a conversion: input file, options, and the build
+// of audioconv64 itself (so that a new version reconverts everything).
+bool conv_job_hash(conv_job_t *job) {
+	const char *version = __DATE__ " " __TIME__;
+	uint64_t h = FNV64_INIT;
+	h = hash_bytes(h, version, strlen(version));
+	h = hash_bytes(h, job->outfn, strlen(job->outfn));
+	if (!hash_file(&h, job->infn))
+		return false;
+
+	HASH_FIELD(h, flag_debug);
+	HASH_FIELD(h, flag_wav_looping); HASH_FIELD(h, flag_wav_looping_offset);
+	HASH_FIELD(h, flag_wav_compress); HASH_FIELD(h, flag_wav_resample);
+	HASH_FIELD(h, flag_wav_mono); HASH_FIELD(h, flag_wav_mdct_kbps);
+	HASH_FIELD(h, flag_ym_compress); HASH_FIELD(h, flag_ym_seekable);
+	job->hash = h;
+	return true;
+}
+
+void queue_conversion(char *infn, char *outfn1) {
+	char *outfn = conv_outfn(infn, outfn1);
+	if (!outfn) {
+		fprintf(stderr, "WARNING: ignoring unknown file: %s\n", infn);
 		return;
 	}
+	conv_job_t job = { .infn = strdup(infn), .outfn = outfn };
+	stbds_arrput(jobs, job);
+}
 
-	if (strcasecmp(ext, ".wav") == 0 || strcasecmp(ext, ".aiff") == 0 || strcasecmp(ext, ".mp3") == 0) {
-		char *outfn = changeext(outfn1, ".wav64");
-		wav_convert(infn, outfn);
-		free(outfn);
-	} else if (strcasecmp(ext, ".xm") == 0) {
-		char *outfn = changeext(outfn1, ".xm64");
-		xm_convert(infn, outfn);
-		free(outfn);
-	} else if (strcasecmp(ext, ".ym") == 0) {
-		char *outfn = changeext(outfn1, ".ym64");
-		ym_convert(infn, outfn);
-		free(outfn);
-	} else {
-		fprintf(stderr, "WARNING: ignoring unknown file: %s\n", infn);
+// Run all the queued conversions. Conversions are run in parallel in child
+// processes, as the converters keep global state and abort on fatal errors.
+void run_jobs(void) {
+	int num_jobs = stbds_arrlen(jobs);
+	if (!num_jobs)
+		return;
+
+	// Load the cache of hashes of the previous run
+	if (flag_cache && !cache_loaded) {
+		cache = hash_cache_load(flag_cache);
+		cache_loaded = true;
+	}
+
+	// Skip conversions whose inputs did not change since last time
+	conv_job_t **todo = NULL;
+	for (int i=0; i<num_jobs; i++) {
+		conv_job_t *job = &jobs[i];
+		if (flag_cache) {
+			if (!conv_job_hash(job)) {
+				fprintf(stderr, "ERROR: cannot read input file: %s\n", job->infn);
+				job->failed = true;
+				continue;
+			}
+			if (hash_cache_uptodate(cache, job->outfn, job->hash)) {
+				if (flag_verbose)
+					fprintf(stderr, "Up to date: %s\n", job->outfn);
+				num_skipped++;
+				continue;
+			}
+		}
+		stbds_arrput(todo, job);
+	}
+
+	int num_todo = stbds_arrlen(todo);
+	int num_procs = flag_jobs ? flag_jobs : cpu_count();
+	#ifdef _WIN32
+	num_procs = 1;
+	#endif
+	if (num_procs > num_todo) num_procs = num_todo;
+
+	if (num_procs <= 1) {
+		for (int i=0; i<num_todo; i++)
+			todo[i]->failed = convert(todo[i]->infn, todo[i]->outfn) != 0;
+	}
+	#ifndef _WIN32
+	else {
+		pid_t pids[num_procs];
+		conv_job_t *running[num_procs];
+		int next = 0, num_running = 0;
+		while (next < num_todo || num_running > 0) {
+			// Start new conversions until all the slots are busy
+			while (next < num_todo && num_running < num_procs) {
+				fflush(NULL);
+				pid_t pid = fork();
+				if (pid == 0)
+					exit(convert(todo[next]->infn, todo[next]->outfn) != 0);
+				if (pid < 0)
+					fatal("cannot create process for conversion: %s\n", strerror(errno));
+				pids[num_running] = pid;
+				running[num_running++] = todo[next++];
+			}
+
+			// Wait for any conversion to finish
+			int status;
+			pid_t pid = wait(&status);
+			if (pid < 0)
+				fatal("cannot wait for conversion: %s\n", strerror(errno));
+			for (int i=0; i<num_running; i++) {
+				if (pids[i] == pid) {
+					running[i]->failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+					pids[i] = pids[num_running-1];
+					running[i] = running[num_running-1];
+					num_running--;
+					break;
+				}
+			}
+		}
 	}
+	#endif
+
+	// Update the cache and the statistics
+	for (int i=0; i<num_jobs; i++) {
+		conv_job_t *job = &jobs[i];
+		if (job->failed) {
+			num_failed++;
+			if (flag_cache)
+				(void)stbds_shdel(cache, job->outfn);
+		}
+	}
+	for (int i=0; i<num_todo; i++) {
+		if (!todo[i]->failed) {
+			num_converted++;
+			if (flag_cache)
+				stbds_shput(cache, todo[i]->outfn, todo[i]->hash);
+		}
+	}
+
+	for (int i=0; i<num_jobs; i++) {
+		free(jobs[i].infn);
+		free(jobs[i].outfn);
+	}
+	stbds_arrfree(todo);
+	stbds_arrfree(jobs);
+}
+
+void save_cache(void) {
+	if (!cache_loaded)
+		return;
+	if (!hash_cache_save(cache, flag_cache))
+		fprintf(stderr, "ERROR: cannot write cache file: %s\n", flag_cache);
+	stbds_shfree(cache);
 }
 
 bool exists(const char *path) {
@@ -124,14 +298,12 @@ bool exists(const char *path) {
 
 bool isfile(const char *path) {
 	struct stat st;
-	stat(path, &st);
-	return (st.st_mode & S_IFREG) != 0;
+	return stat(path, &st) == 0 && (st.st_mode & S_IFREG) != 0;
 }
 
 bool isdir(const char *path) {
 	struct stat st;
-	stat(path, &st);
-	return (st.st_mode & S_IFDIR) != 0;
+	return stat(path, &st) == 0 && (st.st_mode & S_IFDIR) != 0;
 }
 
 void walkdir(char *inpath, char *outpath, void (*func)(char *, char*)) {
@@ -192,6 +364,10 @@ int main(int argc, char *argv[]) {
 	int i;
 	for (i=1; i<argc; i++) {
 		if (argv[i][0] == '-') {	
+			// Options apply to the files that follow, so convert the files
+			// queued so far with the current options.
+			run_jobs();
+
 			if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
 				flag_verbose = true;
 			} else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
@@ -205,6 +381,22 @@ int main(int argc, char *argv[]) {
 				outdir = argv[i];
 			} else if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--debug")) {
 				flag_debug = true;
+			} else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for -j/--jobs\n");
+					return 1;
+				}
+				flag_jobs = atoi(argv[i]);
+				if (flag_jobs < 1) {
+					fprintf(stderr, "invalid argument for -j/--jobs: %s\n", argv[i]);
+					return 1;
+				}
+			} else if (!strcmp(argv[i], "--cache")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for --cache\n");
+					return 1;
+				}
+				flag_cache = argv[i];
 			} else if (!strcmp(argv[i], "--wav-loop")) {
 				if (++i == argc) {
 					fprintf(stderr, "missing argument for --wav-loop\n");
@@ -241,6 +433,16 @@ int main(int argc, char *argv[]) {
 					fprintf(stderr, "invalid argument for --wav-compress: %s\n", argv[i]);
 					return 1;
 				}
+			} else if (!strcmp(argv[i], "--wav-mdct-kbps")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for --wav-mdct-kbps\n");
+					return 1;
+				}
+				flag_wav_mdct_kbps = atoi(argv[i]);
+				if (flag_wav_mdct_kbps < 1) {
+					fprintf(stderr, "invalid argument for --wav-mdct-kbps: %s\n", argv[i]);
+					return 1;
+				}
 			} else if (!strcmp(argv[i], "--wav-resample")) {
 				if (++i == argc) {
 					fprintf(stderr, "missing argument for --wav-resample\n");
@@ -264,6 +466,19 @@ int main(int argc, char *argv[]) {
 					fprintf(stderr, "invalid boolean argument for --ym-compress: %s\n", argv[i]);
 					return 1;
 				}
+			} else if (!strcmp(argv[i], "--ym-seekable")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for --ym-seekable\n");
+					return 1;
+				}
+				if (!strcmp(argv[i], "true") || !strcmp(argv[i], "1"))
+					flag_ym_seekable = true;
+				else if (!strcmp(argv[i], "false") || !strcmp(argv[i], "0"))
+					flag_ym_seekable = false;
+				else {
+					fprintf(stderr, "invalid boolean argument for --ym-seekable: %s\n", argv[i]);
+					return 1;
+				}
 			} else {
 				fprintf(stderr, "invalid option: %s\n", argv[i]);
 				return 1;
@@ -273,10 +488,17 @@ int main(int argc, char *argv[]) {
 			if (!exists(argv[i])) {
 				fprintf(stderr, "ERROR: file %s does not exist\n", argv[i]);
 			} else {
-				walkdir(argv[i], outdir, convert);
+				walkdir(argv[i], outdir, queue_conversion);
 			}
 		}
 	}
 
-	return 0;
+	run_jobs();
+	save_cache();
+
+	if (flag_verbose || num_skipped)
+		fprintf(stderr, "audioconv64: %d converted, %d up to date, %d failed\n",
+			num_converted, num_skipped, num_failed);
+
+	return num_failed ? 1 : 0;
 }
@@ -1,4 +1,7 @@
 #include "../../src/audio/wav64internal.h"
+#include "../../src/audio/mdct.c"
+#include <math.h>
+#include <pthread.h>
 
 #define DR_WAV_IMPLEMENTATION
 #include "dr_wav.h"
@@ -32,6 +35,7 @@ int flag_wav_looping_offset = 0;
 int flag_wav_compress = 1;
 int flag_wav_resample = 0;
 bool flag_wav_mono = false;
+int flag_wav_mdct_kbps = 0;
 
 typedef struct {
 	int16_t *samples;
@@ -40,6 +44,31 @@ typedef struct {
 	int sampleRate;
 } wav_data_t;
 
+// VADPCM encoding of a single channel. Channels are encoded independently
+// (each one has its own codebook), so they are processed in parallel threads.
+typedef struct {
+	const wav_data_t *wav;
+	int channel;
+	int nframes;
+	const struct vadpcm_params *parms;
+	struct vadpcm_vector *codebook;
+	uint8_t *dest;
+	vadpcm_error err;
+} vadpcm_channel_job_t;
+
+static void* vadpcm_encode_channel(void *arg) {
+	vadpcm_channel_job_t *job = arg;
+	int cnt = job->nframes * kVADPCMFrameSampleCount;
+	int16_t *schan = malloc(cnt * sizeof(int16_t));
+	void *scratch = malloc(vadpcm_encode_scratch_size(job->nframes));
+	for (int j=0; j<cnt; j++)
+		schan[j] = job->wav->samples[job->channel + j*job->wav->channels];
+	job->err = vadpcm_encode(job->parms, job->codebook, job->nframes, job->dest, schan, scratch);
+	free(scratch);
+	free(schan);
+	return NULL;
+}
+
 static size_t read_wav(const char *infn, wav_data_t *out)
 {
 	drwav wav;
@@ -88,9 +117,170 @@ static size_t read_mp3(const char *infn, wav_data_t *out)
 	return cnt;
 }
 
+/** @brief Bit writer for MDCT frames (MSB first). Bits past the end are dropped. */
+typedef struct {
+	uint8_t *dst;           ///< Output buffer
+	int nbits;              ///< Capacity of the buffer in bits
+	int pos;                ///< Current bit position
+} bitwriter_t;
+
+static void bw_write(bitwriter_t *bw, uint32_t v, int n)
+{
+	while (n--) {
+		if (bw->pos < bw->nbits && ((v >> n) & 1))
+			bw->dst[bw->pos >> 3] |= 0x80 >> (bw->pos & 7);
+		bw->pos++;
+	}
+}
+
+/** @brief Number of bits used to encode a scalefactor delta */
+static int mdct_sf_delta_bits(int d)
+{
+	if (d == 0) return 1;
+	if (d == 1 || d == -1) return 3;
+	if (d >= -3 && d <= 3) return 5;
+	return 3 + MDCT_SF_BITS;
+}
+
+/** @brief Amplitude of a band, given its scalefactor (as used by mdct_dequant) */
+static double mdct_sf_amplitude(int sf)
+{
+	return ((sf & 1) ? 23170.0 : 16384.0) / 16384.0 * (double)(1LL << (sf >> 1));
+}
+
+/** @brief Forward MDCT of a frame (2*MDCT_FRAME_SIZE samples), with sine window */
+static void mdct_forward(const double *x, double *coeffs)
+{
+	enum { N = MDCT_FRAME_SIZE };
+	static double basis[N][2*N];
+	static bool init = false;
+	if (!init) {
+		for (int k=0; k<N; k++)
+			for (int n=0; n<2*N; n++)
+				basis[k][n] = sin(M_PI * (n + 0.5) / (2*N)) * cos(M_PI / N * (n + 0.5 + N/2) * (k + 0.5));
+		init = true;
+	}
+
+	for (int k=0; k<N; k++) {
+		double v = 0;
+		for (int n=0; n<2*N; n++)
+			v += basis[k][n] * x[n];
+		coeffs[k] = v;
+	}
+}
+
+/**
+ * @brief Quantize and encode a frame of MDCT coefficients.
+ *
+ * The scalefactors are computed from the energy of each band, and then
+ * the highest global allocation level that fits the frame size is selected.
+ */
+static void mdct_encode_frame(const double *coeffs, uint8_t *dst, int nbytes)
+{
+	uint8_t sf[MDCT_NUM_BANDS], bits[MDCT_NUM_BANDS];
+
+	for (int b=0; b<MDCT_NUM_BANDS; b++) {
+		double energy = 0;
+		for (int k=mdct_band_start[b]; k<mdct_band_start[b+1]; k++)
+			energy += coeffs[k] * coeffs[k];
+		double rms = sqrt(energy / (mdct_band_start[b+1] - mdct_band_start[b]));
+		if (rms < 1.0)
+			sf[b] = 0;
+		else {
+			int v = lround(2.0 * log2(rms));
+			sf[b] = v < 1 ? 1 : (v > 63 ? 63 : v);
+		}
+	}
+
+	int header_bits = MDCT_ALLOC_BITS + MDCT_SF_BITS;
+	for (int b=1; b<MDCT_NUM_BANDS; b++)
+		header_bits += mdct_sf_delta_bits(sf[b] - sf[b-1]);
+
+	// Find the highest allocation level that fits the frame
+	int alloc;
+	for (alloc = (1 << MDCT_ALLOC_BITS) - 1; alloc > 0; alloc--) {
+		mdct_band_bits(alloc, sf, bits);
+		int nb = header_bits;
+		for (int b=0; b<MDCT_NUM_BANDS; b++)
+			nb += bits[b] * (mdct_band_start[b+1] - mdct_band_start[b]);
+		if (nb <= nbytes * 8)
+			break;
+	}
+	mdct_band_bits(alloc, sf, bits);
+
+	memset(dst, 0, nbytes);
+	bitwriter_t bw = { .dst = dst, .nbits = nbytes*8 };
+	bw_write(&bw, alloc, MDCT_ALLOC_BITS);
+	bw_write(&bw, sf[0], MDCT_SF_BITS);
+	for (int b=1; b<MDCT_NUM_BANDS; b++) {
+		int d = sf[b] - sf[b-1];
+		if (d == 0)
+			bw_write(&bw, 0, 1);
+		else if (d == 1 || d == -1)
+			bw_write(&bw, d < 0 ? 5 : 4, 3);
+		else if (d >= -3 && d <= 3)
+			bw_write(&bw, (0x6 << 2) | (d < 0 ? 2 : 0) | ((d < 0 ? -d : d) - 2), 5);
+		else {
+			bw_write(&bw, 7, 3);
+			bw_write(&bw, sf[b], MDCT_SF_BITS);
+		}
+	}
+
+	for (int b=0; b<MDCT_NUM_BANDS; b++) {
+		int nb = bits[b];
+		if (nb == 0)
+			continue;
+		double unit = mdct_quant_step[nb] / 4096.0 * mdct_sf_amplitude(sf[b]);
+		for (int k=mdct_band_start[b]; k<mdct_band_start[b+1]; k++) {
+			if (nb == 1) {
+				bw_write(&bw, coeffs[k] < 0, 1);
+			} else {
+				int qmax = (1 << (nb-1)) - 1;
+				long q = lround(coeffs[k] / unit);
+				if (q > qmax) q = qmax;
+				if (q < -qmax) q = -qmax;
+				bw_write(&bw, q + qmax, nb);
+			}
+		}
+	}
+}
+
+/** @brief Decode a MDCT-compressed waveform with the reference decoder and save it as WAV (for debugging) */
+static void mdct_debug_dump(const char *outfn, const uint8_t *data, int nframes, int frame_bytes, int channels, int freq)
+{
+	int16_t *samples = calloc((size_t)nframes * MDCT_FRAME_SIZE * channels, sizeof(int16_t));
+	int16_t state[2][MDCT_FRAME_SIZE] = {0};
+	int16_t prime[MDCT_FRAME_SIZE*2];
+	mdct_record_t rec;
+
+	// Frame 0 only primes the overlap-add state; frame f outputs samples of block f-1.
+	for (int f=0; f<nframes; f++) {
+		for (int ch=0; ch<channels; ch++) {
+			int gain = mdct_unpack_frame(data + (f*channels + ch)*frame_bytes, frame_bytes, f*2+ch, &rec);
+			int16_t *out = f ? samples + (f-1)*MDCT_FRAME_SIZE*channels + ch : prime;
+			mdct_imdct(&rec, gain, state[ch], out, channels);
+		}
+	}
+
+	char *fn = changeext(outfn, ".mdct.wav");
+	drwav_data_format fmt = {
+		.container = drwav_container_riff, .format = DR_WAVE_FORMAT_PCM,
+		.channels = channels, .sampleRate = freq, .bitsPerSample = 16,
+	};
+	drwav wav;
+	if (drwav_init_file_write(&wav, fn, &fmt, NULL)) {
+		drwav_write_pcm_frames(&wav, (nframes-1) * MDCT_FRAME_SIZE, samples);
+		drwav_uninit(&wav);
+	} else {
+		fprintf(stderr, "WARNING: %s: cannot create debug file\n", fn);
+	}
+	free(fn);
+	free(samples);
+}
+
 int wav_convert(const char *infn, const char *outfn) {
 	if (flag_verbose) {
-		const char *compr[3] = { "raw", "vadpcm", "raw" };
+		const char *compr[4] = { "raw", "vadpcm", "raw", "mdct" };
 		fprintf(stderr, "Converting: %s => %s (%s)\n", infn, outfn, compr[flag_wav_compress]);
 	}
 
@@ -199,6 +389,37 @@ int wav_convert(const char *infn, const char *outfn) {
 		loop_len -= 1;
 	}
 
+	if (flag_wav_compress == 3) {
+		// MDCT compression works on frames of MDCT_FRAME_SIZE samples, and the
+		// decoder can only seek at frame boundaries. If the waveform loops,
+		// prepend silence so that the loop start is aligned to a frame.
+		int loop_start = cnt - loop_len;
+		if (loop_len && loop_start % MDCT_FRAME_SIZE) {
+			int pad = MDCT_FRAME_SIZE - loop_start % MDCT_FRAME_SIZE;
+			if (flag_verbose)
+				fprintf(stderr, "  adding %d samples of silence to align the loop start\n", pad);
+			wav.samples = realloc(wav.samples, (cnt + pad) * wav.channels * sizeof(int16_t));
+			memmove(wav.samples + pad * wav.channels, wav.samples, cnt * wav.channels * sizeof(int16_t));
+			memset(wav.samples, 0, pad * wav.channels * sizeof(int16_t));
+			cnt += pad;
+			loop_start += pad;
+		}
+
+		// Extend the waveform to a multiple of the frame size. If it loops,
+		// continue with the loop samples (to avoid a gap of silence), which
+		// makes the loop a bit longer.
+		if (cnt % MDCT_FRAME_SIZE) {
+			int newcnt = (cnt + MDCT_FRAME_SIZE - 1) / MDCT_FRAME_SIZE * MDCT_FRAME_SIZE;
+			wav.samples = realloc(wav.samples, newcnt * wav.channels * sizeof(int16_t));
+			for (int i=cnt; i<newcnt; i++)
+				for (int ch=0; ch<wav.channels; ch++)
+					wav.samples[i*wav.channels + ch] = loop_len ? wav.samples[(loop_start + (i - cnt) % loop_len)*wav.channels + ch] : 0;
+			if (loop_len)
+				loop_len += newcnt - cnt;
+			cnt = newcnt;
+		}
+	}
+
 	FILE *out = fopen(outfn, "wb");
 	if (!out) {
 		fprintf(stderr, "ERROR: %s: cannot create file\n", outfn);
@@ -258,7 +479,7 @@ int wav_convert(const char *infn, const char *outfn) {
 		if (cnt % kVADPCMFrameSampleCount) {
 			int newcnt = (cnt + kVADPCMFrameSampleCount - 1) / kVADPCMFrameSampleCount * kVADPCMFrameSampleCount;
 			wav.samples = realloc(wav.samples, newcnt * wav.channels * sizeof(int16_t));
-			memset(wav.samples + cnt, 0, (newcnt - cnt) * wav.channels * sizeof(int16_t));
+			memset(wav.samples + cnt * wav.channels, 0, (newcnt - cnt) * wav.channels * sizeof(int16_t));
 			cnt = newcnt;
 		}
 
@@ -266,7 +487,6 @@ int wav_convert(const char *infn, const char *outfn) {
 
 		assert(cnt % kVADPCMFrameSampleCount == 0);
 		int nframes = cnt / kVADPCMFrameSampleCount;
-		void *scratch = malloc(vadpcm_encode_scratch_size(nframes));
 		struct vadpcm_vector *codebook = alloca(kPREDICTORS * kVADPCMEncodeOrder * wav.channels * sizeof(struct vadpcm_vector));
 		struct vadpcm_params parms = { .predictor_count = kPREDICTORS };
 		void *dest = malloc(nframes * kVADPCMFrameByteSize * wav.channels);
@@ -274,17 +494,30 @@ int wav_convert(const char *infn, const char *outfn) {
 		if (flag_verbose)
 			fprintf(stderr, "  compressing into VADPCM format (%d frames)\n", nframes);
 
-		int16_t *schan = malloc(cnt * sizeof(int16_t));
-		uint8_t *destchan = dest;
+		vadpcm_channel_job_t jobs[wav.channels];
+		pthread_t threads[wav.channels];
+		bool threaded[wav.channels];
+		for (int i=0; i<wav.channels; i++) {
+			jobs[i] = (vadpcm_channel_job_t){
+				.wav = &wav, .channel = i, .nframes = nframes, .parms = &parms,
+				.codebook = codebook + kPREDICTORS * kVADPCMEncodeOrder * i,
+				.dest = (uint8_t*)dest + i * nframes * kVADPCMFrameByteSize,
+			};
+			// Encode the last channel (or any channel whose thread could not
+			// be created) in the current thread
+			threaded[i] = i < wav.channels-1 && pthread_create(&threads[i], NULL, vadpcm_encode_channel, &jobs[i]) == 0;
+			if (!threaded[i])
+				vadpcm_encode_channel(&jobs[i]);
+		}
+		for (int i=0; i<wav.channels; i++) {
+			if (threaded[i])
+				pthread_join(threads[i], NULL);
+		}
 		for (int i=0; i<wav.channels; i++) {
-			for (int j=0; j<cnt; j++)
-				schan[j] = wav.samples[i + j*wav.channels];
-			vadpcm_error err = vadpcm_encode(&parms, codebook + kPREDICTORS * kVADPCMEncodeOrder * i, nframes, destchan, schan, scratch);
-			if (err != 0) {
-				fprintf(stderr, "VADPCM encoding error: %s\n", vadpcm_error_name(err));
+			if (jobs[i].err != 0) {
+				fprintf(stderr, "VADPCM encoding error: %s\n", vadpcm_error_name(jobs[i].err));
 				return 1;
 			}
-			destchan += nframes * kVADPCMFrameByteSize;
 		}
 
 		struct vadpcm_vector state = {0};
@@ -305,7 +538,48 @@ int wav_convert(const char *infn, const char *outfn) {
 				fwrite(dest + (j * nframes + i) * kVADPCMFrameByteSize, 1, kVADPCMFrameByteSize, out);
 		}
 		free(dest);
-		free(scratch);
+	} break;
+
+	case 3: { // mdct
+		// Calculate the frame size from the requested bitrate. Default is
+		// about 10:1 compared to 16-bit samples. Keep it even so that each
+		// frame is at an even ROM address (as required for DMA).
+		int frame_bytes = MDCT_FRAME_SIZE * 2 / 10;
+		if (flag_wav_mdct_kbps)
+			frame_bytes = (int64_t)flag_wav_mdct_kbps * 1000 * MDCT_FRAME_SIZE / 8 / wav.sampleRate / wav.channels;
+		frame_bytes = (frame_bytes + 1) & ~1;
+		if (frame_bytes < 24) frame_bytes = 24;
+		if (frame_bytes > 254) frame_bytes = 254;
+
+		// Frame f covers samples [(f-1)*N, (f+1)*N): one extra frame is needed
+		// at the end to complete the overlap-add of the last block.
+		int nframes = cnt / MDCT_FRAME_SIZE + 1;
+		if (flag_verbose)
+			fprintf(stderr, "  compressing into MDCT format (%d frames, %d bytes per frame, %d kbps)\n",
+				nframes, frame_bytes, frame_bytes * 8 * wav.channels * wav.sampleRate / MDCT_FRAME_SIZE / 1000);
+
+		uint8_t *dest = calloc(nframes * wav.channels, frame_bytes);
+		double x[MDCT_FRAME_SIZE*2], coeffs[MDCT_FRAME_SIZE];
+		for (int f=0; f<nframes; f++) {
+			for (int ch=0; ch<wav.channels; ch++) {
+				for (int n=0; n<MDCT_FRAME_SIZE*2; n++) {
+					int idx = (f-1)*MDCT_FRAME_SIZE + n;
+					x[n] = (idx >= 0 && idx < cnt) ? wav.samples[idx*wav.channels + ch] : 0;
+				}
+				mdct_forward(x, coeffs);
+				mdct_encode_frame(coeffs, dest + (f*wav.channels + ch)*frame_bytes, frame_bytes);
+			}
+		}
+
+		w16(out, MDCT_FRAME_SIZE);
+		w16(out, frame_bytes);
+		w32(out, nframes);
+		w32_at(out, wstart_offset, ftell(out));
+		fwrite(dest, 1, nframes * wav.channels * frame_bytes, out);
+
+		if (flag_debug)
+			mdct_debug_dump(outfn, dest, nframes, frame_bytes, wav.channels, wav.sampleRate);
+		free(dest);
 	} break;
 
 	}
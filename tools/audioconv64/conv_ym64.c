@@ -9,6 +9,7 @@
  *   * Convert from older YM versions (eg: YM3!, YM3b).
  *   * Convert non-interleaved to interleaved.
  *   * Re-compress with LHA -lh5-.
+ *   * Optionally, compress in independent chunks to allow seeking.
  *
  */
 
@@ -26,6 +27,11 @@
 
 
 bool flag_ym_compress = false;
+bool flag_ym_seekable = false;
+
+// Number of audioframes per chunk in seekable compressed files.
+// Smaller chunks make seeking faster but compress worse.
+#define YM_CHUNK_FRAMES     256
 
 typedef struct __attribute__((packed)) {
     uint8_t size;
@@ -129,6 +135,66 @@ static void lha_compress(const char *outfn, const char *infn) {
     fclose(in); fclose(out);
 }
 
+// Write a seekable compressed YM64 file. The file has the same header and
+// metadata of a YM5 file (uncompressed, with "YM64" as version), followed by
+// an index of chunks. Each chunk contains YM_CHUNK_FRAMES audioframes and is
+// compressed as an independent LHA -lh5- stream, so that the player can seek
+// by restarting the decompression from the beginning of any chunk.
+//
+// The index is made by two big-endian 32-bit words (number of audioframes
+// per chunk, number of chunks), followed by the absolute file offset of
+// each chunk, plus one final offset that marks the end of the last chunk.
+static void ym_write_seekable(const char *outfn, ym5header *ymhead,
+    const char *song_name, const char *song_author, const char *song_comment,
+    const uint8_t *data, int numframes)
+{
+    ym_f = fopen(outfn, "wb");
+    if (!ym_f) fatal("cannot create: %s", outfn);
+
+    ymwrite("YM64LeOnArD!", 12);
+    ymwrite(ymhead, sizeof(*ymhead));
+    ymwrite(song_name, strlen(song_name)+1);
+    ymwrite(song_author, strlen(song_author)+1);
+    ymwrite(song_comment, strlen(song_comment)+1);
+
+    int nchunks = (numframes + YM_CHUNK_FRAMES - 1) / YM_CHUNK_FRAMES;
+    uint32_t chunkhead[2] = { HOST_TO_BE32(YM_CHUNK_FRAMES), HOST_TO_BE32(nchunks) };
+    ymwrite(chunkhead, sizeof(chunkhead));
+
+    // Reserve space for the index, it will be written once all the
+    // chunks have been compressed.
+    uint32_t *index = calloc(nchunks+1, sizeof(uint32_t));
+    long index_off = ftell(ym_f);
+    ymwrite(index, (nchunks+1)*sizeof(uint32_t));
+
+    // The LHA compressor works only through FILE*, so go through
+    // a temporary file for each chunk.
+    lzh5_init(LZHUFF5_METHOD_NUM);
+    for (int i=0; i<nchunks; i++) {
+        int nf = numframes - i*YM_CHUNK_FRAMES;
+        if (nf > YM_CHUNK_FRAMES) nf = YM_CHUNK_FRAMES;
+
+        FILE *tmp = tmpfile();
+        if (!tmp) fatal("cannot create temporary file");
+        fwrite(data + i*YM_CHUNK_FRAMES*16, 1, nf*16, tmp);
+        rewind(tmp);
+
+        index[i] = HOST_TO_BE32(ftell(ym_f));
+        lzh5_encode(tmp, ym_f, NULL, NULL, NULL);
+        fclose(tmp);
+    }
+    index[nchunks] = HOST_TO_BE32(ftell(ym_f));
+
+    fseek(ym_f, index_off, SEEK_SET);
+    ymwrite(index, (nchunks+1)*sizeof(uint32_t));
+    fclose(ym_f); ym_f = NULL;
+
+    if (flag_verbose)
+        fprintf(stderr, "  compressed %d frames into %d chunks (%u bytes)\n",
+            numframes, nchunks, BE32_TO_HOST(index[nchunks]));
+    free(index);
+}
+
 int ym_convert(const char *infn, const char *outfn) {
     ym_f = fopen(infn, "rb");
     if (!ym_f) fatal("cannot open: %s\n", infn);
@@ -180,7 +246,7 @@ int ym_convert(const char *infn, const char *outfn) {
         uint8_t *data = malloc(csize);
         ymread(data, csize);
         if (head[3] == 'b') ymread(&loop, 4);
-        fclose(ym_f);
+        fclose(ym_f); ym_f = NULL;
 
         // De-interleave the data. Notice that YM3! stores data for 14
         // registers, while YM5! has room for 16 registers (to handle digidrums).
@@ -192,24 +258,30 @@ int ym_convert(const char *infn, const char *outfn) {
             outdata[f*16+r] = data[i];
         }
 
-        // Write a YM5 format (uncompressed) into temporary file.
-        const char *tmpfilename = ".song.tmp";
-        ym_f = fopen(tmpfilename, "wb");
-        if (!ym_f) fatal("cannot create: %s", tmpfilename);
-
-        ymwrite("YM5!LeOnArD!", 12);
-
         ym5header head;
         memset(&head, 0, sizeof(head));
         head.nvbl = HOST_TO_BE32(nframes);
         head.extfreq = HOST_TO_BE32(1000000);
         head.playfreq = HOST_TO_BE16(50);
         head.loop = loop;
-        ymwrite(&head, sizeof(head));
 
         const char *song_name = "";
         const char *song_author = "";
         const char *song_comment = "";
+
+        if (flag_ym_seekable) {
+            ym_write_seekable(outfn, &head, song_name, song_author, song_comment, outdata, nframes);
+            free(data); free(outdata);
+            return 0;
+        }
+
+        // Write a YM5 format (uncompressed) into temporary file.
+        const char *tmpfilename = ".song.tmp";
+        ym_f = fopen(tmpfilename, "wb");
+        if (!ym_f) fatal("cannot create: %s", tmpfilename);
+
+        ymwrite("YM5!LeOnArD!", 12);
+        ymwrite(&head, sizeof(head));
         ymwrite(song_name, strlen(song_name)+1);
         ymwrite(song_author, strlen(song_author)+1);
         ymwrite(song_comment, strlen(song_comment)+1);
@@ -268,6 +340,12 @@ int ym_convert(const char *infn, const char *outfn) {
         // Turn off interleaving bit in header attributes
         ymhead.attrs = HOST_TO_BE32((BE32_TO_HOST(ymhead.attrs) & ~1));
 
+        if (flag_ym_seekable) {
+            ym_write_seekable(outfn, &ymhead, song_name, song_author, song_comment, outdata, numframes);
+            free(data); free(outdata);
+            return 0;
+        }
+
         // Write back the YM5 file into a temporary file.
         const char *tmpfilename = ".song.tmp";
         ym_f = fopen(flag_ym_compress ? tmpfilename : outfn, "wb");
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "binout.h"
 #include "aplib_compress.h"
@@ -21,6 +22,12 @@
 
 #include "lz4_compress.h"
 
+static void asset_init_all_compressions(void)
+{
+    asset_init_compression(2);
+    asset_init_compression(3);
+}
+
 void asset_compress_mem(int compression, const uint8_t *data, int sz, uint8_t **output, int *cmp_size, int *winsize, int *margin)
 {
     switch (compression) {
@@ -100,8 +107,9 @@ void asset_compress_mem(int compression, const uint8_t *data, int sz, uint8_t **
  */
 bool asset_compress(const char *infn, const char *outfn, int compression, int winsize)
 {
-    asset_init_compression(2);
-    asset_init_compression(3);
+    // Tools can compress from multiple threads (eg: mksprite batch mode)
+    static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+    pthread_once(&init_once, asset_init_all_compressions);
 
     // Make sure the file exists before calling asset_load,
     // which would just assert.
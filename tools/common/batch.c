@@ -0,0 +1,56 @@
+/**
+ * @file batch.c
+ * @brief Helpers for the batch conversions of the asset tools
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "batch.h"
+
+#define STBDS_NO_SHORT_NAMES
+#include "stb_ds.h"
+
+int cpu_count(void)
+{
+    #ifdef _WIN32
+    const char *env = getenv("NUMBER_OF_PROCESSORS");
+    int n = env ? atoi(env) : 1;
+    #else
+    int n = sysconf(_SC_NPROCESSORS_ONLN);
+    #endif
+    return n > 0 ? n : 1;
+}
+
+hash_cache_t *hash_cache_load(const char *fn)
+{
+    hash_cache_t *cache = NULL;
+    stbds_sh_new_strdup(cache);
+    FILE *f = fopen(fn, "r");
+    if (f) {
+        char outfn[4096]; unsigned long long h;
+        while (fscanf(f, "%llx %4095[^\n]\n", &h, outfn) == 2)
+            stbds_shput(cache, outfn, h);
+        fclose(f);
+    }
+    return cache;
+}
+
+bool hash_cache_uptodate(hash_cache_t *cache, const char *outfn, uint64_t hash)
+{
+    struct stat st;
+    int idx = stbds_shgeti(cache, outfn);
+    return idx >= 0 && cache[idx].value == hash && stat(outfn, &st) == 0;
+}
+
+bool hash_cache_save(hash_cache_t *cache, const char *fn)
+{
+    FILE *f = fopen(fn, "w");
+    if (!f)
+        return false;
+    for (int i=0; i<stbds_shlen(cache); i++)
+        fprintf(f, "%016llx %s\n", (unsigned long long)cache[i].value, cache[i].key);
+    return fclose(f) == 0;
+}
@@ -0,0 +1,61 @@
+#ifndef LIBDRAGON_TOOLS_BATCH_H
+#define LIBDRAGON_TOOLS_BATCH_H
+
+/**
+ * @file batch.h
+ * @brief Helpers for the batch conversions of the asset tools
+ *
+ * Tools that convert many files in one run (audioconv64, mksprite) run the
+ * conversions in parallel, and can keep a cache file with the hash of the
+ * inputs of each output file (see hash.h), to skip the conversions that
+ * are already up to date.
+ *
+ * The cache file is a text file with one line per output file, containing
+ * the hash in hexadecimal followed by the output filename.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hash.h"
+
+/** @brief Number of CPUs available, used as default number of jobs */
+int cpu_count(void);
+
+/** @brief Cache of the hashes of the inputs of each output file (stb_ds string hashmap) */
+typedef struct {
+    char *key;                  ///< Output filename
+    uint64_t value;             ///< Hash of the inputs of the conversion
+} hash_cache_t;
+
+/**
+ * @brief Load a cache file
+ *
+ * A missing or unreadable file is not an error: an empty cache is returned,
+ * so that all the outputs are converted.
+ *
+ * @param fn        Filename of the cache
+ * @return          Cache (to be freed with stbds_shfree)
+ */
+hash_cache_t *hash_cache_load(const char *fn);
+
+/**
+ * @brief Check whether an output file is up to date
+ *
+ * @param cache     Cache loaded by #hash_cache_load
+ * @param outfn     Output filename
+ * @param hash      Hash of the current inputs of the conversion
+ * @return          True if the hash matches the one in the cache and the
+ *                  output file still exists
+ */
+bool hash_cache_uptodate(hash_cache_t *cache, const char *outfn, uint64_t hash);
+
+/**
+ * @brief Save a cache file
+ *
+ * @param cache     Cache to save
+ * @param fn        Filename of the cache
+ * @return          False if the file cannot be written
+ */
+bool hash_cache_save(hash_cache_t *cache, const char *fn);
+
+#endif
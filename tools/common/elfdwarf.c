@@ -0,0 +1,1856 @@
+/**
+ * @file elfdwarf.c
+ * @brief Minimal ELF and DWARF reader for symbolization
+ *
+ * The DWARF lookups replicate the behavior of BFD (the library behind
+ * GNU addr2line), including its quirks: the choice of the innermost function
+ * as the one with the smallest range, the merging of contiguous ranges,
+ * the fallback to the ELF symbol table for functions that have no
+ * linkage name, and the cache used for that fallback. This is required so
+ * that the output is byte-for-byte identical to what the toolchain produces.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "elfdwarf.h"
+
+#define STBDS_NO_SHORT_NAMES
+#include "stb_ds.h"
+
+#define DW_TAG_entry_point          0x03
+#define DW_TAG_compile_unit         0x11
+#define DW_TAG_inlined_subroutine   0x1d
+#define DW_TAG_subprogram           0x2e
+
+#define DW_AT_name                  0x03
+#define DW_AT_stmt_list             0x10
+#define DW_AT_low_pc                0x11
+#define DW_AT_high_pc               0x12
+#define DW_AT_language              0x13
+#define DW_AT_comp_dir              0x1b
+#define DW_AT_abstract_origin       0x31
+#define DW_AT_specification         0x47
+#define DW_AT_ranges                0x55
+#define DW_AT_call_file             0x58
+#define DW_AT_call_line             0x59
+#define DW_AT_linkage_name          0x6e
+#define DW_AT_str_offsets_base      0x72
+#define DW_AT_addr_base             0x73
+#define DW_AT_rnglists_base         0x74
+#define DW_AT_MIPS_linkage_name     0x2007
+
+#define DW_FORM_addr                0x01
+#define DW_FORM_block2              0x03
+#define DW_FORM_block4              0x04
+#define DW_FORM_data2               0x05
+#define DW_FORM_data4               0x06
+#define DW_FORM_data8               0x07
+#define DW_FORM_string              0x08
+#define DW_FORM_block               0x09
+#define DW_FORM_block1              0x0a
+#define DW_FORM_data1               0x0b
+#define DW_FORM_flag                0x0c
+#define DW_FORM_sdata               0x0d
+#define DW_FORM_strp                0x0e
+#define DW_FORM_udata               0x0f
+#define DW_FORM_ref_addr            0x10
+#define DW_FORM_ref1                0x11
+#define DW_FORM_ref2                0x12
+#define DW_FORM_ref4                0x13
+#define DW_FORM_ref8                0x14
+#define DW_FORM_ref_udata           0x15
+#define DW_FORM_indirect            0x16
+#define DW_FORM_sec_offset          0x17
+#define DW_FORM_exprloc             0x18
+#define DW_FORM_flag_present        0x19
+#define DW_FORM_strx                0x1a
+#define DW_FORM_addrx               0x1b
+#define DW_FORM_ref_sup4            0x1c
+#define DW_FORM_strp_sup            0x1d
+#define DW_FORM_data16              0x1e
+#define DW_FORM_line_strp           0x1f
+#define DW_FORM_ref_sig8            0x20
+#define DW_FORM_implicit_const      0x21
+#define DW_FORM_loclistx            0x22
+#define DW_FORM_rnglistx            0x23
+#define DW_FORM_ref_sup8            0x24
+#define DW_FORM_strx1               0x25
+#define DW_FORM_strx2               0x26
+#define DW_FORM_strx3               0x27
+#define DW_FORM_strx4               0x28
+#define DW_FORM_addrx1              0x29
+#define DW_FORM_addrx2              0x2a
+#define DW_FORM_addrx3              0x2b
+#define DW_FORM_addrx4              0x2c
+#define DW_FORM_GNU_addr_index      0x1f01
+#define DW_FORM_GNU_str_index       0x1f02
+#define DW_FORM_GNU_ref_alt         0x1f20
+#define DW_FORM_GNU_strp_alt        0x1f21
+
+#define DW_UT_compile               0x01
+#define DW_UT_type                  0x02
+#define DW_UT_partial               0x03
+#define DW_UT_skeleton              0x04
+#define DW_UT_split_compile         0x05
+#define DW_UT_split_type            0x06
+
+#define DW_LNS_copy                 0x01
+#define DW_LNS_advance_pc           0x02
+#define DW_LNS_advance_line         0x03
+#define DW_LNS_set_file             0x04
+#define DW_LNS_const_add_pc         0x08
+#define DW_LNS_fixed_advance_pc     0x09
+#define DW_LNE_end_sequence         0x01
+#define DW_LNE_set_address          0x02
+#define DW_LNE_define_file          0x03
+#define DW_LNCT_path                0x01
+#define DW_LNCT_directory_index     0x02
+
+#define DW_RLE_end_of_list          0x00
+#define DW_RLE_base_addressx        0x01
+#define DW_RLE_startx_endx          0x02
+#define DW_RLE_startx_length        0x03
+#define DW_RLE_offset_pair          0x04
+#define DW_RLE_base_address         0x05
+#define DW_RLE_start_end            0x06
+#define DW_RLE_start_length         0x07
+
+/** @brief Maximum number of abbreviation codes stored in the direct lookup table */
+#define DW_ABBREV_DIRECT            1024
+
+/** @brief Filename used by BFD for invalid file indices */
+static const char DW_UNKNOWN_FILE[] = "<unknown>";
+
+/*********************************************************************
+ * ELF loader
+ *********************************************************************/
+
+static uint16_t rd16(bool be, const uint8_t *p)
+{
+    return be ? (p[0] << 8) | p[1] : p[0] | (p[1] << 8);
+}
+
+static uint32_t rd32(bool be, const uint8_t *p)
+{
+    return be ? ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]
+              : p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t rd64(bool be, const uint8_t *p)
+{
+    return be ? ((uint64_t)rd32(be, p) << 32) | rd32(be, p+4)
+              : rd32(be, p) | ((uint64_t)rd32(be, p+4) << 32);
+}
+
+uint32_t elf_read32(const elf_t *elf, const uint8_t *p)
+{
+    return rd32(elf->be, p);
+}
+
+static const char *elf_string(const elf_section_t *strtab, uint64_t off)
+{
+    if (!strtab->data || off >= strtab->size)
+        return "";
+    return (const char*)strtab->data + off;
+}
+
+elf_t *elf_open(const char *fn)
+{
+    FILE *f = fopen(fn, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < 64) {
+        fclose(f);
+        return NULL;
+    }
+    uint8_t *buf = malloc(size);
+    if (fread(buf, 1, size, f) != size) {
+        fclose(f);
+        free(buf);
+        return NULL;
+    }
+    fclose(f);
+
+    if (memcmp(buf, "\x7f" "ELF", 4) != 0 || (buf[4] != 1 && buf[4] != 2) || (buf[5] != 1 && buf[5] != 2)) {
+        free(buf);
+        return NULL;
+    }
+
+    elf_t *elf = calloc(1, sizeof(elf_t));
+    elf->buf = buf;
+    elf->size = size;
+    elf->is64 = buf[4] == 2;
+    elf->be = buf[5] == 2;
+    bool be = elf->be;
+    elf->machine = rd16(be, buf+18);
+
+    uint64_t shoff; int shentsize, shnum, shstrndx;
+    if (elf->is64) {
+        shoff = rd64(be, buf+0x28);
+        shentsize = rd16(be, buf+0x3A);
+        shnum = rd16(be, buf+0x3C);
+        shstrndx = rd16(be, buf+0x3E);
+    } else {
+        shoff = rd32(be, buf+0x20);
+        shentsize = rd16(be, buf+0x2E);
+        shnum = rd16(be, buf+0x30);
+        shstrndx = rd16(be, buf+0x32);
+    }
+    if (shentsize < (elf->is64 ? 64 : 40) || shoff > size || (uint64_t)shnum * shentsize > size - shoff) {
+        elf_close(elf);
+        return NULL;
+    }
+
+    // Load the section headers
+    uint32_t *name_offs = calloc(shnum, sizeof(uint32_t));
+    elf->num_sections = shnum;
+    elf->sections = calloc(shnum, sizeof(elf_section_t));
+    for (int i=0; i<shnum; i++) {
+        const uint8_t *p = buf + shoff + i*shentsize;
+        elf_section_t *s = &elf->sections[i];
+        uint64_t offset;
+        name_offs[i] = rd32(be, p+0);
+        s->type = rd32(be, p+4);
+        if (elf->is64) {
+            s->flags = rd64(be, p+8);
+            s->addr = rd64(be, p+16);
+            offset = rd64(be, p+24);
+            s->size = rd64(be, p+32);
+            s->link = rd32(be, p+40);
+        } else {
+            s->flags = rd32(be, p+8);
+            s->addr = rd32(be, p+12);
+            offset = rd32(be, p+16);
+            s->size = rd32(be, p+20);
+            s->link = rd32(be, p+24);
+        }
+        if (s->type != ELF_SHT_NOBITS && offset <= size && s->size <= size - offset)
+            s->data = buf + offset;
+    }
+    for (int i=0; i<shnum; i++) {
+        if (shstrndx < shnum)
+            elf->sections[i].name = elf_string(&elf->sections[shstrndx], name_offs[i]);
+        else
+            elf->sections[i].name = "";
+    }
+    free(name_offs);
+
+    // Load the symbol table, skipping the initial null symbol
+    for (int i=0; i<shnum; i++) {
+        const elf_section_t *symtab = &elf->sections[i];
+        if (symtab->type != ELF_SHT_SYMTAB || !symtab->data || symtab->link >= shnum)
+            continue;
+        const elf_section_t *strtab = &elf->sections[symtab->link];
+        int entsize = elf->is64 ? 24 : 16;
+        int count = symtab->size / entsize;
+        elf->symbols = calloc(count, sizeof(elf_symbol_t));
+        for (int j=1; j<count; j++) {
+            const uint8_t *p = symtab->data + j*entsize;
+            elf_symbol_t *sym = &elf->symbols[elf->num_symbols++];
+            uint8_t info;
+            sym->name = elf_string(strtab, rd32(be, p+0));
+            if (elf->is64) {
+                info = p[4];
+                sym->other = p[5] & 3;
+                sym->shndx = rd16(be, p+6);
+                sym->value = rd64(be, p+8);
+                sym->size = rd64(be, p+16);
+            } else {
+                sym->value = rd32(be, p+4);
+                sym->size = rd32(be, p+8);
+                info = p[12];
+                sym->other = p[13] & 3;
+                sym->shndx = rd16(be, p+14);
+            }
+            sym->type = info & 0xF;
+            sym->bind = info >> 4;
+        }
+        break;
+    }
+
+    return elf;
+}
+
+void elf_close(elf_t *elf)
+{
+    free(elf->symbols);
+    free(elf->sections);
+    free(elf->buf);
+    free(elf);
+}
+
+/*********************************************************************
+ * DWARF parser
+ *********************************************************************/
+
+/** @brief A DWARF section */
+typedef struct {
+    const uint8_t *data;
+    uint64_t size;
+} dw_section_t;
+
+/** @brief Bounds-checked reader of DWARF data */
+typedef struct {
+    const uint8_t *p;           ///< Current position
+    const uint8_t *end;         ///< End of the data
+    bool be;                    ///< True if the data is big-endian
+} dw_reader_t;
+
+/** @brief Attribute specification in an abbreviation */
+typedef struct {
+    uint16_t name;              ///< Attribute name (DW_AT_*)
+    uint16_t form;              ///< Attribute form (DW_FORM_*)
+    int64_t implicit_const;     ///< Value for DW_FORM_implicit_const
+} dw_attrspec_t;
+
+/** @brief An abbreviation (DIE layout) */
+typedef struct {
+    uint64_t code;              ///< Abbreviation code
+    uint16_t tag;               ///< DIE tag (DW_TAG_*)
+    bool has_children;          ///< True if the DIE has children
+    dw_attrspec_t *attrs;       ///< Attribute specifications (stb_ds array)
+} dw_abbrev_t;
+
+/** @brief An abbreviation table */
+typedef struct {
+    uint64_t offset;            ///< Offset in .debug_abbrev
+    dw_abbrev_t *abbrevs;       ///< Abbreviations (stb_ds array)
+    int *direct;                ///< Index in abbrevs by code (stb_ds array, for small codes)
+} dw_abbrevtab_t;
+
+/** @brief A decoded attribute value */
+typedef struct {
+    uint16_t form;              ///< Form of the value
+    uint64_t u;                 ///< Integer value (constants, addresses, references, offsets)
+    const char *str;            ///< String value (for string forms)
+} dw_attr_t;
+
+/** @brief A row of the line number matrix */
+typedef struct {
+    uint64_t addr;              ///< Address
+    const char *file;           ///< Full filename
+    uint32_t line;              ///< Line number
+    bool end_sequence;          ///< True if this row terminates a sequence
+} dw_row_t;
+
+/** @brief A sequence of rows of the line number matrix */
+typedef struct {
+    uint64_t low;               ///< First address (possibly trimmed)
+    uint64_t high;              ///< Address of the terminating row
+    int unit;                   ///< Index of the unit
+    int first_row;              ///< First row in the unit rows
+    int num_rows;               ///< Number of rows (including the terminating row)
+    int order;                  ///< Sort key for sequences with the same range
+} dw_seq_t;
+
+/** @brief An address range */
+typedef struct {
+    uint64_t lo, hi;            ///< Range [lo, hi)
+    int func;                   ///< Index of the function
+} dw_range_t;
+
+/** @brief A function (concrete subprogram or inlined instance) */
+typedef struct {
+    const char *name;           ///< Name (possibly mangled)
+    bool is_linkage;            ///< True if name is a linkage name (see BFD)
+    uint16_t tag;               ///< DIE tag
+    int caller;                 ///< Index of the function this was inlined into (-1 if none)
+    const char *call_file;      ///< File of the inlined call
+    uint32_t call_line;         ///< Line of the inlined call
+    uint64_t low;               ///< Start of the first range
+} dw_func_t;
+
+/** @brief A file entry of a line number program header */
+typedef struct {
+    const char *name;           ///< Filename
+    uint64_t dir;               ///< Directory index
+} dw_file_t;
+
+/** @brief A unit in .debug_info */
+typedef struct {
+    uint64_t off;               ///< Offset of the unit header
+    uint64_t end;               ///< End offset of the unit
+    uint64_t die_off;           ///< Offset of the unit DIE
+    int version;                ///< DWARF version
+    int addr_size;              ///< Size of an address
+    int off_size;               ///< Size of a section offset (4 or 8)
+    dw_abbrevtab_t *abbrevs;    ///< Abbreviation table
+    uint64_t lang;              ///< Source language (DW_LANG_*)
+    uint64_t base_addr;         ///< Base address (DW_AT_low_pc of the unit)
+    uint64_t str_offsets_base;  ///< Base in .debug_str_offsets
+    uint64_t addr_base;         ///< Base in .debug_addr
+    uint64_t rnglists_base;     ///< Base in .debug_rnglists
+    const char *comp_dir;       ///< Compilation directory
+    bool has_lines;             ///< True if the unit has a line number program
+    uint64_t stmt_list;         ///< Offset of the line number program
+
+    // Line number program header (filled by the worker)
+    bool has_line_table;        ///< True if the line number program was decoded
+    bool dir_and_file_0;        ///< True if the file and directory indices are 0-based (DWARF 5)
+    const char **dirs;          ///< Include directories (stb_ds array)
+    dw_file_t *files;           ///< Files (stb_ds array)
+    char **full_files;          ///< Cache of full filenames, by file index (stb_ds array)
+
+    // Results (filled by the worker)
+    dw_row_t *rows;             ///< Line number matrix (stb_ds array)
+    dw_seq_t *seqs;             ///< Sequences (stb_ds array)
+    dw_func_t *funcs;           ///< Functions (stb_ds array)
+    dw_range_t *ranges;         ///< Function ranges (stb_ds array)
+    int func_base;              ///< Index of the first function in the global table
+} dw_unit_t;
+
+/** @brief A function symbol of the ELF symbol table, as seen by BFD */
+typedef struct {
+    uint64_t addr;              ///< Address of the symbol
+    uint64_t size;              ///< Size of the symbol (at least 1)
+    const char *name;           ///< Name of the symbol
+    const char *file;           ///< Source file attributed to the symbol
+} dw_elfsym_t;
+
+struct dwarf_s {
+    elf_t *elf;                 ///< ELF file
+    int nthreads;               ///< Number of worker threads
+    dw_section_t info, abbrev, line, str, line_str, ranges, rnglists, addr, str_offsets;
+
+    dw_abbrevtab_t **abbrevtabs;                        ///< Abbreviation tables (stb_ds array)
+    struct { uint64_t key; int value; } *abbrev_hash;   ///< Abbreviation tables by offset
+    dw_unit_t *units;           ///< Units (stb_ds array)
+
+    dw_func_t *funcs;           ///< All functions (stb_ds array)
+    dw_seq_t *seqs;             ///< All sequences, sorted by address (stb_ds array)
+    uint64_t *seg_addr;         ///< Boundaries of the address segments (stb_ds array)
+    int *seg_func;              ///< Innermost function of each address segment (stb_ds array)
+
+    dw_elfsym_t **elfsyms;      ///< Function symbols of each section, sorted by address (stb_ds arrays)
+
+    // Cache of the ELF symbol lookup (like _bfd_elf_find_function)
+    int cache_section;          ///< Section of the last lookup
+    const dw_elfsym_t *cache_sym;   ///< Symbol found in the last lookup
+};
+
+static bool rd_avail(dw_reader_t *r, uint64_t n)
+{
+    if ((uint64_t)(r->end - r->p) < n) {
+        r->p = r->end;
+        return false;
+    }
+    return true;
+}
+
+static uint64_t rd_u(dw_reader_t *r, int n)
+{
+    if (!rd_avail(r, n))
+        return 0;
+    uint64_t v = 0;
+    if (r->be) {
+        for (int i=0; i<n; i++) v = (v << 8) | r->p[i];
+    } else {
+        for (int i=n-1; i>=0; i--) v = (v << 8) | r->p[i];
+    }
+    r->p += n;
+    return v;
+}
+
+static void rd_skip(dw_reader_t *r, uint64_t n)
+{
+    if (rd_avail(r, n))
+        r->p += n;
+}
+
+static uint64_t rd_uleb(dw_reader_t *r)
+{
+    uint64_t v = 0; int shift = 0;
+    while (r->p < r->end) {
+        uint8_t b = *r->p++;
+        if (shift < 64) v |= (uint64_t)(b & 0x7F) << shift;
+        shift += 7;
+        if (!(b & 0x80)) break;
+    }
+    return v;
+}
+
+static int64_t rd_sleb(dw_reader_t *r)
+{
+    uint64_t v = 0; int shift = 0; uint8_t b = 0;
+    while (r->p < r->end) {
+        b = *r->p++;
+        if (shift < 64) v |= (uint64_t)(b & 0x7F) << shift;
+        shift += 7;
+        if (!(b & 0x80)) break;
+    }
+    if (shift < 64 && (b & 0x40))
+        v |= -((uint64_t)1 << shift);
+    return v;
+}
+
+static const char *rd_cstr(dw_reader_t *r)
+{
+    const uint8_t *s = r->p;
+    const uint8_t *z = memchr(s, 0, r->end - s);
+    if (!z) {
+        r->p = r->end;
+        return NULL;
+    }
+    r->p = z + 1;
+    return (const char*)s;
+}
+
+/** @brief Read an initial length field, returning the size of the section offsets */
+static uint64_t rd_initial_length(dw_reader_t *r, int *off_size)
+{
+    uint64_t len = rd_u(r, 4);
+    *off_size = 4;
+    if (len == 0xFFFFFFFF) {
+        len = rd_u(r, 8);
+        *off_size = 8;
+    }
+    return len;
+}
+
+static const char *dw_string(const dw_section_t *sec, uint64_t off)
+{
+    if (!sec->data || off >= sec->size || !memchr(sec->data + off, 0, sec->size - off))
+        return NULL;
+    return (const char*)sec->data + off;
+}
+
+static bool dw_is_str_form(uint16_t form)
+{
+    switch (form) {
+    case DW_FORM_string: case DW_FORM_strp: case DW_FORM_line_strp:
+    case DW_FORM_strx: case DW_FORM_strx1: case DW_FORM_strx2:
+    case DW_FORM_strx3: case DW_FORM_strx4: case DW_FORM_GNU_strp_alt:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool dw_is_int_form(uint16_t form)
+{
+    switch (form) {
+    case DW_FORM_addr: case DW_FORM_data1: case DW_FORM_data2:
+    case DW_FORM_data4: case DW_FORM_data8: case DW_FORM_flag:
+    case DW_FORM_sdata: case DW_FORM_udata: case DW_FORM_ref_addr:
+    case DW_FORM_ref1: case DW_FORM_ref2: case DW_FORM_ref4:
+    case DW_FORM_ref8: case DW_FORM_ref_udata: case DW_FORM_sec_offset:
+    case DW_FORM_flag_present: case DW_FORM_implicit_const: case DW_FORM_ref_sig8:
+    case DW_FORM_rnglistx: case DW_FORM_loclistx: case DW_FORM_GNU_ref_alt:
+    case DW_FORM_addrx: case DW_FORM_addrx1: case DW_FORM_addrx2:
+    case DW_FORM_addrx3: case DW_FORM_addrx4: case DW_FORM_GNU_addr_index:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool dw_is_addrx_form(uint16_t form)
+{
+    return form == DW_FORM_addrx || form == DW_FORM_GNU_addr_index ||
+        (form >= DW_FORM_addrx1 && form <= DW_FORM_addrx4);
+}
+
+/** @brief Read an attribute value, resolving strings and indexed addresses */
+static bool dw_read_attr(dwarf_t *dw, const dw_unit_t *cu, dw_reader_t *r, uint16_t form, int64_t implicit_const, dw_attr_t *a)
+{
+    a->form = form;
+    a->u = 0;
+    a->str = NULL;
+
+    switch (form) {
+    case DW_FORM_addr:
+        a->u = rd_u(r, cu->addr_size); break;
+    case DW_FORM_data1: case DW_FORM_ref1: case DW_FORM_flag:
+    case DW_FORM_strx1: case DW_FORM_addrx1:
+        a->u = rd_u(r, 1); break;
+    case DW_FORM_data2: case DW_FORM_ref2: case DW_FORM_strx2: case DW_FORM_addrx2:
+        a->u = rd_u(r, 2); break;
+    case DW_FORM_strx3: case DW_FORM_addrx3:
+        a->u = rd_u(r, 3); break;
+    case DW_FORM_data4: case DW_FORM_ref4: case DW_FORM_strx4:
+    case DW_FORM_addrx4: case DW_FORM_ref_sup4:
+        a->u = rd_u(r, 4); break;
+    case DW_FORM_data8: case DW_FORM_ref8: case DW_FORM_ref_sig8: case DW_FORM_ref_sup8:
+        a->u = rd_u(r, 8); break;
+    case DW_FORM_data16:
+        rd_skip(r, 16); break;
+    case DW_FORM_sdata:
+        a->u = rd_sleb(r); break;
+    case DW_FORM_udata: case DW_FORM_ref_udata: case DW_FORM_strx:
+    case DW_FORM_addrx: case DW_FORM_loclistx: case DW_FORM_rnglistx:
+    case DW_FORM_GNU_addr_index: case DW_FORM_GNU_str_index:
+        a->u = rd_uleb(r); break;
+    case DW_FORM_string:
+        a->str = rd_cstr(r); break;
+    case DW_FORM_strp: case DW_FORM_line_strp: case DW_FORM_sec_offset:
+    case DW_FORM_strp_sup: case DW_FORM_GNU_ref_alt: case DW_FORM_GNU_strp_alt:
+        a->u = rd_u(r, cu->off_size); break;
+    case DW_FORM_ref_addr:
+        a->u = rd_u(r, cu->version <= 2 ? cu->addr_size : cu->off_size); break;
+    case DW_FORM_flag_present:
+        a->u = 1; break;
+    case DW_FORM_implicit_const:
+        a->u = implicit_const; break;
+    case DW_FORM_block1:
+        rd_skip(r, rd_u(r, 1)); break;
+    case DW_FORM_block2:
+        rd_skip(r, rd_u(r, 2)); break;
+    case DW_FORM_block4:
+        rd_skip(r, rd_u(r, 4)); break;
+    case DW_FORM_block: case DW_FORM_exprloc:
+        rd_skip(r, rd_uleb(r)); break;
+    case DW_FORM_indirect:
+        return dw_read_attr(dw, cu, r, rd_uleb(r), 0, a);
+    default:
+        // Unknown form: the size is unknown, so we cannot go on parsing
+        return false;
+    }
+
+    // Resolve the strings and the indexed addresses
+    switch (form) {
+    case DW_FORM_strp:
+        a->str = dw_string(&dw->str, a->u); break;
+    case DW_FORM_line_strp:
+        a->str = dw_string(&dw->line_str, a->u); break;
+    case DW_FORM_strx: case DW_FORM_strx1: case DW_FORM_strx2:
+    case DW_FORM_strx3: case DW_FORM_strx4: {
+        uint64_t off = cu->str_offsets_base + a->u * cu->off_size;
+        if (dw->str_offsets.data && off + cu->off_size <= dw->str_offsets.size) {
+            dw_reader_t ro = { dw->str_offsets.data + off, dw->str_offsets.data + dw->str_offsets.size, r->be };
+            a->str = dw_string(&dw->str, rd_u(&ro, cu->off_size));
+        }
+    }   break;
+    default:
+        if (dw_is_addrx_form(form)) {
+            uint64_t off = cu->addr_base + a->u * cu->addr_size;
+            a->u = 0;
+            if (dw->addr.data && off + cu->addr_size <= dw->addr.size) {
+                dw_reader_t ra = { dw->addr.data + off, dw->addr.data + dw->addr.size, r->be };
+                a->u = rd_u(&ra, cu->addr_size);
+            }
+        }
+        break;
+    }
+    return true;
+}
+
+static dw_abbrevtab_t *dw_abbrevs_get(dwarf_t *dw, uint64_t offset)
+{
+    int idx = stbds_hmget(dw->abbrev_hash, offset);
+    if (idx >= 0)
+        return dw->abbrevtabs[idx];
+
+    dw_abbrevtab_t *tab = calloc(1, sizeof(dw_abbrevtab_t));
+    tab->offset = offset;
+    if (offset < dw->abbrev.size) {
+        dw_reader_t r = { dw->abbrev.data + offset, dw->abbrev.data + dw->abbrev.size, dw->elf->be };
+        while (r.p < r.end) {
+            dw_abbrev_t ab = {0};
+            ab.code = rd_uleb(&r);
+            if (ab.code == 0) break;
+            ab.tag = rd_uleb(&r);
+            ab.has_children = rd_u(&r, 1) != 0;
+            while (r.p < r.end) {
+                dw_attrspec_t spec = {0};
+                spec.name = rd_uleb(&r);
+                spec.form = rd_uleb(&r);
+                if (spec.form == DW_FORM_implicit_const)
+                    spec.implicit_const = rd_sleb(&r);
+                if (spec.name == 0 && spec.form == 0) break;
+                stbds_arrput(ab.attrs, spec);
+            }
+            if (ab.code < DW_ABBREV_DIRECT) {
+                while (stbds_arrlen(tab->direct) <= ab.code)
+                    stbds_arrput(tab->direct, -1);
+                tab->direct[ab.code] = stbds_arrlen(tab->abbrevs);
+            }
+            stbds_arrput(tab->abbrevs, ab);
+        }
+    }
+
+    stbds_hmput(dw->abbrev_hash, offset, stbds_arrlen(dw->abbrevtabs));
+    stbds_arrput(dw->abbrevtabs, tab);
+    return tab;
+}
+
+static const dw_abbrev_t *dw_abbrev_lookup(const dw_abbrevtab_t *tab, uint64_t code)
+{
+    if (code < stbds_arrlen(tab->direct)) {
+        int idx = tab->direct[code];
+        return idx >= 0 ? &tab->abbrevs[idx] : NULL;
+    }
+    for (int i=0; i<stbds_arrlen(tab->abbrevs); i++)
+        if (tab->abbrevs[i].code == code)
+            return &tab->abbrevs[i];
+    return NULL;
+}
+
+/** @brief Find the unit that contains the specified offset in .debug_info */
+static const dw_unit_t *dw_unit_at(const dwarf_t *dw, uint64_t off)
+{
+    int lo = 0, hi = stbds_arrlen(dw->units);
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (off < dw->units[mid].off) hi = mid;
+        else if (off >= dw->units[mid].end) lo = mid + 1;
+        else return &dw->units[mid];
+    }
+    return NULL;
+}
+
+/** @brief Check if the names of a language are not mangled (mangle_style() == 0 in BFD) */
+static bool dw_lang_unmangled(uint64_t lang)
+{
+    switch (lang) {
+    case 0x01: case 0x02: case 0x05: case 0x06:     // C89, C, Cobol74, Cobol85
+    case 0x07: case 0x09: case 0x0c: case 0x0f:     // Fortran77, Pascal83, C99, PLI
+    case 0x12: case 0x1d:                           // UPC, C11
+    case 0x8001: case 0x8765:                       // Mips_Assembler, Upc
+    case 0x8004: case 0x8007: case 0x8008:          // HP_Basic91, HP_IMacro, HP_Assembler
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Compute the full filename for a file index of the line number program.
+ *
+ * This follows concat_filename() in BFD.
+ */
+static const char *dw_filename(dw_unit_t *cu, uint64_t file)
+{
+    if (!cu->has_line_table)
+        return DW_UNKNOWN_FILE;
+    if (!cu->dir_and_file_0) {
+        if (file == 0)
+            return DW_UNKNOWN_FILE;
+        file--;
+    }
+    if (file >= stbds_arrlen(cu->files))
+        return DW_UNKNOWN_FILE;
+    if (file < stbds_arrlen(cu->full_files) && cu->full_files[file])
+        return cu->full_files[file];
+
+    const char *filename = cu->files[file].name;
+    if (!filename)
+        return DW_UNKNOWN_FILE;
+
+    char *name = NULL;
+    if (filename[0] != '/') {
+        const char *dir_name = NULL, *subdir_name = NULL;
+        uint64_t dir = cu->files[file].dir;
+        if (!cu->dir_and_file_0)
+            dir--;
+        if (dir < stbds_arrlen(cu->dirs))
+            subdir_name = cu->dirs[dir];
+        if (!subdir_name || subdir_name[0] != '/')
+            dir_name = cu->comp_dir;
+        if (!dir_name) {
+            dir_name = subdir_name;
+            subdir_name = NULL;
+        }
+        if (dir_name) {
+            int len = strlen(dir_name) + (subdir_name ? strlen(subdir_name) + 1 : 0) + strlen(filename) + 2;
+            name = malloc(len);
+            if (subdir_name)
+                snprintf(name, len, "%s/%s/%s", dir_name, subdir_name, filename);
+            else
+                snprintf(name, len, "%s/%s", dir_name, filename);
+        }
+    }
+    if (!name)
+        name = strdup(filename);
+
+    while (stbds_arrlen(cu->full_files) <= file)
+        stbds_arrput(cu->full_files, NULL);
+    cu->full_files[file] = name;
+    return name;
+}
+
+/** @brief Read the entry formats and the entries of a DWARF 5 directory or file table */
+static bool dw_read_line_entries(dwarf_t *dw, dw_unit_t *cu, dw_reader_t *r, bool is_file)
+{
+    int nformats = rd_u(r, 1);
+    uint64_t formats[nformats][2];
+    for (int i=0; i<nformats; i++) {
+        formats[i][0] = rd_uleb(r);
+        formats[i][1] = rd_uleb(r);
+    }
+    uint64_t count = rd_uleb(r);
+    for (uint64_t n=0; n<count && r->p < r->end; n++) {
+        dw_file_t entry = {0};
+        for (int i=0; i<nformats; i++) {
+            dw_attr_t a;
+            if (!dw_read_attr(dw, cu, r, formats[i][1], 0, &a))
+                return false;
+            if (formats[i][0] == DW_LNCT_path)
+                entry.name = a.str;
+            else if (formats[i][0] == DW_LNCT_directory_index)
+                entry.dir = a.u;
+        }
+        if (is_file)
+            stbds_arrput(cu->files, entry);
+        else
+            stbds_arrput(cu->dirs, entry.name);
+    }
+    return true;
+}
+
+/** @brief Add a row to the current sequence (like add_line_info() in BFD) */
+static void dw_add_row(dw_unit_t *cu, int seq_start, uint64_t addr, const char *file, uint32_t line, bool end_sequence)
+{
+    dw_row_t row = { .addr = addr, .file = file, .line = line, .end_sequence = end_sequence };
+    int n = stbds_arrlen(cu->rows);
+    // Only keep the last of consecutive entries with the same address
+    if (n > seq_start && cu->rows[n-1].addr == addr && cu->rows[n-1].end_sequence == end_sequence)
+        cu->rows[n-1] = row;
+    else
+        stbds_arrput(cu->rows, row);
+}
+
+static int dw_row_cmp(const void *a, const void *b)
+{
+    const dw_row_t *ra = a, *rb = b;
+    if (ra->end_sequence != rb->end_sequence)
+        return ra->end_sequence ? 1 : -1;
+    if (ra->addr != rb->addr)
+        return ra->addr < rb->addr ? -1 : 1;
+    return ra < rb ? -1 : 1;
+}
+
+static void dw_end_sequence(dw_unit_t *cu, int seq_start)
+{
+    int n = stbds_arrlen(cu->rows) - seq_start;
+    if (n <= 0)
+        return;
+    dw_row_t *rows = &cu->rows[seq_start];
+    for (int i=1; i<n; i++) {
+        if (rows[i].addr < rows[i-1].addr) {
+            // Rows are normally in address order. If not, sort them (keeping
+            // the original order for rows with the same address).
+            qsort(rows, n, sizeof(dw_row_t), dw_row_cmp);
+            break;
+        }
+    }
+    stbds_arrput(cu->seqs, ((dw_seq_t){
+        .low = rows[0].addr,
+        .high = rows[n-1].addr,
+        .first_row = seq_start,
+        .num_rows = n,
+    }));
+}
+
+static int dw_seq_cmp(const void *a, const void *b)
+{
+    const dw_seq_t *sa = a, *sb = b;
+    if (sa->low != sb->low)
+        return sa->low < sb->low ? -1 : 1;
+    if (sa->high != sb->high)
+        return sa->high > sb->high ? -1 : 1;
+    return sa->order - sb->order;
+}
+
+/** @brief Decode the line number program of a unit (like decode_line_info() in BFD) */
+static void dw_decode_lines(dwarf_t *dw, dw_unit_t *cu)
+{
+    if (!cu->has_lines || !dw->line.data || cu->stmt_list >= dw->line.size)
+        return;
+
+    dw_reader_t r = { dw->line.data + cu->stmt_list, dw->line.data + dw->line.size, dw->elf->be };
+    int off_size;
+    uint64_t len = rd_initial_length(&r, &off_size);
+    if (len > (uint64_t)(r.end - r.p))
+        return;
+    r.end = r.p + len;
+
+    int version = rd_u(&r, 2);
+    if (version < 2 || version > 5)
+        return;
+    int addr_size = cu->addr_size;
+    if (version >= 5) {
+        addr_size = rd_u(&r, 1);
+        rd_u(&r, 1);    // segment selector size
+    }
+    uint64_t header_len = rd_u(&r, off_size);
+    if (header_len > (uint64_t)(r.end - r.p))
+        return;
+    const uint8_t *prog = r.p + header_len;
+    int min_inst_len = rd_u(&r, 1);
+    if (version >= 4)
+        rd_u(&r, 1);    // maximum operations per instruction
+    rd_u(&r, 1);        // default_is_stmt
+    int line_base = (int8_t)rd_u(&r, 1);
+    int line_range = rd_u(&r, 1);
+    int opcode_base = rd_u(&r, 1);
+    const uint8_t *opcode_lengths = r.p - 1;
+    if (opcode_base > 0)
+        rd_skip(&r, opcode_base - 1);
+    if (line_range == 0)
+        return;
+
+    if (version >= 5) {
+        // The line program uses a different unit context (the offset size
+        // might differ), so read the entries with a modified copy.
+        dw_unit_t lcu = *cu;
+        lcu.off_size = off_size;
+        lcu.dirs = NULL; lcu.files = NULL;
+        if (!dw_read_line_entries(dw, &lcu, &r, false) ||
+            !dw_read_line_entries(dw, &lcu, &r, true)) {
+            stbds_arrfree(lcu.dirs);
+            stbds_arrfree(lcu.files);
+            return;
+        }
+        cu->dirs = lcu.dirs;
+        cu->files = lcu.files;
+        cu->dir_and_file_0 = true;
+    } else {
+        const char *s;
+        while ((s = rd_cstr(&r)) && *s)
+            stbds_arrput(cu->dirs, s);
+        while ((s = rd_cstr(&r)) && *s) {
+            dw_file_t f = { .name = s };
+            f.dir = rd_uleb(&r);
+            rd_uleb(&r);    // modification time
+            rd_uleb(&r);    // file length
+            stbds_arrput(cu->files, f);
+        }
+    }
+    cu->has_line_table = true;
+
+    r.p = prog;
+    while (r.p < r.end) {
+        // State machine registers. The initial file is the primary source
+        // file (index 0 in DWARF 5).
+        uint64_t addr = 0;
+        uint32_t line = 1;
+        const char *file = stbds_arrlen(cu->files) ? dw_filename(cu, cu->dir_and_file_0 ? 0 : 1) : NULL;
+        int seq_start = stbds_arrlen(cu->rows);
+        bool end_sequence = false;
+
+        while (r.p < r.end && !end_sequence) {
+            int op = rd_u(&r, 1);
+            if (op >= opcode_base) {
+                // Special opcode
+                int adj = op - opcode_base;
+                addr += (adj / line_range) * min_inst_len;
+                line += line_base + (adj % line_range);
+                dw_add_row(cu, seq_start, addr, file, line, false);
+                continue;
+            }
+            switch (op) {
+            case 0: {
+                // Extended opcode
+                uint64_t exlen = rd_uleb(&r);
+                const uint8_t *next = r.p + exlen;
+                int exop = rd_u(&r, 1);
+                switch (exop) {
+                case DW_LNE_end_sequence:
+                    end_sequence = true;
+                    dw_add_row(cu, seq_start, addr, file, line, true);
+                    break;
+                case DW_LNE_set_address:
+                    addr = rd_u(&r, exlen > 1 ? exlen - 1 : addr_size);
+                    break;
+                case DW_LNE_define_file: {
+                    dw_file_t f = { .name = rd_cstr(&r) };
+                    f.dir = rd_uleb(&r);
+                    stbds_arrput(cu->files, f);
+                }   break;
+                default:
+                    break;
+                }
+                if (next >= r.p && next <= r.end)
+                    r.p = next;
+            }   break;
+            case DW_LNS_copy:
+                dw_add_row(cu, seq_start, addr, file, line, false);
+                break;
+            case DW_LNS_advance_pc:
+                addr += min_inst_len * rd_uleb(&r);
+                break;
+            case DW_LNS_advance_line:
+                line += rd_sleb(&r);
+                break;
+            case DW_LNS_set_file:
+                file = dw_filename(cu, rd_uleb(&r));
+                break;
+            case DW_LNS_const_add_pc:
+                addr += min_inst_len * ((255 - opcode_base) / line_range);
+                break;
+            case DW_LNS_fixed_advance_pc:
+                addr += rd_u(&r, 2);
+                break;
+            default:
+                // Other standard opcodes do not affect the matrix: skip their arguments
+                for (int i=0; i<opcode_lengths[op]; i++)
+                    rd_uleb(&r);
+                break;
+            }
+        }
+        dw_end_sequence(cu, seq_start);
+    }
+
+    // Sort the sequences and make them binary-searchable, by trimming
+    // overlapping entries and removing nested ones (like sort_line_sequences()).
+    // BFD keeps sequences in reverse parsing order, and uses that as tie-breaker.
+    int nseqs = stbds_arrlen(cu->seqs);
+    if (nseqs == 0)
+        return;
+    for (int i=0; i<nseqs; i++)
+        cu->seqs[i].order = nseqs - 1 - i;
+    qsort(cu->seqs, nseqs, sizeof(dw_seq_t), dw_seq_cmp);
+    int n = 1;
+    uint64_t last_high = cu->seqs[0].high;
+    for (int i=1; i<nseqs; i++) {
+        dw_seq_t seq = cu->seqs[i];
+        if (seq.low < last_high) {
+            if (seq.high <= last_high)
+                continue;
+            seq.low = last_high;
+        }
+        last_high = seq.high;
+        cu->seqs[n++] = seq;
+    }
+    stbds_arrsetlen(cu->seqs, n);
+}
+
+/** @brief Add a range to a function (like arange_add() in BFD, which merges contiguous ranges) */
+static void dw_range_add(dw_range_t **ranges, int func_first, int func, uint64_t lo, uint64_t hi)
+{
+    if (lo == hi)
+        return;
+    int n = stbds_arrlen(*ranges);
+    if (n == func_first) {
+        stbds_arrput(*ranges, ((dw_range_t){ lo, hi, func }));
+        return;
+    }
+    for (int i=func_first; i<n; i++) {
+        dw_range_t *rg = &(*ranges)[i];
+        if (lo == rg->hi) { rg->hi = hi; return; }
+        if (hi == rg->lo) { rg->lo = lo; return; }
+    }
+    // New ranges are inserted after the first one
+    stbds_arrins(*ranges, func_first+1, ((dw_range_t){ lo, hi, func }));
+}
+
+/** @brief Read a range list of a function */
+static void dw_read_ranges(dwarf_t *dw, dw_unit_t *cu, dw_attr_t *a, int func_first, int func)
+{
+    uint64_t offset = a->u;
+    bool be = dw->elf->be;
+    uint64_t max_addr = cu->addr_size == 8 ? ~(uint64_t)0 : ((uint64_t)1 << (cu->addr_size*8)) - 1;
+
+    if (cu->version <= 4) {
+        if (!dw->ranges.data || offset >= dw->ranges.size)
+            return;
+        dw_reader_t r = { dw->ranges.data + offset, dw->ranges.data + dw->ranges.size, be };
+        uint64_t base = cu->base_addr;
+        while (r.p < r.end) {
+            uint64_t lo = rd_u(&r, cu->addr_size);
+            uint64_t hi = rd_u(&r, cu->addr_size);
+            if (lo == 0 && hi == 0)
+                break;
+            if (lo == max_addr && hi != max_addr)
+                base = hi;
+            else
+                dw_range_add(&cu->ranges, func_first, func, base + lo, base + hi);
+        }
+        return;
+    }
+
+    if (a->form == DW_FORM_rnglistx) {
+        uint64_t idx_off = cu->rnglists_base + a->u * cu->off_size;
+        if (!dw->rnglists.data || idx_off + cu->off_size > dw->rnglists.size)
+            return;
+        dw_reader_t ri = { dw->rnglists.data + idx_off, dw->rnglists.data + dw->rnglists.size, be };
+        offset = cu->rnglists_base + rd_u(&ri, cu->off_size);
+    }
+    if (!dw->rnglists.data || offset >= dw->rnglists.size)
+        return;
+
+    dw_reader_t r = { dw->rnglists.data + offset, dw->rnglists.data + dw->rnglists.size, be };
+    uint64_t base = cu->base_addr;
+    while (r.p < r.end) {
+        uint64_t lo, hi;
+        dw_attr_t ax;
+        switch (rd_u(&r, 1)) {
+        case DW_RLE_end_of_list:
+            return;
+        case DW_RLE_base_address:
+            base = rd_u(&r, cu->addr_size);
+            continue;
+        case DW_RLE_base_addressx:
+            dw_read_attr(dw, cu, &r, DW_FORM_addrx, 0, &ax);
+            base = ax.u;
+            continue;
+        case DW_RLE_startx_endx:
+            dw_read_attr(dw, cu, &r, DW_FORM_addrx, 0, &ax); lo = ax.u;
+            dw_read_attr(dw, cu, &r, DW_FORM_addrx, 0, &ax); hi = ax.u;
+            break;
+        case DW_RLE_startx_length:
+            dw_read_attr(dw, cu, &r, DW_FORM_addrx, 0, &ax); lo = ax.u;
+            hi = lo + rd_uleb(&r);
+            break;
+        case DW_RLE_offset_pair:
+            lo = base + rd_uleb(&r);
+            hi = base + rd_uleb(&r);
+            break;
+        case DW_RLE_start_end:
+            lo = rd_u(&r, cu->addr_size);
+            hi = rd_u(&r, cu->addr_size);
+            break;
+        case DW_RLE_start_length:
+            lo = rd_u(&r, cu->addr_size);
+            hi = lo + rd_uleb(&r);
+            break;
+        default:
+            return;
+        }
+        dw_range_add(&cu->ranges, func_first, func, lo, hi);
+    }
+}
+
+/**
+ * @brief Find the name of a function through an abstract origin or specification.
+ *
+ * This follows find_abstract_instance() in BFD: the referenced DIE provides
+ * the name (a linkage name has precedence), and only DW_AT_specification
+ * is followed recursively.
+ */
+static void dw_abstract_name(dwarf_t *dw, const dw_unit_t *cu, const dw_attr_t *ref, int depth, const char **pname, bool *is_linkage)
+{
+    if (depth == 100)
+        return;
+
+    uint64_t off;
+    switch (ref->form) {
+    case DW_FORM_ref_addr:
+        off = ref->u;
+        cu = dw_unit_at(dw, off);
+        if (!cu) return;
+        break;
+    case DW_FORM_ref1: case DW_FORM_ref2: case DW_FORM_ref4:
+    case DW_FORM_ref8: case DW_FORM_ref_udata:
+        off = cu->off + ref->u;
+        if (off >= cu->end) return;
+        break;
+    default:
+        return;
+    }
+
+    dw_reader_t r = { dw->info.data + off, dw->info.data + cu->end, dw->elf->be };
+    const char *name = NULL;
+    uint64_t code = rd_uleb(&r);
+    if (code) {
+        const dw_abbrev_t *ab = dw_abbrev_lookup(cu->abbrevs, code);
+        if (!ab)
+            return;
+        for (int i=0; i<stbds_arrlen(ab->attrs); i++) {
+            dw_attr_t a;
+            if (!dw_read_attr(dw, cu, &r, ab->attrs[i].form, ab->attrs[i].implicit_const, &a))
+                break;
+            switch (ab->attrs[i].name) {
+            case DW_AT_name:
+                if (!name && dw_is_str_form(a.form)) {
+                    name = a.str;
+                    if (dw_lang_unmangled(cu->lang))
+                        *is_linkage = true;
+                }
+                break;
+            case DW_AT_specification:
+                if (dw_is_int_form(a.form))
+                    dw_abstract_name(dw, cu, &a, depth+1, &name, is_linkage);
+                break;
+            case DW_AT_linkage_name:
+            case DW_AT_MIPS_linkage_name:
+                if (dw_is_str_form(a.form)) {
+                    name = a.str;
+                    *is_linkage = true;
+                }
+                break;
+            }
+        }
+    }
+    *pname = name;
+}
+
+/** @brief Scan the DIEs of a unit to collect the functions (like scan_unit_for_symbols() in BFD) */
+static void dw_scan_funcs(dwarf_t *dw, dw_unit_t *cu)
+{
+    dw_reader_t r = { dw->info.data + cu->die_off, dw->info.data + cu->end, dw->elf->be };
+    int *nested = NULL;
+    int level = 0;
+    stbds_arrput(nested, -1);
+
+    while (r.p < r.end) {
+        uint64_t code = rd_uleb(&r);
+        if (code == 0) {
+            if (level > 0) level--;
+            continue;
+        }
+        const dw_abbrev_t *ab = dw_abbrev_lookup(cu->abbrevs, code);
+        if (!ab)
+            break;
+
+        int fidx = -1;
+        if (ab->tag == DW_TAG_subprogram || ab->tag == DW_TAG_entry_point || ab->tag == DW_TAG_inlined_subroutine) {
+            fidx = stbds_arrlen(cu->funcs);
+            dw_func_t func = { .tag = ab->tag, .caller = -1 };
+            if (ab->tag == DW_TAG_inlined_subroutine) {
+                for (int i=level-1; i>=0; i--) {
+                    if (nested[i] >= 0) {
+                        func.caller = nested[i];
+                        break;
+                    }
+                }
+            }
+            stbds_arrput(cu->funcs, func);
+        }
+        nested[level] = fidx;
+
+        int ranges_first = stbds_arrlen(cu->ranges);
+        uint64_t low_pc = 0, high_pc = 0;
+        bool high_pc_relative = false;
+        bool ok = true;
+        for (int i=0; i<stbds_arrlen(ab->attrs); i++) {
+            dw_attr_t a;
+            if (!dw_read_attr(dw, cu, &r, ab->attrs[i].form, ab->attrs[i].implicit_const, &a)) {
+                ok = false;
+                break;
+            }
+            if (fidx < 0)
+                continue;
+            dw_func_t *func = &cu->funcs[fidx];
+            switch (ab->attrs[i].name) {
+            case DW_AT_call_file:
+                if (dw_is_int_form(a.form))
+                    func->call_file = dw_filename(cu, a.u);
+                break;
+            case DW_AT_call_line:
+                if (dw_is_int_form(a.form))
+                    func->call_line = a.u;
+                break;
+            case DW_AT_abstract_origin:
+            case DW_AT_specification:
+                if (dw_is_int_form(a.form))
+                    dw_abstract_name(dw, cu, &a, 0, &func->name, &func->is_linkage);
+                break;
+            case DW_AT_name:
+                if (!func->name && dw_is_str_form(a.form)) {
+                    func->name = a.str;
+                    if (dw_lang_unmangled(cu->lang))
+                        func->is_linkage = true;
+                }
+                break;
+            case DW_AT_linkage_name:
+            case DW_AT_MIPS_linkage_name:
+                if (dw_is_str_form(a.form)) {
+                    func->name = a.str;
+                    func->is_linkage = true;
+                }
+                break;
+            case DW_AT_low_pc:
+                if (dw_is_int_form(a.form))
+                    low_pc = a.u;
+                break;
+            case DW_AT_high_pc:
+                if (dw_is_int_form(a.form)) {
+                    high_pc = a.u;
+                    high_pc_relative = a.form != DW_FORM_addr;
+                }
+                break;
+            case DW_AT_ranges:
+                if (dw_is_int_form(a.form))
+                    dw_read_ranges(dw, cu, &a, ranges_first, fidx);
+                break;
+            }
+        }
+        if (!ok)
+            break;
+
+        if (fidx >= 0) {
+            if (high_pc_relative)
+                high_pc += low_pc;
+            if (high_pc != 0)
+                dw_range_add(&cu->ranges, ranges_first, fidx, low_pc, high_pc);
+            if (stbds_arrlen(cu->ranges) > ranges_first)
+                cu->funcs[fidx].low = cu->ranges[ranges_first].lo;
+        }
+
+        if (ab->has_children) {
+            level++;
+            if (stbds_arrlen(nested) <= level)
+                stbds_arrput(nested, -1);
+            nested[level] = -1;
+        }
+    }
+    stbds_arrfree(nested);
+}
+
+/** @brief Parse the header of a unit and its unit DIE */
+static bool dw_parse_unit_header(dwarf_t *dw, uint64_t off, dw_unit_t *cu, uint64_t *next)
+{
+    dw_reader_t r = { dw->info.data + off, dw->info.data + dw->info.size, dw->elf->be };
+    memset(cu, 0, sizeof(*cu));
+    cu->off = off;
+    uint64_t len = rd_initial_length(&r, &cu->off_size);
+    if (len > (uint64_t)(r.end - r.p))
+        return false;
+    cu->end = (r.p - dw->info.data) + len;
+    *next = cu->end;
+    r.end = r.p + len;
+
+    int unit_type = DW_UT_compile;
+    uint64_t abbrev_off;
+    cu->version = rd_u(&r, 2);
+    if (cu->version < 2 || cu->version > 5)
+        return false;
+    if (cu->version >= 5) {
+        unit_type = rd_u(&r, 1);
+        cu->addr_size = rd_u(&r, 1);
+        abbrev_off = rd_u(&r, cu->off_size);
+        if (unit_type == DW_UT_skeleton || unit_type == DW_UT_split_compile)
+            rd_skip(&r, 8);
+        else if (unit_type == DW_UT_type || unit_type == DW_UT_split_type)
+            rd_skip(&r, 8 + cu->off_size);
+    } else {
+        abbrev_off = rd_u(&r, cu->off_size);
+        cu->addr_size = rd_u(&r, 1);
+    }
+    if (unit_type != DW_UT_compile && unit_type != DW_UT_partial && unit_type != DW_UT_skeleton)
+        return false;
+    if (cu->addr_size != 2 && cu->addr_size != 4 && cu->addr_size != 8)
+        return false;
+    if (r.p >= r.end)
+        return false;
+    cu->die_off = r.p - dw->info.data;
+    cu->abbrevs = dw_abbrevs_get(dw, abbrev_off);
+
+    // Parse the unit DIE. We need two passes, as the attributes with the
+    // bases of indexed values can appear after the attributes using them.
+    uint64_t code = rd_uleb(&r);
+    const dw_abbrev_t *ab = dw_abbrev_lookup(cu->abbrevs, code);
+    if (!ab)
+        return true;
+    const uint8_t *attrs = r.p;
+    for (int pass=0; pass<2; pass++) {
+        r.p = attrs;
+        for (int i=0; i<stbds_arrlen(ab->attrs); i++) {
+            dw_attr_t a;
+            if (!dw_read_attr(dw, cu, &r, ab->attrs[i].form, ab->attrs[i].implicit_const, &a))
+                break;
+            if (pass == 0) {
+                switch (ab->attrs[i].name) {
+                case DW_AT_str_offsets_base: cu->str_offsets_base = a.u; break;
+                case DW_AT_addr_base:        cu->addr_base = a.u; break;
+                case DW_AT_rnglists_base:    cu->rnglists_base = a.u; break;
+                }
+                continue;
+            }
+            switch (ab->attrs[i].name) {
+            case DW_AT_language:
+                cu->lang = a.u;
+                break;
+            case DW_AT_stmt_list:
+                cu->has_lines = true;
+                cu->stmt_list = a.u;
+                break;
+            case DW_AT_low_pc:
+                if (ab->tag == DW_TAG_compile_unit)
+                    cu->base_addr = a.u;
+                break;
+            case DW_AT_comp_dir:
+                if (dw_is_str_form(a.form)) {
+                    const char *comp_dir = a.str;
+                    // Irix 6.2 native cc prepends <machine>.: to the compilation directory (like BFD)
+                    if (comp_dir) {
+                        const char *cp = strchr(comp_dir, ':');
+                        if (cp && cp != comp_dir && cp[-1] == '.' && cp[1] == '/')
+                            comp_dir = cp + 1;
+                    }
+                    cu->comp_dir = comp_dir;
+                }
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+/** @brief Job for the worker threads */
+typedef struct {
+    dwarf_t *dw;                ///< DWARF information
+    void (*fn)(dwarf_t *dw, void *ctx, int begin, int end);  ///< Function to run on a range of items
+    void *ctx;                  ///< Context for the function
+    int count;                  ///< Total number of items
+    int chunk;                  ///< Number of items processed per call
+    int next;                   ///< Next item to process (atomic)
+} dw_job_t;
+
+static void *dw_worker(void *arg)
+{
+    dw_job_t *job = arg;
+    while (1) {
+        int begin = __atomic_fetch_add(&job->next, job->chunk, __ATOMIC_RELAXED);
+        if (begin >= job->count)
+            break;
+        int end = begin + job->chunk < job->count ? begin + job->chunk : job->count;
+        job->fn(job->dw, job->ctx, begin, end);
+    }
+    return NULL;
+}
+
+/** @brief Run a function over a range of items, in parallel across the worker threads */
+static void dw_parallel_for(dwarf_t *dw, int count, int chunk, void (*fn)(dwarf_t*, void*, int, int), void *ctx)
+{
+    dw_job_t job = { .dw = dw, .fn = fn, .ctx = ctx, .count = count, .chunk = chunk };
+    int nthreads = (count + chunk - 1) / chunk;
+    if (nthreads > dw->nthreads)
+        nthreads = dw->nthreads;
+
+    pthread_t threads[nthreads > 1 ? nthreads-1 : 1];
+    int started = 0;
+    for (int i=0; i<nthreads-1; i++) {
+        if (pthread_create(&threads[i], NULL, dw_worker, &job) != 0)
+            break;
+        started++;
+    }
+    dw_worker(&job);
+    for (int i=0; i<started; i++)
+        pthread_join(threads[i], NULL);
+}
+
+static void dw_unit_worker(dwarf_t *dw, void *ctx, int begin, int end)
+{
+    for (int i=begin; i<end; i++) {
+        dw_unit_t *cu = &dw->units[i];
+        dw_decode_lines(dw, cu);
+        dw_scan_funcs(dw, cu);
+    }
+}
+
+static int dw_range_paint_cmp(const void *a, const void *b)
+{
+    const dw_range_t *ra = a, *rb = b;
+    uint64_t la = ra->hi - ra->lo, lb = rb->hi - rb->lo;
+    if (la != lb)
+        return la > lb ? -1 : 1;
+    return ra->func - rb->func;
+}
+
+static int u64_cmp(const void *a, const void *b)
+{
+    uint64_t ua = *(const uint64_t*)a, ub = *(const uint64_t*)b;
+    return ua < ub ? -1 : ua > ub ? 1 : 0;
+}
+
+/** @brief Index of the first element >= v in a sorted array */
+static int u64_lower_bound(const uint64_t *arr, int n, uint64_t v)
+{
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (arr[mid] < v) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * @brief Build the map from addresses to the innermost function.
+ *
+ * BFD picks the function with the smallest range containing the address
+ * (the one parsed last, in case of ties). We precompute this by splitting
+ * the address space into segments at every range boundary, and painting the
+ * ranges from the largest to the smallest one.
+ */
+static void dw_build_func_map(dwarf_t *dw)
+{
+    dw_range_t *ranges = NULL;
+    for (int i=0; i<stbds_arrlen(dw->units); i++) {
+        dw_unit_t *cu = &dw->units[i];
+        for (int j=0; j<stbds_arrlen(cu->ranges); j++) {
+            dw_range_t rg = cu->ranges[j];
+            if (rg.hi <= rg.lo) continue;
+            rg.func += cu->func_base;
+            stbds_arrput(ranges, rg);
+            stbds_arrput(dw->seg_addr, rg.lo);
+            stbds_arrput(dw->seg_addr, rg.hi);
+        }
+    }
+
+    int n = stbds_arrlen(dw->seg_addr);
+    if (n == 0) {
+        stbds_arrfree(ranges);
+        return;
+    }
+    qsort(dw->seg_addr, n, sizeof(uint64_t), u64_cmp);
+    int nu = 1;
+    for (int i=1; i<n; i++)
+        if (dw->seg_addr[i] != dw->seg_addr[nu-1])
+            dw->seg_addr[nu++] = dw->seg_addr[i];
+    stbds_arrsetlen(dw->seg_addr, nu);
+    stbds_arrsetlen(dw->seg_func, nu);
+    for (int i=0; i<nu; i++)
+        dw->seg_func[i] = -1;
+
+    qsort(ranges, stbds_arrlen(ranges), sizeof(dw_range_t), dw_range_paint_cmp);
+    for (int i=0; i<stbds_arrlen(ranges); i++) {
+        int s0 = u64_lower_bound(dw->seg_addr, nu, ranges[i].lo);
+        int s1 = u64_lower_bound(dw->seg_addr, nu, ranges[i].hi);
+        for (int s=s0; s<s1; s++)
+            dw->seg_func[s] = ranges[i].func;
+    }
+    stbds_arrfree(ranges);
+}
+
+static int dw_elfsym_cmp(const void *a, const void *b)
+{
+    const dw_elfsym_t *sa = a, *sb = b;
+    if (sa->addr != sb->addr)
+        return sa->addr < sb->addr ? -1 : 1;
+    if (sa->size != sb->size)
+        return sa->size > sb->size ? -1 : 1;
+    return sa < sb ? -1 : 1;
+}
+
+/**
+ * @brief Build the per-section tables of function symbols.
+ *
+ * These are the symbols that _bfd_elf_find_function would consider, with
+ * the same attribution of source files through STT_FILE symbols. For each
+ * address, only the symbol that BFD would pick is kept.
+ */
+static void dw_build_elfsyms(dwarf_t *dw)
+{
+    elf_t *elf = dw->elf;
+    dw->elfsyms = calloc(elf->num_sections, sizeof(dw_elfsym_t*));
+
+    enum { NOTHING_SEEN, SYMBOL_SEEN, FILE_AFTER_SYMBOL_SEEN } state = NOTHING_SEEN;
+    const char *file = NULL;
+    for (int i=0; i<elf->num_symbols; i++) {
+        const elf_symbol_t *sym = &elf->symbols[i];
+        if (sym->type == ELF_STT_FILE) {
+            file = sym->name;
+            if (state == SYMBOL_SEEN)
+                state = FILE_AFTER_SYMBOL_SEEN;
+            continue;
+        }
+        if (state == NOTHING_SEEN)
+            state = SYMBOL_SEEN;
+
+        if (sym->type == ELF_STT_SECTION || sym->type == ELF_STT_OBJECT || sym->type == ELF_STT_TLS)
+            continue;
+        if (sym->shndx == ELF_SHN_UNDEF || sym->shndx >= ELF_SHN_LORESERVE || sym->shndx >= elf->num_sections)
+            continue;
+        // Ignore hidden local zero-sized labels (eg: generated by the annobin plugin)
+        if (sym->size == 0 && sym->bind == ELF_STB_LOCAL && sym->type == ELF_STT_NOTYPE && sym->other == ELF_STV_HIDDEN)
+            continue;
+
+        dw_elfsym_t es = {
+            .addr = sym->value,
+            .size = sym->size ? sym->size : 1,
+            .name = sym->name,
+        };
+        if (file && (sym->bind == ELF_STB_LOCAL || state != FILE_AFTER_SYMBOL_SEEN))
+            es.file = file;
+        stbds_arrput(dw->elfsyms[sym->shndx], es);
+    }
+
+    for (int s=0; s<elf->num_sections; s++) {
+        dw_elfsym_t *syms = dw->elfsyms[s];
+        int n = stbds_arrlen(syms);
+        if (n == 0) continue;
+        qsort(syms, n, sizeof(dw_elfsym_t), dw_elfsym_cmp);
+        int nu = 1;
+        for (int i=1; i<n; i++)
+            if (syms[i].addr != syms[nu-1].addr)
+                syms[nu++] = syms[i];
+        stbds_arrsetlen(dw->elfsyms[s], nu);
+    }
+}
+
+dwarf_t *dwarf_open(elf_t *elf, int nthreads)
+{
+    dwarf_t *dw = calloc(1, sizeof(dwarf_t));
+    dw->elf = elf;
+    dw->nthreads = nthreads > 0 ? nthreads : 1;
+    dw->cache_section = -1;
+    stbds_hmdefault(dw->abbrev_hash, -1);
+
+    struct { const char *name; dw_section_t *sec; } secs[] = {
+        { ".debug_info", &dw->info },
+        { ".debug_abbrev", &dw->abbrev },
+        { ".debug_line", &dw->line },
+        { ".debug_str", &dw->str },
+        { ".debug_line_str", &dw->line_str },
+        { ".debug_ranges", &dw->ranges },
+        { ".debug_rnglists", &dw->rnglists },
+        { ".debug_addr", &dw->addr },
+        { ".debug_str_offsets", &dw->str_offsets },
+    };
+    for (int i=0; i<elf->num_sections; i++) {
+        for (int j=0; j<sizeof(secs)/sizeof(secs[0]); j++) {
+            if (!secs[j].sec->data && elf->sections[i].data && !strcmp(elf->sections[i].name, secs[j].name)) {
+                secs[j].sec->data = elf->sections[i].data;
+                secs[j].sec->size = elf->sections[i].size;
+            }
+        }
+    }
+
+    // Read the headers of all units. This also parses all the abbreviation
+    // tables, so that the workers can access them read-only.
+    if (dw->info.data && dw->abbrev.data) {
+        uint64_t off = 0;
+        while (off < dw->info.size) {
+            dw_unit_t cu; uint64_t next = dw->info.size;
+            if (dw_parse_unit_header(dw, off, &cu, &next))
+                stbds_arrput(dw->units, cu);
+            if (next <= off)
+                break;
+            off = next;
+        }
+    }
+
+    // Decode the line number programs and collect the functions of each unit, in parallel
+    dw_parallel_for(dw, stbds_arrlen(dw->units), 1, dw_unit_worker, NULL);
+
+    // Merge the results of all units
+    for (int i=0; i<stbds_arrlen(dw->units); i++) {
+        dw_unit_t *cu = &dw->units[i];
+        cu->func_base = stbds_arrlen(dw->funcs);
+        for (int j=0; j<stbds_arrlen(cu->funcs); j++) {
+            dw_func_t f = cu->funcs[j];
+            if (f.caller >= 0)
+                f.caller += cu->func_base;
+            stbds_arrput(dw->funcs, f);
+        }
+        for (int j=0; j<stbds_arrlen(cu->seqs); j++) {
+            dw_seq_t seq = cu->seqs[j];
+            seq.unit = i;
+            seq.order = stbds_arrlen(dw->seqs);
+            stbds_arrput(dw->seqs, seq);
+        }
+    }
+    qsort(dw->seqs, stbds_arrlen(dw->seqs), sizeof(dw_seq_t), dw_seq_cmp);
+    dw_build_func_map(dw);
+    dw_build_elfsyms(dw);
+    return dw;
+}
+
+/** @brief Find the row of the line number matrix for an address (like lookup_address_in_line_info_table()) */
+static const dw_row_t *dw_lookup_line(const dwarf_t *dw, uint64_t addr)
+{
+    int lo = 0, hi = stbds_arrlen(dw->seqs);
+    const dw_seq_t *seq = NULL;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (addr < dw->seqs[mid].low) hi = mid;
+        else if (addr >= dw->seqs[mid].high) lo = mid + 1;
+        else { seq = &dw->seqs[mid]; break; }
+    }
+    if (!seq)
+        return NULL;
+
+    const dw_row_t *rows = &dw->units[seq->unit].rows[seq->first_row];
+    int n = seq->num_rows;
+    // Find the last row with address <= addr
+    lo = 0; hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (rows[mid].addr <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    int i = lo - 1;
+    if (i < 0 || i >= n-1 || rows[i].end_sequence || addr >= rows[i+1].addr)
+        return NULL;
+    return &rows[i];
+}
+
+/** @brief Find the innermost function containing an address */
+static int dw_lookup_func(const dwarf_t *dw, uint64_t addr)
+{
+    int n = stbds_arrlen(dw->seg_addr);
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (dw->seg_addr[mid] <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo > 0 && lo < n ? dw->seg_func[lo-1] : -1;
+}
+
+/** @brief Find the ELF symbol for an address, without using the cache */
+static const dw_elfsym_t *dw_lookup_elfsym(const dwarf_t *dw, int section, uint64_t addr)
+{
+    const dw_elfsym_t *syms = dw->elfsyms[section];
+    int lo = 0, hi = stbds_arrlen(syms);
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (syms[mid].addr <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo > 0 ? &syms[lo-1] : NULL;
+}
+
+/** @brief Find the ELF symbol for an address, using the same cache of _bfd_elf_find_function */
+static const dw_elfsym_t *dw_find_elfsym(dwarf_t *dw, int section, uint64_t addr)
+{
+    const dw_elfsym_t *sym = dw->cache_sym;
+    if (dw->cache_section != section || !sym || addr < sym->addr || addr >= sym->addr + sym->size) {
+        dw->cache_section = section;
+        dw->cache_sym = dw_lookup_elfsym(dw, section, addr);
+    }
+    return dw->cache_sym;
+}
+
+/** @brief Lookup results of an address, computed by the worker threads */
+typedef struct {
+    int section;                ///< Section containing the address (-1 if none)
+    int func;                   ///< Innermost function (-1 if none)
+    const dw_row_t *row;        ///< Row of the line number matrix (NULL if none)
+} dw_lookup_t;
+
+/** @brief Context of the lookup workers */
+typedef struct {
+    const uint64_t *addrs;      ///< Addresses to lookup
+    dw_lookup_t *lookups;       ///< Lookup results
+} dw_lookup_ctx_t;
+
+static void dw_lookup_worker(dwarf_t *dw, void *vctx, int begin, int end)
+{
+    dw_lookup_ctx_t *ctx = vctx;
+    elf_t *elf = dw->elf;
+    for (int i=begin; i<end; i++) {
+        uint64_t addr = ctx->addrs[i];
+        dw_lookup_t *lk = &ctx->lookups[i];
+        lk->section = -1;
+        lk->func = -1;
+        lk->row = NULL;
+        for (int s=0; s<elf->num_sections; s++) {
+            const elf_section_t *sec = &elf->sections[s];
+            if ((sec->flags & ELF_SHF_ALLOC) && addr >= sec->addr && addr - sec->addr < sec->size) {
+                lk->section = s;
+                break;
+            }
+        }
+        if (lk->section < 0)
+            continue;
+        lk->func = dw_lookup_func(dw, addr);
+        lk->row = dw_lookup_line(dw, addr);
+    }
+}
+
+dwarf_result_t *dwarf_addr2line(dwarf_t *dw, const uint64_t *addrs, int count, bool inlines)
+{
+    // Run the lookups in parallel. Each thread processes a contiguous chunk
+    // of addresses, so that it accesses mostly the same data.
+    dw_lookup_ctx_t ctx = { .addrs = addrs, .lookups = calloc(count, sizeof(dw_lookup_t)) };
+    int chunk = count / (dw->nthreads * 4) + 1;
+    dw_parallel_for(dw, count, chunk, dw_lookup_worker, &ctx);
+
+    // Resolve the names sequentially. BFD updates the names of functions
+    // as a side effect of lookups, so this must be done in order.
+    dwarf_result_t *res = calloc(count, sizeof(dwarf_result_t));
+    for (int i=0; i<count; i++) {
+        dw_lookup_t *lk = &ctx.lookups[i];
+        dwarf_frame_t frame = {0};
+
+        if (lk->section >= 0) {
+            dw_func_t *func = lk->func >= 0 ? &dw->funcs[lk->func] : NULL;
+            if (lk->row) {
+                frame.file = lk->row->file;
+                frame.line = lk->row->line;
+            }
+            if (func && func->is_linkage) {
+                frame.func = func->name;
+            } else {
+                // Fallback to the ELF symbol table. If the function has no
+                // linkage name and the symbol is at the start of the function,
+                // BFD switches the function to using the symbol name.
+                const dw_elfsym_t *sym = dw_find_elfsym(dw, lk->section, addrs[i]);
+                if (sym) {
+                    frame.func = sym->name;
+                    if (!frame.file)
+                        frame.file = sym->file;
+                }
+                if (func) {
+                    if (!sym)
+                        frame.func = func->name;
+                    else if (sym->addr == func->low)
+                        func->name = sym->name;
+                    func->is_linkage = true;
+                }
+            }
+        }
+
+        dwarf_frame_t *frames = NULL;
+        stbds_arrput(frames, frame);
+        if (inlines && lk->func >= 0 && dw->funcs[lk->func].tag == DW_TAG_inlined_subroutine) {
+            const dw_func_t *func = &dw->funcs[lk->func];
+            while (func->caller >= 0) {
+                const dw_func_t *caller = &dw->funcs[func->caller];
+                stbds_arrput(frames, ((dwarf_frame_t){
+                    .func = caller->name,
+                    .file = func->call_file,
+                    .line = func->call_line,
+                }));
+                func = caller;
+            }
+        }
+
+        res[i].num_frames = stbds_arrlen(frames);
+        res[i].frames = malloc(res[i].num_frames * sizeof(dwarf_frame_t));
+        memcpy(res[i].frames, frames, res[i].num_frames * sizeof(dwarf_frame_t));
+        stbds_arrfree(frames);
+    }
+
+    free(ctx.lookups);
+    return res;
+}
+
+void dwarf_free_results(dwarf_result_t *res, int count)
+{
+    for (int i=0; i<count; i++)
+        free(res[i].frames);
+    free(res);
+}
+
+void dwarf_close(dwarf_t *dw)
+{
+    for (int i=0; i<stbds_arrlen(dw->units); i++) {
+        dw_unit_t *cu = &dw->units[i];
+        for (int j=0; j<stbds_arrlen(cu->full_files); j++)
+            free(cu->full_files[j]);
+        stbds_arrfree(cu->full_files);
+        stbds_arrfree(cu->dirs);
+        stbds_arrfree(cu->files);
+        stbds_arrfree(cu->rows);
+        stbds_arrfree(cu->seqs);
+        stbds_arrfree(cu->funcs);
+        stbds_arrfree(cu->ranges);
+    }
+    for (int i=0; i<stbds_arrlen(dw->abbrevtabs); i++) {
+        dw_abbrevtab_t *tab = dw->abbrevtabs[i];
+        for (int j=0; j<stbds_arrlen(tab->abbrevs); j++)
+            stbds_arrfree(tab->abbrevs[j].attrs);
+        stbds_arrfree(tab->abbrevs);
+        stbds_arrfree(tab->direct);
+        free(tab);
+    }
+    for (int s=0; s<dw->elf->num_sections; s++)
+        stbds_arrfree(dw->elfsyms[s]);
+    free(dw->elfsyms);
+    stbds_arrfree(dw->abbrevtabs);
+    stbds_hmfree(dw->abbrev_hash);
+    stbds_arrfree(dw->units);
+    stbds_arrfree(dw->funcs);
+    stbds_arrfree(dw->seqs);
+    stbds_arrfree(dw->seg_addr);
+    stbds_arrfree(dw->seg_func);
+    free(dw);
+}
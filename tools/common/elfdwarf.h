@@ -0,0 +1,141 @@
+#ifndef LIBDRAGON_TOOLS_ELFDWARF_H
+#define LIBDRAGON_TOOLS_ELFDWARF_H
+
+/**
+ * @file elfdwarf.h
+ * @brief Minimal ELF and DWARF reader for symbolization
+ *
+ * This module loads an ELF file (32/64-bit, any endianness), and parses
+ * the DWARF debugging information (versions 2 to 5) needed to resolve
+ * addresses into function names, source files and line numbers, including
+ * the chain of inlined functions.
+ *
+ * The resolution is designed to produce the same results that GNU addr2line
+ * (`addr2line --functions --inlines`) would give, so that tools can avoid
+ * spawning the binutils programs and still produce identical output. Names
+ * are returned raw: demangling is left to the caller.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/** @brief A section of an ELF file */
+typedef struct {
+    const char *name;           ///< Name of the section
+    uint32_t type;              ///< Section type (SHT_*)
+    uint64_t flags;             ///< Section flags (SHF_*)
+    uint64_t addr;              ///< Virtual address of the section
+    uint64_t size;              ///< Size of the section in bytes
+    uint32_t link;              ///< Linked section index
+    const uint8_t *data;        ///< Contents of the section (NULL if not present in the file)
+} elf_section_t;
+
+/** @brief A symbol in the ELF symbol table */
+typedef struct {
+    const char *name;           ///< Name of the symbol
+    uint64_t value;             ///< Value (address) of the symbol
+    uint64_t size;              ///< Size of the symbol
+    uint8_t type;               ///< Symbol type (STT_*)
+    uint8_t bind;               ///< Symbol binding (STB_*)
+    uint8_t other;              ///< Symbol visibility (STV_*)
+    uint16_t shndx;             ///< Index of the section the symbol belongs to
+} elf_symbol_t;
+
+/** @brief A loaded ELF file */
+typedef struct {
+    uint8_t *buf;               ///< Contents of the file
+    size_t size;                ///< Size of the file
+    bool is64;                  ///< True if the file is ELF64
+    bool be;                    ///< True if the file is big-endian
+    uint16_t machine;           ///< Machine type (EM_*)
+    elf_section_t *sections;    ///< Sections (in header order)
+    int num_sections;           ///< Number of sections
+    elf_symbol_t *symbols;      ///< Symbols (in symbol table order, without the null symbol)
+    int num_symbols;            ///< Number of symbols
+} elf_t;
+
+#define ELF_EM_MIPS             8           ///< Machine type: MIPS
+#define ELF_SHT_SYMTAB          2           ///< Section type: symbol table
+#define ELF_SHT_NOBITS          8           ///< Section type: no data in file
+#define ELF_SHF_ALLOC           0x2         ///< Section flag: occupies memory
+#define ELF_SHF_EXECINSTR       0x4         ///< Section flag: contains code
+#define ELF_STT_NOTYPE          0           ///< Symbol type: unspecified
+#define ELF_STT_OBJECT          1           ///< Symbol type: data object
+#define ELF_STT_FUNC            2           ///< Symbol type: function
+#define ELF_STT_SECTION         3           ///< Symbol type: section
+#define ELF_STT_FILE            4           ///< Symbol type: source file
+#define ELF_STT_COMMON          5           ///< Symbol type: common data object
+#define ELF_STT_TLS             6           ///< Symbol type: thread-local data object
+#define ELF_STB_LOCAL           0           ///< Symbol binding: local
+#define ELF_STV_HIDDEN          2           ///< Symbol visibility: hidden
+#define ELF_SHN_UNDEF           0           ///< Section index: undefined symbol
+#define ELF_SHN_LORESERVE       0xff00      ///< Section index: first reserved index
+
+/**
+ * @brief Load an ELF file
+ *
+ * @param fn    Filename
+ * @return      The loaded file, or NULL if the file cannot be read or is not a valid ELF.
+ */
+elf_t *elf_open(const char *fn);
+
+/** @brief Free an ELF file loaded with #elf_open */
+void elf_close(elf_t *elf);
+
+/** @brief Read a 32-bit word from the file contents, in the file endianness */
+uint32_t elf_read32(const elf_t *elf, const uint8_t *p);
+
+/** @brief Opaque DWARF information of an ELF file */
+typedef struct dwarf_s dwarf_t;
+
+/** @brief One level of the inlining chain of an address */
+typedef struct {
+    const char *func;           ///< Function name (raw, not demangled), or NULL if unknown
+    const char *file;           ///< Source file, or NULL if unknown
+    int line;                   ///< Line number, or 0 if unknown
+} dwarf_frame_t;
+
+/** @brief Result of the resolution of an address */
+typedef struct {
+    dwarf_frame_t *frames;      ///< Frames, from the innermost (inlined) to the outermost one
+    int num_frames;             ///< Number of frames (always at least 1)
+} dwarf_result_t;
+
+/**
+ * @brief Parse the DWARF information of an ELF file
+ *
+ * The compilation units are parsed in parallel using the specified number of
+ * threads. If the file has no DWARF information, resolution falls back
+ * to the ELF symbol table, like addr2line does.
+ *
+ * @param elf       ELF file (must be kept open until #dwarf_close)
+ * @param nthreads  Number of worker threads to use
+ * @return          The parsed information
+ */
+dwarf_t *dwarf_open(elf_t *elf, int nthreads);
+
+/**
+ * @brief Resolve a batch of addresses
+ *
+ * This is equivalent to sending the addresses, in the same order, to
+ * `addr2line --functions [--inlines]`: the output mirrors the heuristics
+ * (and the order-dependent caches) of BFD, so that it is identical even in
+ * corner cases. The lookups are run in parallel, split among the threads
+ * by address range.
+ *
+ * @param dw        DWARF information
+ * @param addrs     Addresses to resolve
+ * @param count     Number of addresses
+ * @param inlines   If true, also return the chain of inlined functions
+ * @return          Array of @p count results (free with #dwarf_free_results)
+ */
+dwarf_result_t *dwarf_addr2line(dwarf_t *dw, const uint64_t *addrs, int count, bool inlines);
+
+/** @brief Free the results returned by #dwarf_addr2line */
+void dwarf_free_results(dwarf_result_t *res, int count);
+
+/** @brief Free the DWARF information */
+void dwarf_close(dwarf_t *dw);
+
+#endif
@@ -0,0 +1,27 @@
+/**
+ * @file hash.c
+ * @brief 64-bit FNV-1a hashing of memory buffers and files
+ */
+#include <stdio.h>
+#include "hash.h"
+
+uint64_t hash_bytes(uint64_t h, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    for (size_t i=0; i<len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+bool hash_file(uint64_t *h, const char *fn)
+{
+    FILE *f = fopen(fn, "rb");
+    if (!f) return false;
+    uint8_t buf[65536]; size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        *h = hash_bytes(*h, buf, n);
+    fclose(f);
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef LIBDRAGON_TOOLS_HASH_H
+#define LIBDRAGON_TOOLS_HASH_H
+
+/**
+ * @file hash.h
+ * @brief 64-bit FNV-1a hashing of memory buffers and files
+ *
+ * This is used by the tools to fingerprint their inputs, eg: to detect
+ * duplicated files (mkdfs) or to skip conversions whose inputs did not
+ * change since the previous run (see batch.h).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/** @brief Initial value of a 64-bit FNV-1a hash */
+#define FNV64_INIT      0xcbf29ce484222325ull
+
+/**
+ * @brief Continue a 64-bit FNV-1a hash over a buffer
+ *
+ * @param h         Current value of the hash (#FNV64_INIT to start a new one)
+ * @param data      Buffer to hash
+ * @param len       Length of the buffer in bytes
+ * @return          Updated value of the hash
+ */
+uint64_t hash_bytes(uint64_t h, const void *data, size_t len);
+
+/** @brief Hash the contents of a variable or structure field into @p h */
+#define HASH_FIELD(h, x)   ((h) = hash_bytes((h), &(x), sizeof(x)))
+
+/**
+ * @brief Continue a 64-bit FNV-1a hash over the contents of a file
+ *
+ * @param h         Hash to update
+ * @param fn        Filename
+ * @return          False if the file cannot be opened (@p h is unchanged)
+ */
+bool hash_file(uint64_t *h, const char *fn);
+
+#endif
@@ -1,5 +1,8 @@
 
-int lz4_distance_max = 16384;
+// Maximum match distance (window size) used by the compressor. LZ4 reads it
+// through the LZ4_DISTANCE_MAX macro, so it cannot be passed as a parameter:
+// it is thread-local so that each thread compresses with its own window.
+__thread int lz4_distance_max = 16384;
 
 #define LZ4_DISTANCE_MAX lz4_distance_max
 #include "lz4/lz4.c"
@@ -0,0 +1,89 @@
+/**
+ * @file symt.c
+ * @brief Reader of the SYMT symbol tables created by n64sym
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symt.h"
+
+#define STBDS_NO_SHORT_NAMES
+#include "stb_ds.h"
+
+uint8_t *load_file(const char *fn, int *size)
+{
+    FILE *f = fopen(fn, "rb");
+    if (!f) {
+        fprintf(stderr, "cannot open file: %s\n", fn);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(*size);
+    fread(buf, 1, *size, f);
+    fclose(f);
+    return buf;
+}
+
+void symt_load(symt_t *symt, const char *fn)
+{
+    symt->buf = load_file(fn, &symt->size);
+    if (symt->size < 32 || memcmp(symt->buf, "SYMT", 4) || r32(symt->buf + 4) != 2) {
+        fprintf(stderr, "invalid or unsupported symbol table: %s\n", fn);
+        exit(1);
+    }
+    symt->addrtab = symt->buf + r32(symt->buf + 8);
+    symt->count = r32(symt->buf + 12);
+    symt->symtab = symt->buf + r32(symt->buf + 16);
+    symt->strtab = (const char*)symt->buf + r32(symt->buf + 24);
+}
+
+symt_entry_t symt_entry(const symt_t *symt, int i)
+{
+    const uint8_t *e = symt->symtab + i*16;
+    return (symt_entry_t){
+        .addr = r32(symt->addrtab + i*4) & ~3,
+        .func = symt->strtab + r32(e+0),
+        .func_len = r16(e+8),
+        .file = symt->strtab + r32(e+4),
+        .file_len = r16(e+10),
+        .line = r16(e+12),
+    };
+}
+
+void symt_symbolize(const symt_t *symt, uint32_t addr, bool inlines, int **entries)
+{
+    // Find the last entry <= addr
+    int min = 0, max = symt->count;
+    while (min < max) {
+        int mid = (min + max) / 2;
+        if ((r32(symt->addrtab + mid*4) & ~3) <= addr)
+            min = mid + 1;
+        else
+            max = mid;
+    }
+    int idx = min - 1;
+    if (idx < 0) {
+        stbds_arrput(*entries, -1);
+        return;
+    }
+
+    // A callsite is recorded exactly in the symbol table, including the
+    // chain of functions inlined in its caller. Otherwise, we can only
+    // find out the function that contains the address.
+    uint32_t a = r32(symt->addrtab + idx*4);
+    if (inlines && (a & ~3) == addr) {
+        while (idx > 0 && (r32(symt->addrtab + (idx-1)*4) & ~3) == addr)
+            idx--;
+        while (1) {
+            a = r32(symt->addrtab + idx*4);
+            stbds_arrput(*entries, idx);
+            if (!(a & 2) || ++idx == symt->count) break;
+        }
+        return;
+    }
+    while (idx > 0 && !(a & 1))
+        a = r32(symt->addrtab + --idx*4);
+    stbds_arrput(*entries, idx);
+}
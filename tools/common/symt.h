@@ -0,0 +1,83 @@
+#ifndef LIBDRAGON_TOOLS_SYMT_H
+#define LIBDRAGON_TOOLS_SYMT_H
+
+/**
+ * @file symt.h
+ * @brief Reader of the SYMT symbol tables created by n64sym
+ *
+ * This module loads a symbol table created by n64sym (see backtrace.c for
+ * the layout), and symbolizes the addresses found in the dumps of the
+ * profilers (n64prof, n64memprof), including the chain of inlined functions
+ * at callsites.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** @brief Read a big-endian 32-bit word */
+static inline uint32_t r32(const uint8_t *p) { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+/** @brief Read a big-endian 16-bit word */
+static inline uint16_t r16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+
+/**
+ * @brief Load a whole file in memory
+ *
+ * Exits with an error message if the file cannot be opened.
+ *
+ * @param fn        Filename
+ * @param size      Receives the size of the file
+ * @return          Contents of the file (to be freed with free)
+ */
+uint8_t *load_file(const char *fn, int *size);
+
+/** @brief A loaded symbol table */
+typedef struct {
+    uint8_t *buf;               ///< Contents of the file
+    int size;                   ///< Size of the file
+    const uint8_t *addrtab;     ///< Address table (one word per entry)
+    const uint8_t *symtab;      ///< Symbol entries (16 bytes each)
+    const char *strtab;         ///< String table
+    int count;                  ///< Number of entries
+} symt_t;
+
+/** @brief A symbol entry, with strings pointing into the string table (not terminated) */
+typedef struct {
+    uint32_t addr;              ///< Address of the entry
+    const char *func;           ///< Function name
+    int func_len;               ///< Length of the function name
+    const char *file;           ///< Source file
+    int file_len;               ///< Length of the source file name
+    int line;                   ///< Line number
+} symt_entry_t;
+
+/**
+ * @brief Load a symbol table
+ *
+ * Exits with an error message if the file is not a valid symbol table.
+ *
+ * @param symt      Receives the loaded table
+ * @param fn        Filename
+ */
+void symt_load(symt_t *symt, const char *fn);
+
+/** @brief Return the i-th entry of the symbol table */
+symt_entry_t symt_entry(const symt_t *symt, int i);
+
+/**
+ * @brief Symbolize an address
+ *
+ * The indices of the entries are appended to @p entries (a stb_ds array),
+ * from the innermost to the outermost function. A callsite is recorded
+ * exactly in the symbol table, together with the chain of functions inlined
+ * in its caller: if @p inlines is set, all of them are appended. Otherwise,
+ * only the entry of the function that contains the address is appended.
+ * If the address is not covered by the table, -1 is appended.
+ *
+ * @param symt      Symbol table
+ * @param addr      Address to symbolize
+ * @param inlines   True to expand the inlined functions at a callsite
+ * @param entries   Array where the entries are appended
+ */
+void symt_symbolize(const symt_t *symt, uint32_t addr, bool inlines, int **entries);
+
+#endif
@@ -5,10 +5,13 @@
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <ctype.h>
 #include <sys/types.h>
 #include <sys/param.h>
 #include "dragonfs.h"
 #include "dfsinternal.h"
+#include "../common/hash.h"
 
 #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
 #define SWAPLONG(i) (i)
@@ -19,6 +22,32 @@
 uint8_t *dfs = NULL;
 uint32_t fs_size = 0;
 
+/* A file referenced by a directory entry, whose contents are added to the
+   filesystem after the whole directory structure has been built. */
+typedef struct
+{
+    char *file;         /* Path of the file on the host */
+    char *dfs_path;     /* Path of the file within the filesystem */
+    uint32_t entry;     /* Offset of the directory entry of the file */
+    bool placed;        /* True if the contents have been added */
+} pending_file_t;
+
+/* Contents of a file already added to the filesystem, used to deduplicate
+   files with identical contents. */
+typedef struct
+{
+    uint64_t hash;      /* FNV-1a hash of the contents */
+    uint32_t size;      /* Size of the contents in bytes */
+    uint32_t offset;    /* Offset of the contents in the filesystem */
+    const char *file;   /* First file with these contents */
+} blob_t;
+
+pending_file_t *pending_files = NULL;
+int num_pending_files = 0;
+blob_t *blobs = NULL;
+int num_blobs = 0;
+uint32_t dedup_bytes = 0;
+
 /* Offset from start of filesystem */
 inline uint32_t sector_offset(void *sector)
 {
@@ -75,21 +104,34 @@ void kill_fs()
     {
         free(dfs);
     }
+
+    for(int i = 0; i < num_pending_files; i++)
+    {
+        free(pending_files[i].file);
+        free(pending_files[i].dfs_path);
+    }
+    free(pending_files);
+    free(blobs);
 }
 
 void print_help(const char * const prog_name)
 {
-    fprintf(stderr, "Usage: %s <File> <Directory>\n", prog_name);
+    fprintf(stderr, "Usage: %s [flags] <File> <Directory>\n", prog_name);
     fprintf(stderr, "  where <File> is the resulting filesystem image\n");
     fprintf(stderr, "  and <Directory> is the directory (including subdirectories) to include\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Flags:\n");
+    fprintf(stderr, "  --order <manifest>   Place files in the order listed in <manifest>, one path per line\n");
+    fprintf(stderr, "                       (eg: in the order they are accessed at runtime). Files not listed\n");
+    fprintf(stderr, "                       are placed afterwards, in directory order.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Files with identical contents are stored only once in the image.\n");
 }
 
 uint32_t add_file(const char * const file, uint32_t *size)
 {
     FILE *fp;
 
-    printf("Adding '%s' to filesystem image.\n", file);
-
     fp = fopen(file, "rb");
 
     if(!fp)
@@ -108,22 +150,118 @@ uint32_t add_file(const char * const file, uint32_t *size)
         return 0;
     }
 
-    uint32_t blob = new_blob(*size);
-    uint8_t *data = sector_to_memory(blob);
+    uint8_t *data = malloc(*size ? *size : 1);
 
-    int read = fread(data, 1, *size, fp);
-    if (read < 0) {
-        /* Wat? */
+    if(!data || fread(data, 1, *size, fp) != *size)
+    {
         fprintf(stderr, "Cannot add all contents of file '%s' to filesystem!\n", file);
+        free(data);
         fclose(fp);
-        return 0;    
+        return 0;
     }
 
     fclose(fp);
+
+    /* Check whether the same contents were already added by another file */
+    uint64_t hash = hash_bytes(FNV64_INIT, data, *size);
+
+    for(int i = 0; i < num_blobs; i++)
+    {
+        if(blobs[i].hash == hash && blobs[i].size == *size &&
+           memcmp(sector_to_memory(blobs[i].offset), data, *size) == 0)
+        {
+            printf("Adding '%s' to filesystem image (same contents as '%s').\n", file, blobs[i].file);
+            dedup_bytes += *size;
+            free(data);
+            return blobs[i].offset;
+        }
+    }
+
+    printf("Adding '%s' to filesystem image.\n", file);
+
+    uint32_t blob = new_blob(*size);
+    memcpy(sector_to_memory(blob), data, *size);
+    free(data);
+
+    blobs = realloc(blobs, (num_blobs + 1) * sizeof(blob_t));
+    blobs[num_blobs++] = (blob_t){ .hash = hash, .size = *size, .offset = blob, .file = file };
+
     return blob;
 }
 
-uint32_t add_directory(const char * const path)
+/* Add the contents of a file to the filesystem, and link them to its directory entry */
+int place_file(pending_file_t *pf)
+{
+    uint32_t file_size = 0;
+    uint32_t new_file = add_file(pf->file, &file_size);
+
+    if(!new_file)
+    {
+        return 0;
+    }
+
+    directory_entry_t *tmp_entry = sector_to_memory(pf->entry);
+    tmp_entry->file_pointer = SWAPLONG(new_file);
+    tmp_entry->flags = SWAPLONG((FLAGS_FILE << 28) | (file_size & 0x0FFFFFFF));
+    pf->placed = true;
+
+    return 1;
+}
+
+/* Place the files listed in the manifest, in the order they are listed. Each line
+   contains a path within the filesystem (optionally prefixed by "rom:/"); empty
+   lines and lines starting with # are ignored. */
+int place_manifest(const char * const manifest)
+{
+    FILE *fp = fopen(manifest, "r");
+    char line[1024];
+
+    if(!fp)
+    {
+        fprintf(stderr, "Cannot open manifest '%s' for read!\n", manifest);
+        return 0;
+    }
+
+    while(fgets(line, sizeof(line), fp))
+    {
+        char *path = line;
+        char *end = line + strlen(line);
+
+        /* Trim whitespace, and skip the filesystem prefix */
+        while(end > path && isspace((unsigned char)end[-1])) *--end = 0;
+        while(isspace((unsigned char)*path)) path++;
+        if(!*path || *path == '#') continue;
+        if(strncmp(path, "rom:", 4) == 0) path += 4;
+        while(*path == '/') path++;
+
+        int i;
+        for(i = 0; i < num_pending_files; i++)
+        {
+            if(strcmp(pending_files[i].dfs_path, path) == 0)
+            {
+                break;
+            }
+        }
+
+        if(i == num_pending_files)
+        {
+            fprintf(stderr, "Warning: file in manifest not found in filesystem: %s\n", path);
+            continue;
+        }
+
+        /* Files accessed more than once are placed at their first access */
+        if(!pending_files[i].placed && !place_file(&pending_files[i]))
+        {
+            fclose(fp);
+            return 0;
+        }
+    }
+
+    fclose(fp);
+    return 1;
+}
+
+uint32_t add_directory(const char * const path, const char * const dfs_dir)
 {
     directory_entry_t *tmp_entry;
     uint32_t first_entry = 0;
@@ -171,10 +309,13 @@ uint32_t add_directory(const char * const path)
                 /* Figure out if it is a directory or regular (windows doesn't include d_type in dirent) */
                 stat( file, &stats );
 
+                /* Path within the filesystem */
+                char *dfs_path = malloc(strlen(dfs_dir) + strlen(dp->d_name) + 2);
+                sprintf(dfs_path, "%s%s%s", dfs_dir, *dfs_dir ? "/" : "", dp->d_name);
+
                 if(S_ISREG(stats.st_mode))
                 {
                     uint32_t new_entry = new_sector();
-                    uint32_t file_size = 0;
 
                     tmp_entry = sector_to_memory(new_entry);
                     tmp_entry->next_entry = 0;
@@ -183,17 +324,13 @@ uint32_t add_directory(const char * const path)
                     strncpy(tmp_entry->path, dp->d_name, MAX_FILENAME_LEN);
                     tmp_entry->path[MAX_FILENAME_LEN] = 0;
 
-                    uint32_t new_file = add_file(file, &file_size);
-
-                    if(!new_file)
-                    {
-                        free(file);
-                        return 0;
-                    }
-
-                    tmp_entry = sector_to_memory(new_entry);
-                    tmp_entry->file_pointer = SWAPLONG(new_file);
-                    tmp_entry->flags = SWAPLONG((FLAGS_FILE << 28) | (file_size & 0x0FFFFFFF));
+                    /* The contents are added once the directory structure is complete,
+                       so that they can be laid out in the requested order */
+                    pending_files = realloc(pending_files, (num_pending_files + 1) * sizeof(pending_file_t));
+                    pending_files[num_pending_files++] = (pending_file_t){
+                        .file = file, .dfs_path = dfs_path, .entry = new_entry,
+                    };
+                    file = dfs_path = NULL;
 
                     if(cur_entry)
                     {
@@ -217,11 +354,12 @@ uint32_t add_directory(const char * const path)
                     strncpy(tmp_entry->path, dp->d_name, MAX_FILENAME_LEN);
                     tmp_entry->path[MAX_FILENAME_LEN] = 0;
 
-                    uint32_t new_directory = add_directory(file);
+                    uint32_t new_directory = add_directory(file, dfs_path);
 
                     if(!new_directory)
                     {
                         fprintf(stderr, "Skipping empty directory: %s\n", file);
+                        free(dfs_path);
                         free(file);
                         continue;
                     }
@@ -240,6 +378,7 @@ uint32_t add_directory(const char * const path)
                     cur_entry = new_entry;
                 }
 
+                free(dfs_path);
                 free(file);
 
                 if(!first_entry)
@@ -259,12 +398,31 @@ uint32_t add_directory(const char * const path)
 
 int main(int argc, char *argv[])
 {
-    if(argc != 3)
+    const char *manifest = NULL;
+    int i = 1;
+
+    for(; i < argc && argv[i][0] == '-'; i++)
+    {
+        if(strcmp(argv[i], "--order") == 0 && i + 1 < argc)
+        {
+            manifest = argv[++i];
+        }
+        else
+        {
+            print_help(argv[0]);
+            return -1;
+        }
+    }
+
+    if(argc - i != 2)
     {
         print_help(argv[0]);
         return -1;
     }
 
+    const char *outfn = argv[i];
+    const char *indir = argv[i+1];
+
     /* Add in identifier */
     directory_entry_t *id = sector_to_memory(new_sector());
 
@@ -279,23 +437,47 @@ int main(int argc, char *argv[])
     id->next_entry = SWAPLONG(ROOT_NEXT_ENTRY);
     strcpy(id->path, ROOT_PATH);
 
-    if(!add_directory(argv[2]))
+    if(!add_directory(indir, ""))
     {
         /* Error adding directory */
-        fprintf(stderr, "Error creating filesystem: directory is empty or does not exist: %s\n", argv[2]);
+        fprintf(stderr, "Error creating filesystem: directory is empty or does not exist: %s\n", indir);
 
         kill_fs();
 
         return -1;
     }
 
+    /* Add the file contents after all directory entries: first the files
+       listed in the manifest (if any), then all the others in directory order */
+    if(manifest && !place_manifest(manifest))
+    {
+        kill_fs();
+
+        return -1;
+    }
+
+    for(int j = 0; j < num_pending_files; j++)
+    {
+        if(!pending_files[j].placed && !place_file(&pending_files[j]))
+        {
+            kill_fs();
+
+            return -1;
+        }
+    }
+
+    if(dedup_bytes)
+    {
+        printf("Deduplicated %u bytes of identical file contents.\n", dedup_bytes);
+    }
+
     /* Write out filesystem */
-    FILE *fp = fopen(argv[1], "wb");
+    FILE *fp = fopen(outfn, "wb");
 
     if(!fp)
     {
         /* Error writing file out */
-        fprintf(stderr, "Error opening '%s' for writing.\n", argv[1]);
+        fprintf(stderr, "Error opening '%s' for writing.\n", outfn);
 
         kill_fs();
 
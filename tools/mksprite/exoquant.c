@@ -50,6 +50,7 @@ exq_data *exq_init()
 	pExq->optimized = 0;
 	pExq->transparency = 1;
 	pExq->numBitsPerChannel = 8;
+	pExq->randState = 1;
 
 	return pExq;
 }
@@ -503,7 +504,12 @@ void exq_map_image_dither(exq_data *pExq, int width, int height,
 			if(ordered)
 				d = (x & 1) + (y & 1) * 2;
 			else
-				d = rand() & 3;
+			{
+				/* per-quantizer LCG instead of rand(): deterministic output,
+				   and safe to use from several threads at once */
+				pExq->randState = pExq->randState * 1103515245 + 12345;
+				d = (pExq->randState >> 16) & 3;
+			}
 			pHist = exq_find_histogram(pExq, pIn);
 			p.r = *pIn++ / 255.0f * SCALE_R;
 			p.g = *pIn++ / 255.0f * SCALE_G;
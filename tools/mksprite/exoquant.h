@@ -96,6 +96,7 @@ typedef struct _exq_data
 	int						numBitsPerChannel;
 	int						optimized;
 	int						transparency;
+	unsigned int			randState;
 } exq_data;
 
 /* interface */
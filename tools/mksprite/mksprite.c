@@ -6,6 +6,11 @@
 #include <string.h>
 #include <assert.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 #include "../common/binout.c"
 #include "../common/binout.h"
 #include "../common/polyfill.h"
@@ -23,6 +28,11 @@
 // Compression library
 #include "../common/assetcomp.h"
 
+#define STBDS_NO_SHORT_NAMES
+#define STB_DS_IMPLEMENTATION
+#include "../common/stb_ds.h"
+#include "../common/batch.h"
+
 // Bring in tex_format_t definition
 #include "surface.h"
 #include "sprite.h"
@@ -30,7 +40,11 @@
 #define FMT_ZBUF   (64 + 0)
 #define FMT_IHQ    (64 + 1)
 
+// Value of the bitdepth byte of the header of VQ-compressed sprites (see sprite_internal.h)
+#define SPRITE_VQ_MARKER   0x56
+
 #define SWAP(a, b) ({ typeof(a) t = a; a = b; b = t; })
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define ROUND_UP(n, d) ({ \
 	typeof(n) _n = n; typeof(d) _d = d; \
 	(((_n) + (_d) - 1) / (_d) * (_d)); \
@@ -121,6 +135,13 @@ typedef struct {
         bool         use_main_tex;
         bool         enabled;
     } detail;
+    struct {
+        uint8_t (*colors)[4];   // Shared palette to quantize to (NULL if none)
+        int num_colors;         // Number of colors in the shared palette
+        int bank;               // 16-color bank of the palette to use (CI4 only)
+    } shared_palette;
+    bool tmem_layout;           // Store the images pre-swizzled in TMEM layout
+    bool vq;                    // Compress the image with vector quantization
 
 } parms_t;
 
@@ -143,6 +164,9 @@ void print_supported_dithers(void) {
 void print_args( char * name )
 {
     fprintf(stderr, "Usage: %s [flags] <input files...>\n", name);
+    fprintf(stderr, "       %s [flags] --batch <manifest>\n", name);
+    fprintf(stderr, "       %s [flags] --atlas <name> <input files...>\n", name);
+    fprintf(stderr, "       %s [flags] --shared-palette <input files...>\n", name);
     fprintf(stderr, "\n");
     fprintf(stderr, "Command-line flags:\n");
     fprintf(stderr, "   -v/--verbose          Verbose output\n");
@@ -151,6 +175,27 @@ void print_args( char * name )
     fprintf(stderr, "   -D/--dither <dither>  Dithering algorithm (default: NONE)\n");
     fprintf(stderr, "   -c/--compress <level> Compress output files (default: %d)\n", DEFAULT_COMPRESSION);
     fprintf(stderr, "   -d/--debug            Dump computed images (eg: mipmaps) as PNG files in output directory\n");
+    fprintf(stderr, "   --tmem-layout         Store pixels pre-swizzled in TMEM layout, so that they are always uploaded\n");
+    fprintf(stderr, "                         with a single LOAD_BLOCK (not supported for RGBA32)\n");
+    fprintf(stderr, "   --vq                  Compress the image with vector quantization (2x2 blocks, RGBA16/CI8 only).\n");
+    fprintf(stderr, "                         The sprite is expanded by RSP when drawn with rdpq\n");
+    fprintf(stderr, "\nBatch mode flags:\n");
+    fprintf(stderr, "   --batch <manifest>    Convert all the files listed in the manifest. Each line of the manifest\n");
+    fprintf(stderr, "                         has the format: <input.png> <output.sprite> [flags...]\n");
+    fprintf(stderr, "                         where flags are any conversion flags, that override those given on the\n");
+    fprintf(stderr, "                         command line. Files whose inputs and flags did not change are skipped.\n");
+    fprintf(stderr, "   --cache <file>        Cache file used to skip up-to-date files (default: <manifest>.cache)\n");
+    fprintf(stderr, "   -j/--jobs <N>         Number of parallel conversions (default: number of CPUs)\n");
+    fprintf(stderr, "\nAtlas mode flags:\n");
+    fprintf(stderr, "   --atlas <name>        Pack all the input files into a texture atlas, made of one or more pages\n");
+    fprintf(stderr, "                         that each fit TMEM in the format specified with -f. Pages are written as\n");
+    fprintf(stderr, "                         <name>.<N>.sprite, and the position of each image in <name>.atlas\n");
+    fprintf(stderr, "   --atlas-padding <N>   Empty pixels between images in the atlas (default: 0)\n");
+    fprintf(stderr, "\nShared palette flags:\n");
+    fprintf(stderr, "   --shared-palette      Quantize all the input files together, so that all sprites share the same\n");
+    fprintf(stderr, "                         palette, which is loaded into TMEM only once when drawing them (CI4/CI8)\n");
+    fprintf(stderr, "   --palette-banks <N>   For CI4, split the shared palette in N banks of 16 colors, and use for each\n");
+    fprintf(stderr, "                         sprite the bank that fits it best (default: 1)\n");
     fprintf(stderr, "\nSampling flags:\n");
     fprintf(stderr, "   --texparms <x,s,r,m>          Sampling parameters:\n");
     fprintf(stderr, "                                 x=translation, s=scale, r=repetitions, m=mirror\n");
@@ -224,9 +269,14 @@ typedef struct {
     const char *outfn;      // Output file
     image_t images[MAX_IMAGES]; // Pixel images (one per lod level).
     palette_t palette;      // Palette (if any)
+    bool palette_shared;    // True if the palette is shared with other sprites
+    int palette_bank;       // 16-color bank of the shared palette used by the image (CI4 only)
     int vslices;            // Number of vertical slices (deprecated API for old rdp.c)
     int hslices;            // Number of horizontal slices (deprecated API for old rdp.c)
     texparms_t texparms;    // Texture parameters
+    bool tmem_layout;       // If true, write images in TMEM layout (see SPRITE_FLAGS_TMEMLAYOUT)
+    uint8_t *vq_data;       // VQ-compressed main image (codebook + indices), or NULL
+    int vq_size;            // Size of the VQ-compressed data in bytes
     struct{
         const char   *infn;         // Input file for detail texture
         texparms_t   texparms;      // Texture parameters for the detail
@@ -289,12 +339,16 @@ bool load_png_image(const char *infn, tex_format_t fmt, image_t *imgout, palette
     // Try first inspecting the extension
     if (fmt == FMT_NONE) {
         // Check the filename string if it contains a texformat for output
+        // Split manually rather than with strtok, which is not reentrant
+        // and this runs in parallel in batch mode.
         char *fntok = strdup(infn);
-        char *sect = strtok(fntok, ".");
+        char *sect = fntok;
         while (sect) {
+            char *next = strchr(sect, '.');
+            if (next) *next++ = 0;
             fmt = tex_format_from_name(sect);
             if (fmt != FMT_NONE) break;
-            sect = strtok(NULL, ".");
+            sect = next;
         }
         if (fmt != FMT_NONE) {
             if (flag_verbose)
@@ -910,6 +964,232 @@ bool spritemaker_convert_ihq(spritemaker_t *spr) {
     return true;
 }
 
+// Number of palette colors that are loaded into TMEM when drawing the sprite
+int spritemaker_palette_upload_colors(spritemaker_t *spr)
+{
+    if (spr->images[0].fmt != FMT_CI4 && spr->images[0].fmt != FMT_CI8)
+        return 0;
+    // A CI4 sprite might be shipped with a larger palette (eg: for effects),
+    // but only its first 16 colors are loaded, unless it uses a shared palette
+    // made of multiple banks.
+    int num_colors = spr->palette.num_colors;
+    if (spr->images[0].fmt == FMT_CI4 && num_colors > 16 && !spr->palette_shared)
+        num_colors = 16;
+    return num_colors;
+}
+
+// Identifier of a palette (FNV-1a of the RGBA5551 colors), used at runtime to
+// skip reloading a palette that is already in TMEM. 0 means no palette.
+uint32_t palette_hash(uint8_t colors[][4], int num_colors)
+{
+    if (!num_colors)
+        return 0;
+    uint32_t h = 0x811c9dc5;
+    for (int i=0; i<num_colors; i++) {
+        uint16_t c = conv_rgb5551(colors[i][0], colors[i][1], colors[i][2], colors[i][3]);
+        h = (h ^ (c >> 8)) * 0x01000193;
+        h = (h ^ (c & 0xFF)) * 0x01000193;
+    }
+    return h ? h : 1;
+}
+
+// Squared distance between two blocks of 2x2 RGBA texels
+static int vq_block_dist(const int *a, const int *b) {
+    int d = 0;
+    for (int i=0; i<16; i++)
+        d += (a[i] - b[i]) * (a[i] - b[i]);
+    return d;
+}
+
+// Find the codebook entry nearest to a block
+static int vq_nearest(const int *block, int (*codebook)[16], int num_entries, int *out_dist) {
+    int best = 0, best_dist = INT32_MAX;
+    for (int k=0; k<num_entries; k++) {
+        int d = vq_block_dist(block, codebook[k]);
+        if (d < best_dist) { best_dist = d; best = k; }
+    }
+    if (out_dist) *out_dist = best_dist;
+    return best;
+}
+
+// Compress the first image with vector quantization. The image is split into
+// blocks of 2x2 texels, that are clustered via k-means into a codebook of 256
+// entries. The lines of the image are padded to the TMEM pitch (the expanded
+// image is written by RSP directly in TMEM layout), and each line of indices
+// is padded to 8 bytes, as required by RSP DMA.
+bool spritemaker_vq_compress(spritemaker_t *spr) {
+    image_t *img = &spr->images[0];
+    assert(img->fmt == FMT_RGBA16 || img->fmt == FMT_CI8);
+    bool ci8 = img->fmt == FMT_CI8;
+
+    int pitch = ROUND_UP(TEX_FORMAT_PIX2BYTES(img->fmt, img->width), 8);
+    int bw = ci8 ? pitch / 2 : pitch / 4;
+    int bh = (img->height + 1) / 2;
+    int index_stride = ROUND_UP(bw, 8);
+    int num_blocks = bw * bh;
+    const int num_entries = 256;
+
+    if (flag_verbose)
+        fprintf(stderr, "VQ compression: %d blocks of 2x2 texels\n", num_blocks);
+
+    // Extract the blocks as RGBA vectors. Padding texels replicate the edges.
+    int (*blocks)[16] = malloc(num_blocks * sizeof(*blocks));
+    for (int by=0; by<bh; by++) {
+        for (int bx=0; bx<bw; bx++) {
+            int *b = blocks[by*bw + bx];
+            for (int i=0; i<4; i++) {
+                int x = MIN(bx*2 + (i&1), img->width-1);
+                int y = MIN(by*2 + (i>>1), img->height-1);
+                const uint8_t *px = ci8 ? spr->palette.colors[img->image[y*img->width + x]] : &img->image[(y*img->width + x)*4];
+                for (int c=0; c<4; c++)
+                    b[i*4+c] = px[c];
+                // Quantize RGBA16 texels to the output precision, so that
+                // clustering happens in the same space as the final codebook
+                if (!ci8) {
+                    for (int c=0; c<3; c++)
+                        b[i*4+c] &= ~7;
+                    b[i*4+3] = b[i*4+3] >= 128 ? 255 : 0;
+                }
+            }
+        }
+    }
+
+    // Initialize the codebook with blocks evenly spaced in the image, then
+    // run a few iterations of k-means.
+    int (*codebook)[16] = calloc(num_entries, sizeof(*codebook));
+    int64_t (*sums)[16] = malloc(num_entries * sizeof(*sums));
+    int *counts = malloc(num_entries * sizeof(int));
+    int *assign = malloc(num_blocks * sizeof(int));
+    int *dists = malloc(num_blocks * sizeof(int));
+    for (int k=0; k<num_entries; k++)
+        memcpy(codebook[k], blocks[(int64_t)k * num_blocks / num_entries], sizeof(codebook[k]));
+
+    for (int iter=0; iter<16; iter++) {
+        bool changed = false;
+        for (int i=0; i<num_blocks; i++) {
+            int k = vq_nearest(blocks[i], codebook, num_entries, &dists[i]);
+            if (iter == 0 || assign[i] != k) changed = true;
+            assign[i] = k;
+        }
+        if (!changed)
+            break;
+
+        memset(sums, 0, num_entries * sizeof(*sums));
+        memset(counts, 0, num_entries * sizeof(int));
+        for (int i=0; i<num_blocks; i++) {
+            counts[assign[i]]++;
+            for (int c=0; c<16; c++)
+                sums[assign[i]][c] += blocks[i][c];
+        }
+        for (int k=0; k<num_entries; k++) {
+            if (counts[k] == 0) {
+                // Reseed empty entries with the worst approximated block
+                int worst = 0;
+                for (int i=1; i<num_blocks; i++)
+                    if (dists[i] > dists[worst]) worst = i;
+                memcpy(codebook[k], blocks[worst], sizeof(codebook[k]));
+                dists[worst] = 0;
+                continue;
+            }
+            for (int c=0; c<16; c++)
+                codebook[k][c] = (sums[k][c] + counts[k]/2) / counts[k];
+        }
+    }
+
+    // Convert the codebook to the output format. Notice that this changes the
+    // entries (eg: RGBA16 has 1-bit alpha), so the indices are recalculated
+    // against the final codebook.
+    int entry_size = ci8 ? 4 : 8;
+    spr->vq_size = num_entries * entry_size + index_stride * bh;
+    spr->vq_data = calloc(1, spr->vq_size);
+    uint8_t *entry = spr->vq_data;
+    for (int k=0; k<num_entries; k++) {
+        for (int i=0; i<4; i++) {
+            int *c = &codebook[k][i*4];
+            if (ci8) {
+                int best = 0, best_dist = INT32_MAX;
+                for (int p=0; p<spr->palette.num_colors; p++) {
+                    uint8_t *pal = spr->palette.colors[p];
+                    int d = 0;
+                    for (int j=0; j<4; j++)
+                        d += (c[j] - pal[j]) * (c[j] - pal[j]);
+                    if (d < best_dist) { best_dist = d; best = p; }
+                }
+                *entry++ = best;
+                for (int j=0; j<4; j++)
+                    c[j] = spr->palette.colors[best][j];
+            } else {
+                uint16_t px = conv_rgb5551(c[0], c[1], c[2], c[3] >= 128 ? 255 : 0);
+                *entry++ = px >> 8;
+                *entry++ = px & 0xFF;
+                c[0] = (px >> 11) << 3; c[1] = ((px >> 6) & 0x1F) << 3;
+                c[2] = ((px >> 1) & 0x1F) << 3; c[3] = (px & 1) ? 255 : 0;
+            }
+        }
+    }
+
+    // Write the indices, and replace the image with its decompressed version,
+    // so that debug dumps show the quality of the compression.
+    uint8_t *indices = spr->vq_data + num_entries * entry_size;
+    for (int by=0; by<bh; by++) {
+        for (int bx=0; bx<bw; bx++) {
+            int k = vq_nearest(blocks[by*bw + bx], codebook, num_entries, NULL);
+            indices[by*index_stride + bx] = k;
+            for (int i=0; i<4; i++) {
+                int x = bx*2 + (i&1), y = by*2 + (i>>1);
+                if (x >= img->width || y >= img->height)
+                    continue;
+                if (ci8) {
+                    img->image[y*img->width + x] = spr->vq_data[k*entry_size + i];
+                } else {
+                    for (int c=0; c<4; c++)
+                        img->image[(y*img->width + x)*4 + c] = codebook[k][i*4+c];
+                }
+            }
+        }
+    }
+
+    if (flag_verbose)
+        fprintf(stderr, "VQ compression: %d bytes (uncompressed: %d bytes)\n", spr->vq_size,
+            TEX_FORMAT_PIX2BYTES(img->fmt, img->width * img->height));
+
+    free(blocks); free(codebook); free(sums); free(counts); free(assign); free(dists);
+    return true;
+}
+
+// Copy an image written linearly into the output file, converting it to TMEM layout:
+// each line is padded to the TMEM pitch (8 bytes), and on odd lines the two 32-bit
+// words of each 64-bit word are swapped, like the RDP does when loading a texture
+// with LOAD_TILE. This allows to load any image with a single LOAD_BLOCK with dxt=0.
+// Returns false if the linear image cannot be read back.
+bool write_tmem_layout(FILE *out, FILE *linear, image_t *image) {
+    tex_format_t fmt = image->fmt == FMT_ZBUF ? FMT_IA16 : image->fmt;
+    int line_bytes = TEX_FORMAT_PIX2BYTES(fmt, image->width);
+    int pitch = ROUND_UP(line_bytes, 8);
+    uint8_t *line = malloc(pitch);
+
+    rewind(linear);
+    for (int y=0; y<image->height; y++) {
+        memset(line, 0, pitch);
+        if (fread(line, 1, line_bytes, linear) != line_bytes) {
+            fprintf(stderr, "ERROR: cannot read temporary file\n");
+            free(line);
+            return false;
+        }
+        if (y & 1) {
+            for (int x=0; x<pitch; x+=8) {
+                uint8_t tmp[4];
+                memcpy(tmp, line+x, 4);
+                memcpy(line+x, line+x+4, 4);
+                memcpy(line+x+4, tmp, 4);
+            }
+        }
+        fwrite(line, 1, pitch, out);
+    }
+    free(line);
+    return true;
+}
+
 bool spritemaker_write(spritemaker_t *spr) {
     FILE *out;
     if (strcmp(spr->outfn, "(stdout)") == 0) {
@@ -934,8 +1214,8 @@ bool spritemaker_write(spritemaker_t *spr) {
     if (img0fmt == FMT_ZBUF) img0fmt = FMT_IA16;
     w16(out, spr->images[0].width);
     w16(out, spr->images[0].height);
-    w8(out, 0); // deprecated field
-    w8(out, (uint8_t)(img0fmt | SPRITE_FLAGS_EXT));
+    w8(out, spr->vq_data ? SPRITE_VQ_MARKER : 0); // deprecated field, reused to mark VQ sprites
+    w8(out, (uint8_t)(img0fmt | SPRITE_FLAGS_EXT | (spr->tmem_layout ? SPRITE_FLAGS_TMEMLAYOUT : 0)));
     w8(out, spr->hslices);
     w8(out, spr->vslices);
 
@@ -954,7 +1234,24 @@ bool spritemaker_write(spritemaker_t *spr) {
             w32_at(out, w_lodpos[m-1], xpos);
         }
 
-        switch ((int)image->fmt) {
+        // In TMEM layout, the image is first written linearly into a temporary
+        // file, and then converted while copying it to the output file.
+        FILE *sprite_out = out;
+        if (spr->tmem_layout) {
+            out = tmpfile();
+            if (!out) {
+                perror("ERROR: cannot create temporary file");
+                fclose(sprite_out);
+                return false;
+            }
+        }
+
+        switch (m == 0 && spr->vq_data ? -1 : (int)image->fmt) {
+        case -1:
+            // VQ-compressed image: already encoded by spritemaker_vq_compress
+            fwrite(spr->vq_data, 1, spr->vq_size, out);
+            break;
+
         case FMT_RGBA16: {
             assert(image->ct == LCT_RGBA);
             // Convert to 16-bit RGB5551 format.
@@ -1045,14 +1342,25 @@ bool spritemaker_write(spritemaker_t *spr) {
         }
         }
 
+        if (spr->tmem_layout) {
+            FILE *linear = out;
+            out = sprite_out;
+            bool ok = write_tmem_layout(out, linear, image);
+            fclose(linear);
+            if (!ok) {
+                fclose(out);
+                return false;
+            }
+        }
+
         // Padding to force alignment of every image
         walign(out, 8);
         
         // Write extended sprite header after first image
         // See sprite_ext_t (sprite_internal.h)
         if (m == 0) { 
-            w16(out, 124);  // sizeof(sprite_ext_t)
-            w16(out, 4);    // version
+            w16(out, 132);  // sizeof(sprite_ext_t)
+            w16(out, 5);    // version
             w_palpos = w32_placeholder(out); // placeholder for position of palette
             int numlods = 0;
             for (int i=1; i<8; i++) {
@@ -1097,6 +1405,13 @@ bool spritemaker_write(spritemaker_t *spr) {
             w8(out, 0); // padding
             w8(out, 0); // padding
 
+            // palette information
+            int pal_colors = spritemaker_palette_upload_colors(spr);
+            w32(out, palette_hash(spr->palette.colors, pal_colors));
+            w16(out, pal_colors);
+            w8(out, spr->palette_bank);
+            w8(out, 0); // padding
+
             walign(out, 8);
         }
     }
@@ -1174,6 +1489,8 @@ void spritemaker_free(spritemaker_t *spr) {
     for (int i=0; i<MAX_IMAGES; i++)
         if (spr->images[i].image)
             free(spr->images[i].image);
+    if (spr->vq_data)
+        free(spr->vq_data);
     memset(spr, 0, sizeof(*spr));
 }
 
@@ -1258,7 +1575,21 @@ int convert(const char *infn, const char *outfn, const parms_t *pm) {
     }
 
     // Run quantization if needed
-    if (spr.images[0].fmt == FMT_CI8 || spr.images[0].fmt == FMT_CI4) {
+    if ((spr.images[0].fmt == FMT_CI8 || spr.images[0].fmt == FMT_CI4) && pm->shared_palette.colors) {
+        // Quantize with the shared palette (only the colors of the requested bank for CI4)
+        int bank = pm->shared_palette.bank;
+        int bank_colors = spr.images[0].fmt == FMT_CI8 ? pm->shared_palette.num_colors : 16;
+        if (spr.images[0].ct == LCT_PALETTE && !spritemaker_expand_rgba(&spr))
+            goto error;
+        if (!spritemaker_quantize(&spr, pm->shared_palette.colors[bank*16], bank_colors, pm->dither_algo))
+            goto error;
+        // Store the full shared palette, so that all the banks are loaded together
+        memcpy(spr.palette.colors, pm->shared_palette.colors, pm->shared_palette.num_colors * 4);
+        spr.palette.num_colors = pm->shared_palette.num_colors;
+        spr.palette.used_colors = bank_colors;
+        spr.palette_shared = true;
+        spr.palette_bank = bank;
+    } else if (spr.images[0].fmt == FMT_CI8 || spr.images[0].fmt == FMT_CI4) {
         int expected_colors = spr.images[0].fmt == FMT_CI8 ? 256 : 16;
 
         switch (spr.images[0].ct) {
@@ -1280,6 +1611,21 @@ int convert(const char *infn, const char *outfn, const parms_t *pm) {
         }
     }
 
+    // Compress with vector quantization, if requested
+    if (pm->vq) {
+        if (spr.images[0].fmt != FMT_RGBA16 && spr.images[0].fmt != FMT_CI8) {
+            fprintf(stderr, "ERROR: %s: VQ compression is only supported for RGBA16 and CI8 (not %s)\n",
+                infn, tex_format_name(spr.images[0].fmt));
+            goto error;
+        }
+        if (spr.images[1].image || spr.detail.enabled) {
+            fprintf(stderr, "ERROR: %s: VQ compression does not support mipmaps or detail textures\n", infn);
+            goto error;
+        }
+        if (!spritemaker_vq_compress(&spr))
+            goto error;
+    }
+
     // Dump TMEM usage
     if (flag_verbose) {
         int tmem_usage; spritemaker_fit_tmem(&spr, &tmem_usage);
@@ -1303,6 +1649,17 @@ int convert(const char *infn, const char *outfn, const parms_t *pm) {
         if (!spr.vslices) spr.vslices = 1;
     }
 
+    // TMEM layout is not supported for 32-bit images, as they are split
+    // in two halves of TMEM, so that a single LOAD_BLOCK cannot load them.
+    spr.tmem_layout = pm->tmem_layout && !spr.vq_data;
+    for (int i=0; i<MAX_IMAGES && spr.tmem_layout; i++) {
+        if (spr.images[i].image && TEX_FORMAT_BITDEPTH(spr.images[i].fmt) == 32) {
+            fprintf(stderr, "WARNING: %s: TMEM layout is not supported for %s, using linear layout\n",
+                infn, tex_format_name(spr.images[i].fmt));
+            spr.tmem_layout = false;
+        }
+    }
+
     // Write the sprite
     if (!spritemaker_write(&spr))
         goto error;
@@ -1359,10 +1716,885 @@ bool cli_parse_texparms(const char *opt, texparms_t *parms)
 }
 
 
+/**
+ * @brief Parse a command-line flag that controls the conversion of a file.
+ * 
+ * These flags can be specified both on the command line and, for each file,
+ * in a batch manifest.
+ * 
+ * @return 1 if the flag was parsed, 0 if it is not a conversion flag, -1 on error
+ */
+int cli_parse_conv_flag(int argc, char *argv[], int *pi, parms_t *pm, int *compression)
+{
+    int i = *pi;
+
+    /* ---------------- FORMAT console argument ------------------- */
+    /* -f/--format <fmt>     Specify output format (default: AUTO)             */
+    if (!strcmp(argv[i], "-f") || !strcmp(argv[i], "--format")) {
+        if (++i == argc) {
+            fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+            return -1;
+        }
+        pm->outfmt = tex_format_from_name(argv[i]);
+        if (pm->outfmt == FMT_NONE && strcasecmp(argv[i], "AUTO") != 0) {
+            fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+            print_supported_formats();
+            return -1;
+        }
+    } 
+
+    /* ---------------- HV TILES console argument ------------------- */
+    else if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--tiles")) {
+        if (++i == argc) {
+            fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+            return -1;
+        }
+        char extra;
+        if (sscanf(argv[i], "%d,%d%c", &pm->tilew, &pm->tileh, &extra) != 2) {
+            fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+            return -1;
+        }
+    }
+    
+    /* ---------------- MIPMAP console argument ------------------- */
+    /* -m/--mipmap <algo>                    Calculate mipmap levels using the specified algorithm (default: NONE)             */
+    else if (!strcmp(argv[i], "-m") || !strcmp(argv[i], "--mipmap")) {
+        if (++i == argc) {
+            fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+            return -1;
+        }
+        if (!strcmp(argv[i], "NONE")) pm->mipmap_algo = MIPMAP_ALGO_NONE;
+        else if (!strcmp(argv[i], "BOX")) pm->mipmap_algo = MIPMAP_ALGO_BOX;
+        else {
+            fprintf(stderr, "invalid mipmap algorithm: %s\n", argv[i]);
+            print_supported_mipmap();
+            return -1;
+        }
+    } 
+
+    /* ---------------- DITHER console argument ------------------- */
+    /* -D/--dither <dither>  Dithering algorithm (default: NONE)             */
+    else if (!strcmp(argv[i], "-D") || !strcmp(argv[i], "--dither")) {
+        if (++i == argc) {
+            fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+            return -1;
+        }
+        if (!strcmp(argv[i], "NONE")) pm->dither_algo = DITHER_ALGO_NONE;
+        else if (!strcmp(argv[i], "RANDOM")) pm->dither_algo = DITHER_ALGO_RANDOM;
+        else if (!strcmp(argv[i], "ORDERED")) pm->dither_algo = DITHER_ALGO_ORDERED;
+        else {
+            fprintf(stderr, "invalid dithering algorithm: %s\n", argv[i]);
+            print_supported_dithers();
+            return -1;
+        }
+    } 
+    
+    /* ---------------- COMPRESS console argument ------------------- */
+    /* -c/--compress         Compress output files (using mksasset)             */
+    else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--compress")) {
+        // Optional compression level
+        if (i+1 < argc && argv[i+1][1] == 0) {
+            int level = argv[i+1][0] - '0';
+            if (level >= 0 && level <= 3) {
+                *compression = level;
+                i++;
+            }
+            else {
+                fprintf(stderr, "invalid compression level: %s\n", argv[i+1]);
+                return -1;
+            }
+        }
+    }
+
+    /* ---------------- TEXTURE PARAMETERS console argument ------------------- */
+    /* --texparms <x,s,r,m>          Sampling parameters             */
+    /* --texparms <x,x,s,s,r,r,m,m>  Sampling parameters (different for S/T)             */
+    else if (!strcmp(argv[i], "--texparms")) {
+        if (++i == argc) {
+            fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+            return -1;
+        }
+        if (!cli_parse_texparms(argv[i], &pm->texparms))
+            return -1;
+    } 
+    
+    /* ---------------- DETAIL console argument ------------------- */
+    /* --detail [<image>][,<fmt>][,<factor>] Activate detail texture             */
+    else if (!strcmp(argv[i], "--detail")) {
+        pm->detail.blend_factor = 0.5;
+        pm->detail.use_main_tex = true;
+        pm->detail.outfmt = FMT_NONE;
+        pm->detail.infn = NULL;
+        pm->detail.enabled = true;
+
+        if (++i != argc) {
+            char *fntok = strdup(argv[i]);
+            char *sect = strtok(fntok, ",");
+
+            // First argument is either the filename or the factor. If
+            // it's the factor, we should be done
+            if (!sscanf(sect, "%f", &pm->detail.blend_factor)) {
+                // Not a floating point number, should be a filename,
+                // but error out if it's a format instead
+                if (tex_format_from_name(sect) != FMT_NONE) {
+                    fprintf(stderr, "cannot specify a format without a filename for %s: %s\n", argv[i-1], argv[i]);
+                    return -1;
+                }
+                pm->detail.infn = sect;
+                pm->detail.use_main_tex = false;
+
+                // Next argument is either the format or the factor
+                sect = strtok(NULL, ",");
+                if (sect) {
+                    tex_format_t fmt = tex_format_from_name(sect);
+                    if (fmt != FMT_NONE) {
+                        pm->detail.outfmt = fmt;
+                        sect = strtok(NULL, ",");
+                    }
+                }
+                // Third argument (or second) must be the blend factor
+                if (sect) {
+                    if (!sscanf(sect, "%f", &pm->detail.blend_factor)) {
+                        fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                        return -1;
+                    }
+                }
+            }
+            // There should be no other arguments
+            sect = strtok(NULL, ",");
+            if (sect) {
+                fprintf(stderr, "too many values for argument %s: %s\n", argv[i-1], argv[i]);
+                return -1;
+            }
+        }
+    }
+
+    /* ---------------- TMEM LAYOUT console argument ------------------- */
+    /* --tmem-layout         Store pixels pre-swizzled in TMEM layout             */
+    else if (!strcmp(argv[i], "--tmem-layout")) {
+        pm->tmem_layout = true;
+    }
+
+    /* ---------------- VQ console argument ------------------- */
+    /* --vq                  Compress the image with vector quantization             */
+    else if (!strcmp(argv[i], "--vq")) {
+        pm->vq = true;
+    }
+
+    /* ---------------- DETAIL TEXTURE PARAMETERS console argument ------------------- */
+    /* --detail-texparms <x,s,r,m>          Sampling parameters             */
+    /* --detail-texparms <x,x,s,s,r,r,m,m>  Sampling parameters (different for S/T)             */
+    else if (!strcmp(argv[i], "--detail-texparms")) {
+        if (++i == argc) {
+            fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+            return -1;
+        }
+        if (!cli_parse_texparms(argv[i], &pm->detail.texparms))
+            return -1;
+    }
+
+    else {
+        return 0;
+    }
+
+    *pi = i;
+    return 1;
+}
+
+// Convert a file and compress the output if requested
+int convert_and_compress(const char *infn, const char *outfn, const parms_t *pm, int compression)
+{
+    if (convert(infn, outfn, pm) != 0)
+        return 1;
+
+    if (compression == -1)
+        compression = DEFAULT_COMPRESSION;
+    if (compression) {
+        struct stat st_decomp = {0}, st_comp = {0};
+        stat(outfn, &st_decomp);
+        asset_compress(outfn, outfn, compression, 0);
+        stat(outfn, &st_comp);
+        if (flag_verbose)
+            fprintf(stderr, "compressed: %s (%d -> %d, ratio %.1f%%)\n", outfn,
+            (int)st_decomp.st_size, (int)st_comp.st_size, 100.0 * (float)st_comp.st_size / (float)(st_decomp.st_size == 0 ? 1 :st_decomp.st_size));
+    }
+    return 0;
+}
+
+/** @brief A conversion to perform in batch mode */
+typedef struct {
+    char *infn;             ///< Input PNG file
+    char *outfn;            ///< Output sprite file
+    parms_t pm;             ///< Conversion parameters
+    int compression;        ///< Compression level (-1 = default)
+    int line;               ///< Line of the manifest
+    uint64_t hash;          ///< Hash of input files and parameters
+    bool skipped;           ///< True if the output was up to date
+    bool failed;            ///< True if the conversion failed
+    double time;            ///< Conversion time in milliseconds
+} batch_job_t;
+
+batch_job_t *batch_jobs = NULL;
+int batch_next_job = 0;
+
+uint64_t hash_texparms(uint64_t h, const texparms_t *tp)
+{
+    HASH_FIELD(h, tp->defined);
+    if (tp->defined) {
+        HASH_FIELD(h, tp->s.translate); HASH_FIELD(h, tp->s.scale);
+        HASH_FIELD(h, tp->s.repeats); HASH_FIELD(h, tp->s.mirror);
+        HASH_FIELD(h, tp->t.translate); HASH_FIELD(h, tp->t.scale);
+        HASH_FIELD(h, tp->t.repeats); HASH_FIELD(h, tp->t.mirror);
+    }
+    return h;
+}
+
+// Hash all the inputs of a conversion: input files, parameters, and the
+// build of mksprite itself (so that a new version reconverts everything).
+bool batch_job_hash(batch_job_t *job)
+{
+    const char *version = __DATE__ " " __TIME__;
+    uint64_t h = FNV64_INIT;
+    h = hash_bytes(h, version, strlen(version));
+    h = hash_bytes(h, job->outfn, strlen(job->outfn));
+    if (!hash_file(&h, job->infn))
+        return false;
+    const parms_t *pm = &job->pm;
+    HASH_FIELD(h, pm->outfmt);
+    HASH_FIELD(h, pm->hslices); HASH_FIELD(h, pm->vslices);
+    HASH_FIELD(h, pm->tilew); HASH_FIELD(h, pm->tileh);
+    HASH_FIELD(h, pm->mipmap_algo); HASH_FIELD(h, pm->dither_algo);
+    h = hash_texparms(h, &pm->texparms);
+    HASH_FIELD(h, pm->detail.enabled);
+    if (pm->detail.enabled) {
+        HASH_FIELD(h, pm->detail.use_main_tex);
+        HASH_FIELD(h, pm->detail.outfmt);
+        HASH_FIELD(h, pm->detail.blend_factor);
+        h = hash_texparms(h, &pm->detail.texparms);
+        if (pm->detail.infn && !hash_file(&h, pm->detail.infn))
+            return false;
+    }
+    HASH_FIELD(h, job->compression);
+    HASH_FIELD(h, flag_debug);
+    job->hash = h;
+    return true;
+}
+
+double time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+void* batch_worker(void *arg)
+{
+    int num_jobs = stbds_arrlen(batch_jobs);
+    while (1) {
+        int i = __atomic_fetch_add(&batch_next_job, 1, __ATOMIC_RELAXED);
+        if (i >= num_jobs)
+            break;
+        batch_job_t *job = &batch_jobs[i];
+        if (job->skipped)
+            continue;
+        double t0 = time_ms();
+        job->failed = convert_and_compress(job->infn, job->outfn, &job->pm, job->compression) != 0;
+        job->time = time_ms() - t0;
+    }
+    return NULL;
+}
+
+// Split a manifest line into whitespace-separated tokens (in place). Double
+// quotes can be used for tokens containing spaces.
+int tokenize(char *line, char **tokens, int max_tokens)
+{
+    int n = 0;
+    char *p = line;
+    while (1) {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+        if (!*p || *p == '#') break;
+        if (n == max_tokens) return -1;
+        if (*p == '"') {
+            tokens[n++] = ++p;
+            while (*p && *p != '"') p++;
+        } else {
+            tokens[n++] = p;
+            while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+        }
+        if (!*p) break;
+        *p++ = 0;
+    }
+    return n;
+}
+
+int cmp_job_time(const void *a, const void *b)
+{
+    const batch_job_t *ja = *(const batch_job_t**)a, *jb = *(const batch_job_t**)b;
+    return ja->time < jb->time ? 1 : ja->time > jb->time ? -1 : 0;
+}
+
+int batch_convert(const char *manifest, const char *cachefn, const parms_t *defpm, int defcompression, int num_threads)
+{
+    FILE *f = fopen(manifest, "r");
+    if (!f) {
+        fprintf(stderr, "cannot open manifest: %s\n", manifest);
+        return 1;
+    }
+
+    // Parse the manifest. Each line is: <input> <output> [flags...]
+    char *line = NULL; size_t line_size = 0;
+    int lineno = 0;
+    while (getline(&line, &line_size, f) != -1) {
+        lineno++;
+        char *linecopy = strdup(line);
+        char *tokens[256];
+        int ntok = tokenize(linecopy, tokens, 256);
+        if (ntok == 0) { free(linecopy); continue; }
+        if (ntok < 2) {
+            fprintf(stderr, "%s:%d: expected <input> <output> [flags...]\n", manifest, lineno);
+            return 1;
+        }
+
+        batch_job_t job = { .infn = tokens[0], .outfn = tokens[1], .pm = *defpm,
+            .compression = defcompression, .line = lineno };
+        for (int i = 2; i < ntok; i++) {
+            int ret = cli_parse_conv_flag(ntok, tokens, &i, &job.pm, &job.compression);
+            if (ret <= 0) {
+                if (ret == 0) fprintf(stderr, "invalid flag: %s\n", tokens[i]);
+                fprintf(stderr, "%s:%d: invalid conversion flags\n", manifest, lineno);
+                return 1;
+            }
+        }
+        stbds_arrput(batch_jobs, job);
+    }
+    free(line);
+    fclose(f);
+
+    // Load the cache of hashes of the previous run
+    hash_cache_t *cache = hash_cache_load(cachefn);
+
+    // Skip conversions whose inputs did not change since last time
+    int num_jobs = stbds_arrlen(batch_jobs), num_skipped = 0;
+    for (int i = 0; i < num_jobs; i++) {
+        batch_job_t *job = &batch_jobs[i];
+        if (!batch_job_hash(job)) {
+            fprintf(stderr, "%s:%d: cannot read input file: %s\n", manifest, job->line, job->infn);
+            job->skipped = true;
+            job->failed = true;
+            continue;
+        }
+        if (hash_cache_uptodate(cache, job->outfn, job->hash)) {
+            if (flag_verbose)
+                fprintf(stderr, "Up to date: %s\n", job->outfn);
+            job->skipped = true;
+            num_skipped++;
+        }
+    }
+
+    // Run the conversions in parallel
+    double t0 = time_ms();
+    if (num_threads > num_jobs) num_threads = num_jobs;
+    if (num_threads <= 1) {
+        batch_worker(NULL);
+    } else {
+        pthread_t threads[num_threads];
+        for (int i = 0; i < num_threads; i++)
+            pthread_create(&threads[i], NULL, batch_worker, NULL);
+        for (int i = 0; i < num_threads; i++)
+            pthread_join(threads[i], NULL);
+    }
+    double elapsed = time_ms() - t0;
+
+    // Update the cache with the successful conversions, and collect the
+    // converted files for the timing report
+    int num_failed = 0;
+    batch_job_t **converted = NULL;
+    for (int i = 0; i < num_jobs; i++) {
+        batch_job_t *job = &batch_jobs[i];
+        if (job->failed) {
+            (void)stbds_shdel(cache, job->outfn);
+            num_failed++;
+            continue;
+        }
+        stbds_shput(cache, job->outfn, job->hash);
+        if (!job->skipped)
+            stbds_arrput(converted, job);
+    }
+    if (!hash_cache_save(cache, cachefn))
+        fprintf(stderr, "cannot write cache file: %s\n", cachefn);
+
+    // Report per-file timings, slowest first, to spot pathological images
+    int num_converted = stbds_arrlen(converted);
+    int num_report = flag_verbose ? num_converted : (num_converted < 10 ? num_converted : 10);
+    if (num_report) {
+        qsort(converted, num_converted, sizeof(batch_job_t*), cmp_job_time);
+        fprintf(stderr, "Slowest conversions:\n");
+        for (int i = 0; i < num_report; i++)
+            fprintf(stderr, "  %9.1f ms  %s -> %s\n", converted[i]->time, converted[i]->infn, converted[i]->outfn);
+    }
+    fprintf(stderr, "mksprite: %d converted, %d up to date, %d failed (%.1f ms, %d threads)\n",
+        num_converted, num_skipped, num_failed, elapsed, num_threads);
+
+    stbds_arrfree(converted);
+    stbds_shfree(cache);
+    return num_failed ? 1 : 0;
+}
+
+// Quantize a set of RGBA images together, producing a single palette
+void quantize_images(image_t **imgs, int num, int num_colors, uint8_t colors[][4])
+{
+    exq_data *exq = exq_init();
+    exq->numBitsPerChannel = 5;   // force calculations using rgb555
+    for (int i=0; i<num; i++)
+        exq_feed(exq, imgs[i]->image, imgs[i]->width * imgs[i]->height);
+    exq_quantize_hq(exq, num_colors);
+    exq_get_palette(exq, colors[0], num_colors);
+    exq_free(exq);
+}
+
+// Calculate the error of representing an RGBA image with a 16-color palette.
+// Big images are subsampled, as this is just used to compare palettes.
+uint64_t palette_error(image_t *img, uint8_t colors[][4])
+{
+    int npix = img->width * img->height;
+    int step = npix > 4096 ? npix / 4096 : 1;
+    uint64_t err = 0;
+    for (int i=0; i<npix; i+=step) {
+        uint8_t *px = &img->image[i*4];
+        int best = INT32_MAX;
+        for (int c=0; c<16; c++) {
+            int dr = px[0]-colors[c][0], dg = px[1]-colors[c][1];
+            int db = px[2]-colors[c][2], da = px[3]-colors[c][3];
+            int d = dr*dr + dg*dg + db*db + da*da;
+            if (d < best) best = d;
+        }
+        err += best;
+    }
+    return err * step;
+}
+
+// Convert a set of images to CI4/CI8 sprites sharing the same palette, so that
+// the palette is loaded into TMEM only once when drawing them. For CI4, the
+// palette can be made of multiple 16-color banks: images are clustered so that
+// each one uses the bank that represents its colors best.
+int shared_palette_convert(char **infns, int num, const char *outdir, const parms_t *pm, int compression, int num_banks)
+{
+    if (pm->outfmt != FMT_CI4 && pm->outfmt != FMT_CI8) {
+        fprintf(stderr, "ERROR: shared palettes require an output format of CI4 or CI8 (-f)\n");
+        return 1;
+    }
+    if (pm->outfmt == FMT_CI8)
+        num_banks = 1;
+
+    int ret = 1;
+    image_t *imgs = calloc(num, sizeof(image_t));
+    image_t **group = malloc(num * sizeof(image_t*));
+    int *bank_of = calloc(num, sizeof(int));
+    uint8_t (*colors)[4] = calloc(256, 4);
+
+    // Load all images as RGBA, as we will quantize them from scratch
+    for (int i=0; i<num; i++) {
+        palette_t pal;
+        if (!load_png_image(infns[i], FMT_RGBA32, &imgs[i], &pal))
+            goto error;
+    }
+
+    if (pm->outfmt == FMT_CI8) {
+        for (int i=0; i<num; i++) group[i] = &imgs[i];
+        quantize_images(group, num, 256, colors);
+    } else {
+        // Clustering of images into banks (k-means like). Seed each bank with
+        // the palette of one of the biggest images, then alternate between
+        // assigning each image to the best bank and recomputing the palettes.
+        if (num_banks > num) num_banks = num;
+        int *order = malloc(num * sizeof(int));
+        for (int i=0; i<num; i++) order[i] = i;
+        for (int i=0; i<num; i++)
+            for (int j=i+1; j<num; j++)
+                if (imgs[order[j]].width * imgs[order[j]].height > imgs[order[i]].width * imgs[order[i]].height)
+                    SWAP(order[i], order[j]);
+        for (int b=0; b<num_banks; b++) {
+            group[0] = &imgs[order[b]];
+            quantize_images(group, 1, 16, &colors[b*16]);
+        }
+        free(order);
+
+        uint64_t *img_err = malloc(num * sizeof(uint64_t));
+        int *bank_size = malloc(num_banks * sizeof(int));
+        for (int iter=0; iter<8; iter++) {
+            bool changed = false;
+            memset(bank_size, 0, num_banks * sizeof(int));
+            for (int i=0; i<num; i++) {
+                int best = 0; uint64_t best_err = UINT64_MAX;
+                for (int b=0; b<num_banks; b++) {
+                    uint64_t err = palette_error(&imgs[i], &colors[b*16]);
+                    if (err < best_err) { best_err = err; best = b; }
+                }
+                if (iter == 0 || bank_of[i] != best) changed = true;
+                bank_of[i] = best;
+                img_err[i] = best_err;
+                bank_size[best]++;
+            }
+            // Do not waste banks: move the worst represented image to each
+            // empty bank, so that it will get a palette of its own
+            for (int b=0; b<num_banks; b++) {
+                if (bank_size[b]) continue;
+                int worst = -1;
+                for (int i=0; i<num; i++)
+                    if (bank_size[bank_of[i]] > 1 && (worst < 0 || img_err[i] > img_err[worst]))
+                        worst = i;
+                if (worst < 0) break;
+                bank_size[bank_of[worst]]--;
+                bank_of[worst] = b;
+                bank_size[b]++;
+                img_err[worst] = 0;
+                changed = true;
+            }
+            if (!changed)
+                break;
+            for (int b=0; b<num_banks; b++) {
+                int n = 0;
+                for (int i=0; i<num; i++)
+                    if (bank_of[i] == b) group[n++] = &imgs[i];
+                if (n) quantize_images(group, n, 16, &colors[b*16]);
+            }
+        }
+        free(img_err);
+        free(bank_size);
+    }
+
+    if (flag_verbose)
+        fprintf(stderr, "shared palette: %d images, %d colors\n", num, pm->outfmt == FMT_CI8 ? 256 : num_banks*16);
+
+    // Convert each image using the shared palette
+    ret = 0;
+    for (int i=0; i<num; i++) {
+        parms_t ipm = *pm;
+        ipm.shared_palette.colors = colors;
+        ipm.shared_palette.num_colors = pm->outfmt == FMT_CI8 ? 256 : num_banks*16;
+        ipm.shared_palette.bank = bank_of[i];
+
+        char *basename = strrchr(infns[i], '/');
+        if (!basename) basename = infns[i]; else basename += 1;
+        char* basename_noext = strdup(basename);
+        char* ext = strrchr(basename_noext, '.');
+        if (ext) *ext = '\0';
+        char *outfn;
+        asprintf(&outfn, "%s/%s.sprite", outdir, basename_noext);
+        if (flag_verbose && num_banks > 1)
+            fprintf(stderr, "%s: palette bank %d\n", outfn, bank_of[i]);
+        if (convert_and_compress(infns[i], outfn, &ipm, compression) != 0)
+            ret = 1;
+        free(outfn);
+        free(basename_noext);
+    }
+
+error:
+    for (int i=0; i<num; i++)
+        if (imgs[i].image) free(imgs[i].image);
+    free(imgs);
+    free(group);
+    free(bank_of);
+    free(colors);
+    return ret;
+}
+
+/** @brief An image to place into an atlas */
+typedef struct {
+    char *infn;             ///< Input PNG file
+    char *name;             ///< Name of the image in the atlas (basename without extension)
+    image_t img;            ///< Loaded pixels
+    int page;               ///< Page where the image was placed
+    int x, y;               ///< Position of the image within the page
+} atlas_image_t;
+
+/** @brief A shelf (row of images) within an atlas page */
+typedef struct {
+    int page;               ///< Page of the shelf
+    int y;                  ///< Vertical position of the shelf
+    int height;             ///< Height of the shelf (height of its first image)
+    int used;               ///< Horizontal space already used
+} atlas_shelf_t;
+
+int cmp_atlas_height(const void *a, const void *b)
+{
+    const atlas_image_t *ia = a, *ib = b;
+    if (ia->img.height != ib->img.height) return ib->img.height - ia->img.height;
+    return ib->img.width - ia->img.width;
+}
+
+int cmp_atlas_name(const void *a, const void *b)
+{
+    const atlas_image_t *ia = a, *ib = b;
+    return strcmp(ia->name, ib->name);
+}
+
+// Pack the images into pages of the specified size, using a first-fit
+// decreasing-height shelf algorithm (images must be sorted by height).
+// Horizontal positions are aligned to xalign pixels (needed for 4bpp formats).
+// Returns the number of pages (or -1 if an image does not fit a page), and
+// fills page_heights with the height actually used in each page.
+int atlas_pack(atlas_image_t *imgs, int num, int page_w, int page_h, int padding, int xalign, int *page_heights)
+{
+    atlas_shelf_t *shelves = malloc(num * sizeof(atlas_shelf_t));
+    int *page_top = malloc(num * sizeof(int));
+    int num_shelves = 0, num_pages = 0;
+
+    for (int i=0; i<num; i++) {
+        atlas_image_t *img = &imgs[i];
+        int w = img->img.width, h = img->img.height;
+        if (w > page_w || h > page_h) {
+            num_pages = -1;
+            break;
+        }
+
+        // Try to put the image in an existing shelf
+        atlas_shelf_t *s = NULL;
+        for (int j=0; j<num_shelves && !s; j++)
+            if (h <= shelves[j].height && ROUND_UP(shelves[j].used, xalign) + w <= page_w)
+                s = &shelves[j];
+
+        // Otherwise, open a new shelf in the first page with enough space
+        if (!s) {
+            int p = 0;
+            while (p < num_pages && page_top[p] + h > page_h)
+                p++;
+            if (p == num_pages) {
+                page_top[num_pages] = 0;
+                page_heights[num_pages] = 0;
+                num_pages++;
+            }
+            s = &shelves[num_shelves++];
+            *s = (atlas_shelf_t){ .page = p, .y = page_top[p], .height = h };
+            page_top[p] += h + padding;
+        }
+
+        img->page = s->page;
+        img->x = ROUND_UP(s->used, xalign);
+        img->y = s->y;
+        s->used = img->x + w + padding;
+        if (page_heights[s->page] < img->y + h)
+            page_heights[s->page] = img->y + h;
+    }
+
+    free(page_top);
+    free(shelves);
+    return num_pages;
+}
+
+// Pack multiple PNG files into one or more atlas pages, each of which fits
+// TMEM, and write the pages as sprites together with an index file
+int atlas_convert(const char *name, const char *outdir, char **infns, int num, const parms_t *pm, int compression, int padding)
+{
+    tex_format_t fmt = pm->outfmt;
+    tex_format_t loadfmt = fmt;
+    int bpp;
+    switch ((int)fmt) {
+    case FMT_RGBA32: case FMT_RGBA16: bpp = 4; break;
+    case FMT_CI8: case FMT_CI4: bpp = 4; loadfmt = FMT_RGBA32; break;
+    case FMT_IA16: case FMT_IA8: case FMT_IA4: bpp = 2; break;
+    case FMT_I8: case FMT_I4: bpp = 1; break;
+    case FMT_NONE:
+        fprintf(stderr, "ERROR: atlas mode requires an explicit output format (-f)\n");
+        return 1;
+    default:
+        fprintf(stderr, "ERROR: format %s is not supported in atlas mode\n", tex_format_name(fmt));
+        return 1;
+    }
+    if (pm->mipmap_algo != MIPMAP_ALGO_NONE || pm->detail.enabled) {
+        fprintf(stderr, "ERROR: mipmaps and detail textures are not supported in atlas mode\n");
+        return 1;
+    }
+    if (pm->vq) {
+        fprintf(stderr, "ERROR: VQ compression is not supported in atlas mode\n");
+        return 1;
+    }
+    bool is_ci = (fmt == FMT_CI4 || fmt == FMT_CI8);
+    int tmem_limit = is_ci ? 2048 : 4096;
+    int xalign = TEX_FORMAT_BITDEPTH(fmt) == 4 ? 2 : 1;
+
+    int ret = 1;
+    int num_pages = 0;
+    int *page_heights = NULL;
+    atlas_image_t *imgs = calloc(num, sizeof(atlas_image_t));
+
+    // Load all the images
+    int max_w = 0;
+    for (int i=0; i<num; i++) {
+        atlas_image_t *img = &imgs[i];
+        img->infn = infns[i];
+        char *basename = strrchr(img->infn, '/');
+        if (!basename) basename = img->infn; else basename += 1;
+        img->name = strdup(basename);
+        char *ext = strrchr(img->name, '.');
+        if (ext) *ext = '\0';
+
+        palette_t pal;
+        if (!load_png_image(img->infn, loadfmt, &img->img, &pal))
+            goto error;
+        if (max_w < img->img.width) max_w = img->img.width;
+    }
+
+    // Names are used for lookups, so they must be unique
+    qsort(imgs, num, sizeof(atlas_image_t), cmp_atlas_name);
+    for (int i=1; i<num; i++) {
+        if (!strcmp(imgs[i-1].name, imgs[i].name)) {
+            fprintf(stderr, "ERROR: duplicated image name in atlas: %s (%s, %s)\n", imgs[i].name, imgs[i-1].infn, imgs[i].infn);
+            goto error;
+        }
+    }
+
+    // Find the best page width. For each candidate, the page height is the
+    // maximum that fits TMEM; we then prefer the layout with less pages and,
+    // among those, the one that uses less TMEM (and thus ROM) overall.
+    qsort(imgs, num, sizeof(atlas_image_t), cmp_atlas_height);
+    page_heights = calloc(num, sizeof(int));
+    int best_w = 0, best_pages = 0, best_size = 0;
+    for (int w = ROUND_UP(max_w, 8); w <= 1024; w += 8) {
+        int h = tmem_limit / calc_tmem_usage(fmt, w, 1);
+        if (h > 1024) h = 1024;
+        int np = atlas_pack(imgs, num, w, h, padding, xalign, page_heights);
+        if (np < 0)
+            continue;
+        int size = 0;
+        for (int p=0; p<np; p++)
+            size += calc_tmem_usage(fmt, w, page_heights[p]);
+        if (!best_w || np < best_pages || (np == best_pages && size < best_size)) {
+            best_w = w;
+            best_pages = np;
+            best_size = size;
+        }
+    }
+    if (!best_w) {
+        fprintf(stderr, "ERROR: some images are too big to fit TMEM in format %s\n", tex_format_name(fmt));
+        goto error;
+    }
+    int page_h = tmem_limit / calc_tmem_usage(fmt, best_w, 1);
+    if (page_h > 1024) page_h = 1024;
+    num_pages = atlas_pack(imgs, num, best_w, page_h, padding, xalign, page_heights);
+    if (flag_verbose)
+        fprintf(stderr, "atlas %s: %d images packed into %d pages of %dx%d (%s)\n",
+            name, num, num_pages, best_w, page_h, tex_format_name(fmt));
+
+    // Compose and write each page as a sprite
+    for (int p=0; p<num_pages; p++) {
+        spritemaker_t spr = {0};
+        char *outfn;
+        asprintf(&outfn, "%s/%s.%d.sprite", outdir, name, p);
+        spr.infn = name;
+        spr.outfn = outfn;
+        spr.hslices = 1;
+        spr.vslices = 1;
+        spr.texparms = pm->texparms;
+        if (!spr.texparms.defined) {
+            spr.texparms.s.repeats = 1;
+            spr.texparms.t = spr.texparms.s;
+        }
+
+        image_t *page = &spr.images[0];
+        page->width = best_w;
+        page->height = page_heights[p];
+        page->fmt = fmt;
+        page->ct = bpp == 4 ? LCT_RGBA : bpp == 2 ? LCT_GREY_ALPHA : LCT_GREY;
+        page->image = calloc(page->width * page->height, bpp);
+        for (int i=0; i<num; i++) {
+            atlas_image_t *img = &imgs[i];
+            if (img->page != p) continue;
+            for (int y=0; y<img->img.height; y++)
+                memcpy(page->image + ((img->y + y) * page->width + img->x) * bpp,
+                    img->img.image + y * img->img.width * bpp, img->img.width * bpp);
+        }
+
+        bool ok = true;
+        if (is_ci)
+            ok = spritemaker_quantize(&spr, NULL, fmt == FMT_CI8 ? 256 : 16, pm->dither_algo);
+        if (ok && flag_verbose) {
+            int tmem_usage; spritemaker_fit_tmem(&spr, &tmem_usage);
+            fprintf(stderr, "page %d: %dx%d, TMEM required: %d bytes\n", p, page->width, page->height, tmem_usage);
+        }
+        ok = ok && spritemaker_write(&spr);
+        if (ok && flag_debug)
+            spritemaker_write_pngs(&spr);
+        spritemaker_free(&spr);
+        if (ok && compression == -1)
+            compression = DEFAULT_COMPRESSION;
+        if (ok && compression)
+            asset_compress(outfn, outfn, compression, 0);
+        free(outfn);
+        if (!ok)
+            goto error;
+    }
+
+    // Write the index file. Images are sorted by name so that they can be
+    // looked up with a binary search at runtime.
+    qsort(imgs, num, sizeof(atlas_image_t), cmp_atlas_name);
+    char *outfn;
+    asprintf(&outfn, "%s/%s.atlas", outdir, name);
+    FILE *out = fopen(outfn, "wb");
+    if (!out) {
+        fprintf(stderr, "ERROR: cannot open output file %s\n", outfn);
+        free(outfn);
+        goto error;
+    }
+    int pages_off = 28;
+    int images_off = pages_off + num_pages * 4;
+    int strings_off = images_off + num * 16;
+    fwrite("ATLS", 1, 4, out);
+    w32(out, 1);                // version
+    w32(out, num_pages);
+    w32(out, num);
+    w32(out, pages_off);
+    w32(out, images_off);
+    w32(out, strings_off);
+
+    int str_pos = 0;
+    char **page_names = malloc(num_pages * sizeof(char*));
+    for (int p=0; p<num_pages; p++) {
+        asprintf(&page_names[p], "%s.%d.sprite", name, p);
+        w32(out, str_pos);
+        str_pos += strlen(page_names[p]) + 1;
+    }
+    for (int i=0; i<num; i++) {
+        w32(out, str_pos);
+        str_pos += strlen(imgs[i].name) + 1;
+        w16(out, imgs[i].page);
+        w16(out, imgs[i].x);
+        w16(out, imgs[i].y);
+        w16(out, imgs[i].img.width);
+        w16(out, imgs[i].img.height);
+        w16(out, 0);            // padding
+    }
+    for (int p=0; p<num_pages; p++) {
+        fwrite(page_names[p], 1, strlen(page_names[p]) + 1, out);
+        free(page_names[p]);
+    }
+    for (int i=0; i<num; i++)
+        fwrite(imgs[i].name, 1, strlen(imgs[i].name) + 1, out);
+    free(page_names);
+    fclose(out);
+    free(outfn);
+    ret = 0;
+
+error:
+    for (int i=0; i<num; i++) {
+        free(imgs[i].name);
+        if (imgs[i].img.image) free(imgs[i].img.image);
+    }
+    free(imgs);
+    free(page_heights);
+    return ret;
+}
+
 int main(int argc, char *argv[])
 {
     char *infn = NULL, *outdir = ".", *outfn = NULL;
+    char *manifest = NULL, *cachefn = NULL;
+    char *atlas = NULL, **group_files = NULL;
+    int atlas_padding = 0;
+    bool shared_palette = false;
+    int palette_banks = 1;
     parms_t pm = {0}; int compression = -1;
+    int num_threads = 0;
     bool at_least_one_file = false;
 
     if (argc < 2) {
@@ -1418,168 +2650,94 @@ int main(int argc, char *argv[])
                 outdir = argv[i];
             } 
 
-            /* ---------------- FORMAT console argument ------------------- */
-            /* -f/--format <fmt>     Specify output format (default: AUTO)             */
-            else if (!strcmp(argv[i], "-f") || !strcmp(argv[i], "--format")) {
+            /* ---------------- BATCH console arguments ------------------- */
+            /* --batch <manifest>    Convert all files listed in the manifest             */
+            else if (!strcmp(argv[i], "--batch")) {
                 if (++i == argc) {
                     fprintf(stderr, "missing argument for %s\n", argv[i-1]);
                     return 1;
                 }
-                pm.outfmt = tex_format_from_name(argv[i]);
-                if (pm.outfmt == FMT_NONE && strcasecmp(argv[i], "AUTO") != 0) {
-                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
-                    print_supported_formats();
-                    return 1;
-                }
-            } 
-
-            /* ---------------- HV TILES console argument ------------------- */
-            else if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--tiles")) {
+                manifest = argv[i];
+            }
+            /* --cache <file>        Cache file for batch mode             */
+            else if (!strcmp(argv[i], "--cache")) {
                 if (++i == argc) {
                     fprintf(stderr, "missing argument for %s\n", argv[i-1]);
                     return 1;
                 }
-                char extra;
-                if (sscanf(argv[i], "%d,%d%c", &pm.tilew, &pm.tileh, &extra) != 2) {
-                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
-                    return 1;
-                }
+                cachefn = argv[i];
             }
-            
-            /* ---------------- MIPMAP console argument ------------------- */
-            /* -m/--mipmap <algo>                    Calculate mipmap levels using the specified algorithm (default: NONE)             */
-             else if (!strcmp(argv[i], "-m") || !strcmp(argv[i], "--mipmap")) {
+            /* -j/--jobs <N>         Number of parallel conversions in batch mode             */
+            else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
                 if (++i == argc) {
                     fprintf(stderr, "missing argument for %s\n", argv[i-1]);
                     return 1;
                 }
-                if (!strcmp(argv[i], "NONE")) pm.mipmap_algo = MIPMAP_ALGO_NONE;
-                else if (!strcmp(argv[i], "BOX")) pm.mipmap_algo = MIPMAP_ALGO_BOX;
-                else {
-                    fprintf(stderr, "invalid mipmap algorithm: %s\n", argv[i]);
-                    print_supported_mipmap();
-                    return 1;
-                }
-            } 
+                num_threads = atoi(argv[i]);
+            }
 
-            /* ---------------- DITHER console argument ------------------- */
-            /* -D/--dither <dither>  Dithering algorithm (default: NONE)             */
-            else if (!strcmp(argv[i], "-D") || !strcmp(argv[i], "--dither")) {
+            /* ---------------- SHARED PALETTE console arguments ------------------- */
+            /* --shared-palette      Quantize all input files with the same palette             */
+            else if (!strcmp(argv[i], "--shared-palette")) {
+                shared_palette = true;
+            }
+            /* --palette-banks <N>   Number of 16-color banks of the shared palette             */
+            else if (!strcmp(argv[i], "--palette-banks")) {
                 if (++i == argc) {
                     fprintf(stderr, "missing argument for %s\n", argv[i-1]);
                     return 1;
                 }
-                if (!strcmp(argv[i], "NONE")) pm.dither_algo = DITHER_ALGO_NONE;
-                else if (!strcmp(argv[i], "RANDOM")) pm.dither_algo = DITHER_ALGO_RANDOM;
-                else if (!strcmp(argv[i], "ORDERED")) pm.dither_algo = DITHER_ALGO_ORDERED;
-                else {
-                    fprintf(stderr, "invalid dithering algorithm: %s\n", argv[i]);
-                    print_supported_dithers();
+                palette_banks = atoi(argv[i]);
+                if (palette_banks < 1 || palette_banks > 16) {
+                    fprintf(stderr, "invalid number of palette banks: %s (must be 1-16)\n", argv[i]);
                     return 1;
                 }
-            } 
-            
-            /* ---------------- COMPRESS console argument ------------------- */
-            /* -c/--compress         Compress output files (using mksasset)             */
-            else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--compress")) {
-                // Optional compression level
-                if (i+1 < argc && argv[i+1][1] == 0) {
-                    int level = argv[i+1][0] - '0';
-                    if (level >= 0 && level <= 3) {
-                        compression = level;
-                        i++;
-                    }
-                    else {
-                        fprintf(stderr, "invalid compression level: %s\n", argv[i+1]);
-                        return 1;
-                    }
-                }
             }
 
-            /* ---------------- TEXTURE PARAMETERS console argument ------------------- */
-            /* --texparms <x,s,r,m>          Sampling parameters             */
-            /* --texparms <x,x,s,s,r,r,m,m>  Sampling parameters (different for S/T)             */
-            else if (!strcmp(argv[i], "--texparms")) {
+            /* ---------------- ATLAS console arguments ------------------- */
+            /* --atlas <name>        Pack all input files into an atlas             */
+            else if (!strcmp(argv[i], "--atlas")) {
                 if (++i == argc) {
                     fprintf(stderr, "missing argument for %s\n", argv[i-1]);
                     return 1;
                 }
-                if (!cli_parse_texparms(argv[i], &pm.texparms))
-                    return 1;
-            } 
-            
-            /* ---------------- DETAIL console argument ------------------- */
-            /* --detail [<image>][,<fmt>][,<factor>] Activate detail texture             */
-            else if (!strcmp(argv[i], "--detail")) {
-                pm.detail.blend_factor = 0.5;
-                pm.detail.use_main_tex = true;
-                pm.detail.outfmt = FMT_NONE;
-                pm.detail.infn = NULL;
-                pm.detail.enabled = true;
-
-                if (++i != argc) {
-                    char *fntok = strdup(argv[i]);
-                    char *sect = strtok(fntok, ",");
-
-                    // First argument is either the filename or the factor. If
-                    // it's the factor, we should be done
-                    if (!sscanf(sect, "%f", &pm.detail.blend_factor)) {
-                        // Not a floating point number, should be a filename,
-                        // but error out if it's a format instead
-                        if (tex_format_from_name(sect) != FMT_NONE) {
-                            fprintf(stderr, "cannot specify a format without a filename for %s: %s\n", argv[i-1], argv[i]);
-                            return 1;
-                        }
-                        pm.detail.infn = sect;
-                        pm.detail.use_main_tex = false;
-
-                        // Next argument is either the format or the factor
-                        sect = strtok(NULL, ",");
-                        if (sect) {
-                            tex_format_t fmt = tex_format_from_name(sect);
-                            if (fmt != FMT_NONE) {
-                                pm.detail.outfmt = fmt;
-                                sect = strtok(NULL, ",");
-                            }
-                        }
-                        // Third argument (or second) must be the blend factor
-                        if (sect) {
-                            if (!sscanf(sect, "%f", &pm.detail.blend_factor)) {
-                                fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
-                                return 1;
-                            }
-                        }
-                    }
-                    // There should be no other arguments
-                    sect = strtok(NULL, ",");
-                    if (sect) {
-                        fprintf(stderr, "too many values for argument %s: %s\n", argv[i-1], argv[i]);
-                        return 1;
-                    }
-                }
+                atlas = argv[i];
             }
-
-            /* ---------------- DETAIL TEXTURE PARAMETERS console argument ------------------- */
-            /* --detail-texparms <x,s,r,m>          Sampling parameters             */
-            /* --detail-texparms <x,x,s,s,r,r,m,m>  Sampling parameters (different for S/T)             */
-            else if (!strcmp(argv[i], "--detail-texparms")) {
+            /* --atlas-padding <N>   Empty pixels between images in the atlas             */
+            else if (!strcmp(argv[i], "--atlas-padding")) {
                 if (++i == argc) {
                     fprintf(stderr, "missing argument for %s\n", argv[i-1]);
                     return 1;
                 }
-                if (!cli_parse_texparms(argv[i], &pm.detail.texparms))
+                atlas_padding = atoi(argv[i]);
+                if (atlas_padding < 0) {
+                    fprintf(stderr, "invalid atlas padding: %s\n", argv[i]);
                     return 1;
+                }
             }
-            
+
             else {
-                fprintf(stderr, "invalid flag: %s\n", argv[i]);
-                return 1;
+                int ret = cli_parse_conv_flag(argc, argv, &i, &pm, &compression);
+                if (ret == 0)
+                    fprintf(stderr, "invalid flag: %s\n", argv[i]);
+                if (ret <= 0)
+                    return 1;
             }
             continue;
         }
 
+        if (manifest) {
+            fprintf(stderr, "cannot specify input files together with --batch\n");
+            return 1;
+        }
+
         at_least_one_file = true;
         infn = argv[i];
+        if (atlas || shared_palette) {
+            // Images are processed together once all of them are known
+            stbds_arrput(group_files, infn);
+            continue;
+        }
         char *basename = strrchr(infn, '/');
         if (!basename) basename = infn; else basename += 1;
         char* basename_noext = strdup(basename);
@@ -1588,25 +2746,45 @@ int main(int argc, char *argv[])
 
         asprintf(&outfn, "%s/%s.sprite", outdir, basename_noext);
 
-        if (convert(infn, outfn, &pm) != 0) {
+        if (convert_and_compress(infn, outfn, &pm, compression) != 0)
             error = true;
-        } else {
-            if (compression == -1)
-                compression = DEFAULT_COMPRESSION;
-            if (compression) {
-                struct stat st_decomp = {0}, st_comp = {0};
-                stat(outfn, &st_decomp);
-                asset_compress(outfn, outfn, compression, 0);
-                stat(outfn, &st_comp);
-                if (flag_verbose)
-                    fprintf(stderr, "compressed: %s (%d -> %d, ratio %.1f%%)\n", outfn,
-                    (int)st_decomp.st_size, (int)st_comp.st_size, 100.0 * (float)st_comp.st_size / (float)(st_decomp.st_size == 0 ? 1 :st_decomp.st_size));
-            }
-        }
 
         free(outfn);
     }
 
+    if (manifest) {
+        if (!cachefn)
+            asprintf(&cachefn, "%s.cache", manifest);
+        if (num_threads <= 0)
+            num_threads = cpu_count();
+        return batch_convert(manifest, cachefn, &pm, compression, num_threads);
+    }
+
+    if (atlas && shared_palette) {
+        fprintf(stderr, "cannot use --shared-palette together with --atlas\n");
+        return 1;
+    }
+
+    if (shared_palette) {
+        if (!at_least_one_file) {
+            fprintf(stderr, "no input files specified for --shared-palette\n");
+            return 1;
+        }
+        error = shared_palette_convert(group_files, stbds_arrlen(group_files), outdir, &pm, compression, palette_banks) != 0;
+        stbds_arrfree(group_files);
+        return error ? 1 : 0;
+    }
+
+    if (atlas) {
+        if (!at_least_one_file) {
+            fprintf(stderr, "no input files specified for atlas %s\n", atlas);
+            return 1;
+        }
+        error = atlas_convert(atlas, outdir, group_files, stbds_arrlen(group_files), &pm, compression, atlas_padding) != 0;
+        stbds_arrfree(group_files);
+        return error ? 1 : 0;
+    }
+
     if (!at_least_one_file) {
         infn = "(stdin)";
         outfn = "(stdout)";
@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STBDS_NO_SHORT_NAMES
+#define STB_DS_IMPLEMENTATION
+#include "common/stb_ds.h"
+
+#include "common/elfdwarf.h"
+
+// Dump file magic and version (see binlog.h)
+#define BINLOG_MAGIC        0x424C4F47
+#define BINLOG_VERSION      1
+
+// Argument types (see binlog.h)
+#define BINLOG_ARG_I32      0
+#define BINLOG_ARG_I64      1
+#define BINLOG_ARG_DOUBLE   2
+#define BINLOG_ARG_STR      3
+
+bool flag_timestamps = false;
+
+void usage(const char *progname)
+{
+    fprintf(stderr, "%s - Decode binary logs created by libdragon's binlog module\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Usage: %s [flags] <log.bin> <program.elf>\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "The log is the file written by binlog_dump or sent via USB by binlog_dump_usb.\n");
+    fprintf(stderr, "The ELF file must be the one of the ROM that created the log, as the format\n");
+    fprintf(stderr, "strings are read from it.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Command-line flags:\n");
+    fprintf(stderr, "   -t/--timestamps       Prefix each message with its timestamp (in seconds)\n");
+}
+
+// Read a big-endian 32-bit word
+uint32_t r32(const uint8_t *p) { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+// Read a big-endian 64-bit word
+uint64_t r64(const uint8_t *p) { return ((uint64_t)r32(p) << 32) | r32(p + 4); }
+
+// Load a whole file in memory
+uint8_t *load_file(const char *fn, int *size)
+{
+    FILE *f = fopen(fn, "rb");
+    if (!f) {
+        fprintf(stderr, "cannot open file: %s\n", fn);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(*size);
+    fread(buf, 1, *size, f);
+    fclose(f);
+    return buf;
+}
+
+// Find the format string at the specified address in the ELF file
+const char *elf_string(elf_t *elf, uint32_t addr)
+{
+    for (int i = 0; i < elf->num_sections; i++) {
+        elf_section_t *sec = &elf->sections[i];
+        if (!(sec->flags & ELF_SHF_ALLOC) || !sec->data || sec->type == ELF_SHT_NOBITS)
+            continue;
+        // Addresses are sign-extended in 64-bit ELF files
+        uint32_t start = sec->addr;
+        if (addr >= start && addr < start + sec->size) {
+            const char *s = (const char *)sec->data + (addr - start);
+            if (memchr(s, 0, start + sec->size - addr))
+                return s;
+        }
+    }
+    return NULL;
+}
+
+// A decoded argument
+typedef struct {
+    int type;
+    uint64_t i;
+    double d;
+    char s[256];
+} arg_t;
+
+// Print a message, given the format string and the decoded arguments
+void print_message(const char *fmt, arg_t *args, int nargs)
+{
+    int cur = 0;
+    while (*fmt) {
+        if (*fmt != '%') {
+            putchar(*fmt++);
+            continue;
+        }
+        if (fmt[1] == '%') {
+            putchar('%');
+            fmt += 2;
+            continue;
+        }
+
+        // Copy the conversion specification, without the length modifiers
+        // (the type of the argument is known from the log).
+        char spec[64]; int n = 0;
+        spec[n++] = *fmt++;
+        while (*fmt && strchr("-+ #0123456789.*", *fmt) && n < sizeof(spec) - 8) {
+            if (*fmt == '*') {
+                // Width/precision passed as argument
+                int star = cur < nargs ? (int)args[cur++].i : 0;
+                n += sprintf(spec + n, "%d", star);
+                fmt++;
+                continue;
+            }
+            spec[n++] = *fmt++;
+        }
+        while (*fmt && strchr("hlLqjzt", *fmt))
+            fmt++;
+        char conv = *fmt ? *fmt++ : 'd';
+
+        if (cur >= nargs) {
+            printf("<missing>");
+            continue;
+        }
+        arg_t *a = &args[cur++];
+        switch (a->type) {
+        case BINLOG_ARG_STR:
+            spec[n++] = 's'; spec[n] = 0;
+            printf(spec, a->s);
+            break;
+        case BINLOG_ARG_DOUBLE:
+            spec[n++] = strchr("fFeEgGaA", conv) ? conv : 'g'; spec[n] = 0;
+            printf(spec, a->d);
+            break;
+        case BINLOG_ARG_I32:
+        case BINLOG_ARG_I64:
+            if (conv == 'p') {
+                printf("0x%08llx", (unsigned long long)a->i);
+                break;
+            }
+            if (conv == 's') {
+                // A pointer to a string that was not copied: print the address
+                printf("<%08llx>", (unsigned long long)a->i);
+                break;
+            }
+            if (conv == 'c') {
+                spec[n++] = 'c'; spec[n] = 0;
+                printf(spec, (int)a->i);
+                break;
+            }
+            if (!strchr("diouxX", conv))
+                conv = 'd';
+            spec[n++] = 'l'; spec[n++] = 'l'; spec[n++] = conv; spec[n] = 0;
+            if (conv == 'd' || conv == 'i')
+                printf(spec, a->type == BINLOG_ARG_I32 ? (long long)(int32_t)a->i : (long long)a->i);
+            else
+                printf(spec, (unsigned long long)a->i);
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            usage(argv[0]);
+            return 0;
+        } else if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--timestamps")) {
+            flag_timestamps = true;
+        } else {
+            fprintf(stderr, "invalid flag: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (argc - i != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    elf_t *elf = elf_open(argv[i+1]);
+    if (!elf) {
+        fprintf(stderr, "cannot open ELF file: %s\n", argv[i+1]);
+        return 1;
+    }
+
+    int size;
+    uint8_t *buf = load_file(argv[i], &size);
+    if (size < 20 || r32(buf) != BINLOG_MAGIC || r32(buf + 4) != BINLOG_VERSION) {
+        fprintf(stderr, "invalid or unsupported binary log: %s\n", argv[i]);
+        return 1;
+    }
+    uint32_t ticks_per_second = r32(buf + 8);
+    uint32_t num_bytes = r32(buf + 12);
+    uint32_t num_dropped = r32(buf + 16);
+    if (num_bytes > size - 20) {
+        fprintf(stderr, "truncated binary log: %s\n", argv[i]);
+        num_bytes = size - 20;
+    }
+
+    const uint8_t *ptr = buf + 20, *end = ptr + num_bytes;
+    uint64_t elapsed = 0; uint32_t last_ts = 0;
+    bool first = true;
+    arg_t args[32];
+
+    while (ptr < end) {
+        if (end - ptr < 9)
+            goto truncated;
+        uint32_t addr = r32(ptr);
+        uint32_t ts = r32(ptr + 4);
+        int nargs = ptr[8];
+        ptr += 9;
+        if (nargs > 32 || end - ptr < nargs)
+            goto truncated;
+        const uint8_t *tags = ptr;
+        ptr += nargs;
+
+        for (int j = 0; j < nargs; j++) {
+            args[j].type = tags[j];
+            switch (tags[j]) {
+            case BINLOG_ARG_I32:
+                if (end - ptr < 4) goto truncated;
+                args[j].i = r32(ptr); ptr += 4;
+                break;
+            case BINLOG_ARG_I64:
+                if (end - ptr < 8) goto truncated;
+                args[j].i = r64(ptr); ptr += 8;
+                break;
+            case BINLOG_ARG_DOUBLE: {
+                if (end - ptr < 8) goto truncated;
+                uint64_t v = r64(ptr); ptr += 8;
+                memcpy(&args[j].d, &v, 8);
+            }   break;
+            case BINLOG_ARG_STR: {
+                if (end - ptr < 1 || end - ptr < 1 + ptr[0]) goto truncated;
+                int len = *ptr++;
+                memcpy(args[j].s, ptr, len);
+                args[j].s[len] = 0;
+                ptr += len;
+            }   break;
+            default:
+                fprintf(stderr, "invalid argument type %d in binary log\n", tags[j]);
+                return 1;
+            }
+        }
+
+        // Timestamps are 32-bit and wrap around: accumulate the deltas
+        if (first) { last_ts = ts; first = false; }
+        elapsed += (uint32_t)(ts - last_ts);
+        last_ts = ts;
+        if (flag_timestamps)
+            printf("[%12.6f] ", (double)elapsed / ticks_per_second);
+
+        const char *fmt = elf_string(elf, addr);
+        if (fmt)
+            print_message(fmt, args, nargs);
+        else
+            printf("<unknown format string at %08x>\n", addr);
+    }
+
+    if (num_dropped)
+        fprintf(stderr, "%u messages were dropped because the buffer was full\n", num_dropped);
+    elf_close(elf);
+    return 0;
+
+truncated:
+    fprintf(stderr, "truncated message in binary log\n");
+    return 1;
+}
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STBDS_NO_SHORT_NAMES
+#define STB_DS_IMPLEMENTATION
+#include "common/stb_ds.h"
+#include "common/symt.h"
+
+// Dump file magic and version (see memprof.h)
+#define MEMPROF_MAGIC       0x4D454D50
+#define MEMPROF_VERSION     1
+// Maximum depth of the call sites (see memprof.c)
+#define MEMPROF_MAX_DEPTH   16
+
+enum { SORT_LIVE, SORT_PEAK, SORT_COUNT };
+
+int flag_sort = SORT_LIVE;
+int flag_max_sites = 20;
+bool flag_all = false;
+bool flag_folded = false;
+bool flag_inlines = true;
+
+void usage(const char *progname)
+{
+    fprintf(stderr, "%s - Analyze heap allocations dumped by libdragon's memprof module\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Usage: %s [flags] <memprof.bin> <program.sym>\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "The dump is the file written by memprof_dump or sent via USB by memprof_dump_usb.\n");
+    fprintf(stderr, "The symbol table is the one created by n64sym for the profiled ROM.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Command-line flags:\n");
+    fprintf(stderr, "   --live                Sort call sites by live bytes (default)\n");
+    fprintf(stderr, "   --peak                Sort call sites by peak bytes\n");
+    fprintf(stderr, "   --count               Sort call sites by number of allocations\n");
+    fprintf(stderr, "   --all                 Also list call sites without live allocations\n");
+    fprintf(stderr, "   --folded              Folded stacks weighted by live bytes, to be used with flamegraph.pl\n");
+    fprintf(stderr, "   -n/--max-sites <N>    Maximum number of call sites in the report (default: 20)\n");
+    fprintf(stderr, "   --no-inlines          Do not expand inlined functions at callsites\n");
+}
+
+// Symbol table created by n64sym
+symt_t symt;
+
+// A symbolized frame: function name and source location
+typedef struct {
+    char *func;
+    char *file;
+    int line;
+} frame_t;
+
+// Copy a string of the string table
+char *symt_string(const char *str, int len)
+{
+    char *s = malloc(len+1);
+    memcpy(s, str, len); s[len] = 0;
+    return s;
+}
+
+// Symbolize a return address, appending the frames to the array, from the
+// innermost to the outermost one.
+void symbolize(uint32_t addr, frame_t **frames)
+{
+    int *entries = NULL;
+    symt_symbolize(&symt, addr, flag_inlines, &entries);
+    for (int i=0; i<stbds_arrlen(entries); i++) {
+        if (entries[i] < 0) {
+            stbds_arrput(*frames, ((frame_t){ .func = "???", .file = "???" }));
+            continue;
+        }
+        // The line is only meaningful if the address is the callsite itself,
+        // rather than somewhere within the function.
+        symt_entry_t e = symt_entry(&symt, entries[i]);
+        stbds_arrput(*frames, ((frame_t){
+            .func = symt_string(e.func, e.func_len),
+            .file = symt_string(e.file, e.file_len),
+            .line = e.addr == addr ? e.line : 0,
+        }));
+    }
+    stbds_arrfree(entries);
+}
+
+// A call site, with its symbolized backtrace (innermost frame first)
+typedef struct {
+    uint32_t live_allocs;
+    uint32_t live_bytes;
+    uint32_t peak_bytes;
+    uint32_t num_allocs;
+    frame_t *frames;
+} site_t;
+
+site_t *sites = NULL;
+uint32_t live_bytes, peak_bytes, num_allocs, num_frees, untracked;
+
+void dump_load(const char *fn)
+{
+    int size;
+    uint8_t *buf = load_file(fn, &size);
+    if (size < 36 || r32(buf) != MEMPROF_MAGIC) {
+        fprintf(stderr, "invalid memprof dump: %s\n", fn);
+        exit(1);
+    }
+    if (r32(buf + 4) != MEMPROF_VERSION) {
+        fprintf(stderr, "unsupported memprof dump version: %d\n", r32(buf + 4));
+        exit(1);
+    }
+    uint32_t max_depth = r32(buf + 8);
+    if (max_depth > MEMPROF_MAX_DEPTH) {
+        fprintf(stderr, "invalid memprof dump: %s (max depth %u)\n", fn, max_depth);
+        exit(1);
+    }
+    int num_sites = r32(buf + 12);
+    live_bytes = r32(buf + 16);
+    peak_bytes = r32(buf + 20);
+    num_allocs = r32(buf + 24);
+    num_frees = r32(buf + 28);
+    untracked = r32(buf + 32);
+
+    const uint8_t *p = buf + 36, *end = buf + size;
+    for (int i=0; i<num_sites; i++) {
+        if (p + 20 > end) {
+            fprintf(stderr, "truncated memprof dump: %s\n", fn);
+            exit(1);
+        }
+        // Check the depth first, so that the size of the frames cannot overflow
+        if (r32(p+16) > max_depth) {
+            fprintf(stderr, "invalid memprof dump: %s (call site depth %u, max %u)\n", fn, r32(p+16), max_depth);
+            exit(1);
+        }
+        if (p + 20 + r32(p+16)*4 > end) {
+            fprintf(stderr, "truncated memprof dump: %s\n", fn);
+            exit(1);
+        }
+        site_t s = {
+            .live_allocs = r32(p+0),
+            .live_bytes = r32(p+4),
+            .peak_bytes = r32(p+8),
+            .num_allocs = r32(p+12),
+        };
+        int depth = r32(p+16); p += 20;
+        for (int j=0; j<depth; j++, p += 4)
+            symbolize(r32(p), &s.frames);
+        stbds_arrput(sites, s);
+    }
+    free(buf);
+}
+
+int cmp_sites(const void *a, const void *b)
+{
+    const site_t *sa = a, *sb = b;
+    uint32_t ka, kb;
+    switch (flag_sort) {
+    case SORT_PEAK:  ka = sa->peak_bytes; kb = sb->peak_bytes; break;
+    case SORT_COUNT: ka = sa->num_allocs; kb = sb->num_allocs; break;
+    default:         ka = sa->live_bytes; kb = sb->live_bytes; break;
+    }
+    if (ka != kb) return ka < kb ? 1 : -1;
+    if (sa->peak_bytes != sb->peak_bytes) return sa->peak_bytes < sb->peak_bytes ? 1 : -1;
+    return 0;
+}
+
+void print_frame(const frame_t *f)
+{
+    if (f->line)
+        printf("%s (%s:%d)\n", f->func, f->file, f->line);
+    else
+        printf("%s (%s)\n", f->func, f->file);
+}
+
+void report_sites(void)
+{
+    printf("%u bytes live (peak: %u bytes), %u allocations, %u frees, %d call sites",
+        live_bytes, peak_bytes, num_allocs, num_frees, (int)stbds_arrlen(sites));
+    if (untracked)
+        printf(", %u allocations not tracked", untracked);
+    printf("\n\n");
+
+    printf("    live  allocs      peak     count  call site\n");
+    for (int i=0, n=0; i<stbds_arrlen(sites) && n<flag_max_sites; i++) {
+        site_t *s = &sites[i];
+        if (!s->live_allocs && !flag_all)
+            continue;
+        printf("%8u  %6u  %8u  %8u  ", s->live_bytes, s->live_allocs, s->peak_bytes, s->num_allocs);
+        if (!stbds_arrlen(s->frames))
+            printf("???\n");
+        for (int j=0; j<stbds_arrlen(s->frames); j++) {
+            if (j > 0) printf("%38s<- ", "");
+            print_frame(&s->frames[j]);
+        }
+        n++;
+    }
+}
+
+void report_folded(void)
+{
+    // Aggregate identical stacks (from the root to the leaf)
+    struct { char *key; int value; } *stacks = NULL;
+    stbds_sh_new_arena(stacks);
+    char *buf = NULL;
+    for (int i=0; i<stbds_arrlen(sites); i++) {
+        site_t *s = &sites[i];
+        if (!s->live_bytes)
+            continue;
+        stbds_arrsetlen(buf, 0);
+        for (int j=stbds_arrlen(s->frames)-1; j>=0; j--) {
+            if (j < stbds_arrlen(s->frames)-1) stbds_arrput(buf, ';');
+            for (const char *c = s->frames[j].func; *c; c++)
+                stbds_arrput(buf, *c);
+        }
+        stbds_arrput(buf, 0);
+        int n = stbds_shget(stacks, buf);
+        stbds_shput(stacks, buf, n + s->live_bytes);
+    }
+    for (int i=0; i<stbds_shlen(stacks); i++)
+        printf("%s %d\n", stacks[i].key, stacks[i].value);
+    stbds_arrfree(buf);
+    stbds_shfree(stacks);
+}
+
+int main(int argc, char *argv[])
+{
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            usage(argv[0]);
+            return 0;
+        } else if (!strcmp(argv[i], "--live")) {
+            flag_sort = SORT_LIVE;
+        } else if (!strcmp(argv[i], "--peak")) {
+            flag_sort = SORT_PEAK;
+        } else if (!strcmp(argv[i], "--count")) {
+            flag_sort = SORT_COUNT;
+        } else if (!strcmp(argv[i], "--all")) {
+            flag_all = true;
+        } else if (!strcmp(argv[i], "--folded")) {
+            flag_folded = true;
+        } else if (!strcmp(argv[i], "--no-inlines")) {
+            flag_inlines = false;
+        } else if (!strcmp(argv[i], "-n") || !strcmp(argv[i], "--max-sites")) {
+            if (++i == argc) {
+                fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                return 1;
+            }
+            flag_max_sites = atoi(argv[i]);
+        } else {
+            fprintf(stderr, "invalid flag: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (argc - i != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    symt_load(&symt, argv[i+1]);
+    dump_load(argv[i]);
+
+    if (flag_folded) {
+        report_folded();
+    } else {
+        qsort(sites, stbds_arrlen(sites), sizeof(site_t), cmp_sites);
+        report_sites();
+    }
+    return 0;
+}
@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STBDS_NO_SHORT_NAMES
+#define STB_DS_IMPLEMENTATION
+#include "common/stb_ds.h"
+#include "common/symt.h"
+
+// Dump file magic and version (see cpuprof.h)
+#define CPUPROF_MAGIC       0x50524F46
+#define CPUPROF_VERSION     1
+
+enum { MODE_FLAT, MODE_CALLGRAPH, MODE_FOLDED };
+
+int flag_mode = MODE_FLAT;
+int flag_max_funcs = 50;
+bool flag_inlines = true;
+
+void usage(const char *progname)
+{
+    fprintf(stderr, "%s - Analyze CPU profiles created by libdragon's cpuprof module\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Usage: %s [flags] <profile.bin> <program.sym>\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "The profile is the file written by cpuprof_dump or sent via USB by cpuprof_dump_usb.\n");
+    fprintf(stderr, "The symbol table is the one created by n64sym for the profiled ROM.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Command-line flags:\n");
+    fprintf(stderr, "   --flat                Flat profile, sorted by self time (default)\n");
+    fprintf(stderr, "   --callgraph           Call graph profile, with callers and callees of each function\n");
+    fprintf(stderr, "   --folded              Folded stacks, to be used with flamegraph.pl or similar tools\n");
+    fprintf(stderr, "   -n/--max-funcs <N>    Maximum number of functions in flat/call graph reports (default: 50)\n");
+    fprintf(stderr, "   --no-inlines          Do not expand inlined functions at callsites\n");
+}
+
+// Symbol table created by n64sym
+symt_t symt;
+
+// Interned names of functions. Each name is an index in this array, so that
+// stacks can be compared and hashed as arrays of integers.
+char **names = NULL;
+struct { char *key; int value; } *names_hash = NULL;
+
+int intern(const char *name, int len)
+{
+    char buf[len+1];
+    memcpy(buf, name, len); buf[len] = 0;
+    int idx = stbds_shgeti(names_hash, buf);
+    if (idx >= 0)
+        return names_hash[idx].value;
+    char *s = strdup(buf);
+    stbds_arrput(names, s);
+    stbds_shput(names_hash, s, stbds_arrlen(names)-1);
+    return stbds_arrlen(names)-1;
+}
+
+int name_unknown = -1;
+
+// Symbolize an address, appending the functions to the frames array, from the
+// innermost to the outermost one.
+void symbolize(uint32_t addr, bool callsite, int **frames)
+{
+    int *entries = NULL;
+    symt_symbolize(&symt, addr, callsite && flag_inlines, &entries);
+    for (int i=0; i<stbds_arrlen(entries); i++) {
+        if (entries[i] < 0) {
+            stbds_arrput(*frames, name_unknown);
+            continue;
+        }
+        symt_entry_t e = symt_entry(&symt, entries[i]);
+        stbds_arrput(*frames, intern(e.func, e.func_len));
+    }
+    stbds_arrfree(entries);
+}
+
+// A symbolized sample: functions from the outermost to the innermost one
+typedef struct {
+    int *funcs;
+} sample_t;
+
+sample_t *samples = NULL;
+uint32_t prof_hz, prof_overwritten;
+
+void profile_load(const char *fn)
+{
+    int size;
+    uint8_t *buf = load_file(fn, &size);
+    if (size < 24 || r32(buf) != CPUPROF_MAGIC) {
+        fprintf(stderr, "invalid profile: %s\n", fn);
+        exit(1);
+    }
+    if (r32(buf + 4) != CPUPROF_VERSION) {
+        fprintf(stderr, "unsupported profile version: %d\n", r32(buf + 4));
+        exit(1);
+    }
+    prof_hz = r32(buf + 8);
+    int num_samples = r32(buf + 16);
+    prof_overwritten = r32(buf + 20);
+
+    const uint8_t *p = buf + 24, *end = buf + size;
+    for (int i=0; i<num_samples; i++) {
+        if (p + 4 > end || p + 4 + r32(p)*4 > end) {
+            fprintf(stderr, "truncated profile: %s\n", fn);
+            exit(1);
+        }
+        int depth = r32(p); p += 4;
+        int *frames = NULL;
+        for (int j=0; j<depth; j++, p += 4)
+            symbolize(r32(p), j > 0, &frames);
+
+        // Reverse the frames so that the stack goes from the root to the leaf
+        for (int j=0; j<stbds_arrlen(frames)/2; j++) {
+            int t = frames[j];
+            frames[j] = frames[stbds_arrlen(frames)-1-j];
+            frames[stbds_arrlen(frames)-1-j] = t;
+        }
+        stbds_arrput(samples, ((sample_t){ .funcs = frames }));
+    }
+    free(buf);
+}
+
+// Number of samples for each caller or callee of a function
+typedef struct { int key; int value; } edge_t;
+
+// Per-function statistics
+typedef struct {
+    int self;                   // Samples in which the function was running
+    int total;                  // Samples in which the function was in the stack
+    edge_t *callers;            // Caller -> number of samples
+    edge_t *callees;            // Callee -> number of samples
+} func_stats_t;
+
+func_stats_t *stats = NULL;
+
+// Return true if the value is present in the first n elements of the array
+bool contains(const int *arr, int n, int v)
+{
+    for (int i=0; i<n; i++)
+        if (arr[i] == v) return true;
+    return false;
+}
+
+void compute_stats(void)
+{
+    stats = calloc(stbds_arrlen(names), sizeof(func_stats_t));
+    for (int i=0; i<stbds_arrlen(samples); i++) {
+        int *f = samples[i].funcs;
+        int n = stbds_arrlen(f);
+        stats[f[n-1]].self++;
+        for (int j=0; j<n; j++) {
+            // Count functions and edges only once per sample, even if recursive
+            if (!contains(f, j, f[j]))
+                stats[f[j]].total++;
+            if (j > 0) {
+                bool dup = false;
+                for (int k=1; k<j && !dup; k++)
+                    dup = f[k-1] == f[j-1] && f[k] == f[j];
+                if (!dup) {
+                    int n_caller = stbds_hmget(stats[f[j]].callers, f[j-1]);
+                    stbds_hmput(stats[f[j]].callers, f[j-1], n_caller + 1);
+                    int n_callee = stbds_hmget(stats[f[j-1]].callees, f[j]);
+                    stbds_hmput(stats[f[j-1]].callees, f[j], n_callee + 1);
+                }
+            }
+        }
+    }
+}
+
+int cmp_by_self(const void *a, const void *b)
+{
+    const func_stats_t *sa = &stats[*(const int*)a], *sb = &stats[*(const int*)b];
+    if (sa->self != sb->self) return sb->self - sa->self;
+    return sb->total - sa->total;
+}
+
+int cmp_by_total(const void *a, const void *b)
+{
+    const func_stats_t *sa = &stats[*(const int*)a], *sb = &stats[*(const int*)b];
+    if (sa->total != sb->total) return sb->total - sa->total;
+    return sb->self - sa->self;
+}
+
+// Return the functions that appear in the profile, sorted with the specified comparator
+int *sorted_funcs(int (*cmp)(const void*, const void*), int *count)
+{
+    int *order = NULL;
+    for (int i=0; i<stbds_arrlen(names); i++)
+        if (stats[i].total) stbds_arrput(order, i);
+    qsort(order, stbds_arrlen(order), sizeof(int), cmp);
+    *count = stbds_arrlen(order);
+    return order;
+}
+
+double pct(int n) { return n * 100.0 / stbds_arrlen(samples); }
+
+void print_header(void)
+{
+    printf("%d samples at %d Hz (%.3f seconds)", (int)stbds_arrlen(samples), prof_hz,
+        prof_hz ? (double)stbds_arrlen(samples) / prof_hz : 0.0);
+    if (prof_overwritten)
+        printf(", %d older samples were overwritten", prof_overwritten);
+    printf("\n\n");
+}
+
+void report_flat(void)
+{
+    int count; int *order = sorted_funcs(cmp_by_self, &count);
+    print_header();
+    printf("  self%%   total%%      self     total  function\n");
+    for (int i=0; i<count && i<flag_max_funcs; i++) {
+        func_stats_t *s = &stats[order[i]];
+        printf("%6.2f  %7.2f  %8d  %8d  %s\n", pct(s->self), pct(s->total), s->self, s->total, names[order[i]]);
+    }
+    stbds_arrfree(order);
+}
+
+int cmp_by_samples(const void *a, const void *b)
+{
+    return ((const edge_t*)b)->value - ((const edge_t*)a)->value;
+}
+
+// Print the entries of a caller/callee map, sorted by number of samples
+void print_edges(edge_t *edges, const char *prefix)
+{
+    int n = stbds_hmlen(edges);
+    edge_t sorted[n];
+    memcpy(sorted, edges, n * sizeof(edge_t));
+    qsort(sorted, n, sizeof(edge_t), cmp_by_samples);
+    for (int i=0; i<n; i++)
+        printf("          %8d  %s%s\n", sorted[i].value, prefix, names[sorted[i].key]);
+}
+
+void report_callgraph(void)
+{
+    int count; int *order = sorted_funcs(cmp_by_total, &count);
+    print_header();
+    printf("Each entry lists the callers of a function, the function itself (self and\n");
+    printf("total samples), and the functions it calls, with the number of samples in\n");
+    printf("which each call was in the stack.\n\n");
+    for (int i=0; i<count && i<flag_max_funcs; i++) {
+        func_stats_t *s = &stats[order[i]];
+        print_edges(s->callers, "    ");
+        printf("[%5.1f%%]  %8d  %s (self: %d, %.1f%%)\n", pct(s->total), s->total, names[order[i]], s->self, pct(s->self));
+        print_edges(s->callees, "        ");
+        printf("-----------------------------------------------------------------------------\n");
+    }
+    stbds_arrfree(order);
+}
+
+void report_folded(void)
+{
+    // Aggregate identical stacks
+    struct { char *key; int value; } *stacks = NULL;
+    stbds_sh_new_arena(stacks);
+    char *buf = NULL;
+    for (int i=0; i<stbds_arrlen(samples); i++) {
+        int *f = samples[i].funcs;
+        stbds_arrsetlen(buf, 0);
+        for (int j=0; j<stbds_arrlen(f); j++) {
+            if (j > 0) stbds_arrput(buf, ';');
+            for (const char *s = names[f[j]]; *s; s++)
+                stbds_arrput(buf, *s);
+        }
+        stbds_arrput(buf, 0);
+        int n = stbds_shget(stacks, buf);
+        stbds_shput(stacks, buf, n + 1);
+    }
+    for (int i=0; i<stbds_shlen(stacks); i++)
+        printf("%s %d\n", stacks[i].key, stacks[i].value);
+    stbds_arrfree(buf);
+    stbds_shfree(stacks);
+}
+
+int main(int argc, char *argv[])
+{
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            usage(argv[0]);
+            return 0;
+        } else if (!strcmp(argv[i], "--flat")) {
+            flag_mode = MODE_FLAT;
+        } else if (!strcmp(argv[i], "--callgraph")) {
+            flag_mode = MODE_CALLGRAPH;
+        } else if (!strcmp(argv[i], "--folded")) {
+            flag_mode = MODE_FOLDED;
+        } else if (!strcmp(argv[i], "--no-inlines")) {
+            flag_inlines = false;
+        } else if (!strcmp(argv[i], "-n") || !strcmp(argv[i], "--max-funcs")) {
+            if (++i == argc) {
+                fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                return 1;
+            }
+            flag_max_funcs = atoi(argv[i]);
+        } else {
+            fprintf(stderr, "invalid flag: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (argc - i != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    symt_load(&symt, argv[i+1]);
+    name_unknown = intern("???", 3);
+    profile_load(argv[i]);
+    if (!stbds_arrlen(samples)) {
+        fprintf(stderr, "no samples in profile\n");
+        return 1;
+    }
+
+    compute_stats();
+    switch (flag_mode) {
+    case MODE_FLAT:      report_flat(); break;
+    case MODE_CALLGRAPH: report_callgraph(); break;
+    case MODE_FOLDED:    report_folded(); break;
+    }
+    return 0;
+}
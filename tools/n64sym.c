@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #define STBDS_NO_SHORT_NAMES
 #define STB_DS_IMPLEMENTATION
@@ -12,10 +14,14 @@
 #include "common/subprocess.h"
 #include "common/polyfill.h"
 #include "common/utils.h"
+#include "common/elfdwarf.h"
+#include "common/batch.h"
 
 bool flag_verbose = false;
 int flag_max_sym_len = 64;
 bool flag_inlines = true;
+bool flag_addr2line = false;
+int flag_jobs = 0;
 const char *n64_inst = NULL;
 
 // Printf if verbose
@@ -38,8 +44,27 @@ void usage(const char *progname)
     fprintf(stderr, "   -v/--verbose          Verbose output\n");
     fprintf(stderr, "   -m/--max-len <N>      Maximum symbol length (default: 64)\n");
     fprintf(stderr, "   --no-inlines          Do not export inlined symbols\n");
+    fprintf(stderr, "   -j/--jobs <N>         Number of threads used to parse DWARF (default: number of CPUs)\n");
+    fprintf(stderr, "   --addr2line           Use the toolchain objdump/addr2line instead of the builtin\n");
+    fprintf(stderr, "                         ELF/DWARF parser (slower, for debugging)\n");
     fprintf(stderr, "\n");
-    fprintf(stderr, "This program requires a libdragon toolchain installed in $N64_INST.\n");
+    fprintf(stderr, "This program requires a libdragon toolchain installed in $N64_INST\n");
+    fprintf(stderr, "to demangle C++ symbols, and to run in --addr2line mode.\n");
+}
+
+// Return the toolchain directory, exiting if it is not configured
+const char *toolchain_dir(void)
+{
+    if (!n64_inst) {
+        n64_inst = n64_toolchain_dir();
+        if (!n64_inst) {
+            // Do not mention N64_GCCPREFIX in the error message, since it is
+            // a seldom used configuration.
+            fprintf(stderr, "Error: N64_INST environment variable not set\n");
+            exit(1);
+        }
+    }
+    return n64_inst;
 }
 
 char *stringtable = NULL;
@@ -134,7 +159,7 @@ void symbol_add(const char *elf, uint32_t addr, bool is_func)
             cur_elf = NULL; addr2line_r = addr2line_w = NULL;
         }
         if (!addrbin)
-            asprintf(&addrbin, "%s/bin/mips64-elf-addr2line", n64_inst);
+            asprintf(&addrbin, "%s/bin/mips64-elf-addr2line", toolchain_dir());
 
         const char *cmd_addr[16] = {0}; int i = 0;
         cmd_addr[i++] = addrbin;
@@ -213,7 +238,7 @@ void elf_find_callsites(const char *elf)
 {
     // Start objdump to parse the disassembly of the ELF file
     char *cmd = NULL;
-    asprintf(&cmd, "%s/bin/mips64-elf-objdump -d %s", n64_inst, elf);
+    asprintf(&cmd, "%s/bin/mips64-elf-objdump -d %s", toolchain_dir(), elf);
     verbose("Running: %s\n", cmd);
     FILE *disasm = popen(cmd, "r");
     if (!disasm) {
@@ -240,6 +265,210 @@ void elf_find_callsites(const char *elf)
     free(cmd);
 }
 
+// Address to symbolize, found in the ELF file
+struct query_s {
+    uint32_t addr;
+    bool is_func;
+};
+
+int u64_cmp(const void *a, const void *b)
+{
+    uint64_t ua = *(const uint64_t*)a, ub = *(const uint64_t*)b;
+    return ua < ub ? -1 : ua > ub ? 1 : 0;
+}
+
+// Find all functions and callsites, without running objdump. This walks the
+// code sections like "objdump -d" does: each symbol starts a new chunk
+// (which becomes a function entry), and jal/jalr instructions within the
+// chunk are callsites. Data objects are not disassembled.
+struct query_s *elf_find_callsites_native(elf_t *elf)
+{
+    struct query_s *queries = NULL;
+
+    for (int s=0; s<elf->num_sections; s++) {
+        const elf_section_t *sec = &elf->sections[s];
+        if (!(sec->flags & ELF_SHF_EXECINSTR) || !sec->data || sec->size == 0)
+            continue;
+        uint64_t start = sec->addr, end = sec->addr + sec->size;
+
+        // Collect the labels in this section
+        uint64_t *labels = NULL;
+        stbds_arrput(labels, start);
+        for (int i=0; i<elf->num_symbols; i++) {
+            const elf_symbol_t *sym = &elf->symbols[i];
+            if (sym->shndx != s || sym->type == ELF_STT_FILE || sym->type == ELF_STT_SECTION)
+                continue;
+            if (sym->value > start && sym->value < end)
+                stbds_arrput(labels, sym->value);
+        }
+        qsort(labels, stbds_arrlen(labels), sizeof(uint64_t), u64_cmp);
+
+        for (int l=0; l<stbds_arrlen(labels); l++) {
+            uint64_t lstart = labels[l];
+            if (l > 0 && lstart == labels[l-1])
+                continue;
+            uint64_t lend = end;
+            for (int k=l+1; k<stbds_arrlen(labels); k++)
+                if (labels[k] != lstart) { lend = labels[k]; break; }
+
+            stbds_arrput(queries, ((struct query_s){ .addr = lstart, .is_func = true }));
+
+            // objdump does not disassemble data objects
+            bool has_func = false, has_object = false;
+            for (int i=0; i<elf->num_symbols; i++) {
+                const elf_symbol_t *sym = &elf->symbols[i];
+                if (sym->shndx != s || sym->value != lstart) continue;
+                if (sym->type == ELF_STT_FUNC) has_func = true;
+                if (sym->type == ELF_STT_OBJECT) has_object = true;
+            }
+            if ((has_object && !has_func) || elf->machine != ELF_EM_MIPS)
+                continue;
+
+            for (uint64_t addr = lstart; addr + 4 <= lend; addr += 4) {
+                uint32_t op = elf_read32(elf, sec->data + (addr - start));
+                bool jal = (op & 0xfc000000) == 0x0c000000;
+                bool jalr = (op & 0xfc1f07ff) == 0x00000009;
+                if (jal || jalr)
+                    stbds_arrput(queries, ((struct query_s){ .addr = addr, .is_func = false }));
+            }
+        }
+        stbds_arrfree(labels);
+    }
+    return queries;
+}
+
+// Hash table of names to demangle (name -> demangled name)
+typedef struct { char *key; char *value; } demangle_hash_t;
+
+struct demangle_writer_s {
+    FILE *f;
+    char **names;
+};
+
+void *demangle_writer(void *arg)
+{
+    struct demangle_writer_s *w = arg;
+    for (int i=0; i<stbds_arrlen(w->names); i++)
+        fprintf(w->f, "%s\n", w->names[i]);
+    fclose(w->f);
+    return NULL;
+}
+
+// Demangle all the names in a hash table with a single run of c++filt. The names are written from a separate thread, to avoid a
+// deadlock in case c++filt output fills the pipe before we finish writing.
+void demangle_names(demangle_hash_t *names)
+{
+    if (stbds_shlen(names) == 0)
+        return;
+
+    char *cxxfilt = NULL;
+    asprintf(&cxxfilt, "%s/bin/mips64-elf-c++filt", toolchain_dir());
+    const char *cmd[] = { cxxfilt, "-i", NULL };
+    struct subprocess_s subp;
+    if (subprocess_create(cmd, subprocess_option_no_window, &subp) != 0) {
+        fprintf(stderr, "Error: cannot run: %s\n", cxxfilt);
+        exit(1);
+    }
+
+    struct demangle_writer_s w = { .f = subprocess_stdin(&subp) };
+    for (int i=0; i<stbds_shlen(names); i++)
+        stbds_arrput(w.names, names[i].key);
+    subp.stdin_file = NULL;
+    pthread_t writer;
+    pthread_create(&writer, NULL, demangle_writer, &w);
+
+    FILE *r = subprocess_stdout(&subp);
+    char *line = NULL; size_t line_size = 0;
+    for (int i=0; i<stbds_shlen(names); i++) {
+        int n = getline(&line, &line_size, r);
+        if (n == -1) {
+            fprintf(stderr, "Error: unexpected end of output from: %s\n", cxxfilt);
+            exit(1);
+        }
+        if (n > 0 && line[n-1] == '\n') line[--n] = 0;
+        names[i].value = strdup(line);
+    }
+    free(line);
+
+    pthread_join(writer, NULL);
+    int ret;
+    subprocess_join(&subp, &ret);
+    subprocess_destroy(&subp);
+    stbds_arrfree(w.names);
+    free(cxxfilt);
+}
+
+// Find all functions and callsites, and symbolize them, using the builtin
+// ELF/DWARF parser. The output is the same of elf_find_callsites().
+void elf_find_callsites_builtin(const char *infn)
+{
+    elf_t *elf = elf_open(infn);
+    if (!elf) {
+        fprintf(stderr, "Error: cannot parse ELF file: %s\n", infn);
+        exit(1);
+    }
+
+    struct query_s *queries = elf_find_callsites_native(elf);
+    int count = stbds_arrlen(queries);
+    verbose("Found %d functions and callsites\n", count);
+
+    verbose("Parsing DWARF information (%d threads)...\n", flag_jobs);
+    dwarf_t *dw = dwarf_open(elf, flag_jobs);
+    uint64_t *addrs = malloc(count * sizeof(uint64_t));
+    for (int i=0; i<count; i++)
+        addrs[i] = queries[i].addr;
+    dwarf_result_t *res = dwarf_addr2line(dw, addrs, count, flag_inlines);
+
+    // Collect the names that might need demangling, and demangle them in one go
+    demangle_hash_t *demangled = NULL;
+    stbds_sh_new_arena(demangled);
+    for (int i=0; i<count; i++) {
+        for (int j=0; j<res[i].num_frames; j++) {
+            const char *func = res[i].frames[j].func;
+            if (func && func[0] == '_')
+                stbds_shput(demangled, func, NULL);
+        }
+    }
+    verbose("Demangling %d symbols...\n", (int)stbds_shlen(demangled));
+    demangle_names(demangled);
+
+    // Add one symbol for each inlined function
+    for (int i=0; i<count; i++) {
+        for (int j=0; j<res[i].num_frames; j++) {
+            const dwarf_frame_t *frame = &res[i].frames[j];
+            const char *name = frame->func;
+            if (name && name[0] == '_')
+                name = stbds_shget(demangled, name);
+            if (!name || !name[0])
+                name = "??";
+
+            // Truncate the function name (see symbol_add())
+            int n = strlen(name);
+            char *func = strndup(name, MIN(n, flag_max_sym_len));
+            if (n > flag_max_sym_len) strcpy(&func[flag_max_sym_len-3], "...");
+
+            stbds_arrput(symtable, ((struct symtable_s) {
+                .uuid = stbds_arrlen(symtable),
+                .addr = queries[i].addr,
+                .func = func,
+                .file = strdup(frame->file ? frame->file : "??"),
+                .line = frame->line,
+                .is_func = queries[i].is_func,
+                .is_inline = j < res[i].num_frames-1,
+            }));
+        }
+    }
+
+    for (int i=0; i<stbds_shlen(demangled); i++)
+        free(demangled[i].value);
+    stbds_shfree(demangled);
+    dwarf_free_results(res, count);
+    free(addrs);
+    stbds_arrfree(queries);
+    dwarf_close(dw);
+    elf_close(elf);
+}
+
 void compute_function_offsets(void)
 {
     uint32_t func_addr = 0;
@@ -279,9 +508,13 @@ void process(const char *infn, const char *outfn)
 {
     verbose("Processing: %s -> %s\n", infn, outfn);
 
-    // First, find all functions and call sites. We do this by disassembling
-    // the ELF file and grepping it.
-    elf_find_callsites(infn);
+    // First, find all functions and call sites, and symbolize them. By
+    // default, we parse the ELF/DWARF information directly; the legacy mode
+    // disassembles the ELF file with objdump, greps it and runs addr2line.
+    if (flag_addr2line)
+        elf_find_callsites(infn);
+    else
+        elf_find_callsites_builtin(infn);
     verbose("Found %d callsites\n", stbds_arrlen(symtable));
 
     // Sort the symbole table by symbol length. We want longer symbols
@@ -382,6 +615,14 @@ int main(int argc, char *argv[])
             flag_verbose = true;
         } else if (!strcmp(argv[i], "--no-inlines")) {
             flag_inlines = false;
+        } else if (!strcmp(argv[i], "--addr2line")) {
+            flag_addr2line = true;
+        } else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+            if (++i == argc) {
+                fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                return 1;
+            }
+            flag_jobs = atoi(argv[i]);
         } else if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) {
             if (++i == argc) {
                 fprintf(stderr, "missing argument for %s\n", argv[i-1]);
@@ -405,14 +646,8 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    // Find n64 installation directory
-    n64_inst = n64_toolchain_dir();
-    if (!n64_inst) {
-        // Do not mention N64_GCCPREFIX in the error message, since it is
-        // a seldom used configuration.
-        fprintf(stderr, "Error: N64_INST environment variable not set\n");
-        return 1;
-    }
+    if (flag_jobs <= 0)
+        flag_jobs = cpu_count();
 
     const char *infn = argv[i];
     if (i < argc-1)
@@ -0,0 +1,37 @@
+#!/usr/bin/env bash
+# Regression test for n64sym: check that the builtin ELF/DWARF parser
+# produces exactly the same symbol table as the addr2line-based mode.
+#
+# Usage: ./test-n64sym.sh [program.elf ...]
+# Without arguments, all the built examples are tested.
+set -euo pipefail
+
+cd "$(dirname "$0")"
+N64SYM="${N64SYM:-./n64sym}"
+
+if [ $# -eq 0 ]; then
+    shopt -s nullglob
+    set -- ../examples/*/build/*.elf
+    if [ $# -eq 0 ]; then
+        echo "No ELF files found: build the examples first, or pass ELF files to test" >&2
+        exit 1
+    fi
+fi
+
+TMPDIR="$(mktemp -d)"
+trap 'rm -rf "$TMPDIR"' EXIT
+
+FAILED=0
+for elf in "$@"; do
+    for flags in "" "--no-inlines"; do
+        "$N64SYM" --addr2line $flags "$elf" "$TMPDIR/ref.sym"
+        "$N64SYM" $flags "$elf" "$TMPDIR/out.sym"
+        if cmp -s "$TMPDIR/ref.sym" "$TMPDIR/out.sym"; then
+            echo "PASS: $elf $flags"
+        else
+            echo "FAIL: $elf $flags"
+            FAILED=1
+        fi
+    done
+done
+exit $FAILED